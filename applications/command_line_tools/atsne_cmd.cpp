@@ -41,6 +41,7 @@
 #include "hdi/dimensionality_reduction/tsne_parameters.h"
 #include "hdi/utils/visual_utils.h"
 #include "hdi/utils/scoped_timers.h"
+#include "hdi/utils/memory_mapped_file.h"
 
 #include <QApplication>
 #include <QCommandLineParser>
@@ -111,6 +112,24 @@ int main(int argc, char *argv[])
         QCoreApplication::translate("main", "similarities"));
     parser.addOption(save_similarities_option);
 
+    //Out-of-core
+    QCommandLineOption memory_budget_option(QStringList() << "m" << "memory_budget",
+        QCoreApplication::translate("main", "Memory-map the input and compute the neighborhoods out-of-core using <memory_budget> MB for the blocks of data."),
+        QCoreApplication::translate("main", "memory_budget"));
+    parser.addOption(memory_budget_option);
+
+    //Neighborhood graph cache
+    QCommandLineOption knn_cache_option(QStringList() << "knn_cache",
+        QCoreApplication::translate("main", "Store the neighborhood graph in <knn_cache> and reuse it in the following runs on the same data."),
+        QCoreApplication::translate("main", "knn_cache"));
+    parser.addOption(knn_cache_option);
+
+    //PCA
+    QCommandLineOption pca_option(QStringList() << "pca",
+        QCoreApplication::translate("main", "Compute the neighborhoods on the first <pca> principal components of the data."),
+        QCoreApplication::translate("main", "pca"));
+    parser.addOption(pca_option);
+
     // Process the actual command line arguments given by the user
     parser.process(app);
 
@@ -135,6 +154,8 @@ int main(int argc, char *argv[])
     int perplexity              = 30;
     double theta                = 0.5;
     int num_target_dimensions   = 2;
+    int memory_budget           = 0;
+    int pca_components          = 0;
 
 
     verbose     = parser.isSet(verbose_option);
@@ -155,6 +176,14 @@ int main(int argc, char *argv[])
       num_target_dimensions = atoi(parser.value(target_dimensions_option).toStdString().c_str());
       hdi::checkAndThrowRuntime(num_target_dimensions >= 1, "Invalid number of target dimensions");
     }
+    if(parser.isSet(memory_budget_option)){
+      memory_budget = atoi(parser.value(memory_budget_option).toStdString().c_str());
+      hdi::checkAndThrowRuntime(memory_budget > 0, "Invalid memory budget");
+    }
+    if(parser.isSet(pca_option)){
+      pca_components = atoi(parser.value(pca_option).toStdString().c_str());
+      hdi::checkAndThrowRuntime(pca_components > 0, "Invalid number of principal components");
+    }
     if(verbose){
       std::cout << "===============================================" << std::endl;
       std::cout << "Arguments" << std::endl;
@@ -167,6 +196,15 @@ int main(int argc, char *argv[])
       std::cout << "\tExaggeration iter:\t" << exaggeration_iter << std::endl;
       std::cout << "\tPerplexity:\t\t" << perplexity << std::endl;
       std::cout << "\tTheta:\t\t" << theta << std::endl;
+      if(memory_budget > 0){
+        std::cout << "\tMemory budget (MB):\t" << memory_budget << std::endl;
+      }
+      if(pca_components > 0){
+        std::cout << "\tPCA components:\t\t" << pca_components << std::endl;
+      }
+      if(parser.isSet(knn_cache_option)){
+        std::cout << "\tKNN cache:\t\t" << parser.value(knn_cache_option).toStdString() << std::endl;
+      }
       std::cout << "===============================================" << std::endl;
     }
 
@@ -187,9 +225,17 @@ int main(int argc, char *argv[])
     typedef float scalar_type;
     //Input
     std::vector<scalar_type> data;
-    data.resize(num_data_points * num_dimensions);
+    hdi::utils::MemoryMappedFile mapped_data;
 
-    {
+    if(memory_budget > 0){
+      hdi::utils::ScopedTimer<float,hdi::utils::Seconds> timer(data_loading_time);
+      mapped_data.open(args.at(0).toStdString());
+      if(mapped_data.size() != sizeof(scalar_type) * size_t(num_dimensions) * num_data_points){
+          std::cout << "Input file size doesn't agree with input parameters!" << std::endl;
+          return 1;
+      }
+    }else{
+      data.resize(num_data_points * num_dimensions);
       hdi::utils::ScopedTimer<float,hdi::utils::Seconds> timer(data_loading_time);
       std::ifstream input_file (args.at(0).toStdString(), std::ios::in|std::ios::binary|std::ios::ate);
       if(int(input_file.tellg()) != int(sizeof(scalar_type) * num_dimensions * num_data_points)){
@@ -216,7 +262,17 @@ int main(int argc, char *argv[])
     {
       hdi::utils::ScopedTimer<float,hdi::utils::Seconds> timer(similarities_comp_time);
       prob_gen_param._perplexity = perplexity;
-      prob_gen.computeProbabilityDistributions(data.data(),num_dimensions,num_data_points,distributions,prob_gen_param);
+      prob_gen_param._pca_components = pca_components;
+      if(parser.isSet(knn_cache_option)){
+        prob_gen_param._knn_cache_directory = parser.value(knn_cache_option).toStdString();
+      }
+      if(memory_budget > 0){
+        prob_gen_param._knn_backend = hdi::dr::KNNBackend::OutOfCoreBlocked;
+        prob_gen_param._knn_memory_budget = memory_budget;
+        prob_gen.computeProbabilityDistributions(mapped_data,num_dimensions,distributions,prob_gen_param);
+      }else{
+        prob_gen.computeProbabilityDistributions(data.data(),num_dimensions,num_data_points,distributions,prob_gen_param);
+      }
     }
 
 
@@ -160,6 +160,16 @@ int main(int argc, char *argv[])
             QCoreApplication::translate("main", "Apply a min-max normalization."));
     parser.addOption(normalization_option);
 
+    QCommandLineOption knn_cache_option(QStringList() << "knn_cache",
+            QCoreApplication::translate("main", "Store the KNN graph in <knn_cache> and reuse it in the following runs on the same data."),
+            QCoreApplication::translate("main", "knn_cache"));
+    parser.addOption(knn_cache_option);
+
+    QCommandLineOption pca_option(QStringList() << "pca",
+            QCoreApplication::translate("main", "Compute the KNN graph on the first <pca> principal components of the data."),
+            QCoreApplication::translate("main", "pca"));
+    parser.addOption(pca_option);
+
   ////////////////////////////////////////////////
   ///////////////   Arguments    /////////////////
   ////////////////////////////////////////////////
@@ -261,6 +271,17 @@ int main(int argc, char *argv[])
     if(parser.isSet(name_option)){
         name = parser.value(name_option).toStdString();
     }
+    if(parser.isSet(knn_cache_option)){
+        params._aknn_cache_directory = parser.value(knn_cache_option).toStdString();
+    }
+    if(parser.isSet(pca_option)){
+        const int pca_components = std::atoi(parser.value(pca_option).toStdString().c_str());
+        if(pca_components <= 0){
+          std::cout << "Invalid number of principal components!" << std::endl;
+          return -1;
+        }
+        params._pca_components = pca_components;
+    }
 
     std::cout << "Scales: " << num_scales << std::endl;
 
@@ -156,25 +156,21 @@ int main(int argc, char *argv[])
   ////////////////////////////////////////////////
 
     typedef float scalar_type;
-    //Input
-    std::vector<scalar_type> data;
-        data.resize(num_data_points * num_data_points);
-
-    {
-      std::ifstream input_file (args.at(0).toStdString(), std::ios::in|std::ios::binary|std::ios::ate);
-            int bytes_to_read = int(input_file.tellg());
-            if(bytes_to_read != int(sizeof(scalar_type) * num_data_points * num_data_points)){
-        std::cout << "Input file size doesn't agree with input parameters!" << std::endl;
-        return 1;
-      }
-      input_file.seekg (0, std::ios::beg);
-            input_file.read (reinterpret_cast<char*>(data.data()), sizeof(scalar_type) * num_data_points * num_data_points);
-      input_file.close();
-    }
-
-    for(auto& v: data){
-        v = v*v;
+    //Input: the distance matrix is streamed in blocks of rows, only the nearest neighbors of every point are kept in memory
+    std::ifstream input_file (args.at(0).toStdString(), std::ios::in|std::ios::binary|std::ios::ate);
+    if(std::streamoff(input_file.tellg()) != std::streamoff(sizeof(scalar_type)) * num_data_points * num_data_points){
+      std::cout << "Input file size doesn't agree with input parameters!" << std::endl;
+      return 1;
     }
+    input_file.seekg (0, std::ios::beg);
+    auto distance_reader = [&](unsigned int row_begin, unsigned int row_end, scalar_type* rows){
+      const size_t num_elements = size_t(row_end-row_begin)*num_data_points;
+      input_file.read (reinterpret_cast<char*>(rows), sizeof(scalar_type) * num_elements);
+      hdi::checkAndThrowRuntime(bool(input_file), "Unable to read the distance matrix");
+      for(size_t i = 0; i < num_elements; ++i){
+        rows[i] = rows[i]*rows[i];
+      }
+    };
 
   ////////////////////////////////////////////////
   ////////////////////////////////////////////////
@@ -190,7 +186,8 @@ int main(int argc, char *argv[])
 
     param._perplexity = perplexity;
 
-    prob_gen.computeProbabilityDistributionsFromDistanceMatrix(data,num_data_points,distributions,param);
+    prob_gen.computeProbabilityDistributionsFromDistanceRows(distance_reader,num_data_points,distributions,param);
+    input_file.close();
     tSNE.initialize(distributions,&embedding);
     tSNE.setTheta(0);
 
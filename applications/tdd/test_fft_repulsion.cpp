@@ -0,0 +1,140 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+#include "catch.hpp"
+#include "hdi/utils/cout_log.h"
+#include "hdi/utils/log_helper_functions.h"
+#include "hdi/utils/scoped_timers.h"
+#include "hdi/dimensionality_reduction/fft_repulsion.h"
+#include "hdi/dimensionality_reduction/sptree.h"
+#include "test_repulsion_helpers.h"
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+
+using namespace repulsion_helpers;
+
+namespace{
+  void testFFTRepulsion(unsigned int dim){
+    const unsigned int num_points = 2000;
+    hdi::dr::FFTRepulsion<float> repulsion;
+    REQUIRE(repulsion.numberOfInterpolationNodes() == 3);
+
+    SECTION("Compact embedding, the interpolation is almost exact"){
+      std::vector<float> points;
+      generatePoints(num_points,dim,points,1.f);
+      std::vector<double> neg_f_exact, point_sum_Q_exact;
+      exactNonEdgeForces(num_points,dim,points,neg_f_exact,point_sum_Q_exact);
+      const double sum_Q_exact = std::accumulate(point_sum_Q_exact.begin(),point_sum_Q_exact.end(),0.);
+
+      std::vector<double> neg_f(size_t(num_points)*dim,0);
+      double sum_Q = 0;
+      repulsion.computeNonEdgeForces(dim,points.data(),num_points,neg_f.data(),sum_Q);
+      REQUIRE(repulsion.numberOfIntervals() >= repulsion.minimumNumberOfIntervals());
+      REQUIRE(sum_Q == Approx(sum_Q_exact).epsilon(1e-5));
+      REQUIRE(relativeError(neg_f,neg_f_exact) < 1e-4);
+    }
+    SECTION("Large embedding, the grid is refined and more nodes increase the accuracy"){
+      std::vector<float> points;
+      generatePoints(num_points,dim,points,40.f);
+      std::vector<double> neg_f_exact, point_sum_Q_exact;
+      exactNonEdgeForces(num_points,dim,points,neg_f_exact,point_sum_Q_exact);
+      const double sum_Q_exact = std::accumulate(point_sum_Q_exact.begin(),point_sum_Q_exact.end(),0.);
+
+      std::vector<double> neg_f(size_t(num_points)*dim,0);
+      double sum_Q = 0;
+      repulsion.computeNonEdgeForces(dim,points.data(),num_points,neg_f.data(),sum_Q);
+      REQUIRE(repulsion.numberOfIntervals() > repulsion.minimumNumberOfIntervals());
+      REQUIRE(sum_Q == Approx(sum_Q_exact).epsilon(1e-2));
+      const double error = relativeError(neg_f,neg_f_exact);
+      REQUIRE(error < 0.05);
+
+      repulsion.setNumberOfInterpolationNodes(5);
+      std::fill(neg_f.begin(),neg_f.end(),0);
+      sum_Q = 0;
+      repulsion.computeNonEdgeForces(dim,points.data(),num_points,neg_f.data(),sum_Q);
+      REQUIRE(relativeError(neg_f,neg_f_exact) < error);
+    }
+  }
+}
+
+TEST_CASE( "FFT repulsion - accuracy", "[fft_repulsion]" ) {
+  SECTION("1D"){
+    testFFTRepulsion(1);
+  }
+  SECTION("2D"){
+    testFFTRepulsion(2);
+  }
+  SECTION("3D is not supported"){
+    std::vector<float> points;
+    generatePoints(100,3,points,1.f);
+    std::vector<double> neg_f(300,0);
+    double sum_Q = 0;
+    hdi::dr::FFTRepulsion<float> repulsion;
+    REQUIRE_THROWS_AS(repulsion.computeNonEdgeForces(3,points.data(),100,neg_f.data(),sum_Q),std::logic_error);
+  }
+}
+
+TEST_CASE( "FFT repulsion - comparison with Barnes-Hut", "[fft_repulsion]" ) {
+  const unsigned int dim = 2;
+  const unsigned int num_points = 200000;
+  std::vector<float> points;
+  generatePoints(num_points,dim,points,5.f);
+
+  hdi::dr::FFTRepulsion<float> repulsion;
+  std::vector<double> neg_f(size_t(num_points)*dim,0), bh_neg_f(size_t(num_points)*dim,0);
+  std::vector<double> sum_Q_subvalues(num_points,0);
+  double sum_Q = 0, bh_sum_Q = 0;
+
+  double time = 0, bh_time = 0;
+  {
+    hdi::utils::ScopedTimer<double> timer(time);
+    repulsion.computeNonEdgeForces(dim,points.data(),num_points,neg_f.data(),sum_Q);
+  }
+  {
+    hdi::utils::ScopedTimer<double> timer(bh_time);
+    hdi::dr::SPTree<float> tree(dim,points.data(),num_points);
+#pragma omp parallel for
+    for(int i = 0; i < int(num_points); ++i){
+      tree.computeNonEdgeForcesOMP<2>(i,0.5,bh_neg_f.data()+size_t(i)*dim,sum_Q_subvalues[i]);
+    }
+    for(auto v: sum_Q_subvalues){
+      bh_sum_Q += v;
+    }
+  }
+  REQUIRE(sum_Q == Approx(bh_sum_Q).epsilon(0.1));
+  REQUIRE(relativeError(bh_neg_f,neg_f) < 0.25);
+
+  hdi::utils::CoutLog log;
+  hdi::utils::secureLogValue(&log,"Repulsive forces, FFT interpolation (ms)",time);
+  hdi::utils::secureLogValue(&log,"Repulsive forces, Barnes-Hut (ms)",bh_time);
+}
@@ -0,0 +1,175 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+#include "catch.hpp"
+#include "hdi/dimensionality_reduction/hd_joint_probability_generator.h"
+#include <random>
+
+namespace{
+  void generateData(unsigned int num_dps, unsigned int num_dim, std::vector<float>& data, std::vector<float>& squared_distances){
+    std::default_random_engine generator(23);
+    std::normal_distribution<float> distribution;
+    data.resize(num_dps*num_dim);
+    for(auto& v: data){
+      v = distribution(generator);
+    }
+    squared_distances.resize(num_dps*num_dps);
+    for(unsigned int i = 0; i < num_dps; ++i){
+      for(unsigned int j = 0; j < num_dps; ++j){
+        double d = 0;
+        for(unsigned int k = 0; k < num_dim; ++k){
+          const double diff = data[i*num_dim+k]-data[j*num_dim+k];
+          d += diff*diff;
+        }
+        squared_distances[i*num_dps+j] = d;
+      }
+    }
+  }
+}
+
+TEST_CASE( "HD probabilities - streamed distance matrix", "[probabilities]" ) {
+  typedef hdi::dr::HDJointProbabilityGenerator<float> prob_gen_type;
+  const unsigned int num_dps = 400;
+  const unsigned int num_dim = 5;
+  std::vector<float> data, squared_distances;
+  generateData(num_dps,num_dim,data,squared_distances);
+
+  prob_gen_type prob_gen;
+  prob_gen_type::Parameters params;
+  params._perplexity = 10;
+  params._knn_backend = hdi::dr::KNNBackend::ExactBlocked;
+  prob_gen_type::sparse_scalar_matrix_type knn_distribution, streamed_distribution;
+  prob_gen.computeProbabilityDistributions(data.data(),num_dim,num_dps,knn_distribution,params);
+
+  //blocks of a few rows
+  params._knn_memory_budget = 0;
+  unsigned int rows_read = 0;
+  prob_gen.computeProbabilityDistributionsFromDistanceRows(
+    [&](unsigned int row_begin, unsigned int row_end, float* rows){
+      REQUIRE(row_begin == rows_read);
+      std::copy(squared_distances.begin()+row_begin*num_dps,squared_distances.begin()+row_end*num_dps,rows);
+      rows_read = row_end;
+    },
+    num_dps,streamed_distribution,params);
+  REQUIRE(rows_read == num_dps);
+
+  //same neighbors and probabilities as the exact neighborhood graph
+  REQUIRE(streamed_distribution.size() == num_dps);
+  for(unsigned int i = 0; i < num_dps; ++i){
+    REQUIRE(streamed_distribution[i].size() == params._perplexity*params._perplexity_multiplier);
+    REQUIRE(streamed_distribution[i].size() == knn_distribution[i].size());
+    for(auto& e: streamed_distribution[i]){
+      REQUIRE(e.first != i);
+      REQUIRE(std::abs(e.second-knn_distribution[i][e.first]) < 1e-4);
+    }
+  }
+}
+
+TEST_CASE( "HD probabilities - dense distance matrix", "[probabilities]" ) {
+  typedef hdi::dr::HDJointProbabilityGenerator<float> prob_gen_type;
+  const unsigned int num_dps = 200;
+  std::vector<float> data, squared_distances;
+  generateData(num_dps,3,data,squared_distances);
+
+  prob_gen_type prob_gen;
+  prob_gen_type::Parameters params;
+  params._perplexity = 20;
+  params._knn_memory_budget = 0;
+  prob_gen_type::sparse_scalar_matrix_type distribution;
+  REQUIRE_THROWS(prob_gen.computeProbabilityDistributionsFromDistanceMatrix(squared_distances,num_dps+1,distribution,params));
+  prob_gen.computeProbabilityDistributionsFromDistanceMatrix(squared_distances,num_dps,distribution,params);
+
+  REQUIRE(distribution.size() == num_dps);
+  for(unsigned int i = 0; i < num_dps; ++i){
+    double sum = 0;
+    for(auto& e: distribution[i]){
+      sum += e.second;
+    }
+    REQUIRE(distribution[i][i] == 0);
+    REQUIRE(std::abs(sum-1) < 1e-4);
+  }
+}
+
+TEST_CASE( "HD probabilities - multiple perplexities", "[probabilities]" ) {
+  typedef hdi::dr::HDJointProbabilityGenerator<float> prob_gen_type;
+  const unsigned int num_dps = 300;
+  std::vector<float> data, squared_distances;
+  generateData(num_dps,4,data,squared_distances);
+
+  prob_gen_type prob_gen;
+  prob_gen_type::Parameters params;
+  params._knn_backend = hdi::dr::KNNBackend::ExactBlocked;
+  const std::vector<float> perplexities = {5,15,10};
+  std::vector<prob_gen_type::sparse_scalar_matrix_type> distributions;
+  REQUIRE_THROWS(prob_gen.computeJointProbabilityDistributions(data.data(),4,num_dps,std::vector<float>(),distributions,params));
+  prob_gen.computeJointProbabilityDistributions(data.data(),4,num_dps,perplexities,distributions,params);
+  REQUIRE(distributions.size() == perplexities.size());
+
+  //same result of a separate computation for every perplexity
+  for(size_t p = 0; p < perplexities.size(); ++p){
+    prob_gen_type::sparse_scalar_matrix_type distribution;
+    params._perplexity = perplexities[p];
+    prob_gen.computeJointProbabilityDistribution(data.data(),4,num_dps,distribution,params);
+    REQUIRE(distributions[p].size() == num_dps);
+    for(unsigned int i = 0; i < num_dps; ++i){
+      REQUIRE(distributions[p][i].size() == distribution[i].size());
+      for(auto& e: distribution[i]){
+        REQUIRE(std::abs(e.second-distributions[p][i][e.first]) < 1e-5);
+      }
+    }
+  }
+
+  //multi-scale kernel: symmetric and with the same mass of the single-scale distributions
+  prob_gen_type::sparse_scalar_matrix_type multiscale, single_scale;
+  prob_gen.computeMultiscaleJointProbabilityDistribution(data.data(),4,num_dps,perplexities,multiscale,params);
+  REQUIRE(multiscale.size() == num_dps);
+  double total = 0;
+  for(unsigned int i = 0; i < num_dps; ++i){
+    REQUIRE(multiscale[i].size() >= 45);
+    for(auto& e: multiscale[i]){
+      REQUIRE(std::abs(e.second-multiscale[e.first][i]) < 1e-6);
+      total += e.second;
+    }
+  }
+  REQUIRE(std::abs(total-num_dps) < 1e-2*num_dps);
+
+  //a single scale is the standard distribution computed on the neighborhood of that perplexity
+  params._perplexity = 10;
+  prob_gen.computeJointProbabilityDistribution(data.data(),4,num_dps,single_scale,params);
+  prob_gen.computeMultiscaleJointProbabilityDistribution(data.data(),4,num_dps,std::vector<float>(1,10),multiscale,params);
+  for(unsigned int i = 0; i < num_dps; ++i){
+    REQUIRE(multiscale[i].size() == single_scale[i].size());
+    for(auto& e: single_scale[i]){
+      REQUIRE(std::abs(e.second-multiscale[i][e.first]) < 1e-5);
+    }
+  }
+}
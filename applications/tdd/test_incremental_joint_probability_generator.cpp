@@ -0,0 +1,179 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+#include "catch.hpp"
+#include "hdi/dimensionality_reduction/incremental_joint_probability_generator.h"
+#include "hdi/dimensionality_reduction/sparse_tsne_user_def_probabilities.h"
+#include <random>
+#include <cmath>
+
+namespace{
+  //Two well separated clusters, the label of each point is returned in labels
+  void generateClusters(unsigned int num_dps, unsigned int num_dim, std::vector<float>& data, std::vector<int>& labels){
+    std::default_random_engine generator(17);
+    std::normal_distribution<float> distribution;
+    std::bernoulli_distribution coin;
+    data.resize(num_dps*num_dim);
+    labels.resize(num_dps);
+    for(unsigned int i = 0; i < num_dps; ++i){
+      labels[i] = coin(generator);
+      for(unsigned int d = 0; d < num_dim; ++d){
+        data[i*num_dim+d] = distribution(generator) + labels[i]*10;
+      }
+    }
+  }
+}
+
+TEST_CASE( "Incremental probabilities - insertion of batches", "[probabilities]" ) {
+  typedef hdi::dr::IncrementalJointProbabilityGenerator<float> prob_gen_type;
+  const unsigned int num_dps = 1000;
+  const unsigned int num_initial_dps = 800;
+  const unsigned int batch_size = 100;
+  const unsigned int num_dim = 8;
+  std::vector<float> data;
+  std::vector<int> labels;
+  generateClusters(num_dps,num_dim,data,labels);
+
+  prob_gen_type::Parameters params;
+  params._perplexity = 10;
+  params._seed = 1;
+
+  prob_gen_type full_gen;
+  prob_gen_type::sparse_scalar_matrix_type full_distribution;
+  full_gen.initialize(data.data(),num_dim,num_dps,full_distribution,params);
+
+  prob_gen_type prob_gen;
+  prob_gen_type::sparse_scalar_matrix_type distribution;
+  prob_gen.initialize(data.data(),num_dim,num_initial_dps,distribution,params);
+  std::vector<unsigned int> updated_rows;
+  REQUIRE_THROWS(prob_gen.addDataPoints(data.data(),batch_size,full_distribution,updated_rows));
+
+  for(unsigned int first = num_initial_dps; first < num_dps; first += batch_size){
+    prob_gen.addDataPoints(data.data()+first*num_dim,batch_size,distribution,updated_rows);
+    REQUIRE(prob_gen.numDataPoints() == first+batch_size);
+    REQUIRE(distribution.size() == first+batch_size);
+    REQUIRE(updated_rows.size() > 0);
+    //the insertion only touches the neighborhood of the new points
+    REQUIRE(updated_rows.size() < first);
+    for(unsigned int r = 0; r < updated_rows.size(); ++r){
+      REQUIRE(updated_rows[r] < first);
+      REQUIRE((r == 0 || updated_rows[r-1] < updated_rows[r]));
+    }
+  }
+
+  //symmetric and equivalent to the distribution computed on all the points
+  double total = 0;
+  double difference = 0;
+  for(unsigned int i = 0; i < num_dps; ++i){
+    double row_sum = 0;
+    for(auto& e: distribution[i]){
+      REQUIRE(e.first != i);
+      REQUIRE(std::abs(e.second-distribution[e.first][i]) < 1e-6);
+      row_sum += e.second;
+    }
+    REQUIRE(row_sum > 0);
+    for(auto& e: full_distribution[i]){
+      total += e.second;
+      difference += std::abs(e.second-distribution[i][e.first]);
+    }
+  }
+  REQUIRE(std::abs(total-num_dps) < 1e-2*num_dps);
+  REQUIRE(difference/total < 0.05);
+}
+
+TEST_CASE( "Incremental probabilities - insertion in the embedding", "[probabilities]" ) {
+  typedef hdi::dr::IncrementalJointProbabilityGenerator<float> prob_gen_type;
+  typedef hdi::dr::SparseTSNEUserDefProbabilities<float> tsne_type;
+  const unsigned int num_dps = 600;
+  const unsigned int num_initial_dps = 500;
+  const unsigned int num_dim = 8;
+  std::vector<float> data;
+  std::vector<int> labels;
+  generateClusters(num_dps,num_dim,data,labels);
+
+  prob_gen_type::Parameters params;
+  params._perplexity = 10;
+  params._seed = 1;
+  prob_gen_type prob_gen;
+  prob_gen_type::sparse_scalar_matrix_type distribution;
+  prob_gen.initialize(data.data(),num_dim,num_initial_dps,distribution,params);
+
+  hdi::data::Embedding<float> embedding;
+  tsne_type tsne;
+  SECTION("Double-precision tree"){
+  }
+  SECTION("Single-precision tree"){
+    tsne.setSinglePrecisionTree(true);
+  }
+  tsne_type::sparse_scalar_matrix_type initial_distribution(distribution);
+  tsne.setTheta(0.5);
+  tsne.initializeWithJointProbabilityDistribution(initial_distribution,&embedding);
+  for(int it = 0; it < 400; ++it){
+    tsne.doAnIteration();
+  }
+
+  std::vector<unsigned int> updated_rows;
+  prob_gen.addDataPoints(data.data()+num_initial_dps*num_dim,num_dps-num_initial_dps,distribution,updated_rows);
+  tsne.addDataPoints(distribution,updated_rows,30);
+  REQUIRE(tsne.getNumberOfDataPoints() == num_dps);
+  REQUIRE(embedding.numDataPoints() == num_dps);
+  for(unsigned int i = 0; i < num_dps; ++i){
+    REQUIRE(tsne.getDistributionP()[i].size() == distribution[i].size());
+  }
+
+  //new points are placed in their cluster
+  double centroids[2][2] = {{0,0},{0,0}};
+  int cluster_size[2] = {0,0};
+  for(unsigned int i = 0; i < num_initial_dps; ++i){
+    centroids[labels[i]][0] += embedding.dataAt(i,0);
+    centroids[labels[i]][1] += embedding.dataAt(i,1);
+    ++cluster_size[labels[i]];
+  }
+  for(int c = 0; c < 2; ++c){
+    centroids[c][0] /= cluster_size[c];
+    centroids[c][1] /= cluster_size[c];
+  }
+  for(unsigned int i = num_initial_dps; i < num_dps; ++i){
+    REQUIRE(std::isfinite(embedding.dataAt(i,0)));
+    REQUIRE(std::isfinite(embedding.dataAt(i,1)));
+    double dist[2];
+    for(int c = 0; c < 2; ++c){
+      const double dx = embedding.dataAt(i,0)-centroids[c][0];
+      const double dy = embedding.dataAt(i,1)-centroids[c][1];
+      dist[c] = dx*dx+dy*dy;
+    }
+    REQUIRE(dist[labels[i]] < dist[1-labels[i]]);
+  }
+
+  tsne.doAnIteration();
+  REQUIRE(std::isfinite(embedding.dataAt(num_dps-1,0)));
+}
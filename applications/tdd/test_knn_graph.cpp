@@ -0,0 +1,197 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+#include "catch.hpp"
+#include "hdi/dimensionality_reduction/knn_graph_generator.h"
+#include "hdi/dimensionality_reduction/knn_graph_cache.h"
+#include "hdi/utils/memory_mapped_file.h"
+#include <random>
+#include <fstream>
+#include <cstdio>
+
+template <typename scalar_type>
+void test_knn_graph(hdi::dr::KNNBackend backend, scalar_type min_recall){
+  const unsigned int num_dps = 1000;
+  const unsigned int num_dim = 8;
+  const unsigned int nn = 11;
+
+  std::vector<scalar_type> data(num_dps*num_dim);
+  std::default_random_engine generator(17);
+  std::normal_distribution<scalar_type> distribution;
+  for(auto& v: data){
+    v = distribution(generator);
+  }
+
+  hdi::dr::KNNGraphGenerator<scalar_type> generator_knn;
+  typename hdi::dr::KNNGraphGenerator<scalar_type>::Parameters params;
+  params._backend = backend;
+  params._recall_num_samples = 100;
+  params._seed = 1;
+
+  std::vector<scalar_type> distances;
+  std::vector<int> indices;
+  REQUIRE_THROWS(generator_knn.computeKNNGraph(data.data(),num_dim,num_dps,num_dps+1,distances,indices,params));
+  REQUIRE_NOTHROW(generator_knn.computeKNNGraph(data.data(),num_dim,num_dps,nn,distances,indices,params));
+
+  REQUIRE(indices.size() == num_dps*nn);
+  REQUIRE(distances.size() == num_dps*nn);
+  for(int i = 0; i < num_dps; ++i){
+    REQUIRE(indices[i*nn] == i);
+    REQUIRE(distances[i*nn] == 0);
+    for(int j = 1; j < nn; ++j){
+      REQUIRE(distances[i*nn+j] >= distances[i*nn+j-1]);
+    }
+  }
+  REQUIRE(generator_knn.statistics()._recall >= min_recall);
+}
+
+TEST_CASE( "KNN graph - exact blocked", "[knn]" ) {
+  test_knn_graph<float>(hdi::dr::KNNBackend::ExactBlocked,1);
+}
+
+TEST_CASE( "KNN graph - kd-forest", "[knn]" ) {
+  test_knn_graph<float>(hdi::dr::KNNBackend::FlannKDTree,0.9);
+}
+
+TEST_CASE( "KNN graph - proximity graph", "[knn]" ) {
+  test_knn_graph<float>(hdi::dr::KNNBackend::ProximityGraph,0.9);
+}
+
+TEST_CASE( "KNN graph - out-of-core blocked", "[knn]" ) {
+  test_knn_graph<float>(hdi::dr::KNNBackend::OutOfCoreBlocked,1);
+}
+
+TEST_CASE( "KNN graph - exact GEMM", "[knn]" ) {
+  test_knn_graph<float>(hdi::dr::KNNBackend::ExactGEMM,1);
+  test_knn_graph<double>(hdi::dr::KNNBackend::ExactGEMM,1);
+}
+
+TEST_CASE( "KNN graph - memory-mapped file", "[knn]" ) {
+  typedef float scalar_type;
+  const unsigned int num_dps = 700;
+  const unsigned int num_dim = 5;
+  const unsigned int nn = 8;
+  const std::string file_name("test_knn_graph_data.bin");
+
+  std::vector<scalar_type> data(num_dps*num_dim);
+  std::default_random_engine generator(3);
+  std::uniform_real_distribution<scalar_type> distribution;
+  for(auto& v: data){
+    v = distribution(generator);
+  }
+  {
+    std::ofstream file(file_name, std::ios::out|std::ios::binary);
+    file.write(reinterpret_cast<const char*>(data.data()), sizeof(scalar_type)*data.size());
+  }
+
+  hdi::dr::KNNGraphGenerator<scalar_type> generator_knn;
+  hdi::dr::KNNGraphGenerator<scalar_type>::Parameters params;
+  params._backend = hdi::dr::KNNBackend::ExactBlocked;
+  std::vector<scalar_type> distances, distances_ooc;
+  std::vector<int> indices, indices_ooc;
+  generator_knn.computeKNNGraph(data.data(),num_dim,num_dps,nn,distances,indices,params);
+
+  {
+    hdi::utils::MemoryMappedFile mapped_file(file_name);
+    REQUIRE(mapped_file.isOpen());
+    REQUIRE(mapped_file.size() == sizeof(scalar_type)*data.size());
+    REQUIRE_THROWS(generator_knn.computeKNNGraph(mapped_file,num_dim+1,nn,distances_ooc,indices_ooc,params));
+
+    params._backend = hdi::dr::KNNBackend::OutOfCoreBlocked;
+    params._block_size = 32;
+    params._memory_budget = 1;
+    REQUIRE_NOTHROW(generator_knn.computeKNNGraph(mapped_file,num_dim,nn,distances_ooc,indices_ooc,params));
+  }
+  std::remove(file_name.c_str());
+
+  REQUIRE(indices_ooc.size() == indices.size());
+  for(int i = 0; i < indices.size(); ++i){
+    REQUIRE(distances_ooc[i] == distances[i]);
+  }
+}
+
+TEST_CASE( "KNN graph - persistent cache", "[knn]" ) {
+  typedef float scalar_type;
+  const unsigned int num_dps = 500;
+  const unsigned int num_dim = 6;
+  const unsigned int nn = 10;
+
+  std::vector<scalar_type> data(num_dps*num_dim);
+  std::default_random_engine generator(5);
+  std::uniform_real_distribution<scalar_type> distribution;
+  for(auto& v: data){
+    v = distribution(generator);
+  }
+
+  hdi::dr::KNNGraphGenerator<scalar_type> generator_knn;
+  hdi::dr::KNNGraphGenerator<scalar_type>::Parameters params;
+  params._backend = hdi::dr::KNNBackend::ExactBlocked;
+  params._cache_directory = ".";
+  const uint64_t data_fingerprint = hdi::dr::KNNGraphCache<scalar_type>::fingerprint(data.data(),num_dim,num_dps);
+  const std::string file_name = hdi::dr::KNNGraphCache<scalar_type>(params._cache_directory).fileName(data_fingerprint,generator_knn.cacheKey(params));
+  std::remove(file_name.c_str());
+
+  std::vector<scalar_type> distances, distances_cached;
+  std::vector<int> indices, indices_cached;
+  generator_knn.computeKNNGraph(data.data(),num_dim,num_dps,nn,distances,indices,params);
+  REQUIRE(!generator_knn.statistics()._cache_hit);
+
+  //same graph, the out-of-core engine is exact as well
+  params._backend = hdi::dr::KNNBackend::OutOfCoreBlocked;
+  generator_knn.computeKNNGraph(data.data(),num_dim,num_dps,nn,distances_cached,indices_cached,params);
+  REQUIRE(generator_knn.statistics()._cache_hit);
+  REQUIRE(distances_cached == distances);
+  REQUIRE(indices_cached == indices);
+
+  //fewer neighbors are served by truncating the cached rows
+  const unsigned int nn_small = 4;
+  generator_knn.computeKNNGraph(data.data(),num_dim,num_dps,nn_small,distances_cached,indices_cached,params);
+  REQUIRE(generator_knn.statistics()._cache_hit);
+  REQUIRE(indices_cached.size() == num_dps*nn_small);
+  for(int i = 0; i < num_dps; ++i){
+    for(int j = 0; j < nn_small; ++j){
+      REQUIRE(indices_cached[i*nn_small+j] == indices[i*nn+j]);
+      REQUIRE(distances_cached[i*nn_small+j] == distances[i*nn+j]);
+    }
+  }
+
+  //more neighbors or different data require a new search
+  generator_knn.computeKNNGraph(data.data(),num_dim,num_dps,nn+1,distances_cached,indices_cached,params);
+  REQUIRE(!generator_knn.statistics()._cache_hit);
+  data[0] += 1;
+  REQUIRE(hdi::dr::KNNGraphCache<scalar_type>::fingerprint(data.data(),num_dim,num_dps) != data_fingerprint);
+  generator_knn.computeKNNGraph(data.data(),num_dim,num_dps,nn,distances_cached,indices_cached,params);
+  REQUIRE(!generator_knn.statistics()._cache_hit);
+
+  std::remove(file_name.c_str());
+  std::remove(hdi::dr::KNNGraphCache<scalar_type>(params._cache_directory).fileName(hdi::dr::KNNGraphCache<scalar_type>::fingerprint(data.data(),num_dim,num_dps),generator_knn.cacheKey(params)).c_str());
+}
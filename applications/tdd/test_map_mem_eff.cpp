@@ -38,6 +38,7 @@
 #include "hdi/utils/timers.h"
 #include "hdi/utils/scoped_timers.h"
 #include <map>
+#include <unordered_map>
 
 /***********************************************/
 /***********************************************/
@@ -225,3 +226,159 @@ TEST_CASE( "MapHelpers::invert", "[MapHelpers]" ) {
     testMapInvert<std::unordered_map<unsigned int,double>>();
   }
 }
+
+
+
+template <typename Map>
+void testMapSymmetrize(){
+  typedef hdi::data::MapHelpers<typename Map::key_type,typename Map::mapped_type, Map> map_helpers_type;
+  typedef std::vector<Map> sparse_matrix_type;
+
+  hdi::utils::CoutLog log;
+  int n = 1500;
+  sparse_matrix_type matrix(n);
+  for(int j = 0; j < matrix.size(); ++j){
+    for(int t = 0; t < matrix.size()/10; ++t){
+      auto i = rand()%n;
+      matrix[j][i] = rand()%1000;
+    }
+  }
+  sparse_matrix_type symmetric;
+  double time(0);
+
+  {
+    hdi::utils::ScopedTimer<double> timer(time);
+    map_helpers_type::symmetrize(matrix,symmetric);
+  }
+  hdi::utils::secureLogValue(&log,"Symmetrize (s)", time);
+
+  REQUIRE(symmetric.size() == matrix.size());
+  for(int j = 0; j < matrix.size(); ++j){
+    for(auto& e: matrix[j]){
+      auto it = matrix[e.first].find(j);
+      typename Map::mapped_type v = (it == matrix[e.first].end())?0:it->second;
+      REQUIRE(symmetric[j].find(e.first)->second == (e.second+v)*0.5);
+      REQUIRE(symmetric[e.first].find(j)->second == (e.second+v)*0.5);
+    }
+  }
+  for(int j = 0; j < symmetric.size(); ++j){
+    for(auto& e: symmetric[j]){
+      REQUIRE((matrix[j].find(e.first) != matrix[j].end() || matrix[e.first].find(j) != matrix[e.first].end()));
+    }
+  }
+}
+
+TEST_CASE( "MapHelpers::symmetrize", "[MapHelpers]" ) {
+  hdi::utils::CoutLog log;
+  SECTION("MapMemEff"){
+    log.display("MapMemEff");
+    testMapSymmetrize<hdi::data::MapMemEff<int,float>>();
+    testMapSymmetrize<hdi::data::MapMemEff<int,double>>();
+    testMapSymmetrize<hdi::data::MapMemEff<unsigned int,float>>();
+    testMapSymmetrize<hdi::data::MapMemEff<unsigned int,double>>();
+  }
+  SECTION("std::map"){
+    log.display("std::map");
+    testMapSymmetrize<std::map<int,float>>();
+    testMapSymmetrize<std::map<unsigned int,double>>();
+  }
+  SECTION("std::unordered_map"){
+    log.display("std::unordered_map");
+    testMapSymmetrize<std::unordered_map<int,float>>();
+    testMapSymmetrize<std::unordered_map<unsigned int,double>>();
+  }
+}
+
+TEST_CASE( "MapMemEff bulk construction and merge", "[MapMemEff]" ) {
+  hdi::utils::CoutLog log;
+  typedef hdi::data::MapMemEff<unsigned int,float> map_type;
+  typedef hdi::data::MapHelpers<unsigned int,float,map_type> map_helpers_type;
+  const int n_test = 30000;
+  std::vector<std::pair<unsigned int,float>> elements(n_test);
+  for(int i = 0; i < n_test; ++i){
+    elements[i] = std::make_pair(rand()%5000,float(rand()%1000));
+  }
+
+  SECTION("finalize combines the duplicates according to the policy"){
+    std::map<unsigned int,float> sum, max, last;
+    for(auto& e: elements){
+      sum[e.first] += e.second;
+      max[e.first] = std::max(max[e.first],e.second);
+      last[e.first] = e.second;
+    }
+    map_type map_sum, map_max, map_last;
+    map_helpers_type::initializeUnsorted(map_sum,elements.begin(),elements.end(),hdi::data::DuplicatePolicy::Sum);
+    map_helpers_type::initializeUnsorted(map_max,elements.begin(),elements.end(),hdi::data::DuplicatePolicy::Max);
+    map_helpers_type::initializeUnsorted(map_last,elements.begin(),elements.end(),hdi::data::DuplicatePolicy::Overwrite);
+    REQUIRE(map_sum.size() == sum.size());
+    REQUIRE(map_max.size() == max.size());
+    REQUIRE(map_last.size() == last.size());
+    for(auto& p: sum){
+      REQUIRE(map_sum.find(p.first)->second == p.second);
+      REQUIRE(map_max.find(p.first)->second == max[p.first]);
+      REQUIRE(map_last.find(p.first)->second == last[p.first]);
+    }
+  }
+
+  SECTION("initializeUnsorted replaces the content of every map type"){
+    std::map<unsigned int,float> map_std;
+    std::unordered_map<unsigned int,float> map_unordered;
+    map_type map_eff;
+    const std::vector<std::pair<unsigned int,float>> old_elements = {{5001,1},{5002,2}};
+    hdi::data::MapHelpers<unsigned int,float,std::map<unsigned int,float>>::initializeUnsorted(map_std,old_elements.begin(),old_elements.end());
+    hdi::data::MapHelpers<unsigned int,float,std::unordered_map<unsigned int,float>>::initializeUnsorted(map_unordered,old_elements.begin(),old_elements.end());
+    map_helpers_type::initializeUnsorted(map_eff,old_elements.begin(),old_elements.end());
+
+    hdi::data::MapHelpers<unsigned int,float,std::map<unsigned int,float>>::initializeUnsorted(map_std,elements.begin(),elements.end());
+    hdi::data::MapHelpers<unsigned int,float,std::unordered_map<unsigned int,float>>::initializeUnsorted(map_unordered,elements.begin(),elements.end());
+    map_helpers_type::initializeUnsorted(map_eff,elements.begin(),elements.end());
+    REQUIRE(map_std.count(5001) == 0);
+    REQUIRE(map_unordered.count(5001) == 0);
+    REQUIRE(map_eff.find(5001) == map_eff.end());
+    REQUIRE(map_std.size() == map_eff.size());
+    REQUIRE(map_unordered.size() == map_eff.size());
+    for(auto& p: map_std){
+      REQUIRE(map_eff.find(p.first)->second == p.second);
+      REQUIRE(map_unordered[p.first] == p.second);
+    }
+  }
+
+  SECTION("merge of two maps"){
+    map_type a, b;
+    std::map<unsigned int,float> reference;
+    for(int i = 0; i < n_test; ++i){
+      map_type& dst = (i%2)?a:b;
+      dst.append(elements[i].first,elements[i].second);
+      reference[elements[i].first] += elements[i].second;
+    }
+    a.finalize();
+    b.finalize();
+    a.merge(b);
+    REQUIRE(a.size() == reference.size());
+    REQUIRE(a.capacity() == a.size());
+    for(auto& p: reference){
+      REQUIRE(a.find(p.first)->second == Approx(p.second));
+    }
+  }
+
+  SECTION("bulk construction gives the same rows as operator[]"){
+    const int n_rows = 200;
+    const int n_elem = 3000;
+    std::vector<map_type> matrix(n_rows), matrix_bulk(n_rows);
+    for(int j = 0; j < n_rows; ++j){
+      for(int i = 0; i < n_elem; ++i){
+        matrix[j][(i*7919+j)%100000] = 1;
+      }
+    }
+    for(int j = 0; j < n_rows; ++j){
+      matrix_bulk[j].reserve(n_elem);
+      for(int i = 0; i < n_elem; ++i){
+        matrix_bulk[j].append((i*7919+j)%100000,1);
+      }
+      matrix_bulk[j].finalize(hdi::data::DuplicatePolicy::Overwrite);
+    }
+    for(int j = 0; j < n_rows; ++j){
+      REQUIRE(matrix[j].memory() == matrix_bulk[j].memory());
+    }
+  }
+}
@@ -0,0 +1,145 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+#include "catch.hpp"
+#include "hdi/dimensionality_reduction/randomized_pca.h"
+#include "hdi/utils/Eigen/Dense"
+#include <random>
+#include <fstream>
+#include <cstdio>
+
+namespace{
+  //! Low-rank data with decreasing variance along the latent directions and isotropic noise
+  void generateLowRankData(unsigned int num_dps, unsigned int num_dim, unsigned int rank, std::vector<float>& data){
+    std::default_random_engine generator(11);
+    std::normal_distribution<double> distribution;
+    Eigen::MatrixXd directions(rank,num_dim);
+    for(unsigned int r = 0; r < rank; ++r){
+      for(unsigned int d = 0; d < num_dim; ++d){
+        directions(r,d) = distribution(generator);
+      }
+    }
+    data.resize(size_t(num_dps)*num_dim);
+    for(unsigned int i = 0; i < num_dps; ++i){
+      Eigen::RowVectorXd point = Eigen::RowVectorXd::Constant(num_dim,5);
+      for(unsigned int r = 0; r < rank; ++r){
+        point += directions.row(r)*distribution(generator)*(rank-r);
+      }
+      for(unsigned int d = 0; d < num_dim; ++d){
+        data[size_t(i)*num_dim+d] = point[d] + 0.1*distribution(generator);
+      }
+    }
+  }
+}
+
+TEST_CASE( "Randomized PCA matches the exact decomposition", "[pca]" ) {
+  const unsigned int num_dps = 2000;
+  const unsigned int num_dim = 60;
+  const unsigned int rank = 8;
+  const unsigned int num_components = 5;
+  std::vector<float> data;
+  generateLowRankData(num_dps,num_dim,rank,data);
+
+  //exact covariance
+  Eigen::MatrixXd x(num_dps,num_dim);
+  for(unsigned int i = 0; i < num_dps; ++i){
+    for(unsigned int d = 0; d < num_dim; ++d){
+      x(i,d) = data[size_t(i)*num_dim+d];
+    }
+  }
+  x.rowwise() -= x.colwise().mean();
+  Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver(x.transpose()*x/(num_dps-1));
+
+  hdi::dr::RandomizedPCA<float> pca;
+  hdi::dr::RandomizedPCA<float>::Parameters params;
+  params._num_components = num_components;
+  params._block_size = 128;
+  hdi::dr::RandomizedPCA<float>::Parameters invalid_params(params);
+  invalid_params._num_components = num_dim+1;
+  REQUIRE_THROWS(pca.fit(data.data(),num_dim,num_dps,invalid_params));
+  std::vector<float> projected;
+  REQUIRE_NOTHROW(pca.fitTransform(data.data(),num_dim,num_dps,projected,params));
+
+  REQUIRE(pca.numComponents() == num_components);
+  REQUIRE(projected.size() == num_dps*num_components);
+  for(unsigned int c = 0; c < num_components; ++c){
+    const double exact_variance = solver.eigenvalues()[num_dim-1-c];
+    REQUIRE(std::abs(pca.explainedVariance()[c]-exact_variance) < 1e-6*exact_variance);
+    //components are unit vectors aligned with the exact eigenvectors
+    double dot = 0;
+    for(unsigned int d = 0; d < num_dim; ++d){
+      dot += pca.components()[c*num_dim+d]*solver.eigenvectors()(d,num_dim-1-c);
+    }
+    REQUIRE(std::abs(std::abs(dot)-1) < 1e-6);
+    //the variance of the projection is the explained variance
+    double var = 0;
+    for(unsigned int i = 0; i < num_dps; ++i){
+      var += double(projected[i*num_components+c])*projected[i*num_components+c];
+    }
+    var /= (num_dps-1);
+    REQUIRE(std::abs(var-exact_variance) < 1e-4*exact_variance);
+  }
+  double ratio = 0;
+  for(auto r: pca.explainedVarianceRatio()){
+    ratio += r;
+  }
+  REQUIRE(ratio > 0.9);
+  REQUIRE(ratio <= 1);
+}
+
+TEST_CASE( "Randomized PCA on a memory-mapped file", "[pca]" ) {
+  const unsigned int num_dps = 1000;
+  const unsigned int num_dim = 40;
+  const std::string file_name("test_randomized_pca_data.bin");
+  std::vector<float> data;
+  generateLowRankData(num_dps,num_dim,4,data);
+  {
+    std::ofstream file(file_name, std::ios::out|std::ios::binary);
+    file.write(reinterpret_cast<const char*>(data.data()), sizeof(float)*data.size());
+  }
+
+  hdi::dr::RandomizedPCA<float> pca, pca_mapped;
+  hdi::dr::RandomizedPCA<float>::Parameters params;
+  params._num_components = 3;
+  std::vector<float> projected, projected_mapped;
+  pca.fitTransform(data.data(),num_dim,num_dps,projected,params);
+  {
+    hdi::utils::MemoryMappedFile file(file_name);
+    pca_mapped.fitTransform(file,num_dim,projected_mapped,params);
+  }
+  std::remove(file_name.c_str());
+
+  REQUIRE(projected_mapped.size() == projected.size());
+  for(size_t i = 0; i < projected.size(); ++i){
+    REQUIRE(std::abs(projected_mapped[i]-projected[i]) < 1e-3);
+  }
+}
@@ -0,0 +1,101 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef TEST_REPULSION_HELPERS_H
+#define TEST_REPULSION_HELPERS_H
+
+#include <vector>
+#include <random>
+#include <cmath>
+
+//! Brute-force reference and error measures shared by the tests of the repulsive forces
+namespace repulsion_helpers{
+
+  //! Points drawn from a normal distribution with a fixed seed
+  template <typename scalar_type>
+  void generatePoints(unsigned int num_points, unsigned int dim, std::vector<scalar_type>& points, scalar_type stddev = 10){
+    std::default_random_engine generator(17);
+    std::normal_distribution<scalar_type> distribution(0,stddev);
+    points.resize(size_t(num_points)*dim);
+    for(auto& v: points){
+      v = distribution(generator);
+    }
+  }
+
+  //! Repulsive forces and normalization of every point computed on all pairs
+  template <typename scalar_type>
+  void exactNonEdgeForces(unsigned int num_points, unsigned int dim, const std::vector<scalar_type>& points, std::vector<double>& neg_f, std::vector<double>& sum_Q){
+    neg_f.assign(size_t(num_points)*dim,0);
+    sum_Q.assign(num_points,0);
+    for(unsigned int i = 0; i < num_points; ++i){
+      for(unsigned int j = 0; j < num_points; ++j){
+        if(i == j){
+          continue;
+        }
+        double dist_sq = 0;
+        for(unsigned int d = 0; d < dim; ++d){
+          const double diff = double(points[i*dim+d]) - points[j*dim+d];
+          dist_sq += diff*diff;
+        }
+        const double q = 1./(1.+dist_sq);
+        sum_Q[i] += q;
+        for(unsigned int d = 0; d < dim; ++d){
+          neg_f[i*dim+d] += q*q*(double(points[i*dim+d]) - points[j*dim+d]);
+        }
+      }
+    }
+  }
+
+  //! Relative error, in the euclidean norm, of v with respect to v_exact
+  inline double relativeError(const std::vector<double>& v, const std::vector<double>& v_exact){
+    double error = 0, norm = 0;
+    for(size_t i = 0; i < v.size(); ++i){
+      error += (v[i]-v_exact[i])*(v[i]-v_exact[i]);
+      norm += v_exact[i]*v_exact[i];
+    }
+    return std::sqrt(error/norm);
+  }
+
+  //! Relative error of the normalized repulsive forces, i.e., of the forces divided by their normalization
+  inline double repulsionError(const std::vector<double>& neg_f, double sum_Q, const std::vector<double>& neg_f_exact, double sum_Q_exact){
+    double error = 0, norm = 0;
+    for(size_t i = 0; i < neg_f.size(); ++i){
+      const double diff = neg_f[i]/sum_Q - neg_f_exact[i]/sum_Q_exact;
+      error += diff*diff;
+      norm += neg_f_exact[i]/sum_Q_exact*neg_f_exact[i]/sum_Q_exact;
+    }
+    return std::sqrt(error/norm);
+  }
+
+}
+
+#endif
@@ -0,0 +1,233 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+#include "catch.hpp"
+#include "hdi/utils/cout_log.h"
+#include "hdi/utils/log_helper_functions.h"
+#include "hdi/utils/scoped_timers.h"
+#include "hdi/data/sparse_matrix_csr.h"
+#include "hdi/data/map_mem_eff.h"
+#include "hdi/data/map_helpers.h"
+#include "hdi/data/io.h"
+#include "hdi/dimensionality_reduction/sparse_tsne_user_def_probabilities.h"
+#include "hdi/dimensionality_reduction/sptree.h"
+#include <random>
+#include <sstream>
+#include <unordered_map>
+
+namespace{
+  //Random sparse matrix with num_neighbors entries per row
+  template <typename Map>
+  void generateSparseMatrix(unsigned int num_rows, unsigned int num_neighbors, std::vector<Map>& matrix){
+    std::default_random_engine generator(42);
+    std::uniform_int_distribution<unsigned int> distribution_int(0,num_rows-1);
+    std::uniform_real_distribution<float> distribution_real(0.1,1);
+    matrix.clear();
+    matrix.resize(num_rows);
+    for(unsigned int i = 0; i < num_rows; ++i){
+      for(unsigned int n = 0; n < num_neighbors; ++n){
+        unsigned int j = distribution_int(generator);
+        if(j != i){
+          matrix[i][j] = distribution_real(generator);
+        }
+      }
+    }
+  }
+
+  template <typename Matrix, typename Map>
+  void requireSameMatrix(const Matrix& matrix, const std::vector<Map>& reference){
+    REQUIRE(matrix.size() == reference.size());
+    for(size_t i = 0; i < reference.size(); ++i){
+      REQUIRE(matrix[i].size() == reference[i].size());
+      for(const auto& e: reference[i]){
+        auto it = matrix[i].find(e.first);
+        REQUIRE(it != matrix[i].end());
+        REQUIRE((*it).second == Approx(e.second));
+      }
+    }
+  }
+}
+
+TEST_CASE( "SparseMatrixCSR - construction and access", "[SparseMatrixCSR]" ) {
+  typedef hdi::data::SparseMatrixCSR<uint32_t,float> csr_type;
+  std::vector<std::unordered_map<uint32_t,float>> unordered;
+  generateSparseMatrix(500,10,unordered);
+
+  csr_type matrix(unordered);
+  requireSameMatrix(matrix,unordered);
+  size_t num_elements = 0;
+  for(size_t i = 0; i < matrix.size(); ++i){
+    num_elements += unordered[i].size();
+    uint32_t previous = 0;
+    bool first = true;
+    for(const auto& e: matrix[i]){
+      REQUIRE((first || e.first > previous));
+      previous = e.first;
+      first = false;
+    }
+  }
+  REQUIRE(matrix.numElements() == num_elements);
+  REQUIRE(matrix[0].find(std::numeric_limits<uint32_t>::max()) == matrix[0].end());
+
+  std::vector<hdi::data::MapMemEff<uint32_t,float>> copy;
+  matrix.copyTo(copy);
+  requireSameMatrix(matrix,copy);
+
+  std::vector<csr_type::offset_type> offsets = {0,2};
+  std::vector<uint32_t> keys = {3,1};
+  std::vector<float> values = {1,1};
+  REQUIRE_THROWS(matrix.assign(offsets,keys,values));
+
+  matrix.resize(600);
+  REQUIRE(matrix.size() == 600);
+  REQUIRE(matrix[599].empty());
+  REQUIRE(matrix.numElements() == num_elements);
+  matrix.resize(10);
+  REQUIRE(matrix.size() == 10);
+  REQUIRE(matrix.numElements() == matrix.offsets().back());
+}
+
+TEST_CASE( "SparseMatrixCSR - MapHelpers and IO", "[SparseMatrixCSR]" ) {
+  typedef hdi::data::SparseMatrixCSR<uint32_t,float> csr_type;
+  typedef hdi::data::MapHelpers<uint32_t,float,csr_type::value_type> csr_helpers_type;
+  typedef hdi::data::MapMemEff<uint32_t,float> map_type;
+  typedef hdi::data::MapHelpers<uint32_t,float,map_type> map_helpers_type;
+
+  std::vector<map_type> reference;
+  generateSparseMatrix(500,10,reference);
+  csr_type matrix(reference);
+
+  SECTION("symmetrize"){
+    std::vector<map_type> reference_sym;
+    csr_type matrix_sym;
+    map_helpers_type::symmetrize(reference,reference_sym);
+    csr_helpers_type::symmetrize(matrix,matrix_sym);
+    requireSameMatrix(matrix_sym,reference_sym);
+  }
+
+  SECTION("invert"){
+    std::vector<map_type> reference_inv;
+    csr_type matrix_inv;
+    map_helpers_type::invert(reference,reference_inv);
+    csr_helpers_type::invert(matrix,matrix_inv);
+    requireSameMatrix(matrix_inv,reference_inv);
+  }
+
+  SECTION("replaceRows"){
+    std::vector<map_type> source;
+    generateSparseMatrix(500,5,source);
+    std::vector<unsigned int> rows = {0,7,499};
+    matrix.replaceRows(source,rows);
+    map_helpers_type::replaceRows(reference,source,rows);
+    requireSameMatrix(matrix,reference);
+  }
+
+  SECTION("save and load"){
+    std::stringstream stream;
+    hdi::data::IO::saveSparseMatrix(matrix,stream,nullptr);
+    csr_type loaded;
+    hdi::data::IO::loadSparseMatrix(loaded,stream,nullptr);
+    requireSameMatrix(loaded,reference);
+  }
+}
+
+TEST_CASE( "SparseMatrixCSR - BH-SNE on a CSR distribution", "[SparseMatrixCSR]" ) {
+  typedef hdi::data::MapMemEff<uint32_t,float> map_type;
+  typedef hdi::data::SparseMatrixCSR<uint32_t,float> csr_type;
+  hdi::utils::CoutLog log;
+
+  const unsigned int num_dps = 5000;
+  std::vector<map_type> conditional;
+  generateSparseMatrix(num_dps,30,conditional);
+  std::vector<map_type> distribution;
+  hdi::data::MapHelpers<uint32_t,float,map_type>::symmetrize(conditional,distribution);
+  csr_type distribution_csr(distribution);
+
+  double memory = 0;
+  for(auto& row: distribution){
+    memory += hdi::data::MapHelpers<uint32_t,float,map_type>::memoryOccupation(row);
+  }
+  hdi::utils::secureLogValue(&log,"MapMemEff memory (MB)",memory/1024./1024.);
+  hdi::utils::secureLogValue(&log,"CSR memory (MB)",distribution_csr.memoryOccupation()/1024./1024.);
+
+  hdi::dr::TsneParameters params;
+  params._seed = 1;
+  hdi::data::Embedding<float> embedding, embedding_csr;
+  hdi::dr::SparseTSNEUserDefProbabilities<float,std::vector<map_type>> tsne;
+  hdi::dr::SparseTSNEUserDefProbabilities<float,csr_type> tsne_csr;
+  tsne.initializeWithJointProbabilityDistribution(distribution,&embedding,params);
+  tsne_csr.initializeWithJointProbabilityDistribution(distribution_csr,&embedding_csr,params);
+
+  double time = 0, time_csr = 0;
+  const int num_iterations = 20;
+  {
+    hdi::utils::ScopedTimer<double> timer(time);
+    for(int i = 0; i < num_iterations; ++i){
+      tsne.doAnIteration();
+    }
+  }
+  {
+    hdi::utils::ScopedTimer<double> timer(time_csr);
+    for(int i = 0; i < num_iterations; ++i){
+      tsne_csr.doAnIteration();
+    }
+  }
+  hdi::utils::secureLogValue(&log,"BH-SNE iterations with MapMemEff (ms)",time);
+  hdi::utils::secureLogValue(&log,"BH-SNE iterations with CSR (ms)",time_csr);
+
+  for(unsigned int i = 0; i < num_dps; ++i){
+    REQUIRE(embedding.dataAt(i,0) == Approx(embedding_csr.dataAt(i,0)));
+    REQUIRE(embedding.dataAt(i,1) == Approx(embedding_csr.dataAt(i,1)));
+  }
+
+  //attractive forces alone
+  hdi::dr::SPTree<float> tree(2,embedding.getContainer().data(),num_dps);
+  std::vector<double> forces(num_dps*2,0), forces_csr(num_dps*2,0);
+  time = 0; time_csr = 0;
+  {
+    hdi::utils::ScopedTimer<double> timer(time);
+    for(int i = 0; i < num_iterations; ++i){
+      tree.computeEdgeForces(distribution,1,forces.data());
+    }
+  }
+  {
+    hdi::utils::ScopedTimer<double> timer(time_csr);
+    for(int i = 0; i < num_iterations; ++i){
+      tree.computeEdgeForces(distribution_csr,1,forces_csr.data());
+    }
+  }
+  hdi::utils::secureLogValue(&log,"Edge forces with MapMemEff (ms)",time);
+  hdi::utils::secureLogValue(&log,"Edge forces with CSR (ms)",time_csr);
+  for(unsigned int i = 0; i < num_dps*2; ++i){
+    REQUIRE(forces[i] == Approx(forces_csr[i]));
+  }
+}
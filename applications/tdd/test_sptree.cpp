@@ -0,0 +1,571 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+#include "catch.hpp"
+#include "hdi/utils/cout_log.h"
+#include "hdi/utils/log_helper_functions.h"
+#include "hdi/utils/scoped_timers.h"
+#include "hdi/dimensionality_reduction/sptree.h"
+#include "hdi/dimensionality_reduction/weighted_sptree.h"
+#include "hdi/data/sparse_matrix_csr.h"
+#include "test_repulsion_helpers.h"
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <unordered_map>
+
+using namespace repulsion_helpers;
+
+namespace{
+  template <typename scalar_type>
+  void testNonEdgeForces(unsigned int dim){
+    const unsigned int num_points = 1500;
+    std::vector<scalar_type> points;
+    generatePoints(num_points,dim,points);
+    std::vector<double> neg_f_exact, sum_Q_exact;
+    exactNonEdgeForces(num_points,dim,points,neg_f_exact,sum_Q_exact);
+
+    hdi::dr::SPTree<scalar_type> tree(dim,points.data(),num_points);
+    REQUIRE(tree.isCorrect());
+    std::vector<unsigned int> indices(num_points);
+    tree.getAllIndices(indices.data());
+    std::sort(indices.begin(),indices.end());
+    for(unsigned int i = 0; i < num_points; ++i){
+      REQUIRE(indices[i] == i);
+    }
+
+    //theta == 0 opens every node, the result is exact
+    for(unsigned int i = 0; i < num_points; ++i){
+      std::vector<double> neg_f(dim,0);
+      double sum_Q = 0;
+      tree.computeNonEdgeForcesOMP(i,0,neg_f.data(),sum_Q);
+      REQUIRE(sum_Q == Approx(sum_Q_exact[i]));
+      for(unsigned int d = 0; d < dim; ++d){
+        REQUIRE(neg_f[d] == Approx(neg_f_exact[i*dim+d]).margin(1e-9));
+      }
+    }
+
+    //with theta > 0 the normalization is approximated
+    double sum_Q = 0, sum_Q_bh = 0;
+    for(unsigned int i = 0; i < num_points; ++i){
+      std::vector<double> neg_f(dim,0);
+      tree.computeNonEdgeForcesOMP(i,0.5,neg_f.data(),sum_Q_bh);
+      sum_Q += sum_Q_exact[i];
+    }
+    REQUIRE(sum_Q_bh == Approx(sum_Q).epsilon(0.1));
+  }
+}
+
+TEST_CASE( "SPTree - non-edge forces", "[sptree]" ) {
+  SECTION("2D"){
+    testNonEdgeForces<float>(2);
+  }
+  SECTION("3D"){
+    testNonEdgeForces<float>(3);
+  }
+  SECTION("2D - double"){
+    testNonEdgeForces<double>(2);
+  }
+  SECTION("4D"){ //not built from Morton codes
+    testNonEdgeForces<float>(4);
+  }
+}
+
+TEST_CASE( "SPTree - weighted tree", "[sptree]" ) {
+  const unsigned int dim = 2;
+  const unsigned int num_points = 1000;
+  std::vector<float> points;
+  generatePoints(num_points,dim,points);
+  std::vector<float> weights(num_points), unit_weights(num_points,1);
+  std::default_random_engine generator(5);
+  std::uniform_real_distribution<float> distribution(0.5,3);
+  for(auto& w: weights){
+    w = distribution(generator);
+  }
+
+  hdi::dr::SPTree<float> tree(dim,points.data(),num_points);
+  hdi::dr::WeightedSPTree<float> unit_weighted_tree(dim,points.data(),unit_weights.data(),num_points);
+  hdi::dr::WeightedSPTree<float> weighted_tree(dim,points.data(),weights.data(),num_points);
+  REQUIRE(weighted_tree.isCorrect());
+  REQUIRE(weighted_tree.getDepth() == tree.getDepth());
+
+  for(unsigned int i = 0; i < num_points; ++i){
+    //unit weights are equivalent to the unweighted tree
+    double f[dim] = {0,0}, unit_f[dim] = {0,0};
+    double sum_Q = 0, unit_sum_Q = 0;
+    tree.computeNonEdgeForcesOMP(i,0.5,f,sum_Q);
+    unit_weighted_tree.computeNonEdgeForces(i,0.5,unit_f,unit_sum_Q);
+    REQUIRE(sum_Q == Approx(unit_sum_Q));
+    REQUIRE(f[0] == Approx(unit_f[0]));
+    REQUIRE(f[1] == Approx(unit_f[1]));
+
+    //with theta == 0 the forces are exact
+    double exact_f[dim] = {0,0}, weighted_f[dim] = {0,0};
+    double exact_sum_Q = 0, weighted_sum_Q = 0;
+    for(unsigned int j = 0; j < num_points; ++j){
+      if(i == j){
+        continue;
+      }
+      const double diff[dim] = {double(points[i*dim])-points[j*dim], double(points[i*dim+1])-points[j*dim+1]};
+      const double q = 1./(1.+diff[0]*diff[0]+diff[1]*diff[1]);
+      exact_sum_Q += weights[i]*weights[j]*q;
+      exact_f[0] += weights[i]*weights[j]*q*q*diff[0];
+      exact_f[1] += weights[i]*weights[j]*q*q*diff[1];
+    }
+    weighted_tree.computeNonEdgeForces(i,0,weighted_f,weighted_sum_Q);
+    REQUIRE(weighted_sum_Q == Approx(exact_sum_Q));
+    REQUIRE(weighted_f[0] == Approx(exact_f[0]).epsilon(1e-4).margin(1e-9));
+    REQUIRE(weighted_f[1] == Approx(exact_f[1]).epsilon(1e-4).margin(1e-9));
+  }
+}
+
+TEST_CASE( "SPTree - rebuild and duplicated points", "[sptree]" ) {
+  const unsigned int dim = 2;
+  const unsigned int num_points = 20000;
+  std::vector<float> points;
+  generatePoints(num_points,dim,points);
+  for(unsigned int i = 0; i < 100; ++i){
+    for(unsigned int d = 0; d < dim; ++d){
+      points[(num_points-1-i)*dim+d] = points[i*dim+d];
+    }
+  }
+
+  //a tree that is rebuilt reuses its storage and produces the same forces of a new tree
+  hdi::dr::SPTree<float> tree(dim,points.data(),num_points/2);
+  tree.build(dim,points.data(),num_points);
+  hdi::dr::SPTree<float> new_tree(dim,points.data(),num_points);
+  REQUIRE(tree.isCorrect());
+  REQUIRE(tree.getNumberOfNodes() == new_tree.getNumberOfNodes());
+  REQUIRE(tree.getDepth() == new_tree.getDepth());
+
+  //duplicated points are stored in the same leaf, hence they are listed once
+  std::vector<unsigned int> indices(num_points,num_points);
+  tree.getAllIndices(indices.data());
+  REQUIRE(std::count(indices.begin(),indices.end(),num_points) == 100);
+  REQUIRE(std::count(indices.begin(),indices.end(),0u) == 1);
+  REQUIRE(std::count(indices.begin(),indices.end(),num_points-1) == 0);
+
+  for(unsigned int i = 0; i < num_points; i += 7){
+    double f[dim] = {0,0}, new_f[dim] = {0,0};
+    double sum_Q = 0, new_sum_Q = 0;
+    tree.computeNonEdgeForcesOMP(i,0.5,f,sum_Q);
+    new_tree.computeNonEdgeForcesOMP(i,0.5,new_f,new_sum_Q);
+    REQUIRE(sum_Q == new_sum_Q);
+    REQUIRE(f[0] == new_f[0]);
+    REQUIRE(f[1] == new_f[1]);
+  }
+
+  hdi::utils::CoutLog log;
+  double time = 0;
+  {
+    hdi::utils::ScopedTimer<double> timer(time);
+    for(int i = 0; i < 10; ++i){
+      tree.build(dim,points.data(),num_points);
+    }
+  }
+  hdi::utils::secureLogValue(&log,"SPTree construction (ms)",time/10);
+}
+
+TEST_CASE( "SPTree - leaves with several points", "[sptree]" ) {
+  const unsigned int dim = 3;
+  const unsigned int num_points = 1000;
+  std::vector<float> points;
+  generatePoints(num_points,dim,points);
+  //Groups of distinct points closer than the resolution of the 21-bit Morton codes, and a group of duplicates
+  for(unsigned int i = 0; i < 100; ++i){
+    for(unsigned int d = 0; d < dim; ++d){
+      points[i*dim+d] = 1.f + (i/10) + ((i%10 < 5) ? 2e-6f*(i%10)*(d+1) : 0.f);
+    }
+  }
+  std::vector<double> neg_f_exact, sum_Q_exact;
+  exactNonEdgeForces(num_points,dim,points,neg_f_exact,sum_Q_exact);
+
+  std::vector<float> weights(num_points,1), other_weights(num_points,1);
+  hdi::dr::SPTree<float> tree(dim,points.data(),num_points);
+  hdi::dr::WeightedSPTree<float> weighted_tree(dim,points.data(),weights.data(),num_points);
+  REQUIRE(tree.isCorrect());
+  std::vector<unsigned int> indices(num_points,num_points);
+  tree.getAllIndices(indices.data());
+  REQUIRE(std::count(indices.begin(),indices.end(),num_points) > 0);
+
+  //The weights are forwarded to the tree, the original ones are not read anymore
+  weighted_tree.setData(points.data(),other_weights.data());
+  std::fill(weights.begin(),weights.end(),-1.f);
+
+  //theta == 0 opens every node, every point interacts with all the others but not with itself
+  for(unsigned int i = 0; i < num_points; ++i){
+    double neg_f[dim] = {0,0,0}, weighted_f[dim] = {0,0,0};
+    double sum_Q = 0, weighted_sum_Q = 0;
+    tree.computeNonEdgeForcesOMP<dim>(i,0,neg_f,sum_Q);
+    weighted_tree.computeNonEdgeForces<dim>(i,0,weighted_f,weighted_sum_Q);
+    REQUIRE(sum_Q == Approx(sum_Q_exact[i]));
+    REQUIRE(weighted_sum_Q == Approx(sum_Q_exact[i]));
+    for(unsigned int d = 0; d < dim; ++d){
+      REQUIRE(neg_f[d] == Approx(neg_f_exact[i*dim+d]).margin(1e-9));
+      REQUIRE(weighted_f[d] == Approx(neg_f_exact[i*dim+d]).margin(1e-9));
+    }
+  }
+}
+
+namespace{
+  //The kernels specialized on the dimensionality must produce the same forces of the generic ones
+  template <unsigned int D>
+  void checkSpecializedKernels(unsigned int num_points){
+    std::vector<float> points;
+    generatePoints(num_points,D,points);
+    hdi::dr::SPTree<float> tree(D,points.data(),num_points);
+    REQUIRE(tree.isCorrect());
+
+    std::vector<double> f(D), generic_f(D);
+    for(unsigned int i = 0; i < num_points; i += 11){
+      double sum_Q = 0, generic_sum_Q = 0;
+      std::fill(f.begin(),f.end(),0);
+      std::fill(generic_f.begin(),generic_f.end(),0);
+      tree.computeNonEdgeForcesOMP<D>(i,0.5,f.data(),sum_Q);
+      tree.computeNonEdgeForcesOMP<0>(i,0.5,generic_f.data(),generic_sum_Q);
+      REQUIRE(std::abs(sum_Q-generic_sum_Q) <= 1e-12*std::abs(generic_sum_Q));
+      for(unsigned int d = 0; d < D; ++d){
+        REQUIRE(std::abs(f[d]-generic_f[d]) <= 1e-12*(1+std::abs(generic_f[d])));
+      }
+    }
+
+    std::vector<std::map<unsigned int,float>> matrix(num_points);
+    for(unsigned int i = 0; i < num_points; ++i){
+      for(unsigned int k = 1; k < 8; ++k){
+        matrix[i][(i+k*k)%num_points] = 1.f/k;
+      }
+    }
+    std::vector<double> pos_f(size_t(num_points)*D,0), generic_pos_f(size_t(num_points)*D,0);
+    tree.computeEdgeForces<D>(matrix,2,pos_f.data());
+    tree.computeEdgeForces<0>(matrix,2,generic_pos_f.data());
+    for(size_t i = 0; i < pos_f.size(); ++i){
+      REQUIRE(std::abs(pos_f[i]-generic_pos_f[i]) <= 1e-12*(1+std::abs(generic_pos_f[i])));
+    }
+  }
+}
+
+TEST_CASE( "SPTree - dimension specialized kernels", "[sptree]" ) {
+  SECTION("1D"){
+    checkSpecializedKernels<1>(3000);
+  }
+  SECTION("2D"){
+    checkSpecializedKernels<2>(3000);
+  }
+  SECTION("3D"){
+    checkSpecializedKernels<3>(3000);
+  }
+}
+
+namespace{
+  //Relative error of the normalized repulsive forces
+  template <unsigned int D>
+  void testDualTreeNonEdgeForces(){
+    const unsigned int num_points = 1500;
+    std::vector<float> points;
+    generatePoints(num_points,D,points);
+    std::vector<double> neg_f_exact, sum_Q_exact;
+    exactNonEdgeForces(num_points,D,points,neg_f_exact,sum_Q_exact);
+    double total_sum_Q_exact = 0;
+    for(auto v: sum_Q_exact){
+      total_sum_Q_exact += v;
+    }
+
+    hdi::dr::SPTree<float> tree(D,points.data(),num_points);
+
+    //theta == 0 splits the cells down to the leaves, the result is exact
+    std::vector<double> neg_f(size_t(num_points)*D,0);
+    double sum_Q = 0;
+    tree.computeDualTreeNonEdgeForces<D>(0,neg_f.data(),sum_Q);
+    REQUIRE(sum_Q == Approx(total_sum_Q_exact));
+    for(size_t i = 0; i < neg_f.size(); ++i){
+      REQUIRE(neg_f[i] == Approx(neg_f_exact[i]).margin(1e-9));
+    }
+
+    //the generic kernel produces the same result
+    std::vector<double> generic_neg_f(size_t(num_points)*D,0);
+    double generic_sum_Q = 0;
+    tree.computeDualTreeNonEdgeForces<0>(0.5,generic_neg_f.data(),generic_sum_Q);
+    std::fill(neg_f.begin(),neg_f.end(),0);
+    sum_Q = 0;
+    tree.computeDualTreeNonEdgeForces<D>(0.5,neg_f.data(),sum_Q);
+    REQUIRE(sum_Q == Approx(generic_sum_Q).epsilon(1e-12));
+
+    //with theta > 0 the approximation is comparable with the one of the traversal per point
+    const double dual_tree_error = repulsionError(neg_f,sum_Q,neg_f_exact,total_sum_Q_exact);
+    std::vector<double> bh_neg_f(size_t(num_points)*D,0);
+    double bh_sum_Q = 0;
+    for(unsigned int i = 0; i < num_points; ++i){
+      tree.computeNonEdgeForcesOMP<D>(i,0.5,bh_neg_f.data()+size_t(i)*D,bh_sum_Q);
+    }
+    const double bh_error = repulsionError(bh_neg_f,bh_sum_Q,neg_f_exact,total_sum_Q_exact);
+    REQUIRE(sum_Q == Approx(total_sum_Q_exact).epsilon(0.1));
+    REQUIRE(dual_tree_error < bh_error);
+
+    hdi::utils::CoutLog log;
+    hdi::utils::secureLogValue(&log,"Relative error of the repulsive forces, traversal per point",bh_error);
+    hdi::utils::secureLogValue(&log,"Relative error of the repulsive forces, dual-tree",dual_tree_error);
+  }
+
+  template <unsigned int D>
+  void compareRepulsionEngines(unsigned int num_points, double theta){
+    std::vector<float> points;
+    generatePoints(num_points,D,points);
+    hdi::dr::SPTree<float> tree(D,points.data(),num_points);
+    std::vector<double> neg_f(size_t(num_points)*D,0), dual_tree_neg_f(size_t(num_points)*D,0);
+    std::vector<double> sum_Q_subvalues(num_points,0);
+    double sum_Q = 0, dual_tree_sum_Q = 0;
+
+    double time = 0, dual_tree_time = 0;
+    {
+      hdi::utils::ScopedTimer<double> timer(time);
+#pragma omp parallel for
+      for(int i = 0; i < int(num_points); ++i){
+        tree.computeNonEdgeForcesOMP<D>(i,theta,neg_f.data()+size_t(i)*D,sum_Q_subvalues[i]);
+      }
+      for(auto v: sum_Q_subvalues){
+        sum_Q += v;
+      }
+    }
+    {
+      hdi::utils::ScopedTimer<double> timer(dual_tree_time);
+      tree.computeDualTreeNonEdgeForces<D>(theta,dual_tree_neg_f.data(),dual_tree_sum_Q);
+    }
+    REQUIRE(dual_tree_sum_Q == Approx(sum_Q).epsilon(0.1));
+    REQUIRE(repulsionError(dual_tree_neg_f,dual_tree_sum_Q,neg_f,sum_Q) < 0.25);
+
+    hdi::utils::CoutLog log;
+    hdi::utils::secureLogValue(&log,"Repulsive forces, traversal per point (ms)",time);
+    hdi::utils::secureLogValue(&log,"Repulsive forces, dual-tree (ms)",dual_tree_time);
+  }
+}
+
+TEST_CASE( "SPTree - dual-tree non-edge forces", "[sptree]" ) {
+  SECTION("2D"){
+    testDualTreeNonEdgeForces<2>();
+    compareRepulsionEngines<2>(100000,0.5);
+  }
+  SECTION("3D"){
+    testDualTreeNonEdgeForces<3>();
+    compareRepulsionEngines<3>(50000,0.5);
+  }
+}
+
+TEST_CASE( "SPTree - edge-balanced attractive forces", "[sptree]" ) {
+  const unsigned int num_points = 5000;
+  const unsigned int D = 2;
+  const double scale = 9;
+  std::vector<float> points;
+  generatePoints(num_points,D,points);
+
+  //Heavy-tailed degree distribution: a few hubs connected to most of the points, some empty rows
+  std::default_random_engine generator(5);
+  std::uniform_int_distribution<unsigned int> distribution_int(0,num_points-1);
+  std::vector<std::map<unsigned int,float>> matrix(num_points);
+  for(unsigned int i = 0; i < num_points; ++i){
+    if(i%7 == 3){
+      continue;
+    }
+    const unsigned int num_edges = (i%1000 == 0) ? 4000 : 5;
+    for(unsigned int k = 0; k < num_edges; ++k){
+      const unsigned int j = distribution_int(generator);
+      if(j != i){
+        matrix[i][j] = 1.f/(1+k%13);
+      }
+    }
+  }
+  hdi::data::SparseMatrixCSR<unsigned int,float> matrix_csr(matrix);
+
+  std::vector<double> expected_f(size_t(num_points)*D,0);
+  for(unsigned int i = 0; i < num_points; ++i){
+    for(auto& e: matrix[i]){
+      double q_ij_1 = 1;
+      for(unsigned int d = 0; d < D; ++d){
+        const double diff = double(points[i*D+d]) - points[e.first*D+d];
+        q_ij_1 += diff*diff;
+      }
+      for(unsigned int d = 0; d < D; ++d){
+        expected_f[i*D+d] += e.second * scale / q_ij_1 / num_points * (double(points[i*D+d]) - points[e.first*D+d]);
+      }
+    }
+  }
+
+  hdi::dr::SPTree<float> tree(D,points.data(),num_points);
+  std::vector<float> weights(num_points,1);
+  hdi::dr::WeightedSPTree<float> weighted_tree(D,points.data(),weights.data(),num_points);
+  std::vector<double> f_map(expected_f.size(),0), f_generic(expected_f.size(),0), f_csr(expected_f.size(),0), f_csr_generic(expected_f.size(),0), f_weighted(expected_f.size(),0);
+  tree.computeEdgeForces<D>(matrix,scale,f_map.data());
+  tree.computeEdgeForces<0>(matrix,scale,f_generic.data());
+  tree.computeEdgeForces<D>(matrix_csr,scale,f_csr.data());
+  tree.computeEdgeForces<0>(matrix_csr,scale,f_csr_generic.data());
+  weighted_tree.computeEdgeForces<D>(matrix_csr,scale,f_weighted.data());
+
+  for(size_t i = 0; i < expected_f.size(); ++i){
+    const double tolerance = 1e-9*(1+std::abs(expected_f[i]));
+    REQUIRE(std::abs(f_map[i]-expected_f[i]) <= tolerance);
+    REQUIRE(std::abs(f_generic[i]-expected_f[i]) <= tolerance);
+    REQUIRE(std::abs(f_csr[i]-expected_f[i]) <= tolerance);
+    REQUIRE(std::abs(f_csr_generic[i]-expected_f[i]) <= tolerance);
+    REQUIRE(std::abs(f_weighted[i]-expected_f[i]) <= tolerance);
+  }
+
+  //Forces are added to pos_f
+  tree.computeEdgeForces<D>(matrix_csr,scale,f_csr.data());
+  for(size_t i = 0; i < expected_f.size(); ++i){
+    REQUIRE(std::abs(f_csr[i]-2*expected_f[i]) <= 2e-9*(1+std::abs(expected_f[i])));
+  }
+}
+
+namespace{
+  template <typename sparse_scalar_matrix>
+  void testSymmetricEdgeForces(const sparse_scalar_matrix& upper, const hdi::dr::SPTree<float>& tree, const std::vector<double>& expected_f, double scale){
+    const unsigned int D = 2;
+    std::vector<double> f(expected_f.size(),0), f_generic(expected_f.size(),0);
+    tree.computeSymmetricEdgeForces<D>(upper,scale,f.data());
+    tree.computeSymmetricEdgeForces<0>(upper,scale,f_generic.data());
+    for(size_t i = 0; i < expected_f.size(); ++i){
+      const double tolerance = 1e-9*(1+std::abs(expected_f[i]));
+      REQUIRE(std::abs(f[i]-expected_f[i]) <= tolerance);
+      REQUIRE(std::abs(f_generic[i]-expected_f[i]) <= tolerance);
+    }
+  }
+}
+
+TEST_CASE( "SPTree - symmetric attractive forces", "[sptree]" ) {
+  const unsigned int num_points = 5000;
+  const unsigned int D = 2;
+  const double scale = 9;
+  std::vector<float> points;
+  generatePoints(num_points,D,points);
+
+  //Symmetric matrix with a few hubs, the first one in the first row, and some empty rows
+  std::default_random_engine generator(9);
+  std::uniform_int_distribution<unsigned int> distribution_int(0,num_points-1);
+  std::vector<std::map<unsigned int,float>> matrix(num_points);
+  for(unsigned int i = 0; i < num_points; ++i){
+    if(i%7 == 3){
+      continue;
+    }
+    const unsigned int num_edges = (i%1000 == 0) ? 4000 : 5;
+    for(unsigned int k = 0; k < num_edges; ++k){
+      const unsigned int j = distribution_int(generator);
+      if(j != i && j%7 != 3){
+        matrix[i][j] = matrix[j][i] = 1.f/(1+k%13);
+      }
+    }
+  }
+  std::vector<std::map<unsigned int,float>> upper(num_points);
+  std::vector<std::unordered_map<unsigned int,float>> upper_unordered(num_points);
+  for(unsigned int i = 0; i < num_points; ++i){
+    for(auto& e: matrix[i]){
+      if(e.first > i){
+        upper[i][e.first] = upper_unordered[i][e.first] = e.second;
+      }
+    }
+  }
+  hdi::data::SparseMatrixCSR<unsigned int,float> upper_csr(upper);
+
+  hdi::dr::SPTree<float> tree(D,points.data(),num_points);
+  std::vector<double> expected_f(size_t(num_points)*D,0);
+  tree.computeEdgeForces<D>(matrix,scale,expected_f.data());
+
+  SECTION("std::map"){
+    testSymmetricEdgeForces(upper,tree,expected_f,scale);
+  }
+  SECTION("std::unordered_map"){
+    testSymmetricEdgeForces(upper_unordered,tree,expected_f,scale);
+  }
+  SECTION("SparseMatrixCSR"){
+    testSymmetricEdgeForces(upper_csr,tree,expected_f,scale);
+  }
+}
+
+namespace{
+  //Single-precision nodes must give the forces of the double-precision ones up to the single-precision rounding
+  template <unsigned int D>
+  void testSinglePrecisionNodes(){
+    const unsigned int num_points = 1500;
+    std::vector<float> points;
+    generatePoints(num_points,D,points);
+    std::vector<double> neg_f_exact, sum_Q_exact;
+    exactNonEdgeForces(num_points,D,points,neg_f_exact,sum_Q_exact);
+
+    hdi::dr::SPTree<float> tree(D,points.data(),num_points);
+    hdi::dr::SPTree<float,float> tree_single(D,points.data(),num_points);
+    REQUIRE(tree_single.isCorrect());
+    REQUIRE(tree_single.getNumberOfNodes() == tree.getNumberOfNodes());
+    REQUIRE(tree_single.memoryOccupation() < tree.memoryOccupation());
+
+    //theta == 0 opens every node, the totals of the point are compensated
+    for(unsigned int i = 0; i < num_points; ++i){
+      std::vector<double> neg_f(D,0);
+      double sum_Q = 0;
+      tree_single.computeNonEdgeForcesOMP<D>(i,0,neg_f.data(),sum_Q);
+      REQUIRE(sum_Q == Approx(sum_Q_exact[i]).epsilon(1e-5));
+      for(unsigned int d = 0; d < D; ++d){
+        REQUIRE(neg_f[d] == Approx(neg_f_exact[i*D+d]).epsilon(1e-4).margin(1e-7));
+      }
+    }
+
+    //Barnes-Hut and dual-tree approximations
+    std::vector<double> neg_f(num_points*D,0), neg_f_single(num_points*D,0), neg_f_generic(num_points*D,0);
+    double sum_Q = 0, sum_Q_single = 0, sum_Q_generic = 0;
+    for(unsigned int i = 0; i < num_points; ++i){
+      tree.computeNonEdgeForcesOMP<D>(i,0.5,neg_f.data()+i*D,sum_Q);
+      tree_single.computeNonEdgeForcesOMP<D>(i,0.5,neg_f_single.data()+i*D,sum_Q_single);
+      tree_single.computeNonEdgeForcesOMP<0>(i,0.5,neg_f_generic.data()+i*D,sum_Q_generic);
+    }
+    REQUIRE(sum_Q_single == Approx(sum_Q).epsilon(1e-5));
+    REQUIRE(repulsionError(neg_f_single,sum_Q_single,neg_f,sum_Q) < 1e-4);
+    REQUIRE(repulsionError(neg_f_generic,sum_Q_generic,neg_f,sum_Q) < 1e-4);
+
+    std::fill(neg_f.begin(),neg_f.end(),0);
+    std::fill(neg_f_single.begin(),neg_f_single.end(),0);
+    sum_Q = sum_Q_single = 0;
+    tree.computeDualTreeNonEdgeForces<D>(0.5,neg_f.data(),sum_Q);
+    tree_single.computeDualTreeNonEdgeForces<D>(0.5,neg_f_single.data(),sum_Q_single);
+    REQUIRE(sum_Q_single == Approx(sum_Q).epsilon(1e-4));
+    REQUIRE(repulsionError(neg_f_single,sum_Q_single,neg_f,sum_Q) < 1e-3);
+  }
+}
+
+TEST_CASE( "SPTree - single-precision nodes", "[sptree]" ) {
+  SECTION("1D"){
+    testSinglePrecisionNodes<1>();
+  }
+  SECTION("2D"){
+    testSinglePrecisionNodes<2>();
+  }
+  SECTION("3D"){
+    testSinglePrecisionNodes<3>();
+  }
+}
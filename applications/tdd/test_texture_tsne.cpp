@@ -0,0 +1,188 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+#include "catch.hpp"
+#include "hdi/utils/cout_log.h"
+#include "hdi/utils/log_helper_functions.h"
+#include "hdi/dimensionality_reduction/gradient_descent_tsne_texture.h"
+#include "hdi/dimensionality_reduction/gpgpu_sne/cpu_sne_compute.h"
+#include <random>
+#include <cmath>
+
+namespace{
+  typedef hdi::data::SparseMatrixCSR<uint32_t,float> csr_matrix_type;
+
+  //Clustered 2D embedding and a joint-probability distribution connecting each point to random points of its cluster
+  void generateClusters(unsigned int num_points, unsigned int num_clusters, float stddev, std::vector<float>& points, csr_matrix_type& P){
+    std::default_random_engine generator(5);
+    std::normal_distribution<float> distribution(0,stddev);
+    std::uniform_int_distribution<unsigned int> distribution_int(0,num_points/num_clusters-1);
+    points.resize(num_points*2);
+    std::vector<hdi::data::MapMemEff<uint32_t,float>> joint(num_points);
+    for(unsigned int i = 0; i < num_points; ++i){
+      const unsigned int cluster = i%num_clusters;
+      points[i*2+0] = distribution(generator) + 4.f*cluster;
+      points[i*2+1] = distribution(generator);
+      for(int k = 0; k < 10; ++k){
+        const unsigned int j = distribution_int(generator)*num_clusters + cluster;
+        if(j != i && j < num_points){
+          joint[i][j] = 0.1f;
+          joint[j][i] = 0.1f;
+        }
+      }
+    }
+    P.assign(joint);
+  }
+
+  //Gradient computed on all pairs, with the normalization of the attractive forces used by the texture-based t-SNE
+  void exactGradient(unsigned int num_points, const std::vector<float>& points, const csr_matrix_type& P, std::vector<double>& gradient){
+    std::vector<double> neg_f(num_points*2,0);
+    double sum_Q = 0;
+    for(unsigned int i = 0; i < num_points; ++i){
+      for(unsigned int j = 0; j < num_points; ++j){
+        if(i == j){
+          continue;
+        }
+        const double dx = double(points[i*2+0]) - points[j*2+0];
+        const double dy = double(points[i*2+1]) - points[j*2+1];
+        const double q = 1./(1.+dx*dx+dy*dy);
+        sum_Q += q;
+        neg_f[i*2+0] += q*q*dx;
+        neg_f[i*2+1] += q*q*dy;
+      }
+    }
+    gradient.assign(num_points*2,0);
+    for(unsigned int i = 0; i < num_points; ++i){
+      double pos_x = 0, pos_y = 0;
+      for(auto& e: P[i]){
+        const double dx = double(points[i*2+0]) - points[e.first*2+0];
+        const double dy = double(points[i*2+1]) - points[e.first*2+1];
+        const double q = 1./(1.+dx*dx+dy*dy);
+        pos_x += e.second*q*dx/num_points;
+        pos_y += e.second*q*dy/num_points;
+      }
+      gradient[i*2+0] = 4*(pos_x - neg_f[i*2+0]/sum_Q);
+      gradient[i*2+1] = 4*(pos_y - neg_f[i*2+1]/sum_Q);
+    }
+  }
+
+  //Relative error of the first gradient descent step of CpuSneCompute with respect to the exact gradient
+  double firstStepError(unsigned int num_points, const std::vector<float>& points, const csr_matrix_type& P, float resolution_factor){
+    hdi::dr::TsneParameters params;
+    params._eta = 1;
+    hdi::data::Embedding<float> embedding(2,num_points);
+    embedding.getContainer() = points;
+
+    hdi::dr::CpuSneCompute cpu_tsne;
+    cpu_tsne.setScalingFactor(resolution_factor);
+    cpu_tsne.initialize(&embedding,params,P);
+    cpu_tsne.compute(&embedding,1,params._mom_switching_iter,1);
+
+    //First step: the gain is increased to 1.2 and the embedding is centered
+    std::vector<double> gradient;
+    exactGradient(num_points,points,P,gradient);
+    std::vector<double> expected(num_points*2);
+    double min_x = 1e30, max_x = -1e30, min_y = 1e30, max_y = -1e30;
+    for(unsigned int i = 0; i < num_points; ++i){
+      expected[i*2+0] = points[i*2+0] - 1.2*gradient[i*2+0];
+      expected[i*2+1] = points[i*2+1] - 1.2*gradient[i*2+1];
+      min_x = std::min(min_x,expected[i*2+0]); max_x = std::max(max_x,expected[i*2+0]);
+      min_y = std::min(min_y,expected[i*2+1]); max_y = std::max(max_y,expected[i*2+1]);
+    }
+    double error = 0, norm = 0;
+    for(unsigned int i = 0; i < num_points; ++i){
+      const double ex = expected[i*2+0] - (min_x+max_x)/2;
+      const double ey = expected[i*2+1] - (min_y+max_y)/2;
+      error += (embedding.getContainer()[i*2+0]-ex)*(embedding.getContainer()[i*2+0]-ex) + (embedding.getContainer()[i*2+1]-ey)*(embedding.getContainer()[i*2+1]-ey);
+      norm += 1.44*(gradient[i*2+0]*gradient[i*2+0] + gradient[i*2+1]*gradient[i*2+1]);
+    }
+    return std::sqrt(error/norm);
+  }
+}
+
+TEST_CASE( "Texture tSNE - CPU fields match the exact gradient", "[algorithms_embedding]" ) {
+  const unsigned int num_points = 1000;
+  std::vector<float> points;
+  csr_matrix_type P;
+  generateClusters(num_points,3,1.5f,points,P);
+
+  const double error = firstStepError(num_points,points,P,2);
+  const double error_fine = firstStepError(num_points,points,P,8);
+  hdi::utils::CoutLog log;
+  hdi::utils::secureLogValue(&log,"Gradient error (2 pixels per unit)",error);
+  hdi::utils::secureLogValue(&log,"Gradient error (8 pixels per unit)",error_fine);
+  REQUIRE(error < 0.1);
+  REQUIRE(error_fine < error);
+}
+
+TEST_CASE( "Texture tSNE - CPU fallback without OpenGL context", "[algorithms_embedding]" ) {
+  const unsigned int num_points = 1500;
+  std::vector<float> points;
+  csr_matrix_type P;
+  generateClusters(num_points,3,1.5f,points,P);
+
+  hdi::dr::TsneParameters params;
+  params._seed = 1;
+  hdi::data::Embedding<float> embedding;
+  hdi::dr::GradientDescentTSNETexture tsne;
+  tsne.initializeWithJointProbabilityDistribution(P,&embedding,params);
+  REQUIRE(tsne.isCpuFallback());
+
+  const double initial_kl = tsne.computeKullbackLeiblerDivergence();
+  for(int iter = 0; iter < 600; ++iter){
+    tsne.doAnIteration();
+  }
+  const double final_kl = tsne.computeKullbackLeiblerDivergence();
+  hdi::utils::CoutLog log;
+  hdi::utils::secureLogValue(&log,"KL divergence (initial)",initial_kl);
+  hdi::utils::secureLogValue(&log,"KL divergence (final)",final_kl);
+  for(auto v: embedding.getContainer()){
+    REQUIRE(std::isfinite(v));
+  }
+  REQUIRE(final_kl < 0.8*initial_kl);
+
+  //The three clusters are separated
+  std::vector<double> center(6,0);
+  for(unsigned int i = 0; i < num_points; ++i){
+    center[(i%3)*2+0] += embedding.getContainer()[i*2+0]/(num_points/3);
+    center[(i%3)*2+1] += embedding.getContainer()[i*2+1]/(num_points/3);
+  }
+  double spread = 0;
+  for(unsigned int i = 0; i < num_points; ++i){
+    spread = std::max<double>(spread,std::hypot(embedding.getContainer()[i*2+0]-center[(i%3)*2+0],embedding.getContainer()[i*2+1]-center[(i%3)*2+1]));
+  }
+  for(int a = 0; a < 3; ++a){
+    for(int b = a+1; b < 3; ++b){
+      REQUIRE(std::hypot(center[a*2]-center[b*2],center[a*2+1]-center[b*2+1]) > 4*spread);
+    }
+  }
+}
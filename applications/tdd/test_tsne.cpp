@@ -36,6 +36,16 @@
 #include "hdi/dimensionality_reduction/tsne.h"
 #include "hdi/utils/cout_log.h"
 #include "hdi/data/embedding.h"
+#include "hdi/dimensionality_reduction/sparse_tsne_user_def_probabilities.h"
+#include "hdi/dimensionality_reduction/gradient_descent_utils.h"
+#include "hdi/dimensionality_reduction/exact_repulsion.h"
+#include "hdi/data/map_mem_eff.h"
+#include "hdi/data/sparse_matrix_csr.h"
+#include <random>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <limits>
 
 
 template <typename scalar_type>
@@ -103,3 +113,685 @@ TEST_CASE( "tSNE - double", "[algorithms_embedding]" ) {
   typedef double scalar_type;
   test_tsne<scalar_type>();
 }
+
+template <typename sparse_scalar_matrix>
+void test_symmetric_storage(){
+  typedef hdi::dr::SparseTSNEUserDefProbabilities<float,sparse_scalar_matrix> tsne_type;
+  const unsigned int num_dps = 2000;
+  std::vector<hdi::data::MapMemEff<uint32_t,float>> conditional(num_dps);
+  std::default_random_engine generator(7);
+  std::uniform_int_distribution<unsigned int> distribution_int(0,num_dps-1);
+  for(unsigned int i = 0; i < num_dps; ++i){
+    for(int k = 0; k < 20; ++k){
+      const unsigned int j = distribution_int(generator);
+      if(j != i){
+        conditional[i][j] = 0.05;
+      }
+    }
+  }
+  sparse_scalar_matrix probabilities(conditional);
+
+  hdi::dr::TsneParameters params;
+  params._seed = 3;
+  hdi::data::Embedding<float> embedding, embedding_sym;
+  tsne_type tsne, tsne_sym;
+  tsne.setTheta(0.5);
+  tsne_sym.setTheta(0.5);
+  tsne.initialize(probabilities,&embedding,params);
+  params._symmetric_storage = true;
+  tsne_sym.initialize(probabilities,&embedding_sym,params);
+
+  size_t num_elem = 0, num_elem_sym = 0;
+  for(unsigned int i = 0; i < num_dps; ++i){
+    num_elem += tsne.getDistributionP()[i].size();
+    num_elem_sym += tsne_sym.getDistributionP()[i].size();
+    for(auto& e: tsne_sym.getDistributionP()[i]){
+      REQUIRE(e.first > i);
+    }
+  }
+  REQUIRE(num_elem == 2*num_elem_sym);
+
+  for(int it = 0; it < 50; ++it){
+    tsne.doAnIteration();
+    tsne_sym.doAnIteration();
+  }
+  for(unsigned int i = 0; i < num_dps; ++i){
+    REQUIRE(embedding.dataAt(i,0) == Approx(embedding_sym.dataAt(i,0)).epsilon(1e-3));
+    REQUIRE(embedding.dataAt(i,1) == Approx(embedding_sym.dataAt(i,1)).epsilon(1e-3));
+  }
+}
+
+template <typename scalar_type>
+void test_gradient_descent_step(unsigned int dim){
+  const unsigned int num_points = 10000; //more than two chunks
+  const double eta = 200, minimum_gain = 0.1, momentum = 0.5, mult = 1;
+  std::default_random_engine generator(13);
+  std::normal_distribution<scalar_type> distribution(0,1);
+  std::vector<scalar_type> gradient(num_points*dim), previous_gradient(num_points*dim), gain(num_points*dim);
+  hdi::data::Embedding<scalar_type> embedding(dim,num_points);
+  for(size_t i = 0; i < gradient.size(); ++i){
+    gradient[i] = distribution(generator)*scalar_type(1e-3);
+    previous_gradient[i] = (i%7 == 0)?0:distribution(generator)*scalar_type(1e-3);
+    gain[i] = (i%5 == 0)?scalar_type(0.11):std::abs(distribution(generator))+scalar_type(0.1);
+    embedding.getContainer()[i] = distribution(generator);
+  }
+
+  //Reference: serial update followed by the bounding box of the embedding
+  std::vector<scalar_type> ref_previous_gradient(previous_gradient), ref_gain(gain);
+  hdi::data::Embedding<scalar_type> ref_embedding(embedding);
+  for(size_t i = 0; i < gradient.size(); ++i){
+    const bool same_sign = (gradient[i] > 0) == (ref_previous_gradient[i] > 0) && (gradient[i] < 0) == (ref_previous_gradient[i] < 0);
+    ref_gain[i] = static_cast<scalar_type>(same_sign?(ref_gain[i]*.8):(ref_gain[i]+.2));
+    if(ref_gain[i] < minimum_gain){
+      ref_gain[i] = static_cast<scalar_type>(minimum_gain);
+    }
+    ref_previous_gradient[i] = static_cast<scalar_type>(momentum*ref_previous_gradient[i] - eta*ref_gain[i]*gradient[i]);
+    ref_embedding.getContainer()[i] += static_cast<scalar_type>(ref_previous_gradient[i]*mult);
+  }
+  std::vector<scalar_type> ref_limits;
+  ref_embedding.computeEmbeddingBBox(ref_limits);
+
+  std::vector<scalar_type> limits(dim*2);
+  hdi::dr::gradientDescentStep(gradient.data(),previous_gradient.data(),gain.data(),embedding.getContainer().data(),num_points,dim,eta,minimum_gain,momentum,mult,limits.data());
+  for(size_t i = 0; i < gradient.size(); ++i){
+    REQUIRE(gain[i] == ref_gain[i]);
+    REQUIRE(previous_gradient[i] == ref_previous_gradient[i]);
+    REQUIRE(embedding.getContainer()[i] == ref_embedding.getContainer()[i]);
+  }
+  for(unsigned int d = 0; d < dim*2; ++d){
+    REQUIRE(limits[d] == ref_limits[d]);
+  }
+
+  //Centering and scaling match the ones of the embedding
+  std::vector<scalar_type> shifts(dim);
+  for(unsigned int d = 0; d < dim; ++d){
+    shifts[d] = static_cast<scalar_type>(-0.5*(limits[d*2+1]+limits[d*2]));
+  }
+  hdi::dr::translateAndScale(embedding.getContainer().data(),num_points,dim,shifts.data());
+  ref_embedding.zeroCentered();
+  for(size_t i = 0; i < gradient.size(); ++i){
+    REQUIRE(embedding.getContainer()[i] == ref_embedding.getContainer()[i]);
+  }
+  ref_embedding.computeEmbeddingBBox(ref_limits);
+  for(unsigned int d = 0; d < dim; ++d){
+    shifts[d] = static_cast<scalar_type>(-0.5*(ref_limits[d*2+1]+ref_limits[d*2]));
+  }
+  const scalar_type diameter = 1000;
+  hdi::dr::translateAndScale(embedding.getContainer().data(),num_points,dim,shifts.data(),diameter/(ref_limits[1]-ref_limits[0]));
+  ref_embedding.scaleIfSmallerThan(diameter);
+  for(size_t i = 0; i < gradient.size(); ++i){
+    REQUIRE(embedding.getContainer()[i] == ref_embedding.getContainer()[i]);
+  }
+}
+
+TEST_CASE( "tSNE - fused gradient descent step", "[algorithms_embedding]" ) {
+  SECTION("float 2D"){
+    test_gradient_descent_step<float>(2);
+  }
+  SECTION("double 3D"){
+    test_gradient_descent_step<double>(3);
+  }
+}
+
+TEST_CASE( "Sparse tSNE - symmetric storage of P", "[algorithms_embedding]" ) {
+  SECTION("MapMemEff"){
+    test_symmetric_storage<std::vector<hdi::data::MapMemEff<uint32_t,float>>>();
+  }
+  SECTION("SparseMatrixCSR"){
+    test_symmetric_storage<hdi::data::SparseMatrixCSR<uint32_t,float>>();
+  }
+}
+
+TEST_CASE( "Sparse tSNE - Q is materialized only on request", "[algorithms_embedding]" ) {
+  typedef hdi::dr::SparseTSNEUserDefProbabilities<float> tsne_type;
+  const unsigned int num_dps = 700; //more than two tiles of the exact computation
+  std::vector<hdi::data::MapMemEff<uint32_t,float>> conditional(num_dps);
+  std::default_random_engine generator(11);
+  std::uniform_int_distribution<unsigned int> distribution_int(0,num_dps-1);
+  for(unsigned int i = 0; i < num_dps; ++i){
+    for(int k = 0; k < 10; ++k){
+      const unsigned int j = distribution_int(generator);
+      if(j != i){
+        conditional[i][j] = 0.1;
+      }
+    }
+  }
+
+  hdi::dr::TsneParameters params;
+  params._seed = 5;
+  //Without exaggeration the embedding is only centered after the gradient descent step
+  params._exaggeration_factor = 1;
+  hdi::data::Embedding<float> embedding_exact, embedding_bh;
+  tsne_type tsne_exact, tsne_bh;
+  tsne_bh.setTheta(0.5);
+  tsne_exact.initialize(conditional,&embedding_exact,params);
+  tsne_bh.initialize(conditional,&embedding_bh,params);
+
+  //Brute-force gradient on the initial embedding: 4 * sum_j (p_ij - q_ij/Z) * q_ij * (y_i-y_j), with q_ij = 1/(1+|y_i-y_j|^2).
+  //The rows of the stored P sum to one, p_ij is the stored value divided by the number of points
+  const std::vector<float> initial = embedding_exact.getContainer();
+  std::vector<double> gradient(num_dps*2,0);
+  double sum_Q = 0;
+  for(unsigned int i = 0; i < num_dps; ++i){
+    for(unsigned int j = 0; j < num_dps; ++j){
+      if(i != j){
+        const double dx = double(initial[i*2]) - initial[j*2];
+        const double dy = double(initial[i*2+1]) - initial[j*2+1];
+        sum_Q += 1./(1.+dx*dx+dy*dy);
+      }
+    }
+  }
+  for(unsigned int i = 0; i < num_dps; ++i){
+    for(unsigned int j = 0; j < num_dps; ++j){
+      if(i != j){
+        const double dx = double(initial[i*2]) - initial[j*2];
+        const double dy = double(initial[i*2+1]) - initial[j*2+1];
+        const double q = 1./(1.+dx*dx+dy*dy);
+        gradient[i*2] -= 4*q*q/sum_Q*dx;
+        gradient[i*2+1] -= 4*q*q/sum_Q*dy;
+      }
+    }
+    for(auto& e: tsne_exact.getDistributionP()[i]){
+      const unsigned int j = e.first;
+      const double dx = double(initial[i*2]) - initial[j*2];
+      const double dy = double(initial[i*2+1]) - initial[j*2+1];
+      const double q = 1./(1.+dx*dx+dy*dy);
+      gradient[i*2] += 4*e.second/num_dps*q*dx;
+      gradient[i*2+1] += 4*e.second/num_dps*q*dy;
+    }
+  }
+
+  //First step: the previous gradient is zero and the gains become 1.2, the embedding is then centered
+  tsne_exact.doAnIteration();
+  std::vector<double> expected(num_dps*2);
+  double limits[4] = {std::numeric_limits<double>::max(),-std::numeric_limits<double>::max(),std::numeric_limits<double>::max(),-std::numeric_limits<double>::max()};
+  double max_step = 0;
+  for(unsigned int i = 0; i < num_dps*2; ++i){
+    expected[i] = initial[i] - params._eta*1.2*gradient[i];
+    limits[(i%2)*2] = std::min(limits[(i%2)*2],expected[i]);
+    limits[(i%2)*2+1] = std::max(limits[(i%2)*2+1],expected[i]);
+    max_step = std::max(max_step,std::abs(params._eta*1.2*gradient[i]));
+  }
+  REQUIRE(max_step > 0);
+  for(unsigned int i = 0; i < num_dps*2; ++i){
+    const double center = 0.5*(limits[(i%2)*2]+limits[(i%2)*2+1]);
+    REQUIRE(embedding_exact.getContainer()[i] == Approx(expected[i]-center).margin(1e-3*max_step));
+  }
+  tsne_bh.doAnIteration();
+
+  const double dense_q_mb = double(num_dps)*num_dps*sizeof(float)/1024/1024;
+  REQUIRE(tsne_exact.memoryOccupation() > 0);
+  REQUIRE(tsne_exact.memoryOccupation() < dense_q_mb);
+
+  for(int it = 1; it < 10; ++it){
+    tsne_exact.doAnIteration();
+    tsne_bh.doAnIteration();
+  }
+  REQUIRE(tsne_exact.memoryOccupation() < dense_q_mb);
+  //the exact repulsion keeps only buffers that are linear in the number of points
+  REQUIRE(tsne_exact.memoryOccupation() - tsne_bh.memoryOccupation() < dense_q_mb/10);
+  for(unsigned int i = 0; i < num_dps; ++i){
+    REQUIRE(std::isfinite(embedding_exact.dataAt(i,0)));
+    REQUIRE(std::isfinite(embedding_exact.dataAt(i,1)));
+  }
+
+  REQUIRE(tsne_exact.getDistributionQ().empty());
+  tsne_exact.computeDistributionQ();
+  const auto& Q = tsne_exact.getDistributionQ();
+  REQUIRE(Q.size() == num_dps*num_dps);
+  for(unsigned int i = 0; i < num_dps; i += 7){
+    for(unsigned int j = 0; j < num_dps; j += 5){
+      const double dx = double(embedding_exact.dataAt(i,0)) - embedding_exact.dataAt(j,0);
+      const double dy = double(embedding_exact.dataAt(i,1)) - embedding_exact.dataAt(j,1);
+      REQUIRE(Q[i*num_dps+j] == Approx((i == j)?0:1./(1.+dx*dx+dy*dy)));
+    }
+  }
+  REQUIRE(tsne_exact.memoryOccupation() > dense_q_mb);
+  tsne_exact.releaseDistributionQ();
+  REQUIRE(tsne_exact.memoryOccupation() < dense_q_mb);
+}
+
+//Kullback-Leibler divergence between P and the distribution Q of a 2D embedding
+template <typename sparse_scalar_matrix>
+double kullbackLeiblerDivergence(const sparse_scalar_matrix& P, const hdi::data::Embedding<float>& embedding){
+  const unsigned int num_dps = embedding.numDataPoints();
+  double sum_Q = 0;
+  for(unsigned int i = 0; i < num_dps; ++i){
+    for(unsigned int j = 0; j < num_dps; ++j){
+      if(i != j){
+        const double dx = embedding.dataAt(i,0) - embedding.dataAt(j,0);
+        const double dy = embedding.dataAt(i,1) - embedding.dataAt(j,1);
+        sum_Q += 1./(1.+dx*dx+dy*dy);
+      }
+    }
+  }
+  //P is not normalized
+  double sum_P = 0;
+  for(unsigned int i = 0; i < num_dps; ++i){
+    for(auto elem: P[i]){
+      sum_P += elem.second;
+    }
+  }
+  double kl = 0;
+  for(unsigned int i = 0; i < num_dps; ++i){
+    for(auto elem: P[i]){
+      const double dx = embedding.dataAt(i,0) - embedding.dataAt(elem.first,0);
+      const double dy = embedding.dataAt(i,1) - embedding.dataAt(elem.first,1);
+      const double p = elem.second/sum_P;
+      const double q = 1./(1.+dx*dx+dy*dy)/sum_Q;
+      kl += p*std::log(p/q);
+    }
+  }
+  return kl;
+}
+
+TEST_CASE( "Sparse tSNE - dual-tree repulsion", "[algorithms_embedding]" ) {
+  typedef hdi::dr::SparseTSNEUserDefProbabilities<float> tsne_type;
+  const unsigned int num_dps = 2000;
+  std::vector<hdi::data::MapMemEff<uint32_t,float>> conditional(num_dps);
+  std::default_random_engine generator(11);
+  std::uniform_int_distribution<unsigned int> distribution_int(0,num_dps-1);
+  for(unsigned int i = 0; i < num_dps; ++i){
+    for(int k = 0; k < 10; ++k){
+      const unsigned int j = distribution_int(generator);
+      if(j != i){
+        conditional[i][j] = 0.1;
+      }
+    }
+  }
+
+  hdi::dr::TsneParameters params;
+  params._seed = 5;
+  hdi::data::Embedding<float> embedding_bh, embedding_dual_tree;
+  tsne_type tsne_bh, tsne_dual_tree;
+  tsne_bh.setTheta(0.5);
+  tsne_dual_tree.setTheta(0.5);
+  tsne_dual_tree.setDualTree(true);
+  REQUIRE(!tsne_bh.dualTree());
+  REQUIRE(tsne_dual_tree.dualTree());
+  tsne_bh.initialize(conditional,&embedding_bh,params);
+  tsne_dual_tree.initialize(conditional,&embedding_dual_tree,params);
+
+  for(int it = 0; it < 300; ++it){
+    tsne_bh.doAnIteration();
+    tsne_dual_tree.doAnIteration();
+  }
+
+  for(unsigned int i = 0; i < num_dps; ++i){
+    REQUIRE(std::isfinite(embedding_dual_tree.dataAt(i,0)));
+    REQUIRE(std::isfinite(embedding_dual_tree.dataAt(i,1)));
+  }
+
+  //the gradient descent amplifies small differences in the gradient, hence the two embeddings are compared on their cost
+  const double kl_bh = kullbackLeiblerDivergence(tsne_bh.getDistributionP(),embedding_bh);
+  const double kl_dual_tree = kullbackLeiblerDivergence(tsne_dual_tree.getDistributionP(),embedding_dual_tree);
+  REQUIRE(kl_dual_tree == Approx(kl_bh).epsilon(0.01));
+}
+
+TEST_CASE( "Sparse tSNE - FFT interpolation", "[algorithms_embedding]" ) {
+  typedef hdi::dr::SparseTSNEUserDefProbabilities<float> tsne_type;
+  const unsigned int num_dps = 2000;
+  std::vector<hdi::data::MapMemEff<uint32_t,float>> conditional(num_dps);
+  std::default_random_engine generator(11);
+  std::uniform_int_distribution<unsigned int> distribution_int(0,num_dps-1);
+  for(unsigned int i = 0; i < num_dps; ++i){
+    for(int k = 0; k < 10; ++k){
+      const unsigned int j = distribution_int(generator);
+      if(j != i){
+        conditional[i][j] = 0.1;
+      }
+    }
+  }
+
+  SECTION("2D"){
+    hdi::dr::TsneParameters params;
+    params._seed = 5;
+    hdi::data::Embedding<float> embedding_bh, embedding_fft;
+    tsne_type tsne_bh, tsne_fft;
+    tsne_bh.setTheta(0.5);
+    tsne_fft.setFFTInterpolation(true);
+    REQUIRE(!tsne_bh.fftInterpolation());
+    REQUIRE(tsne_fft.fftInterpolation());
+    tsne_bh.initialize(conditional,&embedding_bh,params);
+    tsne_fft.initialize(conditional,&embedding_fft,params);
+
+    for(int it = 0; it < 300; ++it){
+      tsne_bh.doAnIteration();
+      tsne_fft.doAnIteration();
+    }
+    for(unsigned int i = 0; i < num_dps; ++i){
+      REQUIRE(std::isfinite(embedding_fft.dataAt(i,0)));
+      REQUIRE(std::isfinite(embedding_fft.dataAt(i,1)));
+    }
+    const double kl_bh = kullbackLeiblerDivergence(tsne_bh.getDistributionP(),embedding_bh);
+    const double kl_fft = kullbackLeiblerDivergence(tsne_fft.getDistributionP(),embedding_fft);
+    REQUIRE(kl_fft == Approx(kl_bh).epsilon(0.01));
+    REQUIRE(tsne_fft.memoryOccupation() > tsne_bh.memoryOccupation());
+  }
+  SECTION("1D"){
+    hdi::dr::TsneParameters params;
+    params._seed = 5;
+    params._embedding_dimensionality = 1;
+    hdi::data::Embedding<float> embedding;
+    tsne_type tsne;
+    tsne.setFFTInterpolation(true);
+    tsne.initialize(conditional,&embedding,params);
+    //the embedding is kept small during the early exaggeration
+    for(int it = 0; it < 450; ++it){
+      tsne.doAnIteration();
+    }
+    float min_pos = embedding.dataAt(0,0), max_pos = embedding.dataAt(0,0);
+    for(unsigned int i = 0; i < num_dps; ++i){
+      REQUIRE(std::isfinite(embedding.dataAt(i,0)));
+      min_pos = std::min(min_pos,embedding.dataAt(i,0));
+      max_pos = std::max(max_pos,embedding.dataAt(i,0));
+    }
+    REQUIRE(max_pos - min_pos > 1);
+  }
+  SECTION("3D is not supported"){
+    hdi::dr::TsneParameters params;
+    params._seed = 5;
+    params._embedding_dimensionality = 3;
+    hdi::data::Embedding<float> embedding;
+    tsne_type tsne;
+    tsne.setFFTInterpolation(true);
+    tsne.initialize(conditional,&embedding,params);
+    REQUIRE_THROWS_AS(tsne.doAnIteration(),std::logic_error);
+  }
+}
+
+//Repulsive forces and normalization computed naively on all the ordered pairs of points
+void naiveRepulsion(unsigned int dim, const std::vector<float>& positions, std::vector<double>& neg_f, double& sum_Q){
+  const unsigned int n = positions.size()/dim;
+  neg_f.assign(positions.size(),0);
+  sum_Q = 0;
+  for(unsigned int i = 0; i < n; ++i){
+    for(unsigned int j = 0; j < n; ++j){
+      if(i == j){
+        continue;
+      }
+      double dist_sq = 0;
+      for(unsigned int d = 0; d < dim; ++d){
+        const double diff = double(positions[i*dim+d]) - positions[j*dim+d];
+        dist_sq += diff*diff;
+      }
+      const double q = 1./(1.+dist_sq);
+      sum_Q += q;
+      for(unsigned int d = 0; d < dim; ++d){
+        neg_f[i*dim+d] += q*q*(double(positions[i*dim+d]) - positions[j*dim+d]);
+      }
+    }
+  }
+}
+
+TEST_CASE( "Exact repulsion", "[algorithms_embedding]" ) {
+  const unsigned int num_dps = 203; //not a multiple of the tile size
+  std::default_random_engine generator(17);
+  std::normal_distribution<float> distribution(0,3);
+
+  for(unsigned int dim = 1; dim <= 4; ++dim){
+    std::vector<float> positions(num_dps*dim);
+    for(auto& v: positions){
+      v = distribution(generator);
+    }
+    std::vector<double> expected_f;
+    double expected_sum_Q;
+    naiveRepulsion(dim,positions,expected_f,expected_sum_Q);
+
+    for(unsigned int tile_size: {16u,256u}){
+      hdi::dr::ExactRepulsion<float> repulsion;
+      REQUIRE_THROWS(repulsion.setTileSize(0));
+      repulsion.setTileSize(tile_size);
+      REQUIRE(repulsion.tileSize() == tile_size);
+      //forces are accumulated, the first call is repeated to check that the internal buffers are reset
+      std::vector<double> neg_f(positions.size(),1);
+      double sum_Q = 1;
+      repulsion.computeNonEdgeForces(dim,positions.data(),num_dps,neg_f.data(),sum_Q);
+      std::fill(neg_f.begin(),neg_f.end(),1);
+      sum_Q = 1;
+      repulsion.computeNonEdgeForces(dim,positions.data(),num_dps,neg_f.data(),sum_Q);
+      REQUIRE(repulsion.memoryOccupation() > 0);
+
+      REQUIRE(sum_Q-1 == Approx(expected_sum_Q).epsilon(1e-9));
+      for(unsigned int i = 0; i < positions.size(); ++i){
+        REQUIRE(neg_f[i]-1 == Approx(expected_f[i]).epsilon(1e-6).margin(1e-9));
+      }
+    }
+  }
+}
+
+//The exact t-SNE computes Q on the fly and stores it only when requested
+TEST_CASE( "tSNE - Q is materialized only on request", "[algorithms_embedding]" ) {
+  const unsigned int num_dps = 300;
+  const unsigned int dim = 5;
+  std::default_random_engine generator(3);
+  std::normal_distribution<float> distribution(0,1);
+  std::vector<std::vector<float>> data(num_dps,std::vector<float>(dim));
+  for(auto& dp: data){
+    for(auto& v: dp){
+      v = distribution(generator);
+    }
+  }
+
+  hdi::dr::TSNE<float> tSNE;
+  hdi::data::Embedding<float> embedding;
+  tSNE.setDimensionality(dim);
+  for(auto& dp: data){
+    tSNE.addDataPoint(dp.data());
+  }
+  tSNE.initialize(&embedding);
+  for(int it = 0; it < 20; ++it){
+    tSNE.doAnIteration();
+  }
+  for(unsigned int i = 0; i < num_dps; ++i){
+    REQUIRE(std::isfinite(embedding.dataAt(i,0)));
+    REQUIRE(std::isfinite(embedding.dataAt(i,1)));
+  }
+  const double kl = tSNE.computeKullbackLeiblerDivergence();
+  REQUIRE(std::isfinite(kl));
+  REQUIRE(kl >= 0);
+  REQUIRE(tSNE.getDistributionQ().empty());
+
+  tSNE.computeDistributionQ();
+  const auto& Q = tSNE.getDistributionQ();
+  const auto& P = tSNE.getDistributionP();
+  REQUIRE(Q.size() == num_dps*num_dps);
+  REQUIRE(Q[1] == Q[num_dps]);
+  double sum_Q = 0;
+  for(auto v : Q){
+    sum_Q += v;
+  }
+  double kl_materialized = 0;
+  for(unsigned int j = 0; j < num_dps; ++j){
+    for(unsigned int i = 0; i < num_dps; ++i){
+      if(i == j) continue;
+      kl_materialized += P[j*num_dps + i] * std::log(P[j*num_dps + i] / (Q[j*num_dps + i]/sum_Q));
+    }
+  }
+  REQUIRE(std::abs(kl - kl_materialized) < 1e-4 * std::abs(kl_materialized) + 1e-6);
+  tSNE.releaseDistributionQ();
+  REQUIRE(tSNE.getDistributionQ().empty());
+}
+
+TEST_CASE( "tSNE - space-filling curve order", "[algorithms_embedding]" ) {
+  const unsigned int num_points = 5000;
+  std::default_random_engine generator(23);
+  std::uniform_real_distribution<float> distribution(-10,10);
+  for(unsigned int dim = 1; dim <= 3; ++dim){
+    std::vector<float> positions(num_points*dim);
+    for(auto& v: positions){
+      v = distribution(generator);
+    }
+    std::vector<unsigned int> order;
+    hdi::dr::spaceFillingCurveOrder(positions.data(),num_points,dim,order);
+    REQUIRE(order.size() == num_points);
+    std::vector<unsigned int> sorted(order);
+    std::sort(sorted.begin(),sorted.end());
+    for(unsigned int i = 0; i < num_points; ++i){
+      REQUIRE(sorted[i] == i);
+    }
+
+    //Consecutive points on the curve are much closer than consecutive points in the input
+    auto pathLength = [&](const std::vector<unsigned int>& sequence){
+      double length = 0;
+      for(unsigned int k = 1; k < num_points; ++k){
+        double dist_sq = 0;
+        for(unsigned int d = 0; d < dim; ++d){
+          const double diff = positions[sequence[k]*dim+d] - positions[sequence[k-1]*dim+d];
+          dist_sq += diff*diff;
+        }
+        length += std::sqrt(dist_sq);
+      }
+      return length;
+    };
+    std::vector<unsigned int> identity(num_points);
+    for(unsigned int i = 0; i < num_points; ++i){
+      identity[i] = i;
+    }
+    REQUIRE(pathLength(order) < 0.25*pathLength(identity));
+
+    //Points are moved to the new index and back
+    std::vector<float> permuted(positions), buffer;
+    std::vector<unsigned int> rank(num_points);
+    for(unsigned int k = 0; k < num_points; ++k){
+      rank[order[k]] = k;
+    }
+    hdi::dr::permutePoints(permuted.data(),num_points,dim,rank,buffer);
+    for(unsigned int d = 0; d < dim; ++d){
+      REQUIRE(permuted[d] == positions[order[0]*dim+d]);
+    }
+    hdi::dr::permutePoints(permuted.data(),num_points,dim,order,buffer);
+    REQUIRE(permuted == positions);
+  }
+}
+
+template <typename sparse_scalar_matrix>
+void test_spatial_reordering(bool symmetric_storage){
+  typedef hdi::dr::SparseTSNEUserDefProbabilities<float,sparse_scalar_matrix> tsne_type;
+  const unsigned int num_dps = 2000;
+  std::vector<hdi::data::MapMemEff<uint32_t,float>> conditional(num_dps);
+  std::default_random_engine generator(11);
+  std::uniform_int_distribution<unsigned int> distribution_int(0,num_dps-1);
+  for(unsigned int i = 0; i < num_dps; ++i){
+    for(int k = 0; k < 10; ++k){
+      const unsigned int j = distribution_int(generator);
+      if(j != i){
+        conditional[i][j] = 0.1;
+      }
+    }
+  }
+  sparse_scalar_matrix probabilities(conditional);
+
+  hdi::dr::TsneParameters params;
+  params._seed = 5;
+  params._symmetric_storage = symmetric_storage;
+
+  //The exact gradient does not depend on the order of the points, the embeddings differ only by the rounding errors
+  {
+    hdi::data::Embedding<float> embedding, embedding_reordered;
+    tsne_type tsne, tsne_reordered;
+    tsne_reordered.setSpatialReorderingPeriod(2);
+    REQUIRE(tsne.spatialReorderingPeriod() == 0);
+    REQUIRE(tsne_reordered.spatialReorderingPeriod() == 2);
+    tsne.initialize(probabilities,&embedding,params);
+    tsne_reordered.initialize(probabilities,&embedding_reordered,params);
+    for(int it = 0; it < 5; ++it){
+      tsne.doAnIteration();
+      tsne_reordered.doAnIteration();
+      for(unsigned int i = 0; i < num_dps; ++i){
+        REQUIRE(embedding_reordered.dataAt(i,0) == Approx(embedding.dataAt(i,0)).epsilon(1e-3).margin(1e-6));
+        REQUIRE(embedding_reordered.dataAt(i,1) == Approx(embedding.dataAt(i,1)).epsilon(1e-3).margin(1e-6));
+      }
+    }
+    REQUIRE(tsne_reordered.memoryOccupation() > tsne.memoryOccupation());
+
+    //P is stored in the order of the curve until the original order is restored
+    tsne_reordered.restoreOriginalOrder();
+    const auto& P = tsne.getDistributionP();
+    const auto& P_reordered = tsne_reordered.getDistributionP();
+    for(unsigned int i = 0; i < num_dps; ++i){
+      REQUIRE(P[i].size() == P_reordered[i].size());
+      auto it = P_reordered[i].begin();
+      for(auto e: P[i]){
+        REQUIRE(e.first == (*it).first);
+        REQUIRE(e.second == (*it).second);
+        ++it;
+      }
+    }
+  }
+
+  //Barnes-Hut
+  {
+    hdi::data::Embedding<float> embedding, embedding_reordered;
+    tsne_type tsne, tsne_reordered;
+    tsne.setTheta(0.5);
+    tsne_reordered.setTheta(0.5);
+    tsne_reordered.setSpatialReorderingPeriod(25);
+    tsne.initialize(probabilities,&embedding,params);
+    tsne_reordered.initialize(probabilities,&embedding_reordered,params);
+    for(int it = 0; it < 300; ++it){
+      tsne.doAnIteration();
+      tsne_reordered.doAnIteration();
+    }
+    for(unsigned int i = 0; i < num_dps; ++i){
+      REQUIRE(std::isfinite(embedding_reordered.dataAt(i,0)));
+      REQUIRE(std::isfinite(embedding_reordered.dataAt(i,1)));
+    }
+    const double kl = kullbackLeiblerDivergence(tsne.getDistributionP(),embedding);
+    tsne_reordered.restoreOriginalOrder();
+    const double kl_reordered = kullbackLeiblerDivergence(tsne_reordered.getDistributionP(),embedding_reordered);
+    REQUIRE(kl_reordered == Approx(kl).epsilon(0.01));
+  }
+}
+
+TEST_CASE( "Sparse tSNE - spatial reordering", "[algorithms_embedding]" ) {
+  SECTION("vector of maps"){
+    test_spatial_reordering<std::vector<hdi::data::MapMemEff<uint32_t,float>>>(false);
+  }
+  SECTION("CSR with symmetric storage"){
+    test_spatial_reordering<hdi::data::SparseMatrixCSR<uint32_t,float>>(true);
+  }
+}
+
+TEST_CASE( "Sparse tSNE - single-precision tree", "[algorithms_embedding]" ) {
+  typedef hdi::dr::SparseTSNEUserDefProbabilities<float> tsne_type;
+  const unsigned int num_dps = 2000;
+  std::vector<hdi::data::MapMemEff<uint32_t,float>> conditional(num_dps);
+  std::default_random_engine generator(11);
+  std::uniform_int_distribution<unsigned int> distribution_int(0,num_dps-1);
+  for(unsigned int i = 0; i < num_dps; ++i){
+    for(int k = 0; k < 10; ++k){
+      const unsigned int j = distribution_int(generator);
+      if(j != i){
+        conditional[i][j] = 0.1;
+      }
+    }
+  }
+
+  hdi::dr::TsneParameters params;
+  params._seed = 5;
+  for(bool dual_tree: {false,true}){
+    hdi::data::Embedding<float> embedding, embedding_single;
+    tsne_type tsne, tsne_single;
+    tsne.setTheta(0.5);
+    tsne_single.setTheta(0.5);
+    tsne.setDualTree(dual_tree);
+    tsne_single.setDualTree(dual_tree);
+    tsne_single.setSinglePrecisionTree(true);
+    REQUIRE(!tsne.singlePrecisionTree());
+    REQUIRE(tsne_single.singlePrecisionTree());
+    tsne.initialize(conditional,&embedding,params);
+    tsne_single.initialize(conditional,&embedding_single,params);
+    for(int it = 0; it < 300; ++it){
+      tsne.doAnIteration();
+      tsne_single.doAnIteration();
+    }
+    for(unsigned int i = 0; i < num_dps; ++i){
+      REQUIRE(std::isfinite(embedding_single.dataAt(i,0)));
+      REQUIRE(std::isfinite(embedding_single.dataAt(i,1)));
+    }
+    const double kl = kullbackLeiblerDivergence(tsne.getDistributionP(),embedding);
+    const double kl_single = kullbackLeiblerDivergence(tsne_single.getDistributionP(),embedding_single);
+    REQUIRE(kl_single == Approx(kl).epsilon(0.01));
+  }
+}
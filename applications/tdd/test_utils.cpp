@@ -145,6 +145,51 @@ void gaussianDistributions(){
 }
 
 
+template <typename scalar_type>
+void batchedGaussianDistributions(){
+  const int num_rows = 37;
+  const int row_size = 50;
+  const double perplexity = 10;
+  std::vector<scalar_type> distances(num_rows*row_size), distribution(num_rows*row_size), sigmas(num_rows);
+  for(int r = 0; r < num_rows; ++r){
+    for(int i = 0; i < row_size; ++i){
+      double v = std::cos(3.1415 / row_size * i) * (r+1);
+      distances[r*row_size+i] = static_cast<scalar_type>(v*v);
+    }
+  }
+
+  REQUIRE_THROWS(hdi::utils::computeGaussianDistributionsWithFixedPerplexity<scalar_type>(distances.data(), distribution.data(), num_rows, 0, perplexity));
+  REQUIRE_NOTHROW(hdi::utils::computeGaussianDistributionsWithFixedPerplexity<scalar_type>(distances.data(), distribution.data(), num_rows, row_size, perplexity, 200, 1e-5, 0, 1, sigmas.data()));
+
+  for(int r = 0; r < num_rows; ++r){
+    auto begin = distribution.begin() + r*row_size;
+    double sum = 0;
+    for(auto it = begin; it != begin + row_size; ++it){
+      sum += *it;
+    }
+    REQUIRE((sum > 0.9999 && sum < 1.00001));
+    REQUIRE(distribution[r*row_size+r] == 0);
+    REQUIRE(sigmas[r] > 0);
+    REQUIRE(std::abs(hdi::utils::computePerplexity(begin, begin + row_size) - perplexity) < 1e-3);
+
+    //Same distribution of the row-by-row calibration
+    std::vector<scalar_type> row_distribution(row_size);
+    hdi::utils::computeGaussianDistributionWithFixedPerplexity<std::vector<scalar_type>>(distances.begin() + r*row_size, distances.begin() + (r+1)*row_size, row_distribution.begin(), row_distribution.end(), perplexity, 200, 1e-5, r);
+    for(int i = 0; i < row_size; ++i){
+      if(i != r){
+        REQUIRE(std::abs(row_distribution[i] - distribution[r*row_size+i]) < 1e-4);
+      }
+    }
+  }
+
+  //In place
+  std::vector<scalar_type> in_place(distances);
+  REQUIRE_NOTHROW(hdi::utils::computeGaussianDistributionsWithFixedPerplexity<scalar_type>(in_place.data(), in_place.data(), num_rows, row_size, perplexity, 200, 1e-5, 0, 1));
+  for(int i = 0; i < in_place.size(); ++i){
+    REQUIRE(in_place[i] == distribution[i]);
+  }
+}
+
 template <typename scalar_type>
 void gaussianFunctions(){
   std::vector<scalar_type> distances, distribution;
@@ -320,6 +365,13 @@ TEST_CASE( "Gaussian distributions are computed correctly - double", "[math]" )
   gaussianDistributions<double>();
 }
 
+TEST_CASE( "Batched gaussian distributions are computed correctly - float", "[math]" ) {
+  batchedGaussianDistributions<float>();
+}
+TEST_CASE( "Batched gaussian distributions are computed correctly - double", "[math]" ) {
+  batchedGaussianDistributions<double>();
+}
+
 TEST_CASE( "Gaussian functions are computed correctly - float", "[math]" ) {
   gaussianFunctions<float>();
 }
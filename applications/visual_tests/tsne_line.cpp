@@ -128,6 +128,7 @@ int main(int argc, char *argv[]){
 
   tSNE.doAnIteration();
   {//Draw Q
+    tSNE.computeDistributionQ();
     auto& Q = tSNE.getDistributionQ();
     scalar_type max_value(0);
     scalar_type min_value(std::numeric_limits<scalar_type>::max());
@@ -169,6 +170,7 @@ int main(int argc, char *argv[]){
     QApplication::processEvents();
   }
   {//Draw Q
+    tSNE.computeDistributionQ();
     auto& Q = tSNE.getDistributionQ();
     scalar_type max_value(0);
     scalar_type min_value(std::numeric_limits<scalar_type>::max());
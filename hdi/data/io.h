@@ -33,6 +33,8 @@
 #ifndef IO_H
 #define IO_H
 
+#include "hdi/data/sparse_matrix_csr.h"
+#include "hdi/data/map_helpers.h"
 
 namespace hdi{
   namespace data{
@@ -143,26 +145,71 @@ namespace hdi{
       void loadSparseMatrix(sparse_scalar_matrix_type& matrix, output_stream_type& stream, utils::AbstractLog* log = nullptr){
         typedef float io_scalar_type;
         typedef uint32_t io_unsigned_int_type;
+        typedef typename sparse_scalar_matrix_type::value_type map_type;
+        typedef typename map_type::key_type key_type;
+        typedef typename map_type::mapped_type mapped_type;
+        typedef MapHelpers<key_type,mapped_type,map_type> map_helpers_type;
 
         //number of rows first
         io_unsigned_int_type num_rows;
         stream.read(reinterpret_cast<char*>(&num_rows),sizeof(io_unsigned_int_type));
         matrix.clear();
         matrix.resize(num_rows);
+        std::vector<std::pair<key_type,mapped_type>> row;
         for(int j = 0; j < num_rows; ++j){
           //number of elements in the current row
           io_unsigned_int_type num_elems;
           stream.read(reinterpret_cast<char*>(&num_elems),sizeof(io_unsigned_int_type));
+          row.resize(num_elems);
           for(int i = 0; i < num_elems; ++i){
             io_unsigned_int_type id;
             io_scalar_type v;
             stream.read(reinterpret_cast<char*>(&id),sizeof(io_unsigned_int_type));
             stream.read(reinterpret_cast<char*>(&v),sizeof(io_scalar_type));
-            matrix[j][id] = v;
+            row[i] = std::make_pair(static_cast<key_type>(id),static_cast<mapped_type>(v));
           }
+          //rows saved from unordered maps are not sorted
+          map_helpers_type::initializeUnsorted(matrix[j],row.begin(),row.end(),DuplicatePolicy::Overwrite);
         }
       }
 
+      //! Load a sparse matrix directly in the CSR arrays. The format is the same of the other sparse matrices
+      template <typename Key, typename T, class output_stream_type>
+      void loadSparseMatrix(SparseMatrixCSR<Key,T>& matrix, output_stream_type& stream, utils::AbstractLog* log = nullptr){
+        typedef float io_scalar_type;
+        typedef uint32_t io_unsigned_int_type;
+        typedef typename SparseMatrixCSR<Key,T>::offset_type offset_type;
+
+        //number of rows first
+        io_unsigned_int_type num_rows;
+        stream.read(reinterpret_cast<char*>(&num_rows),sizeof(io_unsigned_int_type));
+        std::vector<offset_type> offsets(num_rows+1,0);
+        std::vector<Key> keys;
+        std::vector<T> values;
+        std::vector<std::pair<Key,T>> row;
+        for(int j = 0; j < num_rows; ++j){
+          //number of elements in the current row
+          io_unsigned_int_type num_elems;
+          stream.read(reinterpret_cast<char*>(&num_elems),sizeof(io_unsigned_int_type));
+          row.resize(num_elems);
+          for(int i = 0; i < num_elems; ++i){
+            io_unsigned_int_type id;
+            io_scalar_type v;
+            stream.read(reinterpret_cast<char*>(&id),sizeof(io_unsigned_int_type));
+            stream.read(reinterpret_cast<char*>(&v),sizeof(io_scalar_type));
+            row[i] = std::make_pair(static_cast<Key>(id),static_cast<T>(v));
+          }
+          //rows saved from unordered maps are not sorted
+          std::sort(row.begin(),row.end(),[](const std::pair<Key,T>& a, const std::pair<Key,T>& b){return a.first < b.first;});
+          for(auto& e: row){
+            keys.push_back(e.first);
+            values.push_back(e.second);
+          }
+          offsets[j+1] = keys.size();
+        }
+        matrix.assign(std::move(offsets),std::move(keys),std::move(values));
+      }
+
       template <typename scalar_vector, class output_stream_type>
       void loadScalarVector(scalar_vector& vector, output_stream_type& stream, utils::AbstractLog* log = nullptr){
         typedef float io_scalar_type;
@@ -39,7 +39,11 @@
 #include <cassert>
 #include <map>
 #include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <iterator>
 #include "hdi/data/map_mem_eff.h"
+#include "hdi/data/sparse_matrix_csr.h"
 #include "hdi/utils/assert_by_exception.h"
 
 namespace hdi{
@@ -55,8 +59,19 @@ namespace hdi{
       //! Initializes the map with a set of elements ordered by key. No check is performed internally!
       template <typename It>
       static void initialize(Map& map, It begin, It end, T thresh = 0){throw std::logic_error("MapHelpers::shrinkToFit: function not implemented");}
+      //! Initializes the map with a set of elements in any order. Values of duplicated keys are combined according to policy
+      template <typename It>
+      static void initializeUnsorted(Map& map, It begin, It end, DuplicatePolicy policy = DuplicatePolicy::Sum){throw std::logic_error("MapHelpers::initializeUnsorted: function not implemented");}
       //! Invert a sparse matrix implemented with a vector of maps
       static void invert(const std::vector<Map>& matrix, std::vector<Map>& inverse){throw std::logic_error("MapHelpers::invert: function not implemented");}
+      //! Replace the rows in row_ids of matrix with the ones of source. The two matrices must have the same number of rows
+      static void replaceRows(std::vector<Map>& matrix, const std::vector<Map>& source, const std::vector<unsigned int>& row_ids){throw std::logic_error("MapHelpers::replaceRows: function not implemented");}
+      //! Symmetrize a square sparse matrix implemented with a vector of maps: symmetric = (matrix + matrix^T)/2
+      static void symmetrize(const std::vector<Map>& matrix, std::vector<Map>& symmetric){throw std::logic_error("MapHelpers::symmetrize: function not implemented");}
+      //! Remove the elements on and below the diagonal of a square sparse matrix: only the i < j elements of a symmetric matrix are kept
+      static void keepUpperTriangle(std::vector<Map>& matrix){throw std::logic_error("MapHelpers::keepUpperTriangle: function not implemented");}
+      //! Relabel rows and columns, element (i,j) is moved to (new_index[i],new_index[j]). If upper_triangle is set the matrix stores only the upper triangle and the elements that fall in the lower one are transposed
+      static void permute(const std::vector<Map>& matrix, const std::vector<unsigned int>& new_index, bool upper_triangle, std::vector<Map>& permuted){throw std::logic_error("MapHelpers::permute: function not implemented");}
     };
 
 
@@ -76,6 +91,16 @@ namespace hdi{
           ++it;
         }
       }
+      template <typename It>
+      static void initializeUnsorted(std::map<Key,T>& map, It begin, It end, DuplicatePolicy policy = DuplicatePolicy::Sum){
+        map.clear();
+        for(auto it = begin; it != end; ++it){
+          auto res = map.insert(*it);
+          if(!res.second){
+            combineDuplicate(res.first->second,it->second,policy);
+          }
+        }
+      }
       static void invert(const std::vector<std::map<Key,T>>& matrix, std::vector<std::map<Key,T>>& inverse){
         inverse.resize(matrix.size());
         for(int j = 0; j < matrix.size(); ++j){
@@ -84,6 +109,42 @@ namespace hdi{
           }
         }
       }
+      static void replaceRows(std::vector<std::map<Key,T>>& matrix, const std::vector<std::map<Key,T>>& source, const std::vector<unsigned int>& row_ids){
+        checkAndThrowLogic(matrix.size() == source.size(), "MapHelpers::replaceRows: the number of rows does not agree");
+        for(auto r: row_ids){
+          matrix[r] = source[r];
+        }
+      }
+      static void keepUpperTriangle(std::vector<std::map<Key,T>>& matrix){
+#pragma omp parallel for
+        for(int j = 0; j < matrix.size(); ++j){
+          matrix[j].erase(matrix[j].begin(),matrix[j].upper_bound(j));
+        }
+      }
+      static void permute(const std::vector<std::map<Key,T>>& matrix, const std::vector<unsigned int>& new_index, bool upper_triangle, std::vector<std::map<Key,T>>& permuted){
+        permuted.clear();
+        permuted.resize(matrix.size());
+        for(int j = 0; j < matrix.size(); ++j){
+          for(auto& e: matrix[j]){
+            const unsigned int r = new_index[j], c = new_index[e.first];
+            if(upper_triangle && c < r){
+              permuted[c][r] = e.second;
+            }else{
+              permuted[r][c] = e.second;
+            }
+          }
+        }
+      }
+      static void symmetrize(const std::vector<std::map<Key,T>>& matrix, std::vector<std::map<Key,T>>& symmetric){
+        symmetric.clear();
+        symmetric.resize(matrix.size());
+        for(int j = 0; j < matrix.size(); ++j){
+          for(auto& e: matrix[j]){
+            symmetric[j][e.first] += e.second*0.5;
+            symmetric[e.first][j] += e.second*0.5;
+          }
+        }
+      }
     };
 
 
@@ -103,6 +164,16 @@ namespace hdi{
           ++it;
         }
       }
+      template <typename It>
+      static void initializeUnsorted(std::unordered_map<Key,T>& map, It begin, It end, DuplicatePolicy policy = DuplicatePolicy::Sum){
+        map.clear();
+        for(auto it = begin; it != end; ++it){
+          auto res = map.insert(*it);
+          if(!res.second){
+            combineDuplicate(res.first->second,it->second,policy);
+          }
+        }
+      }
       static void invert(const std::vector<std::unordered_map<Key,T>>& matrix, std::vector<std::unordered_map<Key,T>>& inverse){
         inverse.resize(matrix.size());
         for(int j = 0; j < matrix.size(); ++j){
@@ -111,6 +182,48 @@ namespace hdi{
           }
         }
       }
+      static void replaceRows(std::vector<std::unordered_map<Key,T>>& matrix, const std::vector<std::unordered_map<Key,T>>& source, const std::vector<unsigned int>& row_ids){
+        checkAndThrowLogic(matrix.size() == source.size(), "MapHelpers::replaceRows: the number of rows does not agree");
+        for(auto r: row_ids){
+          matrix[r] = source[r];
+        }
+      }
+      static void keepUpperTriangle(std::vector<std::unordered_map<Key,T>>& matrix){
+#pragma omp parallel for
+        for(int j = 0; j < matrix.size(); ++j){
+          for(auto it = matrix[j].begin(); it != matrix[j].end();){
+            if(it->first <= Key(j)){
+              it = matrix[j].erase(it);
+            }else{
+              ++it;
+            }
+          }
+        }
+      }
+      static void permute(const std::vector<std::unordered_map<Key,T>>& matrix, const std::vector<unsigned int>& new_index, bool upper_triangle, std::vector<std::unordered_map<Key,T>>& permuted){
+        permuted.clear();
+        permuted.resize(matrix.size());
+        for(int j = 0; j < matrix.size(); ++j){
+          for(auto& e: matrix[j]){
+            const unsigned int r = new_index[j], c = new_index[e.first];
+            if(upper_triangle && c < r){
+              permuted[c][r] = e.second;
+            }else{
+              permuted[r][c] = e.second;
+            }
+          }
+        }
+      }
+      static void symmetrize(const std::vector<std::unordered_map<Key,T>>& matrix, std::vector<std::unordered_map<Key,T>>& symmetric){
+        symmetric.clear();
+        symmetric.resize(matrix.size());
+        for(int j = 0; j < matrix.size(); ++j){
+          for(auto& e: matrix[j]){
+            symmetric[j][e.first] += e.second*0.5;
+            symmetric[e.first][j] += e.second*0.5;
+          }
+        }
+      }
     };
 
 
@@ -128,6 +241,16 @@ namespace hdi{
       static void initialize(MapMemEff<Key,T>& map, It begin, It end, T thresh = 0){
         map.initialize(begin,end, thresh);
       }
+      //! Bulk construction: the elements are appended and sorted once
+      template <typename It>
+      static void initializeUnsorted(MapMemEff<Key,T>& map, It begin, It end, DuplicatePolicy policy = DuplicatePolicy::Sum){
+        map.clear();
+        map.reserve(std::distance(begin,end));
+        for(auto it = begin; it != end; ++it){
+          map.append(it->first,it->second);
+        }
+        map.finalize(policy);
+      }
       static void invert(const std::vector<hdi::data::MapMemEff<Key,T>>& matrix, std::vector<hdi::data::MapMemEff<Key,T>>& inverse){
         inverse.resize(matrix.size());
         std::vector<unsigned int> inverse_row_size(inverse.size());
@@ -145,8 +268,303 @@ namespace hdi{
           }
         }
       }
+      static void replaceRows(std::vector<hdi::data::MapMemEff<Key,T>>& matrix, const std::vector<hdi::data::MapMemEff<Key,T>>& source, const std::vector<unsigned int>& row_ids){
+        checkAndThrowLogic(matrix.size() == source.size(), "MapHelpers::replaceRows: the number of rows does not agree");
+        for(auto r: row_ids){
+          matrix[r] = source[r];
+        }
+      }
+      //! The rows are sorted, the lower triangle is a prefix of each row. Memory is released
+      static void keepUpperTriangle(std::vector<hdi::data::MapMemEff<Key,T>>& matrix){
+        typedef typename hdi::data::MapMemEff<Key,T>::value_type value_type;
+#pragma omp parallel for
+        for(int j = 0; j < matrix.size(); ++j){
+          auto& row = matrix[j].memory();
+          auto first = std::upper_bound(row.begin(),row.end(),Key(j),[](const Key& k, const value_type& e){return k < e.first;});
+          row.erase(row.begin(),first);
+          row.shrink_to_fit();
+        }
+      }
+      //! Bulk relabeling: the rows are sized with a counting pass, filled and sorted once
+      static void permute(const std::vector<hdi::data::MapMemEff<Key,T>>& matrix, const std::vector<unsigned int>& new_index, bool upper_triangle, std::vector<hdi::data::MapMemEff<Key,T>>& permuted){
+        typedef typename hdi::data::MapMemEff<Key,T>::value_type value_type;
+        const int n = matrix.size();
+        std::vector<unsigned int> row_size(n,0);
+        for(int j = 0; j < n; ++j){
+          for(auto& e: matrix[j]){
+            const unsigned int r = new_index[j], c = new_index[e.first];
+            ++row_size[(upper_triangle && c < r)?c:r];
+          }
+        }
+        permuted.clear();
+        permuted.resize(n);
+        for(int j = 0; j < n; ++j){
+          permuted[j].memory().reserve(row_size[j]);
+        }
+        for(int j = 0; j < n; ++j){
+          for(auto& e: matrix[j]){
+            const unsigned int r = new_index[j], c = new_index[e.first];
+            if(upper_triangle && c < r){
+              permuted[c].memory().push_back(value_type(r,e.second));
+            }else{
+              permuted[r].memory().push_back(value_type(c,e.second));
+            }
+          }
+        }
+#pragma omp parallel for schedule(dynamic,1024)
+        for(int j = 0; j < n; ++j){
+          auto& row = permuted[j].memory();
+          std::sort(row.begin(), row.end(), [](const value_type& a, const value_type& b){return a.first < b.first;});
+        }
+      }
+      //! Parallel symmetrization in linear time.
+      //! The transpose is built in bulk in a CSR layout (count, prefix sum, scatter) and then merged with the sorted rows of the matrix
+      static void symmetrize(const std::vector<hdi::data::MapMemEff<Key,T>>& matrix, std::vector<hdi::data::MapMemEff<Key,T>>& symmetric){
+        typedef typename hdi::data::MapMemEff<Key,T>::value_type value_type;
+        const int n = matrix.size();
+
+        //Number of elements in each row of the transpose
+        std::vector<std::atomic<unsigned int>> cursors(n);
+        for(int j = 0; j < n; ++j){
+          cursors[j] = 0;
+        }
+#pragma omp parallel for
+        for(int j = 0; j < n; ++j){
+          for(auto& e: matrix[j]){
+            ++cursors[e.first];
+          }
+        }
+
+        std::vector<size_t> offsets(n+1,0);
+        for(int j = 0; j < n; ++j){
+          offsets[j+1] = offsets[j] + cursors[j];
+          cursors[j] = 0;
+        }
+
+        //Scatter of the transpose. Rows are sorted afterwards since the insertion order depends on the scheduling
+        std::vector<value_type> transpose(offsets[n]);
+#pragma omp parallel for
+        for(int j = 0; j < n; ++j){
+          for(auto& e: matrix[j]){
+            const size_t pos = offsets[e.first] + cursors[e.first]++;
+            transpose[pos] = value_type(j,e.second);
+          }
+        }
+
+        symmetric.clear();
+        symmetric.resize(n);
+#pragma omp parallel for schedule(dynamic,1024)
+        for(int j = 0; j < n; ++j){
+          auto t_begin = transpose.begin() + offsets[j];
+          auto t_end = transpose.begin() + offsets[j+1];
+          std::sort(t_begin, t_end, [](const value_type& a, const value_type& b){return a.first < b.first;});
+
+          const auto& row = matrix[j].memory();
+          auto& res = symmetric[j].memory();
+
+          //Size of the union of the two rows
+          size_t num_elem = 0;
+          {
+            auto r = row.begin();
+            auto t = t_begin;
+            while(r != row.end() && t != t_end){
+              if(r->first < t->first){ ++r; }
+              else if(t->first < r->first){ ++t; }
+              else{ ++r; ++t; }
+              ++num_elem;
+            }
+            num_elem += (row.end()-r) + (t_end-t);
+          }
+          res.reserve(num_elem);
+
+          auto r = row.begin();
+          auto t = t_begin;
+          while(r != row.end() || t != t_end){
+            if(t == t_end || (r != row.end() && r->first < t->first)){
+              res.push_back(value_type(r->first,static_cast<T>(r->second*0.5)));
+              ++r;
+            }else if(r == row.end() || t->first < r->first){
+              res.push_back(value_type(t->first,static_cast<T>(t->second*0.5)));
+              ++t;
+            }else{
+              res.push_back(value_type(r->first,static_cast<T>((r->second+t->second)*0.5)));
+              ++r;
+              ++t;
+            }
+          }
+        }
+      }
     };
 
+
+    //! Rows of a SparseMatrixCSR are read-only, the functions work on the whole matrix
+    template <typename Key, typename T>
+    class MapHelpers<Key,T,SparseMatrixCSRRow<Key,T>>{
+    public:
+      typedef SparseMatrixCSR<Key,T> matrix_type;
+      typedef typename matrix_type::offset_type offset_type;
+
+      static void shrinkToFit(SparseMatrixCSRRow<Key,T>& map){}
+      static double memoryOccupation(SparseMatrixCSRRow<Key,T>& map){
+        return map.size()*(sizeof(Key)+sizeof(T));
+      }
+      template <typename It>
+      static void initialize(SparseMatrixCSRRow<Key,T>& map, It begin, It end, T thresh = 0){throw std::logic_error("MapHelpers::initialize: the rows of a SparseMatrixCSR cannot be modified");}
+      template <typename It>
+      static void initializeUnsorted(SparseMatrixCSRRow<Key,T>& map, It begin, It end, DuplicatePolicy policy = DuplicatePolicy::Sum){throw std::logic_error("MapHelpers::initializeUnsorted: the rows of a SparseMatrixCSR cannot be modified");}
+      //! Transpose in linear time. Rows are scattered in order, hence the keys of the inverse are sorted
+      static void invert(const matrix_type& matrix, matrix_type& inverse){
+        const size_t n = matrix.size();
+        const auto& offsets = matrix.offsets();
+        const auto& keys = matrix.keys();
+        const auto& values = matrix.values();
+
+        std::vector<offset_type> inverse_offsets(n+1,0);
+        for(size_t e = 0; e < keys.size(); ++e){
+          checkAndThrowLogic(keys[e] < n, "MapHelpers::invert: the matrix is not square");
+          ++inverse_offsets[keys[e]+1];
+        }
+        for(size_t j = 0; j < n; ++j){
+          inverse_offsets[j+1] += inverse_offsets[j];
+        }
+        std::vector<offset_type> cursors(inverse_offsets.begin(),inverse_offsets.end()-1);
+        std::vector<Key> inverse_keys(keys.size());
+        std::vector<T> inverse_values(keys.size());
+        for(size_t j = 0; j < n; ++j){
+          for(offset_type e = offsets[j]; e < offsets[j+1]; ++e){
+            const offset_type pos = cursors[keys[e]]++;
+            inverse_keys[pos] = static_cast<Key>(j);
+            inverse_values[pos] = values[e];
+          }
+        }
+        inverse.assign(std::move(inverse_offsets),std::move(inverse_keys),std::move(inverse_values));
+      }
+      static void replaceRows(matrix_type& matrix, const matrix_type& source, const std::vector<unsigned int>& row_ids){
+        matrix.replaceRows(source,row_ids);
+      }
+      //! Only the elements with key larger than the row are copied to the new arrays
+      static void keepUpperTriangle(matrix_type& matrix){
+        const auto& offsets = matrix.offsets();
+        const auto& keys = matrix.keys();
+        const auto& values = matrix.values();
+        const size_t n = matrix.size();
+        std::vector<offset_type> upper_offsets(n+1,0);
+        std::vector<Key> upper_keys;
+        std::vector<T> upper_values;
+        upper_keys.reserve(keys.size()/2+n);
+        upper_values.reserve(keys.size()/2+n);
+        for(size_t j = 0; j < n; ++j){
+          for(offset_type e = offsets[j]; e < offsets[j+1]; ++e){
+            if(size_t(keys[e]) > j){
+              upper_keys.push_back(keys[e]);
+              upper_values.push_back(values[e]);
+            }
+          }
+          upper_offsets[j+1] = upper_keys.size();
+        }
+        upper_keys.shrink_to_fit();
+        upper_values.shrink_to_fit();
+        matrix.assign(std::move(upper_offsets),std::move(upper_keys),std::move(upper_values));
+      }
+      //! Relabeling in linear time (count, prefix sum, scatter), the keys of every row are sorted afterwards
+      static void permute(const matrix_type& matrix, const std::vector<unsigned int>& new_index, bool upper_triangle, matrix_type& permuted){
+        typedef std::pair<Key,T> value_type;
+        const int n = matrix.size();
+        const auto& offsets = matrix.offsets();
+        const auto& keys = matrix.keys();
+        const auto& values = matrix.values();
+
+        std::vector<offset_type> p_offsets(n+1,0);
+        for(int j = 0; j < n; ++j){
+          for(offset_type e = offsets[j]; e < offsets[j+1]; ++e){
+            const unsigned int r = new_index[j], c = new_index[keys[e]];
+            ++p_offsets[((upper_triangle && c < r)?c:r)+1];
+          }
+        }
+        for(int j = 0; j < n; ++j){
+          p_offsets[j+1] += p_offsets[j];
+        }
+        std::vector<offset_type> cursors(p_offsets.begin(),p_offsets.end()-1);
+        std::vector<value_type> elements(keys.size());
+        for(int j = 0; j < n; ++j){
+          for(offset_type e = offsets[j]; e < offsets[j+1]; ++e){
+            const unsigned int r = new_index[j], c = new_index[keys[e]];
+            if(upper_triangle && c < r){
+              elements[cursors[c]++] = value_type(r,values[e]);
+            }else{
+              elements[cursors[r]++] = value_type(c,values[e]);
+            }
+          }
+        }
+
+        std::vector<Key> p_keys(keys.size());
+        std::vector<T> p_values(keys.size());
+#pragma omp parallel for schedule(dynamic,1024)
+        for(int j = 0; j < n; ++j){
+          std::sort(elements.begin()+p_offsets[j], elements.begin()+p_offsets[j+1], [](const value_type& a, const value_type& b){return a.first < b.first;});
+          for(offset_type e = p_offsets[j]; e < p_offsets[j+1]; ++e){
+            p_keys[e] = elements[e].first;
+            p_values[e] = elements[e].second;
+          }
+        }
+        permuted.assign(std::move(p_offsets),std::move(p_keys),std::move(p_values));
+      }
+      //! Parallel symmetrization in linear time: the sorted rows of the matrix are merged with the ones of the transpose
+      static void symmetrize(const matrix_type& matrix, matrix_type& symmetric){
+        matrix_type transpose;
+        invert(matrix,transpose);
+        const int n = matrix.size();
+        const auto& offsets = matrix.offsets();
+        const auto& keys = matrix.keys();
+        const auto& values = matrix.values();
+        const auto& t_offsets = transpose.offsets();
+        const auto& t_keys = transpose.keys();
+        const auto& t_values = transpose.values();
+
+        //Size of the union of the rows
+        std::vector<offset_type> sym_offsets(n+1,0);
+#pragma omp parallel for schedule(dynamic,1024)
+        for(int j = 0; j < n; ++j){
+          offset_type r = offsets[j], t = t_offsets[j];
+          offset_type num_elem = 0;
+          while(r < offsets[j+1] && t < t_offsets[j+1]){
+            if(keys[r] < t_keys[t]){ ++r; }
+            else if(t_keys[t] < keys[r]){ ++t; }
+            else{ ++r; ++t; }
+            ++num_elem;
+          }
+          sym_offsets[j+1] = num_elem + (offsets[j+1]-r) + (t_offsets[j+1]-t);
+        }
+        for(int j = 0; j < n; ++j){
+          sym_offsets[j+1] += sym_offsets[j];
+        }
+
+        std::vector<Key> sym_keys(sym_offsets[n]);
+        std::vector<T> sym_values(sym_offsets[n]);
+#pragma omp parallel for schedule(dynamic,1024)
+        for(int j = 0; j < n; ++j){
+          offset_type r = offsets[j], t = t_offsets[j], pos = sym_offsets[j];
+          while(r < offsets[j+1] || t < t_offsets[j+1]){
+            if(t == t_offsets[j+1] || (r < offsets[j+1] && keys[r] < t_keys[t])){
+              sym_keys[pos] = keys[r];
+              sym_values[pos] = static_cast<T>(values[r]*0.5);
+              ++r;
+            }else if(r == offsets[j+1] || t_keys[t] < keys[r]){
+              sym_keys[pos] = t_keys[t];
+              sym_values[pos] = static_cast<T>(t_values[t]*0.5);
+              ++t;
+            }else{
+              sym_keys[pos] = keys[r];
+              sym_values[pos] = static_cast<T>((values[r]+t_values[t])*0.5);
+              ++r;
+              ++t;
+            }
+            ++pos;
+          }
+        }
+        symmetric.assign(std::move(sym_offsets),std::move(sym_keys),std::move(sym_values));
+      }
+    };
   }
 }
 
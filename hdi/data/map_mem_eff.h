@@ -37,11 +37,29 @@
 #include <vector>
 #include <cstddef>
 #include <cassert>
+#include <algorithm>
 #include "hdi/utils/assert_by_exception.h"
 
 namespace hdi{
   namespace data{
 
+    //! Policy used to combine the values associated to the same key
+    enum class DuplicatePolicy{
+      Sum = 0,      //! values are accumulated
+      Max = 1,      //! the largest value is kept
+      Overwrite = 2 //! the last value is kept
+    };
+
+    //! Combine v in dst according to policy
+    template <class T>
+    inline void combineDuplicate(T& dst, const T& v, DuplicatePolicy policy){
+      switch(policy){
+        case DuplicatePolicy::Sum:        dst += v; break;
+        case DuplicatePolicy::Max:        dst = std::max(dst,v); break;
+        case DuplicatePolicy::Overwrite:  dst = v; break;
+      }
+    }
+
     //DO NOT CHANGE THE INDICES OUT SIDE
     template <class Key, class T>
     class MapMemEff{
@@ -78,6 +96,15 @@ namespace hdi{
       template <typename It>
       void initialize(It begin, It end, mapped_type thresh = 0);
 
+      //bulk construction
+      void reserve(size_t n){_memory.reserve(n);}
+      //! Append an element without keeping the map ordered. finalize() must be called before the map is accessed
+      void append(const key_type& k, const mapped_type& v){_memory.push_back(value_type(k,v));}
+      //! Order the appended elements and combine the duplicated keys. O(n log n) instead of the O(n^2) of repeated operator[]
+      void finalize(DuplicatePolicy policy = DuplicatePolicy::Sum);
+      //! Merge the elements of another map. The result is allocated once, values of common keys are combined according to policy
+      void merge(const MapMemEff& other, DuplicatePolicy policy = DuplicatePolicy::Sum);
+
       //!MEMORY ACCESS: With great power comes great responsibility!
       storage_type& memory(){return _memory;}
       //!MEMORY ACCESS: With great power comes great responsibility!
@@ -185,6 +212,59 @@ namespace hdi{
       }
     }
 
+    template <class Key, class T>
+    void MapMemEff<Key,T>::finalize(DuplicatePolicy policy){
+      if(_memory.size() < 2){
+        return;
+      }
+      //stable: with DuplicatePolicy::Overwrite the last appended value must win
+      std::stable_sort(_memory.begin(),_memory.end(),[](const value_type& a, const value_type& b){return a.first < b.first;});
+      size_t last = 0;
+      for(size_t i = 1; i < _memory.size(); ++i){
+        if(_memory[i].first == _memory[last].first){
+          combineDuplicate(_memory[last].second,_memory[i].second,policy);
+        }else{
+          _memory[++last] = _memory[i];
+        }
+      }
+      _memory.resize(last+1);
+    }
+
+    template <class Key, class T>
+    void MapMemEff<Key,T>::merge(const MapMemEff& other, DuplicatePolicy policy){
+      const storage_type& a = _memory;
+      const storage_type& b = other._memory;
+      //size of the union
+      size_t num_elem = 0;
+      {
+        size_t i = 0, j = 0;
+        while(i < a.size() && j < b.size()){
+          if(a[i].first < b[j].first){ ++i; }
+          else if(b[j].first < a[i].first){ ++j; }
+          else{ ++i; ++j; }
+          ++num_elem;
+        }
+        num_elem += (a.size()-i) + (b.size()-j);
+      }
+
+      storage_type res;
+      res.reserve(num_elem);
+      size_t i = 0, j = 0;
+      while(i < a.size() && j < b.size()){
+        if(a[i].first < b[j].first){
+          res.push_back(a[i++]);
+        }else if(b[j].first < a[i].first){
+          res.push_back(b[j++]);
+        }else{
+          res.push_back(a[i++]);
+          combineDuplicate(res.back().second,b[j++].second,policy);
+        }
+      }
+      res.insert(res.end(),a.begin()+i,a.end());
+      res.insert(res.end(),b.begin()+j,b.end());
+      _memory.swap(res);
+    }
+
   }
 }
 
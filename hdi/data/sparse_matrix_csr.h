@@ -0,0 +1,305 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef SPARSE_MATRIX_CSR_H
+#define SPARSE_MATRIX_CSR_H
+
+#include <utility>
+#include <vector>
+#include <cstddef>
+#include <iterator>
+#include <algorithm>
+#include "hdi/utils/assert_by_exception.h"
+
+namespace hdi{
+  namespace data{
+
+    //! Row of a SparseMatrixCSR
+    /*!
+      Lightweight view on a row of a SparseMatrixCSR. It exposes the interface of the maps used as rows of the sparse matrices
+      (iteration on (key,value) pairs sorted by key, size and find) but the structure of the row cannot be changed.
+      \note The iterators return a pair that is stored in the iterator, hence references to the elements are valid only until the iterator is incremented
+    */
+    template <class Key, class T>
+    class SparseMatrixCSRRow{
+    public:
+      typedef Key         key_type;
+      typedef T           mapped_type;
+      typedef std::pair<Key,T>  value_type;
+
+      class const_iterator{
+      public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<Key,T> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+
+      public:
+        const_iterator():_key(nullptr),_value(nullptr){}
+        const_iterator(const Key* key, const T* value):_key(key),_value(value){}
+        reference operator*()const{_current.first = *_key; _current.second = *_value; return _current;}
+        pointer operator->()const{return &(**this);}
+        const_iterator& operator++(){++_key; ++_value; return *this;}
+        const_iterator operator++(int){const_iterator res(*this); ++(*this); return res;}
+        bool operator==(const const_iterator& other)const{return _key == other._key;}
+        bool operator!=(const const_iterator& other)const{return _key != other._key;}
+
+      private:
+        const Key* _key;
+        const T* _value;
+        mutable value_type _current;
+      };
+      typedef const_iterator iterator;
+
+    public:
+      SparseMatrixCSRRow(const Key* keys, const T* values, size_t size):_keys(keys),_values(values),_size(size){}
+
+      size_t size()const{return _size;}
+      bool empty()const{return _size == 0;}
+
+      const_iterator begin()const {return const_iterator(_keys,_values);}
+      const_iterator end()const {return const_iterator(_keys+_size,_values+_size);}
+      const_iterator cbegin()const {return begin();}
+      const_iterator cend()const {return end();}
+
+      //! Binary search of a key, end() if the key is not in the row
+      const_iterator find(const key_type& k)const{
+        const Key* it = std::lower_bound(_keys,_keys+_size,k);
+        if(it == _keys+_size || *it != k){
+          return end();
+        }
+        return const_iterator(it,_values+(it-_keys));
+      }
+
+      //! Contiguous keys of the row
+      const Key* keys()const{return _keys;}
+      //! Contiguous values of the row
+      const T* values()const{return _values;}
+
+    private:
+      const Key* _keys;
+      const T* _values;
+      size_t _size;
+    };
+
+    //! Sparse matrix in Compressed Sparse Row format
+    /*!
+      Read-optimized sparse matrix: row offsets, keys and values are stored in three contiguous arrays and the keys of every row are sorted.
+      It can be used as sparse_scalar_matrix template argument in place of a std::vector of maps by the algorithms that do not change
+      the structure of the matrix. The matrix is usually built once from a vector of maps, e.g. SparseMatrixCSR<uint32_t,float> P(distribution);
+      \note Rows are returned by value as SparseMatrixCSRRow views
+    */
+    template <class Key, class T>
+    class SparseMatrixCSR{
+    public:
+      typedef Key         key_type;
+      typedef T           mapped_type;
+      typedef SparseMatrixCSRRow<Key,T> value_type; //! as in a std::vector of maps, value_type is the type of the rows
+      typedef size_t      offset_type;
+
+    public:
+      SparseMatrixCSR():_offsets(1,0){}
+      //! Matrix with num_rows empty rows
+      explicit SparseMatrixCSR(size_t num_rows):_offsets(num_rows+1,0){}
+      //! Copy of a sparse matrix implemented with a vector of maps
+      template <typename Map>
+      explicit SparseMatrixCSR(const std::vector<Map>& matrix){assign(matrix);}
+
+      //! Copy of a sparse matrix implemented with a vector of maps. Elements of the rows are sorted by key
+      template <typename Map>
+      void assign(const std::vector<Map>& matrix);
+      //! Initialize the matrix with the CSR arrays. Keys of every row must be sorted
+      void assign(std::vector<offset_type> offsets, std::vector<Key> keys, std::vector<T> values);
+      //! Copy the matrix in a vector of maps
+      template <typename Map>
+      void copyTo(std::vector<Map>& matrix)const;
+
+      //! Replace the rows in row_ids with the ones of source. Source must have the same number of rows
+      template <typename Matrix>
+      void replaceRows(const Matrix& source, const std::vector<unsigned int>& row_ids);
+
+      size_t size()const{return _offsets.size()-1;}
+      bool empty()const{return size() == 0;}
+      //! Number of elements in the matrix
+      size_t numElements()const{return _keys.size();}
+      //! Number of elements in a row
+      size_t rowSize(size_t i)const{return _offsets[i+1]-_offsets[i];}
+
+      value_type operator[](size_t i)const{return value_type(_keys.data()+_offsets[i],_values.data()+_offsets[i],_offsets[i+1]-_offsets[i]);}
+
+      void clear(){_offsets.assign(1,0); _keys.clear(); _values.clear();}
+      //! Append empty rows or remove the last ones
+      void resize(size_t num_rows);
+      void swap(SparseMatrixCSR& other){_offsets.swap(other._offsets); _keys.swap(other._keys); _values.swap(other._values);}
+      void shrink_to_fit(){_offsets.shrink_to_fit(); _keys.shrink_to_fit(); _values.shrink_to_fit();}
+
+      //! Memory occupied by the matrix in Bytes
+      double memoryOccupation()const{return double(_offsets.capacity())*sizeof(offset_type) + double(_keys.capacity())*sizeof(Key) + double(_values.capacity())*sizeof(T);}
+
+      //!MEMORY ACCESS: offsets of the rows, row i is stored in [offsets[i],offsets[i+1])
+      const std::vector<offset_type>& offsets()const{return _offsets;}
+      //!MEMORY ACCESS: keys of the elements
+      const std::vector<Key>& keys()const{return _keys;}
+      //!MEMORY ACCESS: values of the elements
+      const std::vector<T>& values()const{return _values;}
+      //!MEMORY ACCESS: values of the elements, the structure of the matrix does not change
+      std::vector<T>& values(){return _values;}
+
+    private:
+      //! Append to keys and values the elements of a row sorted by key
+      template <typename Row>
+      void appendRow(const Row& row, std::vector<Key>& keys, std::vector<T>& values)const;
+
+    private:
+      std::vector<offset_type> _offsets;
+      std::vector<Key> _keys;
+      std::vector<T> _values;
+    };
+
+/////////////////////////////////////////////////////////////////////////
+
+    template <class Key, class T>
+    template <typename Row>
+    void SparseMatrixCSR<Key,T>::appendRow(const Row& row, std::vector<Key>& keys, std::vector<T>& values)const{
+      const size_t begin = keys.size();
+      bool sorted = true;
+      for(const auto& e: row){
+        if(keys.size() > begin && !(keys.back() < e.first)){
+          sorted = false;
+        }
+        keys.push_back(e.first);
+        values.push_back(e.second);
+      }
+      if(!sorted){ //e.g. std::unordered_map
+        std::vector<std::pair<Key,T>> elements;
+        elements.reserve(keys.size()-begin);
+        for(size_t i = begin; i < keys.size(); ++i){
+          elements.push_back(std::make_pair(keys[i],values[i]));
+        }
+        std::sort(elements.begin(),elements.end(),[](const std::pair<Key,T>& a, const std::pair<Key,T>& b){return a.first < b.first;});
+        for(size_t i = 0; i < elements.size(); ++i){
+          keys[begin+i] = elements[i].first;
+          values[begin+i] = elements[i].second;
+        }
+      }
+    }
+
+    template <class Key, class T>
+    template <typename Map>
+    void SparseMatrixCSR<Key,T>::assign(const std::vector<Map>& matrix){
+      const size_t n = matrix.size();
+      std::vector<offset_type> offsets(n+1,0);
+      for(size_t i = 0; i < n; ++i){
+        offsets[i+1] = offsets[i] + matrix[i].size();
+      }
+      std::vector<Key> keys;
+      std::vector<T> values;
+      keys.reserve(offsets[n]);
+      values.reserve(offsets[n]);
+      for(size_t i = 0; i < n; ++i){
+        appendRow(matrix[i],keys,values);
+      }
+      _offsets.swap(offsets);
+      _keys.swap(keys);
+      _values.swap(values);
+    }
+
+    template <class Key, class T>
+    void SparseMatrixCSR<Key,T>::assign(std::vector<offset_type> offsets, std::vector<Key> keys, std::vector<T> values){
+      checkAndThrowLogic(offsets.size() > 0 && offsets.front() == 0, "SparseMatrixCSR: invalid offsets");
+      checkAndThrowLogic(offsets.back() == keys.size() && keys.size() == values.size(), "SparseMatrixCSR: the offsets do not agree with the number of elements");
+      for(size_t i = 0; i+1 < offsets.size(); ++i){
+        checkAndThrowLogic(offsets[i] <= offsets[i+1], "SparseMatrixCSR: invalid offsets");
+        for(size_t e = offsets[i]+1; e < offsets[i+1]; ++e){
+          checkAndThrowLogic(keys[e-1] < keys[e], "SparseMatrixCSR: keys are not sorted");
+        }
+      }
+      _offsets.swap(offsets);
+      _keys.swap(keys);
+      _values.swap(values);
+    }
+
+    template <class Key, class T>
+    template <typename Map>
+    void SparseMatrixCSR<Key,T>::copyTo(std::vector<Map>& matrix)const{
+      matrix.clear();
+      matrix.resize(size());
+      for(size_t i = 0; i < size(); ++i){
+        for(offset_type e = _offsets[i]; e < _offsets[i+1]; ++e){
+          matrix[i][_keys[e]] = _values[e];
+        }
+      }
+    }
+
+    template <class Key, class T>
+    template <typename Matrix>
+    void SparseMatrixCSR<Key,T>::replaceRows(const Matrix& source, const std::vector<unsigned int>& row_ids){
+      checkAndThrowLogic(source.size() == size(), "SparseMatrixCSR: the number of rows does not agree");
+      std::vector<char> replaced(size(),0);
+      for(auto r: row_ids){
+        checkAndThrowLogic(r < size(), "SparseMatrixCSR: invalid row");
+        replaced[r] = 1;
+      }
+
+      //The matrix is rebuilt in a single pass
+      std::vector<offset_type> offsets(size()+1,0);
+      std::vector<Key> keys;
+      std::vector<T> values;
+      keys.reserve(_keys.size());
+      values.reserve(_values.size());
+      for(size_t i = 0; i < size(); ++i){
+        if(replaced[i]){
+          appendRow(source[i],keys,values);
+        }else{
+          keys.insert(keys.end(),_keys.begin()+_offsets[i],_keys.begin()+_offsets[i+1]);
+          values.insert(values.end(),_values.begin()+_offsets[i],_values.begin()+_offsets[i+1]);
+        }
+        offsets[i+1] = keys.size();
+      }
+      _offsets.swap(offsets);
+      _keys.swap(keys);
+      _values.swap(values);
+    }
+
+    template <class Key, class T>
+    void SparseMatrixCSR<Key,T>::resize(size_t num_rows){
+      if(num_rows < size()){
+        _keys.resize(_offsets[num_rows]);
+        _values.resize(_offsets[num_rows]);
+      }
+      _offsets.resize(num_rows+1,_offsets.back());
+    }
+
+  }
+}
+#endif
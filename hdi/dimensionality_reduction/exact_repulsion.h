@@ -0,0 +1,87 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef EXACT_REPULSION_H
+#define EXACT_REPULSION_H
+
+#include <vector>
+#include <utility>
+#include "hdi/utils/assert_by_exception.h"
+
+namespace hdi{
+  namespace dr{
+
+    //! Exact repulsive forces of t-SNE computed on all the pairs of points
+    /*!
+      Repulsive forces and normalization of t-SNE computed without approximations and without storing Q.
+      The points are split in tiles that fit in cache and every pair of tiles in the upper triangle is visited once,
+      the kernel q_ij is computed on the fly and applied to both points of the pair.
+      Pairs of tiles are distributed over parallel blocks, each accumulating the forces in a private buffer.
+      The inner loops are specialized for 1D, 2D and 3D embeddings and written as vectorizable reductions.
+      \author Nicola Pezzotti
+    */
+    template <typename scalar_type>
+    class ExactRepulsion{
+    public:
+      typedef double hp_scalar_type;
+
+    public:
+      ExactRepulsion();
+
+      //! Set the number of points in a tile
+      void setTileSize(unsigned int tile_size){
+        checkAndThrowLogic(tile_size > 0,"Invalid tile size");
+        _tile_size = tile_size;
+      }
+      //! Number of points in a tile
+      unsigned int tileSize()const{return _tile_size;}
+
+      //! Compute the repulsive forces and the normalization of N points with D dimensions. The forces are added to neg_f (D values per point) and the normalization to sum_Q
+      void computeNonEdgeForces(unsigned int D, const scalar_type* positions, unsigned int N, hp_scalar_type* neg_f, hp_scalar_type& sum_Q);
+      //! Memory occupation in MB
+      double memoryOccupation()const;
+
+    private:
+      //! Interaction of all the pairs of points between tiles a and b, or inside tile a if a == b. The forces are stored by dimension in forces
+      template <unsigned int D>
+      void interactTiles(unsigned int dim, unsigned int N, unsigned int a, unsigned int b, hp_scalar_type* forces, hp_scalar_type& sum_Q)const;
+
+    private:
+      unsigned int _tile_size;
+      std::vector<hp_scalar_type> _coordinates;                 //! positions stored by dimension
+      std::vector<std::pair<unsigned int, unsigned int>> _tile_pairs;
+      std::vector<std::vector<hp_scalar_type>> _block_forces;   //! forces accumulated by every parallel block, stored by dimension
+    };
+
+  }
+}
+#endif
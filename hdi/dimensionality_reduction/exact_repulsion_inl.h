@@ -0,0 +1,246 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef EXACT_REPULSION_INL
+#define EXACT_REPULSION_INL
+
+#include "hdi/dimensionality_reduction/exact_repulsion.h"
+#include <algorithm>
+#include <thread>
+
+#ifdef __USE_GCD__
+#include <dispatch/dispatch.h>
+#endif
+
+namespace hdi{
+  namespace dr{
+
+    template <typename scalar_type>
+    ExactRepulsion<scalar_type>::ExactRepulsion():
+      _tile_size(256)
+    {}
+
+    template <typename scalar_type>
+    template <unsigned int D>
+    void ExactRepulsion<scalar_type>::interactTiles(unsigned int dim, unsigned int N, unsigned int a, unsigned int b, hp_scalar_type* forces, hp_scalar_type& sum_Q)const{
+      const unsigned int num_dims = (D == 0) ? dim : D;
+      const unsigned int a_begin = a * _tile_size;
+      const unsigned int a_end = std::min(N, a_begin + _tile_size);
+      const unsigned int b_begin = b * _tile_size;
+      const unsigned int b_end = std::min(N, b_begin + _tile_size);
+      const hp_scalar_type* coordinates = _coordinates.data();
+
+      hp_scalar_type sum = 0;
+      for(unsigned int i = a_begin; i < a_end; ++i){
+        const unsigned int j_begin = (a == b) ? i + 1 : b_begin;
+        hp_scalar_type sum_i = 0;
+        if(D == 1){
+          const hp_scalar_type* x = coordinates;
+          hp_scalar_type* f_x = forces;
+          const hp_scalar_type x_i = x[i];
+          hp_scalar_type f_x_i = 0;
+#pragma omp simd reduction(+:sum_i,f_x_i)
+          for(unsigned int j = j_begin; j < b_end; ++j){
+            const hp_scalar_type diff_x = x_i - x[j];
+            const hp_scalar_type q = 1. / (1. + diff_x * diff_x);
+            const hp_scalar_type q_sq = q * q;
+            sum_i += q;
+            f_x_i += q_sq * diff_x;
+            f_x[j] -= q_sq * diff_x;
+          }
+          f_x[i] += f_x_i;
+        }else if(D == 2){
+          const hp_scalar_type* x = coordinates;
+          const hp_scalar_type* y = coordinates + N;
+          hp_scalar_type* f_x = forces;
+          hp_scalar_type* f_y = forces + N;
+          const hp_scalar_type x_i = x[i];
+          const hp_scalar_type y_i = y[i];
+          hp_scalar_type f_x_i = 0;
+          hp_scalar_type f_y_i = 0;
+#pragma omp simd reduction(+:sum_i,f_x_i,f_y_i)
+          for(unsigned int j = j_begin; j < b_end; ++j){
+            const hp_scalar_type diff_x = x_i - x[j];
+            const hp_scalar_type diff_y = y_i - y[j];
+            const hp_scalar_type q = 1. / (1. + diff_x * diff_x + diff_y * diff_y);
+            const hp_scalar_type q_sq = q * q;
+            sum_i += q;
+            f_x_i += q_sq * diff_x;
+            f_y_i += q_sq * diff_y;
+            f_x[j] -= q_sq * diff_x;
+            f_y[j] -= q_sq * diff_y;
+          }
+          f_x[i] += f_x_i;
+          f_y[i] += f_y_i;
+        }else if(D == 3){
+          const hp_scalar_type* x = coordinates;
+          const hp_scalar_type* y = coordinates + N;
+          const hp_scalar_type* z = coordinates + 2 * size_t(N);
+          hp_scalar_type* f_x = forces;
+          hp_scalar_type* f_y = forces + N;
+          hp_scalar_type* f_z = forces + 2 * size_t(N);
+          const hp_scalar_type x_i = x[i];
+          const hp_scalar_type y_i = y[i];
+          const hp_scalar_type z_i = z[i];
+          hp_scalar_type f_x_i = 0;
+          hp_scalar_type f_y_i = 0;
+          hp_scalar_type f_z_i = 0;
+#pragma omp simd reduction(+:sum_i,f_x_i,f_y_i,f_z_i)
+          for(unsigned int j = j_begin; j < b_end; ++j){
+            const hp_scalar_type diff_x = x_i - x[j];
+            const hp_scalar_type diff_y = y_i - y[j];
+            const hp_scalar_type diff_z = z_i - z[j];
+            const hp_scalar_type q = 1. / (1. + diff_x * diff_x + diff_y * diff_y + diff_z * diff_z);
+            const hp_scalar_type q_sq = q * q;
+            sum_i += q;
+            f_x_i += q_sq * diff_x;
+            f_y_i += q_sq * diff_y;
+            f_z_i += q_sq * diff_z;
+            f_x[j] -= q_sq * diff_x;
+            f_y[j] -= q_sq * diff_y;
+            f_z[j] -= q_sq * diff_z;
+          }
+          f_x[i] += f_x_i;
+          f_y[i] += f_y_i;
+          f_z[i] += f_z_i;
+        }else{
+          for(unsigned int j = j_begin; j < b_end; ++j){
+            hp_scalar_type dist_sq = 0;
+            for(unsigned int d = 0; d < num_dims; ++d){
+              const hp_scalar_type diff = coordinates[d * N + i] - coordinates[d * N + j];
+              dist_sq += diff * diff;
+            }
+            const hp_scalar_type q = 1. / (1. + dist_sq);
+            const hp_scalar_type q_sq = q * q;
+            sum_i += q;
+            for(unsigned int d = 0; d < num_dims; ++d){
+              const hp_scalar_type force = q_sq * (coordinates[d * N + i] - coordinates[d * N + j]);
+              forces[d * N + i] += force;
+              forces[d * N + j] -= force;
+            }
+          }
+        }
+        sum += sum_i;
+      }
+      sum_Q += sum;
+    }
+
+    template <typename scalar_type>
+    void ExactRepulsion<scalar_type>::computeNonEdgeForces(unsigned int D, const scalar_type* positions, unsigned int N, hp_scalar_type* neg_f, hp_scalar_type& sum_Q){
+      if(N == 0){
+        return;
+      }
+      const unsigned int num_tiles = (N + _tile_size - 1) / _tile_size;
+
+      //Positions stored by dimension, so that the inner loops read contiguous coordinates
+      _coordinates.resize(size_t(N) * D);
+      for(unsigned int i = 0; i < N; ++i){
+        for(unsigned int d = 0; d < D; ++d){
+          _coordinates[size_t(d) * N + i] = positions[size_t(i) * D + d];
+        }
+      }
+
+      //Pairs of tiles in the upper triangle, q_ij is symmetric
+      _tile_pairs.clear();
+      for(unsigned int a = 0; a < num_tiles; ++a){
+        for(unsigned int b = a; b < num_tiles; ++b){
+          _tile_pairs.push_back(std::make_pair(a, b));
+        }
+      }
+      const unsigned int num_pairs = static_cast<unsigned int>(_tile_pairs.size());
+      const unsigned int num_blocks = std::max(1u, std::min(num_pairs, std::thread::hardware_concurrency()));
+
+      //Pairs are assigned to the blocks in round robin, every block accumulates the forces of both tiles in a private buffer
+      _block_forces.resize(num_blocks);
+      std::vector<hp_scalar_type> block_sum_Q(num_blocks, 0);
+      std::vector<hp_scalar_type>* block_forces = _block_forces.data();
+      hp_scalar_type* block_sum_Q_ptr = block_sum_Q.data();
+      const std::pair<unsigned int, unsigned int>* tile_pairs = _tile_pairs.data();
+#ifdef __USE_GCD__
+      dispatch_apply(num_blocks, dispatch_get_global_queue(0, 0), ^(size_t b) {
+#else
+#pragma omp parallel for schedule(static,1)
+      for(int b = 0; b < int(num_blocks); ++b) {
+#endif //__USE_GCD__
+        std::vector<hp_scalar_type>& forces = block_forces[b];
+        forces.assign(size_t(N) * D, 0);
+        hp_scalar_type sum = 0;
+        for(unsigned int p = b; p < num_pairs; p += num_blocks){
+          switch(D){
+            case 1: interactTiles<1>(D, N, tile_pairs[p].first, tile_pairs[p].second, forces.data(), sum); break;
+            case 2: interactTiles<2>(D, N, tile_pairs[p].first, tile_pairs[p].second, forces.data(), sum); break;
+            case 3: interactTiles<3>(D, N, tile_pairs[p].first, tile_pairs[p].second, forces.data(), sum); break;
+            default: interactTiles<0>(D, N, tile_pairs[p].first, tile_pairs[p].second, forces.data(), sum); break;
+          }
+        }
+        block_sum_Q_ptr[b] = sum;
+      }
+#ifdef __USE_GCD__
+      );
+#endif
+
+      //Reduction of the private buffers
+#ifdef __USE_GCD__
+      dispatch_apply(N, dispatch_get_global_queue(0, 0), ^(size_t i) {
+#else
+#pragma omp parallel for
+      for(int i = 0; i < int(N); ++i) {
+#endif //__USE_GCD__
+        for(unsigned int d = 0; d < D; ++d){
+          hp_scalar_type force = 0;
+          for(unsigned int b = 0; b < num_blocks; ++b){
+            force += block_forces[b][size_t(d) * N + i];
+          }
+          neg_f[size_t(i) * D + d] += force;
+        }
+      }
+#ifdef __USE_GCD__
+      );
+#endif
+      for(unsigned int b = 0; b < num_blocks; ++b){
+        sum_Q += 2 * block_sum_Q[b];
+      }
+    }
+
+    template <typename scalar_type>
+    double ExactRepulsion<scalar_type>::memoryOccupation()const{
+      double mem = _coordinates.capacity() * sizeof(hp_scalar_type);
+      mem += _tile_pairs.capacity() * sizeof(std::pair<unsigned int, unsigned int>);
+      for(const auto& forces: _block_forces){
+        mem += forces.capacity() * sizeof(hp_scalar_type);
+      }
+      return mem / 1024 / 1024;
+    }
+
+  }
+}
+#endif
@@ -0,0 +1,132 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef FFT_REPULSION_H
+#define FFT_REPULSION_H
+
+#include <vector>
+#include <complex>
+#include "hdi/utils/assert_by_exception.h"
+
+namespace hdi{
+  namespace dr{
+
+    //! Repulsive forces of t-SNE computed by interpolation on an equispaced grid and FFT convolution
+    /*!
+      Repulsive forces and normalization of t-SNE computed as in FIt-SNE (Linderman et al., Nature Methods 2019).
+      The embedding is covered by a square grid of intervals, each containing a fixed number of equispaced interpolation nodes.
+      The charges of the points are spread on the nodes with Lagrange polynomials, the Cauchy kernels q and q^2 are applied
+      to the nodes with a convolution computed by FFT and the potentials are interpolated back to the points.
+      The cost is linear in the number of points plus the cost of the FFTs on the grid.
+      1D and 2D embeddings are supported.
+      \author Nicola Pezzotti
+    */
+    template <typename scalar_type>
+    class FFTRepulsion{
+    public:
+      typedef double hp_scalar_type;
+      typedef std::complex<hp_scalar_type> complex_type;
+
+    public:
+      FFTRepulsion();
+
+      //! Set the number of interpolation nodes in each interval
+      void setNumberOfInterpolationNodes(unsigned int num_nodes){
+        checkAndThrowLogic(num_nodes > 0,"Invalid number of interpolation nodes");
+        _num_interpolation_nodes = num_nodes;
+      }
+      //! Number of interpolation nodes in each interval
+      unsigned int numberOfInterpolationNodes()const{return _num_interpolation_nodes;}
+      //! Set the minimum number of intervals per dimension
+      void setMinimumNumberOfIntervals(unsigned int num_intervals){
+        checkAndThrowLogic(num_intervals > 0,"Invalid number of intervals");
+        _min_num_intervals = num_intervals;
+      }
+      //! Minimum number of intervals per dimension
+      unsigned int minimumNumberOfIntervals()const{return _min_num_intervals;}
+      //! Set the number of intervals per unit of length in the embedding, the grid is refined as the embedding expands
+      void setIntervalsPerUnit(double intervals_per_unit){
+        checkAndThrowLogic(intervals_per_unit > 0,"Invalid number of intervals per unit");
+        _intervals_per_unit = intervals_per_unit;
+      }
+      //! Number of intervals per unit of length in the embedding
+      double intervalsPerUnit()const{return _intervals_per_unit;}
+      //! Number of intervals per dimension used in the last computation
+      unsigned int numberOfIntervals()const{return _num_intervals;}
+
+      //! Compute the repulsive forces and the normalization of N points with D dimensions. The forces are added to neg_f (D values per point) and the normalization to sum_Q
+      void computeNonEdgeForces(unsigned int D, const scalar_type* positions, unsigned int N, hp_scalar_type* neg_f, hp_scalar_type& sum_Q);
+      //! Memory occupation in MB
+      double memoryOccupation()const;
+
+    private:
+      //! Square domain and number of intervals
+      void setupGrid(unsigned int D, const scalar_type* positions, unsigned int N);
+      //! First interpolation node and Lagrange weights of every point
+      void computeInterpolationWeights(unsigned int D, const scalar_type* positions, unsigned int N);
+      //! Spread the charges 1, y_1 ... y_D of the points on the nodes, stored in the padded FFT buffers
+      void spreadCharges(unsigned int D, const scalar_type* positions, unsigned int N);
+      //! FFT of the kernels q and q^2 evaluated on the offsets between nodes, packed in the real and imaginary parts
+      void computeKernelsFFT(unsigned int D);
+      //! In place FFT of a D-dimensional array of _fft_size^D elements
+      void fft(unsigned int D, complex_type* data, bool inverse)const;
+      //! In place radix-2 FFT of _fft_size contiguous elements
+      void fft(complex_type* data, bool inverse)const;
+      //! Product of two complex numbers without the checks on infinities of std::complex
+      static complex_type multiply(const complex_type& a, const complex_type& b){
+        return complex_type(a.real()*b.real() - a.imag()*b.imag(), a.real()*b.imag() + a.imag()*b.real());
+      }
+
+    private:
+      unsigned int _num_interpolation_nodes;
+      unsigned int _min_num_intervals;
+      double _intervals_per_unit;
+
+      unsigned int _num_intervals;          //! intervals per dimension
+      unsigned int _grid_size;              //! interpolation nodes per dimension
+      unsigned int _fft_size;               //! power of two, at least twice the number of nodes per dimension
+      hp_scalar_type _min;                  //! corner of the square domain
+      hp_scalar_type _spacing;              //! distance between two interpolation nodes
+
+      std::vector<unsigned int> _first_node;              //! first interpolation node of every point, D values per point
+      std::vector<hp_scalar_type> _interpolation_weights; //! Lagrange weights of every point, D * _num_interpolation_nodes values per point
+      std::vector<hp_scalar_type> _lagrange_denominators;
+      std::vector<complex_type> _twiddles;
+      std::vector<complex_type> _kernels_fft;             //! FFT of q (real part) and q^2 (imaginary part)
+      std::vector<complex_type> _charges_fft;             //! charges 1, y_1 ... y_D packed in pairs
+      std::vector<complex_type> _potentials_fft;          //! potentials q, q^2, q^2 * y_1 ... q^2 * y_D packed in pairs
+      std::vector<std::vector<hp_scalar_type>> _block_charges;
+    };
+
+  }
+}
+#endif
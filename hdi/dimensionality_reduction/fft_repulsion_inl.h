@@ -0,0 +1,450 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef FFT_REPULSION_INL
+#define FFT_REPULSION_INL
+
+#include "hdi/dimensionality_reduction/fft_repulsion.h"
+#include <cmath>
+#include <algorithm>
+#include <thread>
+
+#ifdef __USE_GCD__
+#include <dispatch/dispatch.h>
+#endif
+
+namespace hdi{
+  namespace dr{
+
+    template <typename scalar_type>
+    FFTRepulsion<scalar_type>::FFTRepulsion():
+      _num_interpolation_nodes(3),
+      _min_num_intervals(50),
+      _intervals_per_unit(1),
+      _num_intervals(0),
+      _grid_size(0),
+      _fft_size(0),
+      _min(0),
+      _spacing(1)
+    {}
+
+    template <typename scalar_type>
+    void FFTRepulsion<scalar_type>::computeNonEdgeForces(unsigned int D, const scalar_type* positions, unsigned int N, hp_scalar_type* neg_f, hp_scalar_type& sum_Q){
+      checkAndThrowLogic(D == 1 || D == 2,"FFT interpolation supports only 1D and 2D embeddings");
+      if(N == 0){
+        return;
+      }
+      setupGrid(D, positions, N);
+      computeInterpolationWeights(D, positions, N);
+      spreadCharges(D, positions, N);
+      computeKernelsFFT(D);
+
+      // The kernels are real and even, hence their transforms are real and the convolution of a complex signal convolves
+      // its real and imaginary parts independently. Two real grids are packed in every FFT:
+      // charges 0 = (1, y_1), 1 = (y_2, 1). Potentials 0 = q^2 * charges 0, 1 = q * charges 1 (2D) or charges 0 (1D), 2 = q^2 * charges 1 (2D)
+      const unsigned int num_charges = (D == 1) ? 1 : 2;
+      const unsigned int num_potentials = (D == 1) ? 2 : 3;
+      const size_t fft_elements = (D == 1) ? size_t(_fft_size) : size_t(_fft_size) * _fft_size;
+      for(unsigned int c = 0; c < num_charges; ++c){
+        fft(D, _charges_fft.data() + c * fft_elements, false);
+      }
+      _potentials_fft.resize(num_potentials * fft_elements);
+      const complex_type* kernels_fft = _kernels_fft.data();
+      const complex_type* charges_fft = _charges_fft.data();
+      complex_type* potentials_fft = _potentials_fft.data();
+#ifdef __USE_GCD__
+      dispatch_apply(fft_elements, dispatch_get_global_queue(0, 0), ^(size_t i) {
+#else
+#pragma omp parallel for
+      for(int i = 0; i < int(fft_elements); ++i) {
+#endif //__USE_GCD__
+        const hp_scalar_type kernel_q = kernels_fft[i].real();
+        const hp_scalar_type kernel_q_sq = kernels_fft[i].imag();
+        const complex_type& last_charges = charges_fft[(num_charges - 1) * fft_elements + i];
+        potentials_fft[i] = kernel_q_sq * charges_fft[i];
+        potentials_fft[fft_elements + i] = kernel_q * last_charges;
+        if(num_potentials == 3){
+          potentials_fft[2 * fft_elements + i] = kernel_q_sq * last_charges;
+        }
+      }
+#ifdef __USE_GCD__
+      );
+#endif
+      for(unsigned int c = 0; c < num_potentials; ++c){
+        fft(D, _potentials_fft.data() + c * fft_elements, true);
+      }
+
+      // Interpolation of the potentials on the points. The interaction of a point with itself, q = 1, is removed from the normalization
+      const unsigned int p = _num_interpolation_nodes;
+      const unsigned int fft_size = _fft_size;
+      const hp_scalar_type scale = hp_scalar_type(1) / fft_elements;
+      const unsigned int* first_node = _first_node.data();
+      const hp_scalar_type* weights = _interpolation_weights.data();
+      std::vector<hp_scalar_type> point_sum_Q(N, 0);
+      hp_scalar_type* point_sum_Q_ptr = point_sum_Q.data();
+#ifdef __USE_GCD__
+      dispatch_apply(N, dispatch_get_global_queue(0, 0), ^(size_t i) {
+#else
+#pragma omp parallel for
+      for(int i = 0; i < int(N); ++i) {
+#endif //__USE_GCD__
+        // phi = q, q^2, q^2 * y_1 ... q^2 * y_D
+        hp_scalar_type phi[4] = {0, 0, 0, 0};
+        const hp_scalar_type* w = weights + size_t(i) * D * p;
+        if(D == 1){
+          for(unsigned int k = 0; k < p; ++k){
+            const size_t node = first_node[i] + k;
+            phi[0] += w[k] * potentials_fft[fft_elements + node].real();
+            phi[1] += w[k] * potentials_fft[node].real();
+            phi[2] += w[k] * potentials_fft[node].imag();
+          }
+        }else{
+          for(unsigned int ky = 0; ky < p; ++ky){
+            for(unsigned int kx = 0; kx < p; ++kx){
+              const size_t node = size_t(first_node[size_t(i) * 2 + 1] + ky) * fft_size + first_node[size_t(i) * 2] + kx;
+              const hp_scalar_type wxy = w[kx] * w[p + ky];
+              phi[0] += wxy * potentials_fft[fft_elements + node].imag();
+              phi[1] += wxy * potentials_fft[node].real();
+              phi[2] += wxy * potentials_fft[node].imag();
+              phi[3] += wxy * potentials_fft[2 * fft_elements + node].real();
+            }
+          }
+        }
+        for(unsigned int d = 0; d < D; ++d){
+          neg_f[size_t(i) * D + d] += (positions[size_t(i) * D + d] * phi[1] - phi[2 + d]) * scale;
+        }
+        point_sum_Q_ptr[i] = phi[0] * scale - 1;
+      }
+#ifdef __USE_GCD__
+      );
+#endif
+
+      for(unsigned int i = 0; i < N; ++i){
+        sum_Q += point_sum_Q[i];
+      }
+    }
+
+    template <typename scalar_type>
+    void FFTRepulsion<scalar_type>::setupGrid(unsigned int D, const scalar_type* positions, unsigned int N){
+      hp_scalar_type min_pos = positions[0];
+      hp_scalar_type max_pos = positions[0];
+      for(size_t i = 0; i < size_t(N) * D; ++i){
+        min_pos = std::min<hp_scalar_type>(min_pos, positions[i]);
+        max_pos = std::max<hp_scalar_type>(max_pos, positions[i]);
+      }
+      hp_scalar_type range = max_pos - min_pos;
+      if(range <= 0){
+        range = 1;
+      }
+
+      // The padded grid has a power of two size, the intervals that fit in it are used to increase the accuracy for free
+      const unsigned int p = _num_interpolation_nodes;
+      const unsigned int num_intervals = std::max<unsigned int>(_min_num_intervals, static_cast<unsigned int>(std::ceil(range * _intervals_per_unit)));
+      unsigned int fft_size = 2;
+      while(fft_size < 2 * num_intervals * p){
+        fft_size <<= 1;
+      }
+      _num_intervals = (fft_size / 2) / p;
+      _grid_size = _num_intervals * p;
+      _min = min_pos;
+      _spacing = range / _num_intervals / p;
+
+      if(fft_size != _fft_size){
+        _fft_size = fft_size;
+        _twiddles.resize(fft_size / 2);
+        const hp_scalar_type pi = 3.14159265358979323846;
+        for(unsigned int k = 0; k < fft_size / 2; ++k){
+          _twiddles[k] = complex_type(std::cos(-2 * pi * k / fft_size), std::sin(-2 * pi * k / fft_size));
+        }
+      }
+      if(_lagrange_denominators.size() != p){
+        _lagrange_denominators.assign(p, 1);
+        for(unsigned int k = 0; k < p; ++k){
+          for(unsigned int m = 0; m < p; ++m){
+            if(m != k){
+              _lagrange_denominators[k] *= hp_scalar_type(int(k) - int(m));
+            }
+          }
+        }
+      }
+    }
+
+    template <typename scalar_type>
+    void FFTRepulsion<scalar_type>::computeInterpolationWeights(unsigned int D, const scalar_type* positions, unsigned int N){
+      const unsigned int p = _num_interpolation_nodes;
+      _first_node.resize(size_t(N) * D);
+      _interpolation_weights.resize(size_t(N) * D * p);
+      unsigned int* first_node = _first_node.data();
+      hp_scalar_type* weights = _interpolation_weights.data();
+      const hp_scalar_type* denominators = _lagrange_denominators.data();
+      const hp_scalar_type min_pos = _min;
+      const hp_scalar_type spacing = _spacing;
+      const unsigned int num_intervals = _num_intervals;
+
+#ifdef __USE_GCD__
+      dispatch_apply(size_t(N) * D, dispatch_get_global_queue(0, 0), ^(size_t i) {
+#else
+#pragma omp parallel for
+      for(int i = 0; i < int(N * D); ++i) {
+#endif //__USE_GCD__
+        // Position in units of node spacing, nodes are in the middle of their cells
+        const hp_scalar_type t = (positions[i] - min_pos) / spacing;
+        const unsigned int interval = std::min<unsigned int>(static_cast<unsigned int>(t / p), num_intervals - 1);
+        first_node[i] = interval * p;
+        const hp_scalar_type local = t - 0.5 - first_node[i];
+        for(unsigned int k = 0; k < p; ++k){
+          hp_scalar_type w = 1;
+          for(unsigned int m = 0; m < p; ++m){
+            if(m != k){
+              w *= local - m;
+            }
+          }
+          weights[size_t(i) * p + k] = w / denominators[k];
+        }
+      }
+#ifdef __USE_GCD__
+      );
+#endif
+    }
+
+    template <typename scalar_type>
+    void FFTRepulsion<scalar_type>::spreadCharges(unsigned int D, const scalar_type* positions, unsigned int N){
+      const unsigned int p = _num_interpolation_nodes;
+      const unsigned int num_charges = D + 1;
+      const size_t grid_elements = (D == 1) ? size_t(_grid_size) : size_t(_grid_size) * _grid_size;
+      const unsigned int grid_size = _grid_size;
+      const unsigned int num_blocks = std::max(1u, std::min(N, std::thread::hardware_concurrency()));
+
+      // Points may share nodes, hence every block spreads its charges on a private grid
+      _block_charges.resize(num_blocks);
+      std::vector<hp_scalar_type>* block_charges = _block_charges.data();
+      const unsigned int* first_node = _first_node.data();
+      const hp_scalar_type* weights = _interpolation_weights.data();
+#ifdef __USE_GCD__
+      dispatch_apply(num_blocks, dispatch_get_global_queue(0, 0), ^(size_t b) {
+#else
+#pragma omp parallel for schedule(static,1)
+      for(int b = 0; b < int(num_blocks); ++b) {
+#endif //__USE_GCD__
+        std::vector<hp_scalar_type>& charges = block_charges[b];
+        charges.assign(num_charges * grid_elements, 0);
+        const unsigned int begin = static_cast<unsigned int>(size_t(N) * b / num_blocks);
+        const unsigned int end = static_cast<unsigned int>(size_t(N) * (b + 1) / num_blocks);
+        for(unsigned int i = begin; i < end; ++i){
+          const hp_scalar_type* w = weights + size_t(i) * D * p;
+          const scalar_type* y = positions + size_t(i) * D;
+          if(D == 1){
+            for(unsigned int k = 0; k < p; ++k){
+              const size_t node = first_node[i] + k;
+              charges[node] += w[k];
+              charges[grid_elements + node] += w[k] * y[0];
+            }
+          }else{
+            for(unsigned int ky = 0; ky < p; ++ky){
+              for(unsigned int kx = 0; kx < p; ++kx){
+                const size_t node = size_t(first_node[size_t(i) * 2 + 1] + ky) * grid_size + first_node[size_t(i) * 2] + kx;
+                const hp_scalar_type wxy = w[kx] * w[p + ky];
+                charges[node] += wxy;
+                charges[grid_elements + node] += wxy * y[0];
+                charges[2 * grid_elements + node] += wxy * y[1];
+              }
+            }
+          }
+        }
+      }
+#ifdef __USE_GCD__
+      );
+#endif
+
+      // Reduction of the private grids in the zero-padded FFT buffers
+      const unsigned int fft_size = _fft_size;
+      const size_t fft_elements = (D == 1) ? size_t(_fft_size) : size_t(_fft_size) * _fft_size;
+      _charges_fft.assign(((D == 1) ? 1 : 2) * fft_elements, complex_type(0, 0));
+      complex_type* charges_fft = _charges_fft.data();
+#ifdef __USE_GCD__
+      dispatch_apply(grid_elements, dispatch_get_global_queue(0, 0), ^(size_t node) {
+#else
+#pragma omp parallel for
+      for(int node = 0; node < int(grid_elements); ++node) {
+#endif //__USE_GCD__
+        const size_t padded_node = (D == 1) ? size_t(node) : size_t(node / grid_size) * fft_size + node % grid_size;
+        hp_scalar_type charge[3] = {0, 0, 0};
+        for(unsigned int b = 0; b < num_blocks; ++b){
+          for(unsigned int c = 0; c < num_charges; ++c){
+            charge[c] += block_charges[b][c * grid_elements + node];
+          }
+        }
+        // Packed as (1, y_1) and (y_2, 1)
+        charges_fft[padded_node] = complex_type(charge[0], charge[1]);
+        if(D == 2){
+          charges_fft[fft_elements + padded_node] = complex_type(charge[2], charge[0]);
+        }
+      }
+#ifdef __USE_GCD__
+      );
+#endif
+    }
+
+    template <typename scalar_type>
+    void FFTRepulsion<scalar_type>::computeKernelsFFT(unsigned int D){
+      const unsigned int fft_size = _fft_size;
+      const unsigned int grid_size = _grid_size;
+      const hp_scalar_type spacing_sq = _spacing * _spacing;
+      const size_t fft_elements = (D == 1) ? size_t(_fft_size) : size_t(_fft_size) * _fft_size;
+      _kernels_fft.resize(fft_elements);
+      complex_type* kernels_fft = _kernels_fft.data();
+
+      // Circulant embedding of the kernels: offsets in [0,grid_size) at the beginning of the buffer, negative ones at the end
+#ifdef __USE_GCD__
+      dispatch_apply(fft_elements, dispatch_get_global_queue(0, 0), ^(size_t i) {
+#else
+#pragma omp parallel for
+      for(int i = 0; i < int(fft_elements); ++i) {
+#endif //__USE_GCD__
+        const unsigned int a[2] = {static_cast<unsigned int>(i % fft_size), static_cast<unsigned int>(i / fft_size)};
+        hp_scalar_type dist_sq = 0;
+        bool valid = true;
+        for(unsigned int d = 0; d < D; ++d){
+          const unsigned int offset = (a[d] < grid_size) ? a[d] : fft_size - a[d];
+          valid = valid && (a[d] < grid_size || a[d] > fft_size - grid_size);
+          dist_sq += hp_scalar_type(offset) * offset * spacing_sq;
+        }
+        const hp_scalar_type q = valid ? 1. / (1. + dist_sq) : 0;
+        kernels_fft[i] = complex_type(q, q * q);
+      }
+#ifdef __USE_GCD__
+      );
+#endif
+      // The transforms of the two kernels are real, they are stored in the real and imaginary parts
+      fft(D, _kernels_fft.data(), false);
+    }
+
+    template <typename scalar_type>
+    void FFTRepulsion<scalar_type>::fft(unsigned int D, complex_type* data, bool inverse)const{
+      const unsigned int n = _fft_size;
+      if(D == 1){
+        fft(data, inverse);
+        return;
+      }
+
+      // Rows, columns and rows again. The forward transform skips the rows of zeros of the padding, the inverse transform
+      // computes only the rows of the interpolation nodes
+      const unsigned int grid_size = _grid_size;
+      for(unsigned int pass = 0; pass < 2; ++pass){
+        if(pass == unsigned(inverse)){
+#ifdef __USE_GCD__
+          dispatch_apply(n, dispatch_get_global_queue(0, 0), ^(size_t r) {
+#else
+#pragma omp parallel for
+          for(int r = 0; r < int(n); ++r) {
+#endif //__USE_GCD__
+            complex_type* row = data + size_t(r) * n;
+            const bool zero_row = (inverse) ? (unsigned(r) >= grid_size) : std::all_of(row, row + n, [](const complex_type& v){return v == complex_type(0,0);});
+            if(!zero_row){
+              fft(row, inverse);
+            }
+          }
+#ifdef __USE_GCD__
+          );
+#endif
+        }else{
+          // Columns are processed in groups, which are copied in contiguous buffers
+          const unsigned int group_size = std::min(n, 8u);
+#ifdef __USE_GCD__
+          dispatch_apply(n / group_size, dispatch_get_global_queue(0, 0), ^(size_t g) {
+#else
+#pragma omp parallel for
+          for(int g = 0; g < int(n / group_size); ++g) {
+#endif //__USE_GCD__
+            std::vector<complex_type> columns(size_t(group_size) * n);
+            const size_t first_column = size_t(g) * group_size;
+            for(unsigned int r = 0; r < n; ++r)
+              for(unsigned int c = 0; c < group_size; ++c)
+                columns[size_t(c) * n + r] = data[size_t(r) * n + first_column + c];
+            for(unsigned int c = 0; c < group_size; ++c)
+              fft(columns.data() + size_t(c) * n, inverse);
+            for(unsigned int r = 0; r < n; ++r)
+              for(unsigned int c = 0; c < group_size; ++c)
+                data[size_t(r) * n + first_column + c] = columns[size_t(c) * n + r];
+          }
+#ifdef __USE_GCD__
+          );
+#endif
+        }
+      }
+    }
+
+    template <typename scalar_type>
+    void FFTRepulsion<scalar_type>::fft(complex_type* data, bool inverse)const{
+      const unsigned int n = _fft_size;
+      // Bit-reversal permutation
+      for(unsigned int i = 1, j = 0; i < n; ++i){
+        unsigned int bit = n >> 1;
+        for(; j & bit; bit >>= 1){
+          j ^= bit;
+        }
+        j ^= bit;
+        if(i < j){
+          std::swap(data[i], data[j]);
+        }
+      }
+      // Butterflies, the inverse transform is not normalized
+      for(unsigned int len = 2; len <= n; len <<= 1){
+        const unsigned int half = len / 2;
+        const unsigned int step = n / len;
+        for(unsigned int i = 0; i < n; i += len){
+          for(unsigned int k = 0; k < half; ++k){
+            const complex_type& t = _twiddles[k * step];
+            const complex_type w(t.real(), inverse ? -t.imag() : t.imag());
+            const complex_type u = data[i + k];
+            const complex_type v = multiply(data[i + k + half], w);
+            data[i + k] = u + v;
+            data[i + k + half] = u - v;
+          }
+        }
+      }
+    }
+
+    template <typename scalar_type>
+    double FFTRepulsion<scalar_type>::memoryOccupation()const{
+      double mem = _first_node.capacity() * sizeof(unsigned int);
+      mem += (_interpolation_weights.capacity() + _lagrange_denominators.capacity()) * sizeof(hp_scalar_type);
+      mem += (_twiddles.capacity() + _kernels_fft.capacity() + _charges_fft.capacity() + _potentials_fft.capacity()) * sizeof(complex_type);
+      for(const auto& charges: _block_charges){
+        mem += charges.capacity() * sizeof(hp_scalar_type);
+      }
+      return mem / 1024 / 1024;
+    }
+
+  }
+}
+#endif
@@ -0,0 +1,432 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+#include "cpu_sne_compute.h"
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+
+#ifdef __USE_GCD__
+#include <dispatch/dispatch.h>
+#endif
+
+namespace hdi {
+  namespace dr {
+    typedef CpuSneCompute::Bounds2D Bounds2D;
+    typedef CpuSneCompute::Point2D Point2D;
+
+    CpuSneCompute::CpuSneCompute() :
+      _initialized(false),
+      _adaptive_resolution(true),
+      _resolutionScaling(PIXEL_RATIO),
+      _width(0),
+      _height(0)
+    {
+
+    }
+
+    void CpuSneCompute::initialize(const embedding_type* embedding, TsneParameters params, const sparse_scalar_matrix_type& P) {
+      initialize(embedding, params, csr_scalar_matrix_type(P));
+    }
+
+    void CpuSneCompute::initialize(const embedding_type* embedding, TsneParameters params, const csr_scalar_matrix_type& P) {
+      _params = params;
+
+      unsigned int num_points = embedding->numDataPoints();
+      _P = P;
+
+      _interp_fields.assign(num_points * 3, 0);
+      _gradients.assign(num_points * 2, 0);
+      _prev_gradients.assign(num_points * 2, 0);
+      _gain.assign(num_points * 2, 1);
+
+      _bounds = computeEmbeddingBounds(num_points, embedding->getContainer().data());
+
+      _initialized = true;
+    }
+
+    void CpuSneCompute::clean()
+    {
+      _P.clear();
+      std::vector<float>().swap(_interp_fields);
+      std::vector<float>().swap(_gradients);
+      std::vector<float>().swap(_prev_gradients);
+      std::vector<float>().swap(_gain);
+      std::vector<float>().swap(_fields);
+      std::vector<uint8_t>().swap(_stencil);
+      std::vector<uint8_t>().swap(_tile_stencil);
+      _initialized = false;
+    }
+
+    Bounds2D CpuSneCompute::computeEmbeddingBounds(unsigned int num_points, const float* points, float padding) {
+      Bounds2D bounds;
+      bounds.min.x = std::numeric_limits<float>::max();
+      bounds.max.x = -std::numeric_limits<float>::max();
+      bounds.min.y = std::numeric_limits<float>::max();
+      bounds.max.y = -std::numeric_limits<float>::max();
+
+      for (unsigned int i = 0; i < num_points; ++i) {
+        float x = points[i * 2 + 0];
+        float y = points[i * 2 + 1];
+
+        bounds.min.x = std::min<float>(x, bounds.min.x);
+        bounds.max.x = std::max<float>(x, bounds.max.x);
+        bounds.min.y = std::min<float>(y, bounds.min.y);
+        bounds.max.y = std::max<float>(y, bounds.max.y);
+      }
+
+      // Add any extra padding if requested
+      if (padding != 0) {
+        float half_padding = padding / 2;
+
+        float x_padding = (bounds.max.x - bounds.min.x) * half_padding;
+        float y_padding = (bounds.max.y - bounds.min.y) * half_padding;
+
+        bounds.min.x -= x_padding;
+        bounds.max.x += x_padding;
+        bounds.min.y -= y_padding;
+        bounds.max.y += y_padding;
+      }
+
+      return bounds;
+    }
+
+    void CpuSneCompute::compute(embedding_type* embedding, float exaggeration, float iteration, float mult) {
+      float* points = embedding->getContainer().data();
+      unsigned int num_points = embedding->numDataPoints();
+
+      // Compute the bounds of the given embedding and add a 10% border around it
+      _bounds = computeEmbeddingBounds(num_points, points, 0.1f);
+      Point2D range = _bounds.getRange();
+
+      float aspect = range.x / range.y;
+
+      _width = _adaptive_resolution ? std::max((unsigned int)(range.x * _resolutionScaling), MINIMUM_FIELDS_SIZE) : (int)(FIXED_FIELDS_SIZE * aspect);
+      _height = _adaptive_resolution ? std::max((unsigned int)(range.y * _resolutionScaling), MINIMUM_FIELDS_SIZE) : FIXED_FIELDS_SIZE;
+
+      // Compute the fields in the pixels around the points
+      computeStencil(num_points, points);
+      computeFields(num_points, points);
+
+      // Calculate the normalization sum and sample the field values for every point
+      float sum_Q = interpolateFields(num_points, points);
+
+      // If normalization sum is 0, cancel further updating
+      if (sum_Q == 0) {
+        return;
+      }
+
+      // Compute the gradients of the KL-function
+      computeGradients(num_points, points, sum_Q, exaggeration);
+
+      // Update the point positions
+      updatePoints(num_points, points, iteration, mult);
+      _bounds = computeEmbeddingBounds(num_points, points);
+      updateEmbedding(num_points, points, exaggeration);
+    }
+
+    void CpuSneCompute::computeStencil(unsigned int num_points, const float* points)
+    {
+      const unsigned int tiles_x = (_width + TILE_SIZE - 1) / TILE_SIZE;
+      const unsigned int tiles_y = (_height + TILE_SIZE - 1) / TILE_SIZE;
+      _stencil.assign(size_t(_width) * _height, 0);
+      _tile_stencil.assign(size_t(tiles_x) * tiles_y, 0);
+
+      const Point2D range = _bounds.getRange();
+      for (unsigned int i = 0; i < num_points; ++i) {
+        // Window coordinates of the point, pixels whose center lies in the 3x3 square around it are covered
+        const float px = (points[i * 2 + 0] - _bounds.min.x) / range.x * _width;
+        const float py = (points[i * 2 + 1] - _bounds.min.y) / range.y * _height;
+        const int x_begin = std::max(int(std::ceil(px - 2)), 0);
+        const int x_end = std::min(int(std::ceil(px + 1)), int(_width));
+        const int y_begin = std::max(int(std::ceil(py - 2)), 0);
+        const int y_end = std::min(int(std::ceil(py + 1)), int(_height));
+        for (int y = y_begin; y < y_end; ++y) {
+          for (int x = x_begin; x < x_end; ++x) {
+            _stencil[size_t(y) * _width + x] = 1;
+            _tile_stencil[(y / TILE_SIZE) * tiles_x + x / TILE_SIZE] = 1;
+          }
+        }
+      }
+    }
+
+    void CpuSneCompute::computeFields(unsigned int num_points, const float* points)
+    {
+      const unsigned int width = _width;
+      const unsigned int height = _height;
+      const unsigned int tile_size = TILE_SIZE;
+      const unsigned int tiles_x = (width + tile_size - 1) / tile_size;
+      const unsigned int num_tiles = static_cast<unsigned int>(_tile_stencil.size());
+      const Bounds2D bounds = _bounds;
+      const Point2D range = _bounds.getRange();
+      _fields.assign(size_t(width) * height * 3, 0);
+      float* fields = _fields.data();
+      const uint8_t* stencil = _stencil.data();
+      const uint8_t* tile_stencil = _tile_stencil.data();
+
+      // Every tile is owned by a single thread that splats all the kernels on it.
+      // Partial sums are accumulated in single precision over small blocks of points, as done by the invocations of the shader
+#ifdef __USE_GCD__
+      dispatch_apply(num_tiles, dispatch_get_global_queue(0, 0), ^(size_t t) {
+#else
+#pragma omp parallel for schedule(dynamic,1)
+      for (int t = 0; t < int(num_tiles); ++t) {
+#endif //__USE_GCD__
+        if (tile_stencil[t]) {
+          const unsigned int x_begin = (t % tiles_x) * tile_size;
+          const unsigned int y_begin = (t / tiles_x) * tile_size;
+          const unsigned int tile_width = std::min(tile_size, width - x_begin);
+          const unsigned int tile_height = std::min(tile_size, height - y_begin);
+          const unsigned int tile_pixels = tile_width * tile_height;
+
+          // Position of the pixels in the domain
+          std::vector<float> pixel_x(tile_width), pixel_y(tile_height);
+          for (unsigned int x = 0; x < tile_width; ++x) {
+            pixel_x[x] = ((x_begin + x + 0.5f) / width) * range.x + bounds.min.x;
+          }
+          for (unsigned int y = 0; y < tile_height; ++y) {
+            pixel_y[y] = ((y_begin + y + 0.5f) / height) * range.y + bounds.min.y;
+          }
+
+          const unsigned int block_size = 256;
+          std::vector<double> value(tile_pixels * 3, 0);
+          std::vector<float> partial(tile_pixels * 3);
+          float* partial_q = partial.data();
+          float* partial_x = partial_q + tile_pixels;
+          float* partial_y = partial_x + tile_pixels;
+          for (unsigned int begin = 0; begin < num_points; begin += block_size) {
+            const unsigned int end = std::min(begin + block_size, num_points);
+            std::fill(partial.begin(), partial.end(), 0.f);
+            for (unsigned int i = begin; i < end; ++i) {
+              const float point_x = points[i * 2 + 0];
+              const float point_y = points[i * 2 + 1];
+              for (unsigned int y = 0; y < tile_height; ++y) {
+                const float t_y = pixel_y[y] - point_y;
+                const float t_y_sq = t_y * t_y;
+                float* row_q = partial_q + y * tile_width;
+                float* row_x = partial_x + y * tile_width;
+                float* row_y = partial_y + y * tile_width;
+                for (unsigned int x = 0; x < tile_width; ++x) {
+                  // Distance between pixel and kernel center in domain units
+                  const float t_x = pixel_x[x] - point_x;
+                  const float tstud = 1.f / (1.f + t_x * t_x + t_y_sq);
+                  const float tstud2 = tstud * tstud;
+                  row_q[x] += tstud;
+                  row_x[x] += tstud2 * t_x;
+                  row_y[x] += tstud2 * t_y;
+                }
+              }
+            }
+            for (unsigned int p = 0; p < tile_pixels * 3; ++p) {
+              value[p] += partial[p];
+            }
+          }
+
+          for (unsigned int y = 0; y < tile_height; ++y) {
+            for (unsigned int x = 0; x < tile_width; ++x) {
+              const size_t pixel = size_t(y_begin + y) * width + x_begin + x;
+              if (stencil[pixel] == 0) {
+                continue;
+              }
+              const unsigned int p = y * tile_width + x;
+              fields[pixel * 3 + 0] = static_cast<float>(value[p]);
+              fields[pixel * 3 + 1] = static_cast<float>(value[tile_pixels + p]);
+              fields[pixel * 3 + 2] = static_cast<float>(value[2 * tile_pixels + p]);
+            }
+          }
+        }
+      }
+#ifdef __USE_GCD__
+      );
+#endif
+    }
+
+    float CpuSneCompute::interpolateFields(unsigned int num_points, const float* points)
+    {
+      const unsigned int width = _width;
+      const unsigned int height = _height;
+      const Bounds2D bounds = _bounds;
+      const Point2D range = _bounds.getRange();
+      const float* fields = _fields.data();
+      float* interp_fields = _interp_fields.data();
+
+      // Bilinear sampling of the fields with clamp to edge, as done by the texture units
+#ifdef __USE_GCD__
+      dispatch_apply(num_points, dispatch_get_global_queue(0, 0), ^(size_t i) {
+#else
+#pragma omp parallel for
+      for (int i = 0; i < int(num_points); ++i) {
+#endif //__USE_GCD__
+        const float s = (points[i * 2 + 0] - bounds.min.x) / range.x * width - 0.5f;
+        const float t = (points[i * 2 + 1] - bounds.min.y) / range.y * height - 0.5f;
+        const float s_floor = std::floor(s);
+        const float t_floor = std::floor(t);
+        const float a = s - s_floor;
+        const float b = t - t_floor;
+        const int x0 = std::min(std::max(int(s_floor), 0), int(width) - 1);
+        const int x1 = std::min(std::max(int(s_floor) + 1, 0), int(width) - 1);
+        const int y0 = std::min(std::max(int(t_floor), 0), int(height) - 1);
+        const int y1 = std::min(std::max(int(t_floor) + 1, 0), int(height) - 1);
+        const float* f00 = fields + (size_t(y0) * width + x0) * 3;
+        const float* f10 = fields + (size_t(y0) * width + x1) * 3;
+        const float* f01 = fields + (size_t(y1) * width + x0) * 3;
+        const float* f11 = fields + (size_t(y1) * width + x1) * 3;
+        for (int c = 0; c < 3; ++c) {
+          interp_fields[i * 3 + c] = (1 - b) * ((1 - a) * f00[c] + a * f10[c]) + b * ((1 - a) * f01[c] + a * f11[c]);
+        }
+      }
+#ifdef __USE_GCD__
+      );
+#endif
+
+      double sum_Q = 0;
+      for (unsigned int i = 0; i < num_points; ++i) {
+        sum_Q += std::max(interp_fields[i * 3] - 1, 0.f);
+      }
+      return static_cast<float>(sum_Q);
+    }
+
+    void CpuSneCompute::computeGradients(unsigned int num_points, const float* points, float sum_Q, double exaggeration)
+    {
+      const float inv_num_points = 1.f / float(num_points);
+      const float inv_sum_Q = 1.f / sum_Q;
+      const float exaggeration_f = static_cast<float>(exaggeration);
+      const uint32_t* neighbours = _P.keys().data();
+      const float* probabilities = _P.values().data();
+      const size_t* offsets = _P.offsets().data();
+      const float* interp_fields = _interp_fields.data();
+      float* gradients = _gradients.data();
+
+#ifdef __USE_GCD__
+      dispatch_apply(num_points, dispatch_get_global_queue(0, 0), ^(size_t i) {
+#else
+#pragma omp parallel for
+      for (int i = 0; i < int(num_points); ++i) {
+#endif //__USE_GCD__
+        const float point_x = points[i * 2 + 0];
+        const float point_y = points[i * 2 + 1];
+
+        // Computing positive forces
+        float positive_x = 0;
+        float positive_y = 0;
+        for (size_t e = offsets[i]; e < offsets[i + 1]; ++e) {
+          const float dist_x = point_x - points[neighbours[e] * 2 + 0];
+          const float dist_y = point_y - points[neighbours[e] * 2 + 1];
+
+          // Similarity measure of the two points
+          const float qij = 1 / (1 + dist_x * dist_x + dist_y * dist_y);
+
+          // Calculate the attractive force
+          const float force = probabilities[e] * qij * inv_num_points;
+          positive_x += force * dist_x;
+          positive_y += force * dist_y;
+        }
+
+        // Computing repulsive forces
+        const float negative_x = interp_fields[i * 3 + 1] * inv_sum_Q;
+        const float negative_y = interp_fields[i * 3 + 2] * inv_sum_Q;
+
+        gradients[i * 2 + 0] = 4 * (exaggeration_f * positive_x - negative_x);
+        gradients[i * 2 + 1] = 4 * (exaggeration_f * positive_y - negative_y);
+      }
+#ifdef __USE_GCD__
+      );
+#endif
+    }
+
+    void CpuSneCompute::updatePoints(unsigned int num_points, float* points, float iteration, float mult)
+    {
+      const float eta = static_cast<float>(_params._eta);
+      const float min_gain = static_cast<float>(_params._minimum_gain);
+      const float momentum = static_cast<float>(iteration < _params._mom_switching_iter ? _params._momentum : _params._final_momentum);
+      const float* gradients = _gradients.data();
+      float* prev_gradients = _prev_gradients.data();
+      float* gain = _gain.data();
+
+#ifdef __USE_GCD__
+      dispatch_apply(num_points * 2, dispatch_get_global_queue(0, 0), ^(size_t i) {
+#else
+#pragma omp parallel for
+      for (int i = 0; i < int(num_points * 2); ++i) {
+#endif //__USE_GCD__
+        const float grad = gradients[i];
+        float pgrad = prev_gradients[i];
+        float g = gain[i];
+
+        // Same test as sign(grad) != sign(pgrad) in the shader, where sign(0) is 0
+        const int sign_grad = (grad > 0) - (grad < 0);
+        const int sign_pgrad = (pgrad > 0) - (pgrad < 0);
+        g = sign_grad != sign_pgrad ? g + 0.2f : g * 0.8f;
+        g = std::max(g, min_gain);
+
+        const float eta_gain = eta * g;
+        pgrad = momentum * pgrad - eta_gain * grad;
+
+        gain[i] = g;
+        prev_gradients[i] = pgrad;
+        points[i] += pgrad * mult;
+      }
+#ifdef __USE_GCD__
+      );
+#endif
+    }
+
+    void CpuSneCompute::updateEmbedding(unsigned int num_points, float* points, float exaggeration) {
+      const Bounds2D bounds = _bounds;
+      const Point2D center{ (bounds.min.x + bounds.max.x) * 0.5f, (bounds.min.y + bounds.max.y) * 0.5f };
+
+      // During the exaggeration the embedding is scaled up to a minimum diameter, afterwards it is only centered
+      const float diameter = 0.1f;
+      const float range = bounds.max.x - bounds.min.x;
+      const bool scale = exaggeration > 1.2;
+      if (scale && range >= diameter) {
+        return;
+      }
+      const float scale_factor = scale ? diameter / range : 1.f;
+
+#ifdef __USE_GCD__
+      dispatch_apply(num_points, dispatch_get_global_queue(0, 0), ^(size_t i) {
+#else
+#pragma omp parallel for
+      for (int i = 0; i < int(num_points); ++i) {
+#endif //__USE_GCD__
+        points[i * 2 + 0] = (points[i * 2 + 0] - center.x) * scale_factor;
+        points[i * 2 + 1] = (points[i * 2 + 1] - center.y) * scale_factor;
+      }
+#ifdef __USE_GCD__
+      );
+#endif
+    }
+  }
+}
@@ -0,0 +1,135 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+#pragma once
+
+#include "hdi/data/embedding.h"
+#include "hdi/data/map_mem_eff.h"
+#include "hdi/data/sparse_matrix_csr.h"
+#include "hdi/dimensionality_reduction/tsne_parameters.h"
+
+#include <vector>
+#include <cstdint>
+
+namespace hdi {
+  namespace dr {
+    //! CPU implementation of the texture-based t-SNE computed by GpgpuSneCompute
+    /*!
+    CPU implementation of the field-based t-SNE gradient descent of GpgpuSneCompute, used when no OpenGL context is available.
+    The scalar (normalization) and vector (repulsive forces) fields are computed on an adaptive-resolution grid
+    around the points, sampled bilinearly at the point positions and combined with the attractive forces.
+    Every step mirrors the corresponding compute shader, hence the two implementations produce the same embeddings up to
+    floating point differences.
+    \author Nicola Pezzotti
+    */
+    class CpuSneCompute {
+    public:
+      struct Point2D {
+        float x, y;
+      };
+
+      struct Bounds2D {
+        Point2D min;
+        Point2D max;
+
+        Point2D getRange() {
+          return Point2D{ max.x - min.x, max.y - min.y };
+        }
+      };
+
+      typedef hdi::data::Embedding<float> embedding_type;
+      typedef std::vector<hdi::data::MapMemEff<uint32_t, float>> sparse_scalar_matrix_type;
+      typedef hdi::data::SparseMatrixCSR<uint32_t, float> csr_scalar_matrix_type;
+
+    public:
+      CpuSneCompute();
+
+      void initialize(const embedding_type* embedding, TsneParameters params, const sparse_scalar_matrix_type& P);
+      void initialize(const embedding_type* embedding, TsneParameters params, const csr_scalar_matrix_type& P);
+      void clean();
+
+      void compute(embedding_type* embedding, float exaggeration, float iteration, float mult);
+
+      void setScalingFactor(float factor) { _resolutionScaling = factor; }
+
+      //! Width of the fields computed in the last iteration
+      unsigned int fieldsWidth()const { return _width; }
+      //! Height of the fields computed in the last iteration
+      unsigned int fieldsHeight()const { return _height; }
+
+    private:
+      Bounds2D computeEmbeddingBounds(unsigned int num_points, const float* points, float padding = 0);
+      //! Mark the pixels that are covered by the points, as GpgpuSneCompute does by rendering 3x3 points
+      void computeStencil(unsigned int num_points, const float* points);
+      //! Compute the fields in the pixels covered by the stencil
+      void computeFields(unsigned int num_points, const float* points);
+      float interpolateFields(unsigned int num_points, const float* points);
+      void computeGradients(unsigned int num_points, const float* points, float sum_Q, double exaggeration);
+      void updatePoints(unsigned int num_points, float* points, float iteration, float mult);
+      void updateEmbedding(unsigned int num_points, float* points, float exaggeration);
+
+    private:
+      const unsigned int FIXED_FIELDS_SIZE = 40;
+      const unsigned int MINIMUM_FIELDS_SIZE = 5;
+      const float PIXEL_RATIO = 2;
+      //! Side of the square tiles of pixels in which the fields are computed
+      const unsigned int TILE_SIZE = 16;
+
+      bool _initialized;
+      bool _adaptive_resolution;
+
+      float _resolutionScaling;
+
+      // Joint probabilities
+      csr_scalar_matrix_type _P;
+
+      // Per-point buffers
+      std::vector<float> _interp_fields;
+      std::vector<float> _gradients;
+      std::vector<float> _prev_gradients;
+      std::vector<float> _gain;
+
+      // Fields and stencil
+      unsigned int _width;
+      unsigned int _height;
+      std::vector<float> _fields;
+      std::vector<uint8_t> _stencil;
+      std::vector<uint8_t> _tile_stencil;
+
+      // Embedding bounds
+      Bounds2D _bounds;
+
+      // T-SNE parameters
+      TsneParameters _params;
+    };
+  }
+}
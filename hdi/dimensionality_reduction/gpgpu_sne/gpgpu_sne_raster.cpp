@@ -69,6 +69,10 @@ namespace hdi {
     }
 
     void GpgpuSneRaster::initialize(const embedding_type* embedding, TsneParameters params, const sparse_scalar_matrix_type& P) {
+      initialize(embedding, params, csr_scalar_matrix_type(P));
+    }
+
+    void GpgpuSneRaster::initialize(const embedding_type* embedding, TsneParameters params, const csr_scalar_matrix_type& P) {
       _params = params;
       _P = P;
 
@@ -82,18 +86,15 @@ namespace hdi {
 
       _interpolated_fields.resize(4 * P.size());
 
-      // Linearize sparse probability matrix
+      // Linearize sparse probability matrix, neighbours and probabilities are already contiguous in P
       LinearProbabilityMatrix linear_P;
       unsigned int num_pnts = embedding->numDataPoints();
+      linear_P.neighbours.assign(P.keys().begin(), P.keys().begin() + P.offsets()[num_pnts]);
+      linear_P.probabilities.assign(P.values().begin(), P.values().begin() + P.offsets()[num_pnts]);
+      linear_P.indices.resize(num_pnts * 2);
       for (int i = 0; i < num_pnts; ++i) {
-        linear_P.indices.push_back(linear_P.neighbours.size());
-        int size = 0;
-        for (const auto& pij : P[i]) {
-          linear_P.neighbours.push_back(pij.first);
-          linear_P.probabilities.push_back(pij.second);
-          size++;
-        }
-        linear_P.indices.push_back(size);
+        linear_P.indices[i * 2 + 0] = P.offsets()[i];
+        linear_P.indices[i * 2 + 1] = P.offsets()[i + 1] - P.offsets()[i];
       }
 
       // Compute initial data bounds
@@ -41,6 +41,7 @@
 #include "hdi/data/shader.h"
 #include "hdi/data/embedding.h"
 #include "hdi/data/map_mem_eff.h"
+#include "hdi/data/sparse_matrix_csr.h"
 #include "hdi/dimensionality_reduction/tsne_parameters.h"
 #include "field_computation.h"
 
@@ -73,11 +74,13 @@ namespace hdi {
 
       typedef hdi::data::Embedding<float> embedding_type;
       typedef std::vector<hdi::data::MapMemEff<uint32_t, float>> sparse_scalar_matrix_type;
+      typedef hdi::data::SparseMatrixCSR<uint32_t, float> csr_scalar_matrix_type;
 
     public:
       GpgpuSneRaster();
 
       void initialize(const embedding_type* embedding, TsneParameters params, const sparse_scalar_matrix_type& P);
+      void initialize(const embedding_type* embedding, TsneParameters params, const csr_scalar_matrix_type& P);
       void clean();
 
       void compute(embedding_type* embedding, float exaggeration, float iteration, float mult);
@@ -123,7 +126,7 @@ namespace hdi {
       std::vector<double> _gain;
 
       std::vector<float> _interpolated_fields;
-      sparse_scalar_matrix_type _P;
+      csr_scalar_matrix_type _P;
 
       RasterFieldComputation fieldComputation;
 
@@ -41,8 +41,10 @@
 #include <unordered_map>
 #include "hdi/data/embedding.h"
 #include "hdi/data/map_mem_eff.h"
+#include "hdi/data/sparse_matrix_csr.h"
 #include "gpgpu_sne/gpgpu_sne_compute.h"
 #include "gpgpu_sne/gpgpu_sne_raster.h"
+#include "gpgpu_sne/cpu_sne_compute.h"
 #include "tsne_parameters.h"
 #include <array>
 
@@ -57,6 +59,7 @@ namespace hdi {
     public:
       typedef float scalar_type;
       typedef std::vector<hdi::data::MapMemEff<uint32_t, float>> sparse_scalar_matrix_type;
+      typedef hdi::data::SparseMatrixCSR<uint32_t, float> csr_scalar_matrix_type;
       typedef std::vector<scalar_type> scalar_vector_type;
       typedef uint32_t data_handle_type;
 
@@ -64,8 +67,10 @@ namespace hdi {
       GradientDescentTSNETexture();
       //! Initialize the class with a list of distributions. A joint-probability distribution will be computed as in the tSNE algorithm
       void initialize(const sparse_scalar_matrix_type& probabilities, data::Embedding<scalar_type>* embedding, TsneParameters params = TsneParameters());
+      void initialize(const csr_scalar_matrix_type& probabilities, data::Embedding<scalar_type>* embedding, TsneParameters params = TsneParameters());
       //! Initialize the class with a joint-probability distribution. Note that it must be provided non initialized and with the weight of each row equal to 2.
       void initializeWithJointProbabilityDistribution(const sparse_scalar_matrix_type& distribution, data::Embedding<scalar_type>* embedding, TsneParameters params = TsneParameters());
+      void initializeWithJointProbabilityDistribution(const csr_scalar_matrix_type& distribution, data::Embedding<scalar_type>* embedding, TsneParameters params = TsneParameters());
       //! Reset the internal state of the class but it keeps the inserted data-points
       void reset();
       //! Reset the class and remove all the data points
@@ -77,7 +82,7 @@ namespace hdi {
       //! Get the number of data points
       unsigned int getNumberOfDataPoints() { return _P.size(); }
       //! Get P
-      const sparse_scalar_matrix_type& getDistributionP()const { return _P; }
+      const csr_scalar_matrix_type& getDistributionP()const { return _P; }
       //! Get Q
       const scalar_vector_type& getDistributionQ()const { return _Q; }
 
@@ -99,24 +104,34 @@ namespace hdi {
       //! Set the adaptive texture scaling
       void setResolutionFactor(float factor) {
 #ifndef __APPLE__
-        if (GLAD_GL_VERSION_4_3)
-        {
-          _gpgpu_compute_tsne.setScalingFactor(factor);
-        }
-		else if (GLAD_GL_VERSION_3_3)
+        _gpgpu_compute_tsne.setScalingFactor(factor);
 #endif // __APPLE__
-        {
-          _gpgpu_raster_tsne.setScalingFactor(factor);
-        }
+        _gpgpu_raster_tsne.setScalingFactor(factor);
+        _cpu_tsne.setScalingFactor(factor);
       }
 
+      //! True if the fields are computed on the CPU since no OpenGL context was available at initialization
+      bool isCpuFallback()const { return _backend == CPU_BACKEND; }
+
       //! Exageration baseline
       double& exaggeration_baseline() { return _exaggeration_baseline; }
       const double& exaggeration_baseline()const { return _exaggeration_baseline; }
 
     private:
+      //! Implementations of the texture-based gradient descent
+      enum Backend {
+        COMPUTE_SHADER_BACKEND,
+        RASTERIZATION_BACKEND,
+        CPU_BACKEND
+      };
+
+    private:
+      //! Select the implementation supported by the current OpenGL context, if any
+      Backend availableBackend()const;
+      //! Initialize the selected implementation
+      void initializeBackend();
       //! Compute High-dimensional distribution
-      void computeHighDimensionalDistribution(const sparse_scalar_matrix_type& probabilities);
+      void computeHighDimensionalDistribution(const csr_scalar_matrix_type& probabilities);
       //! Initialize the point in the embedding
       void initializeEmbeddingPosition(int seed, double multiplier = .1);
       //! Do an iteration of the gradient descent
@@ -132,7 +147,7 @@ namespace hdi {
       double exaggerationFactor();
 
     public: //TODO remove
-      sparse_scalar_matrix_type _P; //! Conditional probalility distribution in the High-dimensional space
+      csr_scalar_matrix_type _P; //! Conditional probalility distribution in the High-dimensional space
 
     private:
       data::Embedding<scalar_type>* _embedding; //! embedding
@@ -151,6 +166,8 @@ namespace hdi {
       GpgpuSneCompute _gpgpu_compute_tsne;
 #endif // __APPLE__
       GpgpuSneRaster _gpgpu_raster_tsne;
+      CpuSneCompute _cpu_tsne;
+      Backend _backend;
 
       std::array<scalar_type, 4> _temp;
 
@@ -38,11 +38,13 @@
 #include "hdi/utils/math_utils.h"
 #include "hdi/utils/log_helper_functions.h"
 #include "hdi/utils/scoped_timers.h"
+#include "hdi/data/map_helpers.h"
 #include "sptree.h"
 #include <random>
 
 #ifdef __APPLE__
 #include <dispatch/dispatch.h>
+#include <OpenGL/OpenGL.h>
 #else
 #define __block
 #endif
@@ -71,7 +73,8 @@ namespace hdi {
     GradientDescentTSNETexture::GradientDescentTSNETexture() :
       _initialized(false),
       _logger(nullptr),
-      _exaggeration_baseline(1)
+      _exaggeration_baseline(1),
+      _backend(CPU_BACKEND)
     {
 
     }
@@ -100,6 +103,10 @@ namespace hdi {
 
 
     void GradientDescentTSNETexture::initialize(const sparse_scalar_matrix_type& probabilities, data::Embedding<scalar_type>* embedding, TsneParameters params) {
+      initialize(csr_scalar_matrix_type(probabilities), embedding, params);
+    }
+
+    void GradientDescentTSNETexture::initialize(const csr_scalar_matrix_type& probabilities, data::Embedding<scalar_type>* embedding, TsneParameters params) {
       utils::secureLog(_logger, "Initializing tSNE...");
       {//Aux data
         _params = params;
@@ -116,18 +123,7 @@ namespace hdi {
 
       computeHighDimensionalDistribution(probabilities);
       initializeEmbeddingPosition(params._seed, params._rngRange);
-
-#ifndef __APPLE__
-      if (GLAD_GL_VERSION_4_3)
-      {
-        _gpgpu_compute_tsne.initialize(_embedding, _params, _P);
-      }
-      else if (GLAD_GL_VERSION_3_3)
-#endif // __APPLE__
-      {
-        std::cout << "Compute shaders not available, using rasterization fallback" << std::endl;
-        _gpgpu_raster_tsne.initialize(_embedding, _params, _P);
-      }
+      initializeBackend();
 
       _iteration = 0;
 
@@ -136,6 +132,10 @@ namespace hdi {
     }
 
     void GradientDescentTSNETexture::initializeWithJointProbabilityDistribution(const sparse_scalar_matrix_type& distribution, data::Embedding<scalar_type>* embedding, TsneParameters params) {
+      initializeWithJointProbabilityDistribution(csr_scalar_matrix_type(distribution), embedding, params);
+    }
+
+    void GradientDescentTSNETexture::initializeWithJointProbabilityDistribution(const csr_scalar_matrix_type& distribution, data::Embedding<scalar_type>* embedding, TsneParameters params) {
       utils::secureLog(_logger, "Initializing tSNE with a user-defined joint-probability distribution...");
       {//Aux data
         _params = params;
@@ -152,43 +152,64 @@ namespace hdi {
 
       _P = distribution;
       initializeEmbeddingPosition(params._seed, params._rngRange);
+      initializeBackend();
 
-#ifndef __APPLE__
+      _iteration = 0;
+
+      _initialized = true;
+      utils::secureLog(_logger, "Initialization complete!");
+    }
+
+    GradientDescentTSNETexture::Backend GradientDescentTSNETexture::availableBackend()const {
+#ifdef __APPLE__
+      if (CGLGetCurrentContext() != nullptr)
+      {
+        return RASTERIZATION_BACKEND;
+      }
+#else // __APPLE__
+      // Version flags are set only once the OpenGL functions are loaded in a valid context
       if (GLAD_GL_VERSION_4_3)
       {
-        utils::secureLog(_logger, "Init GPGPU gradient descent using compute shaders.");
-        _gpgpu_compute_tsne.initialize(_embedding, _params, _P);
+        return COMPUTE_SHADER_BACKEND;
+      }
+      if (GLAD_GL_VERSION_3_3)
+      {
+        return RASTERIZATION_BACKEND;
       }
-      else if (GLAD_GL_VERSION_3_3)
 #endif // __APPLE__
+      return CPU_BACKEND;
+    }
+
+    void GradientDescentTSNETexture::initializeBackend() {
+      _backend = availableBackend();
+      switch (_backend)
       {
+#ifndef __APPLE__
+      case COMPUTE_SHADER_BACKEND:
+        utils::secureLog(_logger, "Init GPGPU gradient descent using compute shaders.");
+        _gpgpu_compute_tsne.initialize(_embedding, _params, _P);
+        break;
+#endif // __APPLE__
+      case RASTERIZATION_BACKEND:
         utils::secureLog(_logger, "Init GPU gradient descent. Compute shaders not available, using rasterization fallback.");
         _gpgpu_raster_tsne.initialize(_embedding, _params, _P);
+        break;
+      default:
+        utils::secureLog(_logger, "Init CPU gradient descent. OpenGL context not available, the fields are computed on the CPU.");
+        _cpu_tsne.initialize(_embedding, _params, _P);
+        break;
       }
-
-
-      _iteration = 0;
-
-      _initialized = true;
-      utils::secureLog(_logger, "Initialization complete!");
     }
 
-    void GradientDescentTSNETexture::computeHighDimensionalDistribution(const sparse_scalar_matrix_type& probabilities) {
+    void GradientDescentTSNETexture::computeHighDimensionalDistribution(const csr_scalar_matrix_type& probabilities) {
       utils::secureLog(_logger, "Computing high-dimensional joint probability distribution...");
 
-      const int n = getNumberOfDataPoints();
-      for (int j = 0; j < n; ++j) {
-        for (auto& elem : probabilities[j]) {
-          scalar_type v0 = elem.second;
-          auto iter = probabilities[elem.first].find(j);
-          scalar_type v1 = 0.;
-          if (iter != probabilities[elem.first].end())
-            v1 = iter->second;
-
-          _P[j][elem.first] = static_cast<scalar_type>((v0 + v1)*0.5);
-          _P[elem.first][j] = static_cast<scalar_type>((v0 + v1)*0.5);
-        }
-      }
+      typedef csr_scalar_matrix_type::value_type map_type;
+      typedef map_type::key_type key_type;
+      typedef map_type::mapped_type mapped_type;
+      typedef hdi::data::MapHelpers<key_type, mapped_type, map_type> map_helpers_type;
+
+      map_helpers_type::symmetrize(probabilities, _P);
     }
 
 
@@ -252,16 +273,20 @@ namespace hdi {
     }
 
     void GradientDescentTSNETexture::doAnIterationImpl(double mult) {
-      // Compute gradient of the KL function using a compute shader approach
-#ifndef __APPLE__
-      if (GLAD_GL_VERSION_4_3)
+      // Compute gradient of the KL function using a compute shader approach, or its CPU counterpart
+      switch (_backend)
       {
+#ifndef __APPLE__
+      case COMPUTE_SHADER_BACKEND:
         _gpgpu_compute_tsne.compute(_embedding, exaggerationFactor(), _iteration, mult);
-      }
-      else if (GLAD_GL_VERSION_3_3)
+        break;
 #endif // __APPLE__
-      {
+      case RASTERIZATION_BACKEND:
         _gpgpu_raster_tsne.compute(_embedding, exaggerationFactor(), _iteration, mult);
+        break;
+      default:
+        _cpu_tsne.compute(_embedding, exaggerationFactor(), _iteration, mult);
+        break;
       }
       ++_iteration;
     }
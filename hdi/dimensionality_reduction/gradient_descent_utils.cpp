@@ -0,0 +1,49 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+#include "gradient_descent_utils_inl.h"
+
+namespace hdi{
+  namespace dr{
+    template void gradientDescentStep<float>(const float* gradient, float* previous_gradient, float* gain, float* positions, unsigned int num_points, unsigned int dim, double eta, double minimum_gain, double momentum, double mult, float* limits);
+    template void gradientDescentStep<double>(const double* gradient, double* previous_gradient, double* gain, double* positions, unsigned int num_points, unsigned int dim, double eta, double minimum_gain, double momentum, double mult, double* limits);
+
+    template void translateAndScale<float>(float* positions, unsigned int num_points, unsigned int dim, const float* shifts, double scale_factor);
+    template void translateAndScale<double>(double* positions, unsigned int num_points, unsigned int dim, const double* shifts, double scale_factor);
+
+    template void spaceFillingCurveOrder<float>(const float* positions, unsigned int num_points, unsigned int dim, std::vector<unsigned int>& order);
+    template void spaceFillingCurveOrder<double>(const double* positions, unsigned int num_points, unsigned int dim, std::vector<unsigned int>& order);
+
+    template void permutePoints<float>(float* values, unsigned int num_points, unsigned int dim, const std::vector<unsigned int>& new_index, std::vector<float>& buffer);
+    template void permutePoints<double>(double* values, unsigned int num_points, unsigned int dim, const std::vector<unsigned int>& new_index, std::vector<double>& buffer);
+  }
+}
@@ -0,0 +1,70 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef GRADIENT_DESCENT_UTILS_H
+#define GRADIENT_DESCENT_UTILS_H
+
+#include <vector>
+
+namespace hdi{
+  namespace dr{
+
+    //! Gradient descent step with adaptive gains and momentum used by the tSNE implementations
+    /*!
+      Gains, momentum and positions of the num_points*dim coordinates are updated in a single parallel sweep.
+      If limits is not null it receives the bounding box of the updated positions, tracked during the same sweep,
+      with the layout of data::Embedding::computeEmbeddingBBox (minimum and maximum of each dimension).
+    */
+    template <typename scalar_type>
+    void gradientDescentStep(const scalar_type* gradient, scalar_type* previous_gradient, scalar_type* gain, scalar_type* positions,
+                             unsigned int num_points, unsigned int dim, double eta, double minimum_gain, double momentum, double mult,
+                             scalar_type* limits = nullptr);
+
+    //! Shift the positions by shifts and multiply them by scale_factor in a single parallel sweep
+    template <typename scalar_type>
+    void translateAndScale(scalar_type* positions, unsigned int num_points, unsigned int dim, const scalar_type* shifts, double scale_factor = 1);
+
+    //! Order of the points along a space-filling curve of their positions, order[k] is the index of the k-th point on the curve
+    /*!
+      A Hilbert curve is used for 2D embeddings and a Morton (Z-order) curve otherwise. Points that are close on the curve are close in the embedding,
+      hence storing the points in this order improves the locality of the tree traversals and of the edge forces.
+    */
+    template <typename scalar_type>
+    void spaceFillingCurveOrder(const scalar_type* positions, unsigned int num_points, unsigned int dim, std::vector<unsigned int>& order);
+
+    //! Move the dim values of every point i to new_index[i]. buffer is used as temporary storage and it can be reused across calls
+    template <typename scalar_type>
+    void permutePoints(scalar_type* values, unsigned int num_points, unsigned int dim, const std::vector<unsigned int>& new_index, std::vector<scalar_type>& buffer);
+
+  }
+}
+#endif
@@ -0,0 +1,249 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef GRADIENT_DESCENT_UTILS_INL
+#define GRADIENT_DESCENT_UTILS_INL
+
+#include "hdi/dimensionality_reduction/gradient_descent_utils.h"
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#ifdef __USE_GCD__
+#include <dispatch/dispatch.h>
+#endif
+
+namespace hdi{
+  namespace dr{
+
+    template <typename scalar_type>
+    void gradientDescentStep(const scalar_type* gradient, scalar_type* previous_gradient, scalar_type* gain, scalar_type* positions,
+                             unsigned int num_points, unsigned int dim, double eta, double minimum_gain, double momentum, double mult,
+                             scalar_type* limits){
+      //Points are processed in chunks, whose bounding boxes are computed while their coordinates are still in cache
+      const unsigned int chunk_size = 4096;
+      const unsigned int num_chunks = (num_points+chunk_size-1)/chunk_size;
+      const bool track_limits = (limits != nullptr);
+      std::vector<scalar_type> chunk_limits(track_limits?size_t(num_chunks)*dim*2:0);
+      scalar_type* chunk_limits_ptr = chunk_limits.data();
+
+#ifdef __USE_GCD__
+      dispatch_apply(num_chunks, dispatch_get_global_queue(0, 0), ^(size_t c) {
+#else
+#pragma omp parallel for
+      for(int c = 0; c < int(num_chunks); ++c){
+#endif //__USE_GCD__
+        const size_t point_begin = size_t(c)*chunk_size;
+        const size_t point_end = std::min(size_t(num_points),point_begin+chunk_size);
+        const size_t begin = point_begin*dim;
+        const size_t end = point_end*dim;
+        for(size_t i = begin; i < end; ++i){
+          const double grad = gradient[i];
+          const double prev = previous_gradient[i];
+          //The gain grows if the gradient changed direction, the sign of 0 is 0
+          const bool same_sign = ((grad > 0) == (prev > 0)) && ((grad < 0) == (prev < 0));
+          scalar_type g = static_cast<scalar_type>(same_sign?(gain[i]*.8):(gain[i]+.2));
+          if(g < minimum_gain){
+            g = static_cast<scalar_type>(minimum_gain);
+          }
+          gain[i] = g;
+          const scalar_type step = static_cast<scalar_type>(momentum*prev - eta*g*grad);
+          previous_gradient[i] = step;
+          positions[i] += static_cast<scalar_type>(step*mult);
+        }
+
+        if(track_limits){
+          scalar_type* l = chunk_limits_ptr+size_t(c)*dim*2;
+          for(unsigned int d = 0; d < dim; ++d){
+            l[d*2] = std::numeric_limits<scalar_type>::max();
+            l[d*2+1] = -std::numeric_limits<scalar_type>::max();
+          }
+          for(size_t p = point_begin; p < point_end; ++p){
+            for(unsigned int d = 0; d < dim; ++d){
+              const scalar_type v = positions[p*dim+d];
+              l[d*2] = std::min(l[d*2],v);
+              l[d*2+1] = std::max(l[d*2+1],v);
+            }
+          }
+        }
+      }
+#ifdef __USE_GCD__
+      );
+#endif
+
+      if(!track_limits){
+        return;
+      }
+      for(unsigned int d = 0; d < dim; ++d){
+        limits[d*2] = std::numeric_limits<scalar_type>::max();
+        limits[d*2+1] = -std::numeric_limits<scalar_type>::max();
+      }
+      for(unsigned int c = 0; c < num_chunks; ++c){
+        const scalar_type* l = chunk_limits_ptr+size_t(c)*dim*2;
+        for(unsigned int d = 0; d < dim; ++d){
+          limits[d*2] = std::min(limits[d*2],l[d*2]);
+          limits[d*2+1] = std::max(limits[d*2+1],l[d*2+1]);
+        }
+      }
+    }
+
+    template <typename scalar_type>
+    void translateAndScale(scalar_type* positions, unsigned int num_points, unsigned int dim, const scalar_type* shifts, double scale_factor){
+      const unsigned int chunk_size = 4096;
+      const unsigned int num_chunks = (num_points+chunk_size-1)/chunk_size;
+#ifdef __USE_GCD__
+      dispatch_apply(num_chunks, dispatch_get_global_queue(0, 0), ^(size_t c) {
+#else
+#pragma omp parallel for
+      for(int c = 0; c < int(num_chunks); ++c){
+#endif //__USE_GCD__
+        const size_t point_end = std::min(size_t(num_points),size_t(c+1)*chunk_size);
+        for(size_t p = size_t(c)*chunk_size; p < point_end; ++p){
+          for(unsigned int d = 0; d < dim; ++d){
+            positions[p*dim+d] = static_cast<scalar_type>((positions[p*dim+d]+shifts[d])*scale_factor);
+          }
+        }
+      }
+#ifdef __USE_GCD__
+      );
+#endif
+    }
+
+    namespace{
+      //! Distance of the cell (x,y) along the Hilbert curve that covers a grid of side n, n is a power of 2
+      inline uint64_t hilbertDistance(uint64_t n, uint64_t x, uint64_t y){
+        uint64_t d = 0;
+        for(uint64_t s = n/2; s > 0; s /= 2){
+          const uint64_t rx = (x & s) > 0;
+          const uint64_t ry = (y & s) > 0;
+          d += s * s * ((3 * rx) ^ ry);
+          //Rotation of the quadrant
+          if(ry == 0){
+            if(rx == 1){
+              x = n-1-x;
+              y = n-1-y;
+            }
+            std::swap(x,y);
+          }
+        }
+        return d;
+      }
+    }
+
+    template <typename scalar_type>
+    void spaceFillingCurveOrder(const scalar_type* positions, unsigned int num_points, unsigned int dim, std::vector<unsigned int>& order){
+      //The bounding box is split in 2^bits cells per dimension, the codes of the curve fit in 64 bits
+      const unsigned int bits = (dim == 2) ? 31 : std::max(1u,std::min(32u,64/std::max(1u,dim)));
+      const double num_cells = double(uint64_t(1) << bits);
+      std::vector<double> min_pos(dim,std::numeric_limits<double>::max());
+      std::vector<double> scale(dim,0);
+      {
+        std::vector<double> max_pos(dim,-std::numeric_limits<double>::max());
+        for(size_t p = 0; p < num_points; ++p){
+          for(unsigned int d = 0; d < dim; ++d){
+            min_pos[d] = std::min(min_pos[d],double(positions[p*dim+d]));
+            max_pos[d] = std::max(max_pos[d],double(positions[p*dim+d]));
+          }
+        }
+        for(unsigned int d = 0; d < dim; ++d){
+          if(max_pos[d] > min_pos[d]){
+            scale[d] = (num_cells-1)/(max_pos[d]-min_pos[d]);
+          }
+        }
+      }
+
+      std::vector<std::pair<uint64_t,unsigned int>> codes(num_points);
+      std::pair<uint64_t,unsigned int>* codes_ptr = codes.data();
+      const double* min_pos_ptr = min_pos.data();
+      const double* scale_ptr = scale.data();
+#ifdef __USE_GCD__
+      dispatch_apply(num_points, dispatch_get_global_queue(0, 0), ^(size_t p) {
+#else
+#pragma omp parallel for
+      for(int p = 0; p < int(num_points); ++p){
+#endif //__USE_GCD__
+        const scalar_type* point = positions + size_t(p)*dim;
+        uint64_t code = 0;
+        if(dim == 2){
+          const uint64_t x = uint64_t((point[0]-min_pos_ptr[0])*scale_ptr[0]);
+          const uint64_t y = uint64_t((point[1]-min_pos_ptr[1])*scale_ptr[1]);
+          code = hilbertDistance(uint64_t(1) << bits, x, y);
+        }else{
+          //Morton code, the bits of the coordinates are interleaved
+          for(int b = int(bits)-1; b >= 0; --b){
+            for(unsigned int d = 0; d < dim; ++d){
+              const uint64_t c = uint64_t((point[d]-min_pos_ptr[d])*scale_ptr[d]);
+              code = (code << 1) | ((c >> b) & 1);
+            }
+          }
+        }
+        codes_ptr[p] = std::make_pair(code,unsigned(p));
+      }
+#ifdef __USE_GCD__
+      );
+#endif
+
+      //Ties are broken by index, hence the order is deterministic
+      std::sort(codes.begin(),codes.end());
+      order.resize(num_points);
+      for(size_t k = 0; k < num_points; ++k){
+        order[k] = codes[k].second;
+      }
+    }
+
+    template <typename scalar_type>
+    void permutePoints(scalar_type* values, unsigned int num_points, unsigned int dim, const std::vector<unsigned int>& new_index, std::vector<scalar_type>& buffer){
+      buffer.assign(values,values+size_t(num_points)*dim);
+      const scalar_type* buffer_ptr = buffer.data();
+      const unsigned int* new_index_ptr = new_index.data();
+#ifdef __USE_GCD__
+      dispatch_apply(num_points, dispatch_get_global_queue(0, 0), ^(size_t p) {
+#else
+#pragma omp parallel for
+      for(int p = 0; p < int(num_points); ++p){
+#endif //__USE_GCD__
+        const size_t dst = size_t(new_index_ptr[p])*dim;
+        for(unsigned int d = 0; d < dim; ++d){
+          values[dst+d] = buffer_ptr[size_t(p)*dim+d];
+        }
+      }
+#ifdef __USE_GCD__
+      );
+#endif
+    }
+
+  }
+}
+#endif
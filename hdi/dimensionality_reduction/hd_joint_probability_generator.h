@@ -35,6 +35,8 @@
 
 #include <vector>
 #include <stdint.h>
+#include <string>
+#include <functional>
 #include "hdi/utils/assert_by_exception.h"
 #include "hdi/utils/abstract_log.h"
 #include <map>
@@ -42,6 +44,7 @@
 #include <random>
 #include <unordered_set>
 #include "hdi/data/map_mem_eff.h"
+#include "hdi/dimensionality_reduction/knn_graph_generator.h"
 
 namespace hdi{
   namespace dr{
@@ -58,6 +61,8 @@ namespace hdi{
       typedef scalar scalar_type;
       typedef sparse_scalar_matrix sparse_scalar_matrix_type;
       typedef std::vector<scalar_type> scalar_vector_type; //! Vector of scalar_type
+      //! Reader of a num_dps*num_dps matrix of squared distances: it writes the rows in [row_begin,row_end) in the row-major buffer rows
+      typedef std::function<void(unsigned int row_begin, unsigned int row_end, scalar_type* rows)> distance_rows_reader_type;
 
     public:
       //! Parameters used for the initialization of the algorithm
@@ -69,6 +74,14 @@ namespace hdi{
         int     _perplexity_multiplier; //! Multiplied by the perplexity gives the number of nearest neighbors used
         int     _num_trees;       //! Number of trees used int the AKNN
         int     _num_checks;      //! Number of checks used int the AKNN
+        KNNBackend _knn_backend;  //! Engine used for the computation of the neighborhood graph
+        unsigned int _knn_graph_degree; //! Max number of links per node when the proximity graph engine is used
+        unsigned int _knn_graph_ef; //! Size of the candidate list when the proximity graph engine is used
+        unsigned int _knn_recall_num_samples; //! Number of points used to estimate the recall of the neighborhood graph (0 to disable)
+        unsigned int _knn_memory_budget; //! Memory (MB) used for the blocks of queries and references when the out-of-core engine is used, and for the blocks of rows of a streamed distance matrix
+        std::string _knn_cache_directory; //! Directory where neighborhood graphs are cached and reused across runs (empty to disable)
+        unsigned int _pca_components; //! If larger than 0, neighborhoods are computed on the projection of the data on their first principal components (randomized PCA)
+        int     _seed;            //! Seed used by the randomized engines. If a negative value is provided, a time-based seed is used
       };
 
       //!
@@ -85,8 +98,11 @@ namespace hdi{
 
       public:
         scalar_type _total_time;
+        scalar_type _pca_time;
         scalar_type _trees_construction_time;
         scalar_type _aknn_time;
+        scalar_type _aknn_recall;  //! Sampled recall of the neighborhood graph, -1 if not computed
+        scalar_type _aknn_recall_time;
         scalar_type _distribution_time;
       };
 
@@ -98,6 +114,23 @@ namespace hdi{
       void computeProbabilityDistributions(/*const*/ scalar_type* high_dimensional_data, unsigned int num_dim, unsigned int num_dps, std::vector<scalar_type>& probabilities, std::vector<int>& indices, Parameters params = Parameters());
       void computeProbabilityDistributionsFromDistanceMatrix(const std::vector<scalar_type>& squared_distance_matrix, unsigned int num_dps, sparse_scalar_matrix& distribution, Parameters params = Parameters());
 
+      //! Joint probability distributions for a list of perplexities. The neighborhoods are computed once for the largest perplexity
+      //! and every distribution is calibrated on the first perplexity*perplexity_multiplier neighbors. The _perplexity parameter is ignored
+      void computeJointProbabilityDistributions(/*const*/ scalar_type* high_dimensional_data, unsigned int num_dim, unsigned int num_dps, const std::vector<scalar_type>& perplexities, std::vector<sparse_scalar_matrix>& distributions, Parameters params = Parameters());
+      //! Multi-scale joint probability distribution: the conditional distributions are the average of the gaussian kernels calibrated for every perplexity.
+      //! All the scales use the neighborhoods of the largest perplexity. The _perplexity parameter is ignored
+      void computeMultiscaleJointProbabilityDistribution(/*const*/ scalar_type* high_dimensional_data, unsigned int num_dim, unsigned int num_dps, const std::vector<scalar_type>& perplexities, sparse_scalar_matrix& distribution, Parameters params = Parameters());
+      //! Probability distributions from a matrix of squared distances that is read in blocks of rows. Only the perplexity*perplexity_multiplier nearest neighbors of every point are kept
+      //! The memory required is O(num_dps*k) plus a block of rows sized by the _knn_memory_budget parameter
+      void computeProbabilityDistributionsFromDistanceRows(const distance_rows_reader_type& reader, unsigned int num_dps, sparse_scalar_matrix& distribution, Parameters params = Parameters());
+      //! Probability distributions from a matrix of squared distances stored as a raw row-major matrix in a memory-mapped file. Only the perplexity*perplexity_multiplier nearest neighbors of every point are kept
+      void computeProbabilityDistributionsFromDistanceMatrix(const utils::MemoryMappedFile& squared_distance_matrix, sparse_scalar_matrix& distribution, Parameters params = Parameters());
+
+      //! Joint probability distribution of data stored as a raw row-major matrix in a memory-mapped file. Use it together with the out-of-core KNN engine for data that does not fit in memory
+      void computeJointProbabilityDistribution(const utils::MemoryMappedFile& high_dimensional_data, unsigned int num_dim, sparse_scalar_matrix& distribution, Parameters params = Parameters());
+      //! Probability distributions of data stored as a raw row-major matrix in a memory-mapped file. Use it together with the out-of-core KNN engine for data that does not fit in memory
+      void computeProbabilityDistributions(const utils::MemoryMappedFile& high_dimensional_data, unsigned int num_dim, sparse_scalar_matrix& distribution, Parameters params = Parameters());
+
 
       //! Return the current log
       utils::AbstractLog* logger()const{return _logger;}
@@ -109,11 +142,15 @@ namespace hdi{
 
     private:
       //! Compute the euclidean distances between points
-      void computeHighDimensionalDistances(/*const*/ scalar_type* high_dimensional_data, unsigned int num_dim, unsigned int num_dps, std::vector<scalar_type>& dsitances, std::vector<int>& indices, Parameters& params);
+      void computeHighDimensionalDistances(/*const*/ scalar_type* high_dimensional_data, unsigned int num_dim, unsigned int num_dps, std::vector<scalar_type>& dsitances, std::vector<int>& indices, Parameters& params, const utils::MemoryMappedFile* mapped_file = nullptr);
       //! Compute a gaussian distribution for each data-point
       void computeGaussianDistributions(const std::vector<scalar_type>& dsitances, const std::vector<int>& indices, sparse_scalar_matrix& matrix, Parameters& params);
       //! Compute a gaussian distribution for each data-point
       void computeGaussianDistributions(const std::vector<scalar_type>& dsitances, const std::vector<int>& indices, std::vector<scalar_type>& probabilities, Parameters& params);
+      //! Compute a gaussian distribution for each data-point using the first prefix_nn elements of rows of nn squared distances. The output has prefix_nn elements per row
+      void computeGaussianDistributions(const std::vector<scalar_type>& distances_squared, unsigned int nn, unsigned int prefix_nn, scalar_type perplexity, std::vector<scalar_type>& probabilities);
+      //! Neighborhoods for the largest of the perplexities, returns the number of neighbors of every point (the point itself included)
+      unsigned int computeHighDimensionalDistances(/*const*/ scalar_type* high_dimensional_data, unsigned int num_dim, unsigned int num_dps, const std::vector<scalar_type>& perplexities, std::vector<scalar_type>& distances_squared, std::vector<int>& indices, const Parameters& params);
       //! Create joint distribution
       void symmetrize(sparse_scalar_matrix& matrix);
 
@@ -35,35 +35,22 @@
 #define HD_JOINT_PROBABILITY_GENERATOR_INL
 
 #include "hdi/dimensionality_reduction/hd_joint_probability_generator.h"
+#include "hdi/dimensionality_reduction/randomized_pca.h"
 #include "hdi/utils/math_utils.h"
 #include "hdi/utils/log_helper_functions.h"
 #include "hdi/utils/scoped_timers.h"
+#include "hdi/data/map_helpers.h"
 #include <random>
 #include <chrono>
 #include <unordered_set>
 #include <numeric>
+#include <cmath>
+#include <algorithm>
 
 #ifdef __USE_GCD__
 #include <dispatch/dispatch.h>
 #endif
 
-#pragma warning( push )
-#pragma warning( disable : 4267)
-#pragma warning( push )
-#pragma warning( disable : 4291)
-#pragma warning( push )
-#pragma warning( disable : 4996)
-#pragma warning( push )
-#pragma warning( disable : 4018)
-#pragma warning( push )
-#pragma warning( disable : 4244)
-#include "flann/flann.h"
-#pragma warning( pop )
-#pragma warning( pop )
-#pragma warning( pop )
-#pragma warning( pop )
-#pragma warning( pop )
-
 namespace hdi{
   namespace dr{
   /////////////////////////////////////////////////////////////////////////
@@ -73,7 +60,15 @@ namespace hdi{
       _perplexity(30),
       _perplexity_multiplier(3),
       _num_trees(4),
-      _num_checks(1024)
+      _num_checks(1024),
+      _knn_backend(KNNBackend::FlannKDTree),
+      _knn_graph_degree(16),
+      _knn_graph_ef(200),
+      _knn_recall_num_samples(0),
+      _knn_memory_budget(1024),
+      _knn_cache_directory(),
+      _pca_components(0),
+      _seed(-1)
     {}
 
   /////////////////////////////////////////////////////////////////////////
@@ -81,16 +76,22 @@ namespace hdi{
     template <typename scalar, typename sparse_scalar_matrix>
     HDJointProbabilityGenerator<scalar, sparse_scalar_matrix>::Statistics::Statistics():
       _total_time(0),
+      _pca_time(0),
       _trees_construction_time(0),
       _aknn_time(0),
+      _aknn_recall(-1),
+      _aknn_recall_time(0),
       _distribution_time(0)
     {}
 
     template <typename scalar, typename sparse_scalar_matrix>
     void HDJointProbabilityGenerator<scalar, sparse_scalar_matrix>::Statistics::reset(){
       _total_time = 0;
+      _pca_time = 0;
       _trees_construction_time = 0;
       _aknn_time = 0;
+      _aknn_recall = -1;
+      _aknn_recall_time = 0;
       _distribution_time = 0;
     }
 
@@ -98,8 +99,15 @@ namespace hdi{
     void HDJointProbabilityGenerator<scalar, sparse_scalar_matrix>::Statistics::log(utils::AbstractLog* logger)const{
       utils::secureLog(logger,"\n-------- HD Joint Probability Generator Statistics -----------");
       utils::secureLogValue(logger,"Total time",_total_time);
+      if(_pca_time != 0){
+        utils::secureLogValue(logger,"\tPCA time",_pca_time,true,3);
+      }
       utils::secureLogValue(logger,"\tTrees construction time",_trees_construction_time,true,1);
       utils::secureLogValue(logger,"\tAKNN time",_aknn_time,true,3);
+      if(_aknn_recall != -1){
+        utils::secureLogValue(logger,"\tAKNN recall (sampled)",_aknn_recall,true,2);
+        utils::secureLogValue(logger,"\tAKNN recall time",_aknn_recall_time,true,2);
+      }
       utils::secureLogValue(logger,"\tDistributions time",_distribution_time,true,2);
       utils::secureLog(logger,"--------------------------------------------------------------\n");
     }
@@ -155,27 +163,86 @@ namespace hdi{
     }
 
     template <typename scalar, typename sparse_scalar_matrix>
-    void HDJointProbabilityGenerator<scalar, sparse_scalar_matrix>::computeHighDimensionalDistances(scalar_type* high_dimensional_data, unsigned int num_dim, unsigned int num_dps, std::vector<scalar_type>& distances_squared, std::vector<int>& indices, Parameters& params){
-      hdi::utils::secureLog(_logger,"Computing nearest neighborhoods...");
-      flann::Matrix<scalar_type> dataset  (high_dimensional_data,num_dps,num_dim);
-      flann::Matrix<scalar_type> query  (high_dimensional_data,num_dps,num_dim);
+    void HDJointProbabilityGenerator<scalar, sparse_scalar_matrix>::computeJointProbabilityDistribution(const utils::MemoryMappedFile& high_dimensional_data, unsigned int num_dim, sparse_scalar_matrix& distribution, Parameters params){
+      checkAndThrowLogic(num_dim > 0 && high_dimensional_data.size()%(sizeof(scalar_type)*num_dim) == 0, "HDJointProbabilityGenerator: the size of the file does not agree with the number of dimensions");
+      utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._total_time);
 
-      flann::Index<flann::L2<scalar_type> > index(dataset, flann::KDTreeIndexParams(params._num_trees));
-      const unsigned int nn = params._perplexity*params._perplexity_multiplier + 1;
-      distances_squared.resize(num_dps*nn);
-      indices.resize(num_dps*nn);
-      {
-        utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._trees_construction_time);
-        index.buildIndex();
+      hdi::utils::secureLog(_logger,"Computing the HD joint probability distribution from a memory-mapped file...");
+      const unsigned int num_dps = static_cast<unsigned int>(high_dimensional_data.size()/(sizeof(scalar_type)*num_dim));
+      distribution.resize(num_dps);
+
+      std::vector<scalar_type>  distances_squared;
+      std::vector<int>      indices;
+
+      computeHighDimensionalDistances(nullptr, num_dim, num_dps, distances_squared, indices, params, &high_dimensional_data);
+      computeGaussianDistributions(distances_squared,indices,distribution,params);
+      symmetrize(distribution);
+    }
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    void HDJointProbabilityGenerator<scalar, sparse_scalar_matrix>::computeProbabilityDistributions(const utils::MemoryMappedFile& high_dimensional_data, unsigned int num_dim, sparse_scalar_matrix& distribution, Parameters params){
+      checkAndThrowLogic(num_dim > 0 && high_dimensional_data.size()%(sizeof(scalar_type)*num_dim) == 0, "HDJointProbabilityGenerator: the size of the file does not agree with the number of dimensions");
+      utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._total_time);
+
+      hdi::utils::secureLog(_logger,"Computing the HD joint probability distribution from a memory-mapped file...");
+      const unsigned int num_dps = static_cast<unsigned int>(high_dimensional_data.size()/(sizeof(scalar_type)*num_dim));
+      distribution.resize(num_dps);
+
+      std::vector<scalar_type>  distances_squared;
+      std::vector<int>      indices;
+
+      computeHighDimensionalDistances(nullptr, num_dim, num_dps, distances_squared, indices, params, &high_dimensional_data);
+      computeGaussianDistributions(distances_squared,indices,distribution,params);
+    }
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    void HDJointProbabilityGenerator<scalar, sparse_scalar_matrix>::computeHighDimensionalDistances(scalar_type* high_dimensional_data, unsigned int num_dim, unsigned int num_dps, std::vector<scalar_type>& distances_squared, std::vector<int>& indices, Parameters& params, const utils::MemoryMappedFile* mapped_file){
+      //The neighborhoods are computed on the principal components, the projected data are kept in memory
+      std::vector<scalar_type> projected_data;
+      if(params._pca_components >= num_dim){
+        utils::secureLogValue(_logger,"PCA skipped, the number of components is not smaller than the dimensionality",params._pca_components);
+      }
+      if(params._pca_components > 0 && params._pca_components < num_dim){
+        utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._pca_time);
+        RandomizedPCA<scalar_type> pca;
+        typename RandomizedPCA<scalar_type>::Parameters pca_params;
+        pca_params._num_components = params._pca_components;
+        pca.setLogger(_logger);
+        if(mapped_file != nullptr){
+          pca.fitTransform(*mapped_file, num_dim, projected_data, pca_params);
+        }else{
+          pca.fitTransform(high_dimensional_data, num_dim, num_dps, projected_data, pca_params);
+        }
+        high_dimensional_data = projected_data.data();
+        num_dim = params._pca_components;
+        mapped_file = nullptr;
       }
-      {
-        utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._aknn_time);
-        flann::Matrix<int> indices_mat(indices.data(), query.rows, nn);
-        flann::Matrix<scalar_type> dists_mat(distances_squared.data(), query.rows, nn);
-        flann::SearchParams flann_params(params._num_checks);
-        flann_params.cores = 0; //all cores
-        index.knnSearch(query, indices_mat, dists_mat, nn, flann_params);
+
+      hdi::utils::secureLog(_logger,"Computing nearest neighborhoods...");
+      const unsigned int nn = params._perplexity*params._perplexity_multiplier + 1;
+
+      KNNGraphGenerator<scalar_type> knn_generator;
+      typename KNNGraphGenerator<scalar_type>::Parameters knn_params;
+      knn_params._backend = params._knn_backend;
+      knn_params._num_trees = params._num_trees;
+      knn_params._num_checks = params._num_checks;
+      knn_params._graph_degree = params._knn_graph_degree;
+      knn_params._graph_ef = params._knn_graph_ef;
+      knn_params._recall_num_samples = params._knn_recall_num_samples;
+      knn_params._memory_budget = params._knn_memory_budget;
+      knn_params._cache_directory = params._knn_cache_directory;
+      knn_params._seed = params._seed;
+      knn_generator.setLogger(_logger);
+      if(mapped_file != nullptr){
+        knn_generator.computeKNNGraph(*mapped_file, num_dim, nn, distances_squared, indices, knn_params);
+      }else{
+        knn_generator.computeKNNGraph(high_dimensional_data, num_dim, num_dps, nn, distances_squared, indices, knn_params);
       }
+
+      _statistics._trees_construction_time = knn_generator.statistics()._index_construction_time;
+      _statistics._aknn_time = knn_generator.statistics()._search_time;
+      _statistics._aknn_recall = knn_generator.statistics()._recall;
+      _statistics._aknn_recall_time = knn_generator.statistics()._recall_time;
     }
 
     template <typename scalar, typename sparse_scalar_matrix>
@@ -185,39 +252,20 @@ namespace hdi{
       const int n = distribution.size();
 
       const unsigned int nn = params._perplexity*params._perplexity_multiplier + 1;
-#ifdef __USE_GCD__
-        __block scalar_vector_type temp_vector(distances_squared.size(),0);
-#else
-        scalar_vector_type temp_vector(distances_squared.size(),0);
-#endif //__USE_GCD__
-      
-#ifdef __USE_GCD__
-      std::cout << "GCD dispatch, hd_joint_probability_generator 193.\n";
-      dispatch_apply(n, dispatch_get_global_queue(0, 0), ^(size_t j) {
-#else
-      #pragma omp parallel for
-      for(int j = 0; j < n; ++j){
-#endif //__USE_GCD__
-        const auto sigma =  utils::computeGaussianDistributionWithFixedPerplexity<scalar_vector_type>(
-                  distances_squared.begin() + j*nn, //check squared
-                  distances_squared.begin() + (j + 1)*nn,
-                  temp_vector.begin() + j*nn,
-                  temp_vector.begin() + (j + 1)*nn,
-                  params._perplexity,
-                  200,
-                  1e-5,
-                  0
-                );
-      }
-#ifdef __USE_GCD__
-      );
-#endif
-
+      scalar_vector_type temp_vector(distances_squared.size(),0);
+      utils::computeGaussianDistributionsWithFixedPerplexity<scalar_type>(distances_squared.data(), temp_vector.data(), n, nn, params._perplexity, 200, 1e-5, 0);
+
+      //neighbors are sorted by distance, rows are built in bulk
+      typedef typename sparse_scalar_matrix::value_type map_type;
+      typedef hdi::data::MapHelpers<typename map_type::key_type,typename map_type::mapped_type,map_type> map_helpers_type;
+      typedef std::vector<std::pair<typename map_type::key_type,typename map_type::mapped_type>> row_type;
+      row_type row(nn-1);
       for(int j = 0; j < n; ++j){
         for(int k = 1; k < nn; ++k){
           const unsigned int i = j*nn+k;
-          distribution[j][indices[i]] = temp_vector[i];
+          row[k-1] = std::make_pair(indices[i],temp_vector[i]);
         }
+        map_helpers_type::initializeUnsorted(distribution[j],row.begin(),row.end());
       }
     }
 
@@ -228,87 +276,243 @@ namespace hdi{
 
       const unsigned int nn = params._perplexity*params._perplexity_multiplier + 1;
       const int n = indices.size()/nn;
-      
-#ifdef __USE_GCD__
-      std::cout << "GCD dispatch, hd_joint_probability_generator 232.\n";
-      dispatch_apply(n, dispatch_get_global_queue(0, 0), ^(size_t j) {
-#else
-      #pragma omp parallel for
-      for(int j = 0; j < n; ++j){
-#endif //__USE_GCD__
-        const auto sigma =  utils::computeGaussianDistributionWithFixedPerplexity<scalar_vector_type>(
-                  distances_squared.begin() + j*nn, //check squared
-                  distances_squared.begin() + (j + 1)*nn,
-                  probabilities.begin() + j*nn,
-                  probabilities.begin() + (j + 1)*nn,
-                  params._perplexity,
-                  200,
-                  1e-5,
-                  0
-                );
+
+      probabilities.resize(distances_squared.size());
+      utils::computeGaussianDistributionsWithFixedPerplexity<scalar_type>(distances_squared.data(), probabilities.data(), n, nn, params._perplexity, 200, 1e-5, 0);
+    }
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    void HDJointProbabilityGenerator<scalar, sparse_scalar_matrix>::computeGaussianDistributions(const std::vector<scalar_type>& distances_squared, unsigned int nn, unsigned int prefix_nn, scalar_type perplexity, std::vector<scalar_type>& probabilities){
+      checkAndThrowLogic(prefix_nn > 1 && prefix_nn <= nn, "HDJointProbabilityGenerator: invalid number of neighbors");
+      const size_t n = distances_squared.size()/nn;
+      probabilities.resize(n*prefix_nn);
+      if(prefix_nn == nn){
+        utils::computeGaussianDistributionsWithFixedPerplexity<scalar_type>(distances_squared.data(), probabilities.data(), n, nn, perplexity, 200, 1e-5, 0);
+        return;
       }
-#ifdef __USE_GCD__
-      );
-#endif
+      //Neighbors are sorted by distance, the first prefix_nn of every row are the neighborhood for the smaller perplexity
+      scalar_vector_type prefix_distances(n*prefix_nn);
+      for(size_t j = 0; j < n; ++j){
+        std::copy(distances_squared.begin()+j*nn,distances_squared.begin()+j*nn+prefix_nn,prefix_distances.begin()+j*prefix_nn);
+      }
+      utils::computeGaussianDistributionsWithFixedPerplexity<scalar_type>(prefix_distances.data(), probabilities.data(), n, prefix_nn, perplexity, 200, 1e-5, 0);
     }
 
     template <typename scalar, typename sparse_scalar_matrix>
-    void HDJointProbabilityGenerator<scalar, sparse_scalar_matrix>::symmetrize(sparse_scalar_matrix& distribution){
-      const int n = distribution.size();
-      for(int j = 0; j < n; ++j){
-        for(auto& e: distribution[j]){
-          const unsigned int i = e.first;
-          scalar new_val = (distribution[j][i]+distribution[i][j])*0.5;
-          distribution[j][i] = new_val;
-          distribution[i][j] = new_val;
+    unsigned int HDJointProbabilityGenerator<scalar, sparse_scalar_matrix>::computeHighDimensionalDistances(scalar_type* high_dimensional_data, unsigned int num_dim, unsigned int num_dps, const std::vector<scalar_type>& perplexities, std::vector<scalar_type>& distances_squared, std::vector<int>& indices, const Parameters& params){
+      checkAndThrowLogic(!perplexities.empty(), "HDJointProbabilityGenerator: at least one perplexity is needed");
+      for(auto p: perplexities){
+        checkAndThrowLogic(p > 0, "HDJointProbabilityGenerator: invalid perplexity");
+      }
+      Parameters knn_params = params;
+      knn_params._perplexity = *std::max_element(perplexities.begin(),perplexities.end());
+      computeHighDimensionalDistances(high_dimensional_data, num_dim, num_dps, distances_squared, indices, knn_params);
+      return knn_params._perplexity*knn_params._perplexity_multiplier + 1;
+    }
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    void HDJointProbabilityGenerator<scalar, sparse_scalar_matrix>::computeJointProbabilityDistributions(scalar_type* high_dimensional_data, unsigned int num_dim, unsigned int num_dps, const std::vector<scalar_type>& perplexities, std::vector<sparse_scalar_matrix>& distributions, Parameters params){
+      typedef typename sparse_scalar_matrix::value_type map_type;
+      typedef hdi::data::MapHelpers<typename map_type::key_type,typename map_type::mapped_type,map_type> map_helpers_type;
+      typedef std::vector<std::pair<typename map_type::key_type,typename map_type::mapped_type>> row_type;
+      utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._total_time);
+      hdi::utils::secureLogValue(_logger,"Computing the HD joint probability distributions, number of perplexities",perplexities.size());
+
+      std::vector<scalar_type>  distances_squared;
+      std::vector<int>      indices;
+      const unsigned int nn = computeHighDimensionalDistances(high_dimensional_data, num_dim, num_dps, perplexities, distances_squared, indices, params);
+
+      utils::ScopedTimer<scalar_type, utils::Seconds> distribution_timer(_statistics._distribution_time);
+      distributions.clear();
+      distributions.resize(perplexities.size());
+      scalar_vector_type probabilities;
+      row_type row;
+      for(size_t p = 0; p < perplexities.size(); ++p){
+        const unsigned int prefix_nn = perplexities[p]*params._perplexity_multiplier + 1;
+        computeGaussianDistributions(distances_squared, nn, prefix_nn, perplexities[p], probabilities);
+
+        distributions[p].resize(num_dps);
+        row.resize(prefix_nn-1);
+        for(int j = 0; j < int(num_dps); ++j){
+          for(int k = 1; k < int(prefix_nn); ++k){
+            row[k-1] = std::make_pair(indices[size_t(j)*nn+k],probabilities[size_t(j)*prefix_nn+k]);
+          }
+          map_helpers_type::initializeUnsorted(distributions[p][j],row.begin(),row.end());
         }
+        symmetrize(distributions[p]);
       }
     }
 
+    template <typename scalar, typename sparse_scalar_matrix>
+    void HDJointProbabilityGenerator<scalar, sparse_scalar_matrix>::computeMultiscaleJointProbabilityDistribution(scalar_type* high_dimensional_data, unsigned int num_dim, unsigned int num_dps, const std::vector<scalar_type>& perplexities, sparse_scalar_matrix& distribution, Parameters params){
+      typedef typename sparse_scalar_matrix::value_type map_type;
+      typedef hdi::data::MapHelpers<typename map_type::key_type,typename map_type::mapped_type,map_type> map_helpers_type;
+      typedef std::vector<std::pair<typename map_type::key_type,typename map_type::mapped_type>> row_type;
+      utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._total_time);
+      hdi::utils::secureLogValue(_logger,"Computing the multi-scale HD joint probability distribution, number of perplexities",perplexities.size());
+
+      std::vector<scalar_type>  distances_squared;
+      std::vector<int>      indices;
+      const unsigned int nn = computeHighDimensionalDistances(high_dimensional_data, num_dim, num_dps, perplexities, distances_squared, indices, params);
+
+      utils::ScopedTimer<scalar_type, utils::Seconds> distribution_timer(_statistics._distribution_time);
+      scalar_vector_type probabilities;
+      std::vector<double> kernel(distances_squared.size(),0);
+      for(size_t p = 0; p < perplexities.size(); ++p){
+        computeGaussianDistributions(distances_squared, nn, nn, perplexities[p], probabilities);
+        for(size_t i = 0; i < kernel.size(); ++i){
+          kernel[i] += probabilities[i];
+        }
+      }
+
+      distribution.clear();
+      distribution.resize(num_dps);
+      row_type row(nn-1);
+      for(int j = 0; j < int(num_dps); ++j){
+        for(int k = 1; k < int(nn); ++k){
+          const size_t i = size_t(j)*nn+k;
+          row[k-1] = std::make_pair(indices[i],static_cast<scalar_type>(kernel[i]/perplexities.size()));
+        }
+        map_helpers_type::initializeUnsorted(distribution[j],row.begin(),row.end());
+      }
+      symmetrize(distribution);
+    }
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    void HDJointProbabilityGenerator<scalar, sparse_scalar_matrix>::symmetrize(sparse_scalar_matrix& distribution){
+      typedef typename sparse_scalar_matrix::value_type map_type;
+      typedef typename map_type::key_type key_type;
+      typedef typename map_type::mapped_type mapped_type;
+      typedef hdi::data::MapHelpers<key_type,mapped_type,map_type> map_helpers_type;
+
+      sparse_scalar_matrix symmetric;
+      map_helpers_type::symmetrize(distribution,symmetric);
+      distribution.swap(symmetric);
+    }
+
     template <typename scalar, typename sparse_scalar_matrix>
     void HDJointProbabilityGenerator<scalar, sparse_scalar_matrix>::computeProbabilityDistributionsFromDistanceMatrix(const std::vector<scalar_type>& squared_distance_matrix, unsigned int num_dps, sparse_scalar_matrix& distribution, Parameters params){
       utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._distribution_time);
       utils::secureLog(_logger,"Computing joint-probability distribution...");
-      const int n = num_dps;
+      checkAndThrowLogic(squared_distance_matrix.size() == size_t(num_dps)*num_dps, "HDJointProbabilityGenerator: the size of the distance matrix does not agree with the number of data points");
       const unsigned int nn = num_dps;
-#ifdef __USE_GCD__
-      __block scalar_vector_type temp_vector(num_dps*num_dps,0);
-#else
-      scalar_vector_type temp_vector(num_dps*num_dps,0);
-#endif //__USE_GCD__
       distribution.clear();
-      distribution.resize(n);
+      distribution.resize(num_dps);
+
+      //The probabilities are computed on blocks of rows to avoid a second num_dps*num_dps matrix
+      const unsigned int block_size = std::max<unsigned int>(1,std::min<size_t>(num_dps,(size_t(params._knn_memory_budget)*1024*1024)/(sizeof(scalar_type)*num_dps)));
+      scalar_vector_type temp_vector(size_t(block_size)*nn,0);
+      for(unsigned int row_begin = 0; row_begin < num_dps; row_begin += block_size){
+        const unsigned int num_rows = std::min(block_size,num_dps-row_begin);
+        //Row j ignores the distance of the point to itself
+        utils::computeGaussianDistributionsWithFixedPerplexity<scalar_type>(squared_distance_matrix.data()+size_t(row_begin)*nn, temp_vector.data(), num_rows, nn, params._perplexity, 200, 1e-5, row_begin, 1);
+
+        for(int j = 0; j < int(num_rows); ++j){
+          for(int k = 0; k < int(nn); ++k){
+            const size_t i = size_t(j)*nn+k;
+            distribution[row_begin+j][k] = temp_vector[i];
+          }
+        }
+      }
+    }
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    void HDJointProbabilityGenerator<scalar, sparse_scalar_matrix>::computeProbabilityDistributionsFromDistanceRows(const distance_rows_reader_type& reader, unsigned int num_dps, sparse_scalar_matrix& distribution, Parameters params){
+      typedef std::pair<scalar_type,int> neighbor_type;
+      typedef typename sparse_scalar_matrix::value_type map_type;
+      typedef hdi::data::MapHelpers<typename map_type::key_type,typename map_type::mapped_type,map_type> map_helpers_type;
+      typedef std::vector<std::pair<typename map_type::key_type,typename map_type::mapped_type>> row_type;
+      utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._distribution_time);
+      utils::secureLog(_logger,"Computing joint-probability distribution from streamed distances...");
+      checkAndThrowLogic(num_dps > 1, "HDJointProbabilityGenerator: at least two data points are needed");
+      const unsigned int nn = std::min<unsigned int>(num_dps,params._perplexity*params._perplexity_multiplier + 1);
+      const unsigned int block_size = std::max<unsigned int>(1,std::min<size_t>(num_dps,(size_t(params._knn_memory_budget)*1024*1024)/(sizeof(scalar_type)*num_dps)));
+      distribution.clear();
+      distribution.resize(num_dps);
+
+      scalar_vector_type rows(size_t(block_size)*num_dps);
+      scalar_vector_type distances_squared(size_t(block_size)*nn);
+      scalar_vector_type probabilities(size_t(block_size)*nn);
+      std::vector<int> indices(size_t(block_size)*nn);
+
+      for(unsigned int row_begin = 0; row_begin < num_dps; row_begin += block_size){
+        const unsigned int num_rows = std::min(block_size,num_dps-row_begin);
+        reader(row_begin,row_begin+num_rows,rows.data());
 
+        //Selection of the nn-1 nearest neighbors, the point itself is always the first neighbor
 #ifdef __USE_GCD__
-      std::cout << "GCD dispatch, hd_joint_probability_generator 193.\n";
-      dispatch_apply(n, dispatch_get_global_queue(0, 0), ^(size_t j) {
+        dispatch_apply(num_rows, dispatch_get_global_queue(0, 0), ^(size_t r) {
 #else
-      #pragma omp parallel for
-      for(int j = 0; j < n; ++j){
+        #pragma omp parallel for
+        for(int r = 0; r < int(num_rows); ++r){
 #endif //__USE_GCD__
-        const auto sigma =  utils::computeGaussianDistributionWithFixedPerplexity<scalar_vector_type>(
-                  squared_distance_matrix.begin() + j*nn, //check squared
-                  squared_distance_matrix.begin() + (j + 1)*nn,
-                  temp_vector.begin() + j*nn,
-                  temp_vector.begin() + (j + 1)*nn,
-                  params._perplexity,
-                  200,
-                  1e-5,
-                  j
-                );
-      }
+          const unsigned int i = row_begin+r;
+          const scalar_type* row = rows.data() + size_t(r)*num_dps;
+          std::vector<neighbor_type> heap;
+          heap.reserve(nn);
+          for(unsigned int j = 0; j < num_dps; ++j){
+            if(j == i){
+              continue;
+            }
+            if(heap.size() < nn-1){
+              heap.push_back(neighbor_type(row[j],j));
+              std::push_heap(heap.begin(),heap.end());
+            }else if(row[j] < heap.front().first){
+              std::pop_heap(heap.begin(),heap.end());
+              heap.back() = neighbor_type(row[j],j);
+              std::push_heap(heap.begin(),heap.end());
+            }
+          }
+          std::sort_heap(heap.begin(),heap.end());
+          distances_squared[size_t(r)*nn] = 0;
+          indices[size_t(r)*nn] = i;
+          for(unsigned int k = 1; k < nn; ++k){
+            distances_squared[size_t(r)*nn+k] = heap[k-1].first;
+            indices[size_t(r)*nn+k] = heap[k-1].second;
+          }
+        }
 #ifdef __USE_GCD__
-      );
+        );
 #endif
 
-      for(int j = 0; j < n; ++j){
-        for(int k = 0; k < nn; ++k){
-          const unsigned int i = j*nn+k;
-          distribution[j][k] = temp_vector[i];
+        utils::computeGaussianDistributionsWithFixedPerplexity<scalar_type>(distances_squared.data(), probabilities.data(), num_rows, nn, params._perplexity, 200, 1e-5, 0);
+
+#ifdef __USE_GCD__
+        dispatch_apply(num_rows, dispatch_get_global_queue(0, 0), ^(size_t r) {
+#else
+        #pragma omp parallel for
+        for(int r = 0; r < int(num_rows); ++r){
+#endif //__USE_GCD__
+          row_type row(nn-1);
+          for(unsigned int k = 1; k < nn; ++k){
+            row[k-1] = std::make_pair(indices[size_t(r)*nn+k],probabilities[size_t(r)*nn+k]);
+          }
+          map_helpers_type::initializeUnsorted(distribution[row_begin+r],row.begin(),row.end());
         }
+#ifdef __USE_GCD__
+        );
+#endif
       }
     }
 
+    template <typename scalar, typename sparse_scalar_matrix>
+    void HDJointProbabilityGenerator<scalar, sparse_scalar_matrix>::computeProbabilityDistributionsFromDistanceMatrix(const utils::MemoryMappedFile& squared_distance_matrix, sparse_scalar_matrix& distribution, Parameters params){
+      checkAndThrowLogic(squared_distance_matrix.isOpen(), "HDJointProbabilityGenerator: the file is not mapped");
+      const size_t num_elements = squared_distance_matrix.size()/sizeof(scalar_type);
+      const unsigned int num_dps = static_cast<unsigned int>(std::sqrt(double(num_elements))+0.5);
+      checkAndThrowLogic(size_t(num_dps)*num_dps*sizeof(scalar_type) == squared_distance_matrix.size(), "HDJointProbabilityGenerator: the file does not contain a square matrix");
+
+      const scalar_type* data = squared_distance_matrix.dataAs<scalar_type>();
+      computeProbabilityDistributionsFromDistanceRows(
+        [&](unsigned int row_begin, unsigned int row_end, scalar_type* rows){
+          const size_t offset = size_t(row_begin)*num_dps;
+          const size_t length = size_t(row_end-row_begin)*num_dps;
+          std::copy(data+offset,data+offset+length,rows);
+          squared_distance_matrix.release(offset*sizeof(scalar_type),length*sizeof(scalar_type));
+        },
+        num_dps,distribution,params);
+    }
+
 ///////////////////////////////////////////////////////////////////////////////////7
 
 
@@ -35,6 +35,7 @@
 
 #include <vector>
 #include <stdint.h>
+#include <string>
 #include "hdi/utils/assert_by_exception.h"
 #include "hdi/utils/abstract_log.h"
 #include <map>
@@ -43,6 +44,8 @@
 #include <unordered_set>
 #include "hdi/data/flow_model.h"
 #include "hdi/data/map_mem_eff.h"
+#include "hdi/data/sparse_matrix_csr.h"
+#include "hdi/dimensionality_reduction/knn_graph_generator.h"
 
 namespace hdi{
   namespace dr{
@@ -60,6 +63,8 @@ namespace hdi{
       typedef int32_t int_type;
       typedef std::vector<scalar_type> scalar_vector_type; //! Vector of scalar_type
       typedef uint32_t data_handle_type;
+      //! Read-only CSR snapshot of a transition matrix, used by the random walks
+      typedef data::SparseMatrixCSR<typename sparse_scalar_matrix_type::value_type::key_type, typename sparse_scalar_matrix_type::value_type::mapped_type> csr_transition_matrix_type;
 
     public:
       class Scale{
@@ -91,6 +96,13 @@ namespace hdi{
         unsigned_int_type _num_neighbors; //! Number of neighbors used in the KNN graph
         unsigned_int_type _aknn_num_trees; //! Number of trees in the Approximated KNN algorithm (See Approximated and User Steerable tSNE paper)
         unsigned_int_type _aknn_num_checks; //! Number of checks in the Approximated KNN algorithm (See Approximated and User Steerable tSNE paper)
+        KNNBackend _aknn_backend; //! Engine used for the computation of the KNN graph
+        unsigned_int_type _aknn_graph_degree; //! Max number of links per node when the proximity graph engine is used
+        unsigned_int_type _aknn_graph_ef; //! Size of the candidate list when the proximity graph engine is used
+        unsigned_int_type _aknn_recall_num_samples; //! Number of points used to estimate the recall of the KNN graph (0 to disable)
+        unsigned_int_type _aknn_memory_budget; //! Memory (MB) used for the blocks of queries and references when the out-of-core KNN engine is used
+        std::string _aknn_cache_directory; //! Directory where KNN graphs are cached and reused across runs (empty to disable)
+        unsigned_int_type _pca_components; //! If larger than 0, the KNN graph is computed on the projection of the data on their first principal components (randomized PCA)
 
         /////////////////// Landmark Selection ////////////////////////
         bool _monte_carlo_sampling; //! Select landmarks with a Markov Chain Monte Carlo sampling (MCMCS)
@@ -124,7 +136,9 @@ namespace hdi{
 
       public:
         scalar_type _total_time;
+        scalar_type _init_pca_time; //! Time requested for the projection of the data on their principal components
         scalar_type _init_knn_time; //! Time requested for the initialization of the KNN graph at the first scale
+        scalar_type _init_knn_recall; //! Sampled recall of the KNN graph at the first scale
         scalar_type _init_probabilities_time; //! Time requested for the computation of transision probabilities
         scalar_type _init_fmc_time; //! Time requested for the computation of the FMC from the KNN graph
 
@@ -223,6 +237,8 @@ namespace hdi{
       }
       //! Initialize the class with the current data-points
       void initialize(scalar_type* high_dimensional_data, unsigned_int_type num_dps, Parameters params = Parameters());
+      //! Initialize the hierarchy with data stored as a raw row-major matrix in a memory-mapped file. The mapping must outlive the object
+      void initialize(const utils::MemoryMappedFile& high_dimensional_data, Parameters params = Parameters());
       //! Initialize the class with the current data-points from a given similarity matrix
       void initialize(const sparse_scalar_matrix_type& similarities, Parameters params = Parameters());
       //! Reset the internal state of the class but it keeps the inserted data-points
@@ -300,8 +316,8 @@ namespace hdi{
       //! Compute a new scale with a out-of-core
       bool addScaleOutOfCoreImpl();
 
-      void selectLandmarks(const Scale& previous_scale,Scale& scale, unsigned_int_type& selected_landmarks);
-      void selectLandmarksWithStationaryDistribution(const Scale& previous_scale,Scale& scale, unsigned_int_type& selected_landmarks);
+      void selectLandmarks(const Scale& previous_scale, const csr_transition_matrix_type& transition_matrix, Scale& scale, unsigned_int_type& selected_landmarks);
+      void selectLandmarksWithStationaryDistribution(const Scale& previous_scale, const csr_transition_matrix_type& transition_matrix, Scale& scale, unsigned_int_type& selected_landmarks);
 
 
       //! Return the seed for the random number generation
@@ -309,9 +325,9 @@ namespace hdi{
 
     private:
       //!Compute a random walk using a transition matrix and return the end point after a max_length steps -> used for landmark selection
-      inline unsigned_int_type randomWalk(unsigned_int_type starting_point, unsigned_int_type max_length, const sparse_scalar_matrix_type& transition_matrix, std::uniform_real_distribution<double>& distribution, std::default_random_engine& generator);
+      inline unsigned_int_type randomWalk(unsigned_int_type starting_point, unsigned_int_type max_length, const csr_transition_matrix_type& transition_matrix, std::uniform_real_distribution<double>& distribution, std::default_random_engine& generator);
       //!Compute a random walk using a transition matrix that stops at a provided stopping point -> used for landmark similarity computation
-      inline int randomWalk(unsigned_int_type starting_point, const std::vector<int>& stopping_points, unsigned_int_type max_length, const sparse_scalar_matrix_type& transition_matrix, std::uniform_real_distribution<double>& distribution, std::default_random_engine& generator);
+      inline int randomWalk(unsigned_int_type starting_point, const std::vector<int>& stopping_points, unsigned_int_type max_length, const csr_transition_matrix_type& transition_matrix, std::uniform_real_distribution<double>& distribution, std::default_random_engine& generator);
 
     private:
       hierarchy_type _hierarchy;
@@ -320,6 +336,7 @@ namespace hdi{
       unsigned_int_type _dimensionality;
       unsigned_int_type _num_dps;
        scalar_type* _high_dimensional_data; //! High-dimensional data
+      const utils::MemoryMappedFile* _mapped_file; //! Mapping of the high-dimensional data, if any
 
       bool _initialized; //! Initialization flag
       bool _verbose;
@@ -35,6 +35,7 @@
 #define HIERARCHICAL_SNE_INL
 
 #include "hdi/dimensionality_reduction/hierarchical_sne.h"
+#include "hdi/dimensionality_reduction/randomized_pca.h"
 #include "hdi/utils/math_utils.h"
 #include "hdi/utils/log_helper_functions.h"
 #include "hdi/utils/scoped_timers.h"
@@ -43,6 +44,7 @@
 #include <unordered_set>
 #include <unordered_map>
 #include <numeric>
+#include <algorithm>
 #include "hdi/utils/memory_utils.h"
 #include "hdi/data/map_mem_eff.h"
 #include "hdi/data/map_helpers.h"
@@ -53,24 +55,6 @@
 //#include <dispatch/dispatch.h>
 //#endif
 
-#pragma warning( push )
-#pragma warning( disable : 4267)
-#pragma warning( push )
-#pragma warning( disable : 4291)
-#pragma warning( push )
-#pragma warning( disable : 4996)
-#pragma warning( push )
-#pragma warning( disable : 4018)
-#pragma warning( push )
-#pragma warning( disable : 4244)
-//#define FLANN_USE_CUDA
-#include "flann/flann.h"
-#pragma warning( pop )
-#pragma warning( pop )
-#pragma warning( pop )
-#pragma warning( pop )
-#pragma warning( pop )
-
 namespace hdi{
   namespace dr{
   /////////////////////////////////////////////////////////////////////////
@@ -81,6 +65,13 @@ namespace hdi{
       _num_neighbors(30),
       _aknn_num_trees(4),
       _aknn_num_checks(1024),
+      _aknn_backend(KNNBackend::FlannKDTree),
+      _aknn_graph_degree(16),
+      _aknn_graph_ef(200),
+      _aknn_recall_num_samples(0),
+      _aknn_memory_budget(1024),
+      _aknn_cache_directory(),
+      _pca_components(0),
       _monte_carlo_sampling(true),
       _mcmcs_num_walks(10),
       _mcmcs_landmark_thresh(1.5),
@@ -99,7 +90,9 @@ namespace hdi{
     template <typename scalar_type, typename sparse_scalar_matrix_type>
     HierarchicalSNE<scalar_type,sparse_scalar_matrix_type>::Statistics::Statistics():
       _total_time(-1),
+      _init_pca_time(-1),
       _init_knn_time(-1),
+      _init_knn_recall(-1),
       _init_probabilities_time(-1),
       _init_fmc_time(-1),
       _mcmc_sampling_time(-1),
@@ -115,7 +108,9 @@ namespace hdi{
     template <typename scalar_type, typename sparse_scalar_matrix_type>
     void HierarchicalSNE<scalar_type,sparse_scalar_matrix_type>::Statistics::reset(){
       _total_time = -1;
+      _init_pca_time = -1;
       _init_knn_time = -1;
+      _init_knn_recall = -1;
       _init_probabilities_time = -1;
       _init_fmc_time = -1;
       _mcmc_sampling_time = -1;
@@ -133,7 +128,9 @@ namespace hdi{
     void HierarchicalSNE<scalar_type,sparse_scalar_matrix_type>::Statistics::log(utils::AbstractLog* logger)const{
       utils::secureLog(logger,"\n--------------- Hierarchical-SNE Statistics ------------------");
       utils::secureLogValue(logger,"Total time",_total_time);
+      if(_init_pca_time != -1){           utils::secureLogValue(logger,"\tPCA time", _init_pca_time,true,3);}
       if(_init_knn_time != -1){           utils::secureLogValue(logger,"\tAKNN graph computation time", _init_knn_time,true,2);}
+      if(_init_knn_recall != -1){         utils::secureLogValue(logger,"\tAKNN graph recall (sampled)", _init_knn_recall,true,2);}
       if(_init_probabilities_time != -1){     utils::secureLogValue(logger,"\tTransition probabilities computation time", _init_probabilities_time,true,1);}
       if(_init_fmc_time != -1){           utils::secureLogValue(logger,"\tFMC computation time", _init_fmc_time,true,3);}
       if(_mcmc_sampling_time != -1){        utils::secureLogValue(logger,"\tMarkov Chain Monte Carlo sampling time", _mcmc_sampling_time,true,1);}
@@ -177,6 +174,7 @@ namespace hdi{
       _dimensionality(0),
       _logger(nullptr),
       _high_dimensional_data(nullptr),
+      _mapped_file(nullptr),
       _verbose(false)
     {
   
@@ -190,6 +188,7 @@ namespace hdi{
     template <typename scalar_type, typename sparse_scalar_matrix_type>
     void HierarchicalSNE<scalar_type,sparse_scalar_matrix_type>::clear(){
       _high_dimensional_data = nullptr;
+      _mapped_file = nullptr;
       _initialized = false;
     }
   
@@ -210,6 +209,7 @@ namespace hdi{
       utils::secureLog(_logger,"Initializing Hierarchical-SNE...");
       _params = params;
       _high_dimensional_data = high_dimensional_data;
+      _mapped_file = nullptr;
       _num_dps = num_dps;
 
       utils::secureLogValue(_logger,"Number of data points",_num_dps);
@@ -219,6 +219,25 @@ namespace hdi{
       utils::secureLog(_logger,"Initialization complete!");
     }
 
+    template <typename scalar_type, typename sparse_scalar_matrix_type>
+    void HierarchicalSNE<scalar_type,sparse_scalar_matrix_type>::initialize(const utils::MemoryMappedFile& high_dimensional_data, Parameters params){
+      checkAndThrowLogic(_dimensionality > 0 && high_dimensional_data.size()%(sizeof(scalar_type)*_dimensionality) == 0, "The size of the file does not agree with the dimensionality");
+      _statistics.reset();
+      utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._total_time);
+      utils::secureLog(_logger,"Initializing Hierarchical-SNE from a memory-mapped file...");
+      _params = params;
+      //The data is only read
+      _high_dimensional_data = const_cast<scalar_type*>(high_dimensional_data.dataAs<scalar_type>());
+      _mapped_file = &high_dimensional_data;
+      _num_dps = static_cast<unsigned_int_type>(high_dimensional_data.size()/(sizeof(scalar_type)*_dimensionality));
+
+      utils::secureLogValue(_logger,"Number of data points",_num_dps);
+      initializeFirstScale();
+
+      _initialized = true;
+      utils::secureLog(_logger,"Initialization complete!");
+    }
+
     template <typename scalar_type, typename sparse_scalar_matrix_type>
     void HierarchicalSNE<scalar_type,sparse_scalar_matrix_type>::initialize(const sparse_scalar_matrix_type& similarities, Parameters params){
       _statistics.reset();
@@ -226,6 +245,7 @@ namespace hdi{
       utils::secureLog(_logger,"Initializing Hierarchical-SNE...");
       _params = params;
       _high_dimensional_data = nullptr;
+      _mapped_file = nullptr;
       _num_dps = similarities.size();
 
       utils::secureLogValue(_logger,"Number of data points",_num_dps);
@@ -252,66 +272,57 @@ namespace hdi{
     template <typename scalar_type, typename sparse_scalar_matrix_type>
     void HierarchicalSNE<scalar_type,sparse_scalar_matrix_type>::computeNeighborhoodGraph(scalar_vector_type& distance_based_probabilities, std::vector<int>& neighborhood_graph){
       utils::secureLog(_logger,"Computing the neighborhood graph...");
-      flann::Matrix<scalar_type> dataset  (_high_dimensional_data,_num_dps,_dimensionality);
-      flann::Matrix<scalar_type> query  (_high_dimensional_data,_num_dps,_dimensionality);
-      
-      flann::Index<flann::L2<scalar_type> > index(dataset, flann::KDTreeIndexParams(_params._aknn_num_trees));
       unsigned_int_type nn = _params._num_neighbors + 1;
       scalar_type perplexity = _params._num_neighbors / 3.;
-      neighborhood_graph.resize(_num_dps*nn);
-      distance_based_probabilities.resize(_num_dps*nn);
+
+      //The KNN graph is computed on the principal components, the projected data are kept in memory
+      std::vector<scalar_type> projected_data;
+      if(_params._pca_components >= _dimensionality){
+        utils::secureLogValue(_logger,"PCA skipped, the number of components is not smaller than the dimensionality",_params._pca_components);
+      }
+      if(_params._pca_components > 0 && _params._pca_components < _dimensionality){
+        utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._init_pca_time);
+        RandomizedPCA<scalar_type> pca;
+        typename RandomizedPCA<scalar_type>::Parameters pca_params;
+        pca_params._num_components = _params._pca_components;
+        pca.setLogger(_logger);
+        if(_mapped_file != nullptr){
+          pca.fitTransform(*_mapped_file, _dimensionality, projected_data, pca_params);
+        }else{
+          pca.fitTransform(_high_dimensional_data, _dimensionality, _num_dps, projected_data, pca_params);
+        }
+      }
+      const bool use_pca = !projected_data.empty();
+
       {
-        utils::secureLog(_logger,"\tBuilding the trees...");
         utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._init_knn_time);
-        index.buildIndex();
-        flann::Matrix<int> indices_mat(neighborhood_graph.data(), query.rows, nn);
-        flann::Matrix<scalar_type> dists_mat(distance_based_probabilities.data(), query.rows, nn);
-        flann::SearchParams params(_params._aknn_num_checks);
-        params.cores = 0; //all cores
-        utils::secureLog(_logger,"\tAKNN queries...");
-        index.knnSearch(query, indices_mat, dists_mat, nn, params);
+        KNNGraphGenerator<scalar_type> knn_generator;
+        typename KNNGraphGenerator<scalar_type>::Parameters knn_params;
+        knn_params._backend = _params._aknn_backend;
+        knn_params._num_trees = _params._aknn_num_trees;
+        knn_params._num_checks = _params._aknn_num_checks;
+        knn_params._graph_degree = _params._aknn_graph_degree;
+        knn_params._graph_ef = _params._aknn_graph_ef;
+        knn_params._recall_num_samples = _params._aknn_recall_num_samples;
+        knn_params._memory_budget = _params._aknn_memory_budget;
+        knn_params._cache_directory = _params._aknn_cache_directory;
+        knn_params._seed = _params._seed;
+        knn_generator.setLogger(_logger);
+        if(use_pca){
+          knn_generator.computeKNNGraph(projected_data.data(), _params._pca_components, _num_dps, nn, distance_based_probabilities, neighborhood_graph, knn_params);
+        }else if(_mapped_file != nullptr){
+          knn_generator.computeKNNGraph(*_mapped_file, _dimensionality, nn, distance_based_probabilities, neighborhood_graph, knn_params);
+        }else{
+          knn_generator.computeKNNGraph(_high_dimensional_data, _dimensionality, _num_dps, nn, distance_based_probabilities, neighborhood_graph, knn_params);
+        }
+        _statistics._init_knn_recall = knn_generator.statistics()._recall;
       }
       {
         utils::secureLog(_logger,"\tFMC computation...");
         utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._init_probabilities_time);
         
-//#ifdef __USE_GCD__
-//        std::cout << "GCD dispatch, hierarchical_sne_inl 253.\n";
-//        dispatch_apply(_num_dps, dispatch_get_global_queue(0, 0), ^(size_t d) {
-//#else
-        #pragma omp parallel for
-        for(int_type d = 0; d < _num_dps; ++d){
-//#endif //__USE_GCD__
-          //It could be that the point itself is not the nearest one if two points are identical... I want the point itself to be the first one!
-          if(neighborhood_graph[d*nn] != d){
-            int to_swap = d*nn;
-            for(; to_swap < d*nn+nn; ++to_swap){
-              if(neighborhood_graph[to_swap] == d)
-                break;
-            }
-            std::swap(neighborhood_graph[nn*d],neighborhood_graph[to_swap]);
-            std::swap(distance_based_probabilities[nn*d],distance_based_probabilities[to_swap]);
-          }
-          scalar_vector_type temp_probability(nn,0);
-          utils::computeGaussianDistributionWithFixedPerplexity<scalar_vector_type>(
-                  distance_based_probabilities.begin() + d*nn,
-                  distance_based_probabilities.begin() + (d + 1)*nn,
-                  temp_probability.begin(),
-                  temp_probability.begin() + nn,
-                  perplexity,
-                  200,
-                  1e-5,
-                  0
-                );
-
-          distance_based_probabilities[d*nn] = 0;
-          for(unsigned_int_type n = 1; n < nn; ++n){
-            distance_based_probabilities[d*nn+n] = temp_probability[n];
-          }
-        }
-//#ifdef __USE_GCD__
-//        );
-//#endif
+        //KNNGraphGenerator guarantees that the point itself is the first neighbor, the distances are replaced in place by the probabilities
+        utils::computeGaussianDistributionsWithFixedPerplexity<scalar_type>(distance_based_probabilities.data(), distance_based_probabilities.data(), _num_dps, nn, perplexity, 200, 1e-5, 0);
       }
     }
 
@@ -387,7 +398,7 @@ namespace hdi{
     }
 
     template <typename scalar_type, typename sparse_scalar_matrix_type>
-    void HierarchicalSNE<scalar_type,sparse_scalar_matrix_type>::selectLandmarks(const Scale& previous_scale, Scale& scale, unsigned_int_type& selected_landmarks){
+    void HierarchicalSNE<scalar_type,sparse_scalar_matrix_type>::selectLandmarks(const Scale& previous_scale, const csr_transition_matrix_type& transition_matrix, Scale& scale, unsigned_int_type& selected_landmarks){
       utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._landmarks_selection_time);
       utils::secureLog(_logger,"Landmark selection with fixed reduction...");
       const unsigned_int_type previous_scale_dp = previous_scale._transition_matrix.size();
@@ -413,7 +424,7 @@ namespace hdi{
         assert(idx < _num_dps);
 
         if(_params._rs_outliers_removal_jumps > 0){
-          idx = randomWalk(idx,_params._rs_outliers_removal_jumps,previous_scale._transition_matrix,distribution_real,generator);
+          idx = randomWalk(idx,_params._rs_outliers_removal_jumps,transition_matrix,distribution_real,generator);
         }
 
         if(scale._previous_scale_to_landmark_idx[idx] != -1){
@@ -430,7 +441,7 @@ namespace hdi{
     }
 
     template <typename scalar_type, typename sparse_scalar_matrix_type>
-    void HierarchicalSNE<scalar_type,sparse_scalar_matrix_type>::selectLandmarksWithStationaryDistribution(const Scale& previous_scale, Scale& scale, unsigned_int_type& selected_landmarks){
+    void HierarchicalSNE<scalar_type,sparse_scalar_matrix_type>::selectLandmarksWithStationaryDistribution(const Scale& previous_scale, const csr_transition_matrix_type& transition_matrix, Scale& scale, unsigned_int_type& selected_landmarks){
       utils::secureLog(_logger,"Landmark selection...");
       const unsigned_int_type previous_scale_dp = previous_scale._transition_matrix.size();
       int count = 0;
@@ -459,7 +470,7 @@ namespace hdi{
 //#endif //__USE_GCD__
           for(int p = 0; p < _params._mcmcs_num_walks; ++p){
             int idx = d;
-            idx = randomWalk(idx,_params._mcmcs_walk_length,previous_scale._transition_matrix,distribution_real,generator);
+            idx = randomWalk(idx,_params._mcmcs_walk_length,transition_matrix,distribution_real,generator);
             if(idx != invalid){
               ++importance_sampling[idx];
             }
@@ -521,12 +532,15 @@ namespace hdi{
 
       const unsigned_int_type previous_scale_dp = previous_scale._landmark_to_original_data_idx.size();
 
+      // Flat snapshot of the previous transition matrix, shared by all the random walks of this scale
+      const csr_transition_matrix_type previous_transition_matrix(previous_scale._transition_matrix);
+
       // Landmark selection
       unsigned_int_type selected_landmarks = 0;
       if(_params._monte_carlo_sampling){
-        selectLandmarksWithStationaryDistribution(previous_scale,scale,selected_landmarks);
+        selectLandmarksWithStationaryDistribution(previous_scale,previous_transition_matrix,scale,selected_landmarks);
       }else{
-        selectLandmarks(previous_scale,scale,selected_landmarks);
+        selectLandmarks(previous_scale,previous_transition_matrix,scale,selected_landmarks);
       }
 
       utils::secureLogValue(_logger,"\t#landmarks",selected_landmarks);
@@ -553,7 +567,7 @@ namespace hdi{
 //#endif //__USE_GCD__
             std::unordered_map<unsigned_int_type, unsigned_int_type> landmarks_reached;
             for(int i = 0; i < walks_per_dp; ++i){
-              auto res = randomWalk(d,scale._previous_scale_to_landmark_idx,max_jumps,previous_scale._transition_matrix,distribution_real,generator);
+              auto res = randomWalk(d,scale._previous_scale_to_landmark_idx,max_jumps,previous_transition_matrix,distribution_real,generator);
               if(res != -1){
                 ++landmarks_reached[scale._previous_scale_to_landmark_idx[res]];
               }else{
@@ -642,12 +656,15 @@ namespace hdi{
 
       const unsigned_int_type previous_scale_dp = previous_scale._landmark_to_original_data_idx.size();
 
+      // Flat snapshot of the previous transition matrix, shared by all the random walks of this scale
+      const csr_transition_matrix_type previous_transition_matrix(previous_scale._transition_matrix);
+
       // Landmark selection
       unsigned_int_type selected_landmarks = 0;
       if(_params._monte_carlo_sampling){
-        selectLandmarksWithStationaryDistribution(previous_scale,scale,selected_landmarks);
+        selectLandmarksWithStationaryDistribution(previous_scale,previous_transition_matrix,scale,selected_landmarks);
       }else{
-        selectLandmarks(previous_scale,scale,selected_landmarks);
+        selectLandmarks(previous_scale,previous_transition_matrix,scale,selected_landmarks);
       }
 
       utils::secureLogValue(_logger,"\t#landmarks",selected_landmarks);
@@ -680,7 +697,7 @@ namespace hdi{
               //map because it must be ordered for the initialization of the maps
               std::map<unsigned_int_type, scalar_type> landmarks_reached;
               for(int i = 0; i < walks_per_dp; ++i){
-                auto res = randomWalk(d,scale._previous_scale_to_landmark_idx,max_jumps,previous_scale._transition_matrix,distribution_real,generator);
+                auto res = randomWalk(d,scale._previous_scale_to_landmark_idx,max_jumps,previous_transition_matrix,distribution_real,generator);
                 if(res != -1){
                   ++landmarks_reached[scale._previous_scale_to_landmark_idx[res]];
                 }else{
@@ -1074,17 +1091,20 @@ namespace hdi{
 
     //Compute a random walk using a transition matrix
     template <typename scalar_type, typename sparse_scalar_matrix_type>
-    typename HierarchicalSNE<scalar_type,sparse_scalar_matrix_type>::unsigned_int_type HierarchicalSNE<scalar_type,sparse_scalar_matrix_type>::randomWalk(unsigned_int_type starting_point, unsigned_int_type max_length, const sparse_scalar_matrix_type& transition_matrix, std::uniform_real_distribution<double>& distribution, std::default_random_engine& generator){
+    typename HierarchicalSNE<scalar_type,sparse_scalar_matrix_type>::unsigned_int_type HierarchicalSNE<scalar_type,sparse_scalar_matrix_type>::randomWalk(unsigned_int_type starting_point, unsigned_int_type max_length, const csr_transition_matrix_type& transition_matrix, std::uniform_real_distribution<double>& distribution, std::default_random_engine& generator){
+      const auto& offsets = transition_matrix.offsets();
+      const auto& keys = transition_matrix.keys();
+      const auto& values = transition_matrix.values();
       unsigned_int_type dp_idx = starting_point;
       int walk_length = 0;
       do{
         const double rnd_num = distribution(generator);
         unsigned_int_type idx_knn = dp_idx;
         double incremental_prob = 0;
-        for(auto& elem: transition_matrix[dp_idx]){
-          incremental_prob += elem.second;
+        for(size_t e = offsets[dp_idx]; e < offsets[dp_idx+1]; ++e){
+          incremental_prob += values[e];
           if(rnd_num < incremental_prob){
-            idx_knn = elem.first;
+            idx_knn = keys[e];
             break;
           }
         }
@@ -1101,17 +1121,20 @@ namespace hdi{
 
     //!Compute a random walk using a transition matrix
     template <typename scalar_type, typename sparse_scalar_matrix_type>
-    int HierarchicalSNE<scalar_type,sparse_scalar_matrix_type>::randomWalk(unsigned_int_type starting_point, const std::vector<int>& stopping_points, unsigned_int_type max_length, const sparse_scalar_matrix_type& transition_matrix, std::uniform_real_distribution<double>& distribution, std::default_random_engine& generator){
+    int HierarchicalSNE<scalar_type,sparse_scalar_matrix_type>::randomWalk(unsigned_int_type starting_point, const std::vector<int>& stopping_points, unsigned_int_type max_length, const csr_transition_matrix_type& transition_matrix, std::uniform_real_distribution<double>& distribution, std::default_random_engine& generator){
+      const auto& offsets = transition_matrix.offsets();
+      const auto& keys = transition_matrix.keys();
+      const auto& values = transition_matrix.values();
       unsigned_int_type dp_idx = starting_point;
       int walk_length = 0;
       do{
         const double rnd_num = distribution(generator);
         unsigned_int_type idx_knn = dp_idx;
         double incremental_prob = 0;
-        for(auto& elem: transition_matrix[dp_idx]){
-          incremental_prob += elem.second;
+        for(size_t e = offsets[dp_idx]; e < offsets[dp_idx+1]; ++e){
+          incremental_prob += values[e];
           if(rnd_num < incremental_prob){
-            idx_knn = elem.first;
+            idx_knn = keys[e];
             break;
           }
         }
@@ -0,0 +1,151 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef INCREMENTAL_JOINT_PROBABILITY_GENERATOR_H
+#define INCREMENTAL_JOINT_PROBABILITY_GENERATOR_H
+
+#include <vector>
+#include <stdint.h>
+#include "hdi/utils/abstract_log.h"
+#include "hdi/data/map_mem_eff.h"
+#include "hdi/dimensionality_reduction/proximity_graph_index.h"
+
+namespace hdi{
+  namespace dr{
+
+    //! Joint-probability distribution that can be extended with new data points
+    /*!
+      Joint-probability distribution of the tSNE algorithm that is kept up to date while new data points are inserted.
+      The proximity graph used for the neighborhood queries, the data and the conditional distributions are kept alive after
+      the initialization, hence an insertion only queries the neighbors of the new points.
+      Existing points that have a new point closer than their farthest neighbor (reverse neighbors) replace it and their
+      conditional distribution is recomputed. Only the rows of the symmetric distribution that are affected by the changed
+      conditional distributions are patched, therefore the cost of an insertion depends on the size of the batch and not on the
+      number of points already inserted.
+      \note Reverse neighbors are searched among the _reverse_search_multiplier*perplexity*perplexity_multiplier neighbors of every new point
+    */
+    template <typename scalar = float, typename sparse_scalar_matrix = std::vector<hdi::data::MapMemEff<uint32_t,float>>>
+    class IncrementalJointProbabilityGenerator{
+    public:
+      typedef scalar scalar_type;
+      typedef sparse_scalar_matrix sparse_scalar_matrix_type;
+      typedef std::vector<scalar_type> scalar_vector_type;
+
+    public:
+      //! Parameters used for the initialization of the algorithm
+      class Parameters{
+      public:
+        Parameters();
+      public:
+        scalar_type _perplexity;              //! Perplexity value in evert distribution.
+        int     _perplexity_multiplier;       //! Multiplied by the perplexity gives the number of nearest neighbors used
+        unsigned int _reverse_search_multiplier; //! Multiplied by the number of nearest neighbors gives the size of the search for reverse neighbors
+        unsigned int _knn_graph_degree;       //! Max number of links per node of the proximity graph
+        unsigned int _knn_graph_ef;           //! Size of the candidate list used by the proximity graph
+        int     _seed;                        //! Seed used by the proximity graph. If a negative value is provided, a time-based seed is used
+      };
+
+      //!
+      //! \brief Collector of Statistics on the computation performed
+      //! \note All time are in seconds with millisecond resolution
+      //!
+      class Statistics{
+      public:
+        Statistics();
+        //! Reset the statistics
+        void reset();
+        //! Log the current statistics to logger
+        void log(utils::AbstractLog* logger)const;
+
+      public:
+        scalar_type _total_time;
+        scalar_type _aknn_time;
+        scalar_type _distribution_time;
+        unsigned int _num_updated_rows; //! Rows of the joint-probability distribution patched by the last insertion
+      };
+
+    public:
+      IncrementalJointProbabilityGenerator();
+
+      //! Compute the joint-probability distribution of num_dps points of dimensionality num_dim. The data are copied
+      void initialize(const scalar_type* high_dimensional_data, unsigned int num_dim, unsigned int num_dps, sparse_scalar_matrix& distribution, Parameters params = Parameters());
+      //! Insert num_new_dps points and patch the distribution. The rows of the new points are appended to distribution
+      //! and the indices of the existing rows that changed are returned, sorted, in updated_rows
+      void addDataPoints(const scalar_type* high_dimensional_data, unsigned int num_new_dps, sparse_scalar_matrix& distribution, std::vector<unsigned int>& updated_rows);
+
+      //! Number of data points inserted
+      unsigned int numDataPoints()const{return _num_dps;}
+      //! Number of dimensions of the data
+      unsigned int numDimensions()const{return _num_dim;}
+      //! Number of neighbors of every point
+      unsigned int numNeighbors()const{return _num_neighbors;}
+      //! Neighbors of every point sorted by increasing distance, row-major num_dps*numNeighbors matrix
+      const std::vector<int>& neighbors()const{return _neighbors;}
+      //! Conditional probabilities of the neighbors, row-major num_dps*numNeighbors matrix
+      const scalar_vector_type& conditionalProbabilities()const{return _conditional_probabilities;}
+
+      //! Return the current log
+      utils::AbstractLog* logger()const{return _logger;}
+      //! Set a pointer to an existing log
+      void setLogger(utils::AbstractLog* logger){_logger = logger;}
+
+      //! Return statistics on the computation of the last initialization or insertion
+      const Statistics& statistics(){ return _statistics; }
+
+    private:
+      //! Query the neighbors of the points in [begin,end). Candidates for the reverse neighbors are returned if a buffer is provided
+      void queryNeighbors(unsigned int begin, unsigned int end, std::vector<int>* candidates, scalar_vector_type* candidate_distances, unsigned int num_candidates);
+      //! Recompute the conditional distributions of the given rows
+      void computeConditionalDistributions(const std::vector<unsigned int>& rows);
+      //! Conditional probability of j given i, 0 if j is not a neighbor of i
+      scalar_type conditionalProbability(unsigned int i, unsigned int j)const;
+      //! Recompute the elements of the joint-probability distribution in the given (row,column) pairs. Pairs must be sorted by row
+      void patchJointDistribution(const std::vector<std::pair<unsigned int,unsigned int>>& elements, sparse_scalar_matrix& distribution)const;
+
+    private:
+      Parameters _params;
+      unsigned int _num_dim;
+      unsigned int _num_dps;
+      unsigned int _num_neighbors;
+      scalar_vector_type _data;
+      ProximityGraphIndex<scalar_type> _index;
+      std::vector<int> _neighbors;
+      scalar_vector_type _distances_squared;
+      scalar_vector_type _conditional_probabilities;
+
+      utils::AbstractLog* _logger;
+      Statistics _statistics;
+    };
+
+  }
+}
+#endif
@@ -0,0 +1,406 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef INCREMENTAL_JOINT_PROBABILITY_GENERATOR_INL
+#define INCREMENTAL_JOINT_PROBABILITY_GENERATOR_INL
+
+#include "hdi/dimensionality_reduction/incremental_joint_probability_generator.h"
+#include "hdi/utils/assert_by_exception.h"
+#include "hdi/utils/math_utils.h"
+#include "hdi/utils/log_helper_functions.h"
+#include "hdi/utils/scoped_timers.h"
+#include "hdi/data/map_helpers.h"
+#include <algorithm>
+#include <numeric>
+#include <tuple>
+
+namespace hdi{
+  namespace dr{
+  /////////////////////////////////////////////////////////////////////////
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    IncrementalJointProbabilityGenerator<scalar, sparse_scalar_matrix>::Parameters::Parameters():
+      _perplexity(30),
+      _perplexity_multiplier(3),
+      _reverse_search_multiplier(2),
+      _knn_graph_degree(16),
+      _knn_graph_ef(200),
+      _seed(-1)
+    {}
+
+  /////////////////////////////////////////////////////////////////////////
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    IncrementalJointProbabilityGenerator<scalar, sparse_scalar_matrix>::Statistics::Statistics(){
+      reset();
+    }
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    void IncrementalJointProbabilityGenerator<scalar, sparse_scalar_matrix>::Statistics::reset(){
+      _total_time = 0;
+      _aknn_time = 0;
+      _distribution_time = 0;
+      _num_updated_rows = 0;
+    }
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    void IncrementalJointProbabilityGenerator<scalar, sparse_scalar_matrix>::Statistics::log(utils::AbstractLog* logger)const{
+      utils::secureLog(logger,"\n-------- Incremental Joint Probability Generator Statistics -----------");
+      utils::secureLogValue(logger,"Total time",_total_time);
+      utils::secureLogValue(logger,"\tAKNN time",_aknn_time,true,3);
+      utils::secureLogValue(logger,"\tDistributions time",_distribution_time,true,2);
+      utils::secureLogValue(logger,"\tUpdated rows",_num_updated_rows,true,2);
+      utils::secureLog(logger,"-----------------------------------------------------------------------\n");
+    }
+
+  /////////////////////////////////////////////////////////////////////////
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    IncrementalJointProbabilityGenerator<scalar, sparse_scalar_matrix>::IncrementalJointProbabilityGenerator():
+      _num_dim(0),
+      _num_dps(0),
+      _num_neighbors(0),
+      _logger(nullptr)
+    {}
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    void IncrementalJointProbabilityGenerator<scalar, sparse_scalar_matrix>::initialize(const scalar_type* high_dimensional_data, unsigned int num_dim, unsigned int num_dps, sparse_scalar_matrix& distribution, Parameters params){
+      typedef typename sparse_scalar_matrix::value_type map_type;
+      typedef typename map_type::key_type key_type;
+      typedef typename map_type::mapped_type mapped_type;
+      typedef hdi::data::MapHelpers<key_type,mapped_type,map_type> map_helpers_type;
+
+      checkAndThrowLogic(high_dimensional_data != nullptr && num_dim > 0, "IncrementalJointProbabilityGenerator: invalid data");
+      _statistics.reset();
+      utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._total_time);
+      utils::secureLog(_logger,"Computing the incremental HD joint probability distribution...");
+
+      _params = params;
+      _num_dim = num_dim;
+      _num_neighbors = static_cast<unsigned int>(params._perplexity*params._perplexity_multiplier);
+      checkAndThrowLogic(_num_neighbors > 0, "IncrementalJointProbabilityGenerator: invalid perplexity");
+      checkAndThrowLogic(num_dps > _num_neighbors, "IncrementalJointProbabilityGenerator: the number of data points must be larger than the number of neighbors");
+      _data.assign(high_dimensional_data,high_dimensional_data+size_t(num_dim)*num_dps);
+      _num_dps = num_dps;
+
+      {
+        utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._aknn_time);
+        typename ProximityGraphIndex<scalar_type>::Parameters index_params;
+        index_params._max_degree = params._knn_graph_degree;
+        index_params._ef_construction = params._knn_graph_ef;
+        index_params._seed = params._seed;
+        _index.build(_data.data(),num_dim,num_dps,index_params);
+
+        _neighbors.resize(size_t(num_dps)*_num_neighbors);
+        _distances_squared.resize(size_t(num_dps)*_num_neighbors);
+        _conditional_probabilities.resize(size_t(num_dps)*_num_neighbors);
+        queryNeighbors(0,num_dps,nullptr,nullptr,0);
+      }
+
+      {
+        utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._distribution_time);
+        std::vector<unsigned int> rows(num_dps);
+        std::iota(rows.begin(),rows.end(),0);
+        computeConditionalDistributions(rows);
+
+        sparse_scalar_matrix conditional(num_dps);
+        for(unsigned int i = 0; i < num_dps; ++i){
+          for(unsigned int k = 0; k < _num_neighbors; ++k){
+            const size_t id = size_t(i)*_num_neighbors+k;
+            conditional[i][_neighbors[id]] = _conditional_probabilities[id];
+          }
+        }
+        distribution.clear();
+        map_helpers_type::symmetrize(conditional,distribution);
+      }
+      _statistics._num_updated_rows = num_dps;
+    }
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    void IncrementalJointProbabilityGenerator<scalar, sparse_scalar_matrix>::addDataPoints(const scalar_type* high_dimensional_data, unsigned int num_new_dps, sparse_scalar_matrix& distribution, std::vector<unsigned int>& updated_rows){
+      typedef std::pair<unsigned int,unsigned int> element_type;
+      typedef std::tuple<unsigned int,scalar_type,unsigned int> reverse_neighbor_type; //existing point, distance, new point
+
+      checkAndThrowLogic(_num_dps > 0, "IncrementalJointProbabilityGenerator: the generator must be initialized");
+      checkAndThrowLogic(distribution.size() == _num_dps, "IncrementalJointProbabilityGenerator: the size of the distribution does not agree with the number of data points");
+      updated_rows.clear();
+      if(num_new_dps == 0){
+        return;
+      }
+      checkAndThrowLogic(high_dimensional_data != nullptr, "IncrementalJointProbabilityGenerator: invalid data");
+      _statistics.reset();
+      utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._total_time);
+      utils::secureLogValue(_logger,"Inserting data points",num_new_dps);
+
+      const unsigned int k = _num_neighbors;
+      const unsigned int old_num_dps = _num_dps;
+      const unsigned int num_dps = old_num_dps + num_new_dps;
+      const unsigned int num_candidates = std::max<unsigned int>(1,_params._reverse_search_multiplier)*k;
+
+      std::vector<int> candidates(size_t(num_new_dps)*num_candidates);
+      scalar_vector_type candidate_distances(size_t(num_new_dps)*num_candidates);
+      {
+        utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._aknn_time);
+        _data.insert(_data.end(),high_dimensional_data,high_dimensional_data+size_t(num_new_dps)*_num_dim);
+        _index.addPoints(_data.data(),old_num_dps,num_new_dps);
+        _num_dps = num_dps;
+
+        _neighbors.resize(size_t(num_dps)*k);
+        _distances_squared.resize(size_t(num_dps)*k);
+        _conditional_probabilities.resize(size_t(num_dps)*k);
+        queryNeighbors(old_num_dps,num_dps,&candidates,&candidate_distances,num_candidates);
+      }
+
+      utils::ScopedTimer<scalar_type, utils::Seconds> distribution_timer(_statistics._distribution_time);
+
+      //Existing points that have a new point closer than their farthest neighbor
+      std::vector<reverse_neighbor_type> reverse_neighbors;
+      for(unsigned int q = 0; q < num_new_dps; ++q){
+        for(unsigned int c = 0; c < num_candidates; ++c){
+          const size_t id = size_t(q)*num_candidates+c;
+          const int j = candidates[id];
+          if(j < 0 || unsigned(j) >= old_num_dps){
+            continue;
+          }
+          if(candidate_distances[id] < _distances_squared[size_t(j)*k+k-1]){
+            reverse_neighbors.push_back(reverse_neighbor_type(j,candidate_distances[id],old_num_dps+q));
+          }
+        }
+      }
+      std::sort(reverse_neighbors.begin(),reverse_neighbors.end());
+
+      std::vector<unsigned int> changed_rows;
+      std::vector<size_t> group_offsets;
+      for(size_t r = 0; r < reverse_neighbors.size(); ++r){
+        if(r == 0 || std::get<0>(reverse_neighbors[r]) != std::get<0>(reverse_neighbors[r-1])){
+          changed_rows.push_back(std::get<0>(reverse_neighbors[r]));
+          group_offsets.push_back(r);
+        }
+      }
+      group_offsets.push_back(reverse_neighbors.size());
+
+      //The new points replace the farthest neighbors. Previous neighbors are kept to patch the joint distribution
+      std::vector<int> previous_neighbors(changed_rows.size()*k);
+      const int num_changed_rows = changed_rows.size();
+#ifndef __USE_GCD__
+#pragma omp parallel for
+#endif
+      for(int g = 0; g < num_changed_rows; ++g){
+        const size_t row = size_t(changed_rows[g])*k;
+        int* neighbors = _neighbors.data()+row;
+        scalar_type* distances = _distances_squared.data()+row;
+        std::copy(neighbors,neighbors+k,previous_neighbors.begin()+size_t(g)*k);
+        for(size_t r = group_offsets[g]; r < group_offsets[g+1]; ++r){
+          const scalar_type d = std::get<1>(reverse_neighbors[r]);
+          if(!(d < distances[k-1])){
+            break; //candidates are sorted by distance
+          }
+          unsigned int pos = k-1;
+          for(; pos > 0 && distances[pos-1] > d; --pos){
+            distances[pos] = distances[pos-1];
+            neighbors[pos] = neighbors[pos-1];
+          }
+          distances[pos] = d;
+          neighbors[pos] = std::get<2>(reverse_neighbors[r]);
+        }
+      }
+
+      std::vector<unsigned int> rows(changed_rows);
+      for(unsigned int i = old_num_dps; i < num_dps; ++i){
+        rows.push_back(i);
+      }
+      computeConditionalDistributions(rows);
+
+      //Every element that involves a changed conditional distribution is recomputed, in both directions
+      std::vector<element_type> elements;
+      elements.reserve(size_t(changed_rows.size()*2+num_new_dps)*k*2);
+      for(int g = 0; g < num_changed_rows; ++g){
+        const unsigned int i = changed_rows[g];
+        for(unsigned int n = 0; n < k; ++n){
+          const unsigned int j_prev = previous_neighbors[size_t(g)*k+n];
+          const unsigned int j = _neighbors[size_t(i)*k+n];
+          elements.push_back(element_type(i,j_prev));
+          elements.push_back(element_type(j_prev,i));
+          elements.push_back(element_type(i,j));
+          elements.push_back(element_type(j,i));
+        }
+      }
+      for(unsigned int i = old_num_dps; i < num_dps; ++i){
+        for(unsigned int n = 0; n < k; ++n){
+          const unsigned int j = _neighbors[size_t(i)*k+n];
+          elements.push_back(element_type(i,j));
+          elements.push_back(element_type(j,i));
+        }
+      }
+      std::sort(elements.begin(),elements.end());
+      elements.erase(std::unique(elements.begin(),elements.end()),elements.end());
+
+      distribution.resize(num_dps);
+      patchJointDistribution(elements,distribution);
+
+      for(size_t e = 0; e < elements.size() && elements[e].first < old_num_dps; ++e){
+        if(updated_rows.empty() || updated_rows.back() != elements[e].first){
+          updated_rows.push_back(elements[e].first);
+        }
+      }
+      _statistics._num_updated_rows = updated_rows.size();
+      utils::secureLogValue(_logger,"Updated rows",updated_rows.size());
+    }
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    void IncrementalJointProbabilityGenerator<scalar, sparse_scalar_matrix>::queryNeighbors(unsigned int begin, unsigned int end, std::vector<int>* candidates, scalar_vector_type* candidate_distances, unsigned int num_candidates){
+      const unsigned int k = _num_neighbors;
+      //one more element since the point itself is in the index
+      const unsigned int num_search = std::min(_num_dps,std::max(k,num_candidates)+1);
+      //exceptions cannot leave the parallel region, failures are reported after it
+      bool missing_neighbors = false;
+#ifndef __USE_GCD__
+#pragma omp parallel for reduction(||:missing_neighbors)
+#endif
+      for(int i = int(begin); i < int(end); ++i){
+        std::vector<int> indices(num_search);
+        scalar_vector_type distances(num_search);
+        _index.search(_data.data()+size_t(i)*_num_dim,num_search,_params._knn_graph_ef,indices.data(),distances.data());
+
+        int* neighbors = _neighbors.data()+size_t(i)*k;
+        scalar_type* neighbor_distances = _distances_squared.data()+size_t(i)*k;
+        unsigned int num_neighbors = 0;
+        unsigned int num_found_candidates = 0;
+        for(unsigned int s = 0; s < num_search; ++s){
+          if(indices[s] < 0 || indices[s] == i){
+            continue;
+          }
+          if(num_neighbors < k){
+            neighbors[num_neighbors] = indices[s];
+            neighbor_distances[num_neighbors] = distances[s];
+            ++num_neighbors;
+          }
+          if(candidates != nullptr && num_found_candidates < num_candidates){
+            const size_t id = size_t(i-begin)*num_candidates+num_found_candidates;
+            (*candidates)[id] = indices[s];
+            (*candidate_distances)[id] = distances[s];
+            ++num_found_candidates;
+          }
+        }
+        missing_neighbors = missing_neighbors || num_neighbors != k;
+        if(candidates != nullptr){
+          for(; num_found_candidates < num_candidates; ++num_found_candidates){
+            (*candidates)[size_t(i-begin)*num_candidates+num_found_candidates] = -1;
+          }
+        }
+      }
+      checkAndThrowRuntime(!missing_neighbors, "IncrementalJointProbabilityGenerator: the proximity graph returned too few neighbors");
+    }
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    void IncrementalJointProbabilityGenerator<scalar, sparse_scalar_matrix>::computeConditionalDistributions(const std::vector<unsigned int>& rows){
+      if(rows.empty()){
+        return;
+      }
+      const unsigned int k = _num_neighbors;
+      const unsigned int nn = k+1;
+      //the distance of the point to itself is prepended and ignored, as in the HDJointProbabilityGenerator
+      scalar_vector_type distances(rows.size()*nn,0);
+      scalar_vector_type probabilities(rows.size()*nn,0);
+      for(size_t r = 0; r < rows.size(); ++r){
+        std::copy(_distances_squared.begin()+size_t(rows[r])*k,_distances_squared.begin()+size_t(rows[r]+1)*k,distances.begin()+r*nn+1);
+      }
+      utils::computeGaussianDistributionsWithFixedPerplexity<scalar_type>(distances.data(), probabilities.data(), rows.size(), nn, _params._perplexity, 200, 1e-5, 0);
+      for(size_t r = 0; r < rows.size(); ++r){
+        std::copy(probabilities.begin()+r*nn+1,probabilities.begin()+(r+1)*nn,_conditional_probabilities.begin()+size_t(rows[r])*k);
+      }
+    }
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    typename IncrementalJointProbabilityGenerator<scalar, sparse_scalar_matrix>::scalar_type IncrementalJointProbabilityGenerator<scalar, sparse_scalar_matrix>::conditionalProbability(unsigned int i, unsigned int j)const{
+      const size_t row = size_t(i)*_num_neighbors;
+      for(unsigned int n = 0; n < _num_neighbors; ++n){
+        if(_neighbors[row+n] == int(j)){
+          return _conditional_probabilities[row+n];
+        }
+      }
+      return 0;
+    }
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    void IncrementalJointProbabilityGenerator<scalar, sparse_scalar_matrix>::patchJointDistribution(const std::vector<std::pair<unsigned int,unsigned int>>& elements, sparse_scalar_matrix& distribution)const{
+      typedef typename sparse_scalar_matrix::value_type map_type;
+      typedef typename map_type::key_type key_type;
+      typedef typename map_type::mapped_type mapped_type;
+      typedef hdi::data::MapHelpers<key_type,mapped_type,map_type> map_helpers_type;
+
+      std::vector<size_t> row_offsets;
+      for(size_t e = 0; e < elements.size(); ++e){
+        if(e == 0 || elements[e].first != elements[e-1].first){
+          row_offsets.push_back(e);
+        }
+      }
+      row_offsets.push_back(elements.size());
+
+      //Rows are rebuilt independently: the untouched elements are kept and the patched ones are recomputed
+      const int num_rows = int(row_offsets.size())-1;
+#ifndef __USE_GCD__
+#pragma omp parallel for
+#endif
+      for(int r = 0; r < num_rows; ++r){
+        const unsigned int i = elements[row_offsets[r]].first;
+        auto columns_begin = elements.begin()+row_offsets[r];
+        auto columns_end = elements.begin()+row_offsets[r+1];
+        auto is_patched = [&](key_type j){
+          return std::binary_search(columns_begin,columns_end,std::make_pair(i,static_cast<unsigned int>(j)));
+        };
+
+        std::vector<std::pair<key_type,mapped_type>> row;
+        row.reserve(distribution[i].size()+(columns_end-columns_begin));
+        for(auto& e: distribution[i]){
+          if(!is_patched(e.first)){
+            row.push_back(std::make_pair(e.first,e.second));
+          }
+        }
+        for(auto it = columns_begin; it != columns_end; ++it){
+          const unsigned int j = it->second;
+          const double p = 0.5*(double(conditionalProbability(i,j))+double(conditionalProbability(j,i)));
+          if(p > 0){
+            row.push_back(std::make_pair(key_type(j),mapped_type(p)));
+          }
+        }
+        std::sort(row.begin(),row.end());
+
+        distribution[i] = map_type();
+        map_helpers_type::initialize(distribution[i],row.begin(),row.end());
+      }
+    }
+
+  }
+}
+#endif
@@ -0,0 +1,93 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef KNN_GRAPH_CACHE_H
+#define KNN_GRAPH_CACHE_H
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+namespace hdi{
+  namespace dr{
+
+    //! Persistent cache of k-nearest-neighbor graphs
+    /*!
+      Persistent cache of k-nearest-neighbor graphs.
+      Every graph is stored in a versioned binary file in the cache directory. The name of the file is derived from a fingerprint
+      of the content of the dataset and from a key that identifies the parameters of the search, the number of neighbors excluded.
+      A cached graph satisfies every request with a number of neighbors smaller or equal to the stored one: its rows are truncated.
+      Files are read through a memory mapping and written atomically (temporary file + rename).
+    */
+    template <typename scalar = float>
+    class KNNGraphCache{
+    public:
+      typedef scalar scalar_type;
+
+    public:
+      explicit KNNGraphCache(const std::string& directory);
+
+      //! Fingerprint of the content of a row-major num_dps*num_dim dataset
+      static uint64_t fingerprint(const scalar_type* data, unsigned int num_dim, unsigned int num_dps);
+      //! Mix a value into a key, used to build the key of the parameters of a search
+      static uint64_t combine(uint64_t key, uint64_t value);
+
+      //! Name of the file that stores the graph of a dataset
+      std::string fileName(uint64_t data_fingerprint, uint64_t parameters_key)const;
+      //! Load the first nn neighbors of every point. Return false if the graph is not in the cache or if it has less than nn neighbors
+      bool load(uint64_t data_fingerprint, uint64_t parameters_key, unsigned int num_dim, unsigned int num_dps, unsigned int nn, std::vector<scalar_type>& distances_squared, std::vector<int>& indices)const;
+      //! Store a graph. Return false if the file cannot be written
+      bool save(uint64_t data_fingerprint, uint64_t parameters_key, unsigned int num_dim, unsigned int num_dps, unsigned int nn, const std::vector<scalar_type>& distances_squared, const std::vector<int>& indices)const;
+
+    public:
+      static const uint32_t _version = 1;
+
+    private:
+      //! Header of a cache file, followed by num_dps*nn indices (int32) and by num_dps*nn squared distances (scalar_type)
+      struct Header{
+        char      _magic[8];
+        uint32_t  _version;
+        uint32_t  _scalar_size;
+        uint64_t  _data_fingerprint;
+        uint64_t  _parameters_key;
+        uint32_t  _num_dim;
+        uint32_t  _num_dps;
+        uint32_t  _nn;
+        uint32_t  _padding;
+      };
+
+      std::string _directory;
+    };
+
+  }
+}
+#endif
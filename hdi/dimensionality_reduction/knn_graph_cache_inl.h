@@ -0,0 +1,245 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef KNN_GRAPH_CACHE_INL
+#define KNN_GRAPH_CACHE_INL
+
+#include "hdi/dimensionality_reduction/knn_graph_cache.h"
+#include "hdi/utils/memory_mapped_file.h"
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+#ifdef __USE_GCD__
+#include <dispatch/dispatch.h>
+#endif
+
+namespace hdi{
+  namespace dr{
+
+    namespace knn_graph_cache_internal{
+      static const char magic[8] = {'H','D','I','K','N','N','G','\0'};
+      static const uint64_t prime_1 = 0x9E3779B185EBCA87ULL;
+      static const uint64_t prime_2 = 0xC2B2AE3D27D4EB4FULL;
+
+      inline uint64_t rotl(uint64_t x, int r){
+        return (x << r) | (x >> (64 - r));
+      }
+      inline uint64_t round(uint64_t h, uint64_t w){
+        return rotl(h ^ (w * prime_2), 31) * prime_1;
+      }
+      inline uint64_t avalanche(uint64_t h){
+        h ^= h >> 33; h *= prime_2;
+        h ^= h >> 29; h *= prime_1;
+        h ^= h >> 32;
+        return h;
+      }
+      //! Hash of a chunk of bytes. Four independent lanes are used to hide the latency of the multiplications
+      inline uint64_t hashChunk(const char* data, size_t size, uint64_t seed){
+        uint64_t lanes[4] = {seed + prime_1, seed + prime_2, seed, seed - prime_1};
+        size_t i = 0;
+        for(; i + 32 <= size; i += 32){
+          uint64_t w[4];
+          std::memcpy(w, data + i, 32);
+          for(int l = 0; l < 4; ++l){
+            lanes[l] = round(lanes[l], w[l]);
+          }
+        }
+        uint64_t h = rotl(lanes[0],1) + rotl(lanes[1],7) + rotl(lanes[2],12) + rotl(lanes[3],18);
+        for(; i < size; ++i){
+          h = round(h, static_cast<unsigned char>(data[i]));
+        }
+        return avalanche(h ^ size);
+      }
+    }
+
+  /////////////////////////////////////////////////////////////////////////
+
+    template <typename scalar>
+    KNNGraphCache<scalar>::KNNGraphCache(const std::string& directory):
+      _directory(directory)
+    {}
+
+    template <typename scalar>
+    uint64_t KNNGraphCache<scalar>::fingerprint(const scalar_type* data, unsigned int num_dim, unsigned int num_dps){
+      using namespace knn_graph_cache_internal;
+      const char* bytes = reinterpret_cast<const char*>(data);
+      const size_t size = sizeof(scalar_type)*size_t(num_dim)*num_dps;
+      const size_t chunk_size = size_t(1) << 20;
+      const int num_chunks = static_cast<int>((size + chunk_size - 1) / chunk_size);
+
+      //chunks are hashed independently and then combined in order
+      std::vector<uint64_t> chunk_hashes(num_chunks);
+#ifdef __USE_GCD__
+      dispatch_apply(num_chunks, dispatch_get_global_queue(0, 0), ^(size_t c) {
+#else
+#pragma omp parallel for
+      for(int c = 0; c < num_chunks; ++c){
+#endif //__USE_GCD__
+        const size_t begin = size_t(c)*chunk_size;
+        chunk_hashes[c] = hashChunk(bytes + begin, std::min(chunk_size, size - begin), c);
+      }
+#ifdef __USE_GCD__
+      );
+#endif
+
+      uint64_t h = round(round(sizeof(scalar_type), num_dim), num_dps);
+      for(auto chunk_hash: chunk_hashes){
+        h = round(h, chunk_hash);
+      }
+      return avalanche(h);
+    }
+
+    template <typename scalar>
+    uint64_t KNNGraphCache<scalar>::combine(uint64_t key, uint64_t value){
+      return knn_graph_cache_internal::avalanche(knn_graph_cache_internal::round(key, value));
+    }
+
+    template <typename scalar>
+    std::string KNNGraphCache<scalar>::fileName(uint64_t data_fingerprint, uint64_t parameters_key)const{
+      std::stringstream ss;
+      ss << _directory;
+      if(!_directory.empty() && _directory.back() != '/' && _directory.back() != '\\'){
+        ss << '/';
+      }
+      ss << "knn_" << std::hex << std::setfill('0') << std::setw(16) << data_fingerprint << "_" << std::setw(16) << parameters_key << "_" << std::dec << (sizeof(scalar_type)*8) << ".bin";
+      return ss.str();
+    }
+
+    template <typename scalar>
+    bool KNNGraphCache<scalar>::load(uint64_t data_fingerprint, uint64_t parameters_key, unsigned int num_dim, unsigned int num_dps, unsigned int nn, std::vector<scalar_type>& distances_squared, std::vector<int>& indices)const{
+      const std::string file_name = fileName(data_fingerprint,parameters_key);
+      if(!std::ifstream(file_name, std::ios::in|std::ios::binary).good()){
+        return false;
+      }
+
+      utils::MemoryMappedFile file;
+      try{
+        file.open(file_name);
+      }catch(const std::runtime_error&){
+        return false;
+      }
+      if(file.size() < sizeof(Header)){
+        return false;
+      }
+      Header header;
+      std::memcpy(&header, file.data(), sizeof(Header));
+      if(std::memcmp(header._magic, knn_graph_cache_internal::magic, sizeof(header._magic)) != 0 ||
+         header._version != _version ||
+         header._scalar_size != sizeof(scalar_type) ||
+         header._data_fingerprint != data_fingerprint ||
+         header._parameters_key != parameters_key ||
+         header._num_dim != num_dim ||
+         header._num_dps != num_dps ||
+         header._nn < nn){
+        return false;
+      }
+      const size_t num_entries = size_t(num_dps)*header._nn;
+      if(file.size() != sizeof(Header) + num_entries*(sizeof(int32_t)+sizeof(scalar_type))){
+        return false;
+      }
+
+      distances_squared.resize(size_t(num_dps)*nn);
+      indices.resize(size_t(num_dps)*nn);
+      const char* cached_indices = file.data() + sizeof(Header);
+      const char* cached_distances = cached_indices + num_entries*sizeof(int32_t);
+      const unsigned int cached_nn = header._nn;
+
+      //rows are truncated to the first nn neighbors
+#ifdef __USE_GCD__
+      dispatch_apply(num_dps, dispatch_get_global_queue(0, 0), ^(size_t i) {
+#else
+#pragma omp parallel for
+      for(int i = 0; i < int(num_dps); ++i){
+#endif //__USE_GCD__
+        std::memcpy(indices.data() + size_t(i)*nn, cached_indices + size_t(i)*cached_nn*sizeof(int32_t), nn*sizeof(int32_t));
+        std::memcpy(distances_squared.data() + size_t(i)*nn, cached_distances + size_t(i)*cached_nn*sizeof(scalar_type), nn*sizeof(scalar_type));
+      }
+#ifdef __USE_GCD__
+      );
+#endif
+      return true;
+    }
+
+    template <typename scalar>
+    bool KNNGraphCache<scalar>::save(uint64_t data_fingerprint, uint64_t parameters_key, unsigned int num_dim, unsigned int num_dps, unsigned int nn, const std::vector<scalar_type>& distances_squared, const std::vector<int>& indices)const{
+      const size_t num_entries = size_t(num_dps)*nn;
+      if(distances_squared.size() != num_entries || indices.size() != num_entries){
+        return false;
+      }
+
+      Header header;
+      std::memset(&header, 0, sizeof(Header));
+      std::memcpy(header._magic, knn_graph_cache_internal::magic, sizeof(header._magic));
+      header._version = _version;
+      header._scalar_size = sizeof(scalar_type);
+      header._data_fingerprint = data_fingerprint;
+      header._parameters_key = parameters_key;
+      header._num_dim = num_dim;
+      header._num_dps = num_dps;
+      header._nn = nn;
+
+      //the graph is written in a temporary file that replaces the previous one only when complete
+      const std::string file_name = fileName(data_fingerprint,parameters_key);
+      const std::string tmp_file_name = file_name + ".tmp";
+      {
+        std::ofstream file(tmp_file_name, std::ios::out|std::ios::binary|std::ios::trunc);
+        if(!file.good()){
+          return false;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+        file.write(reinterpret_cast<const char*>(indices.data()), num_entries*sizeof(int32_t));
+        file.write(reinterpret_cast<const char*>(distances_squared.data()), num_entries*sizeof(scalar_type));
+        if(!file.good()){
+          file.close();
+          std::remove(tmp_file_name.c_str());
+          return false;
+        }
+      }
+      if(std::rename(tmp_file_name.c_str(), file_name.c_str()) != 0){
+        //on Windows rename does not replace an existing file
+        std::remove(file_name.c_str());
+        if(std::rename(tmp_file_name.c_str(), file_name.c_str()) != 0){
+          std::remove(tmp_file_name.c_str());
+          return false;
+        }
+      }
+      return true;
+    }
+
+  }
+}
+#endif
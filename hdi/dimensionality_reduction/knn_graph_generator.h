@@ -0,0 +1,156 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef KNN_GRAPH_GENERATOR_H
+#define KNN_GRAPH_GENERATOR_H
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include "hdi/utils/assert_by_exception.h"
+#include "hdi/utils/abstract_log.h"
+#include "hdi/utils/memory_mapped_file.h"
+
+namespace hdi{
+  namespace dr{
+
+    //! Engines available for the computation of the k-nearest-neighbor graph
+    enum class KNNBackend{
+      FlannKDTree = 0,    //! Approximated, randomized kd-forest as implemented in FLANN
+      ExactBlocked = 1,   //! Exact, brute force search computed on tiles of query and reference points
+      ProximityGraph = 2, //! Approximated, hierarchical navigable small-world graph (HNSW)
+      OutOfCoreBlocked = 3, //! Exact, tiled search that keeps in memory only a block of queries and a block of references within a memory budget. Suited for memory-mapped data that does not fit in RAM
+      ExactGEMM = 4       //! Exact search where the distances of a tile are computed as ||x||^2 + ||y||^2 - 2xy^T with a blocked matrix product (Eigen). Best suited for high-dimensional data
+    };
+
+    //! Generator for the k-nearest-neighbor graph of a high-dimensional dataset
+    /*!
+      Generator for the k-nearest-neighbor graph of a high-dimensional dataset.
+      It is shared by the algorithms that compute similarities on the neighborhood graph and it hides the engine used for the search.
+      The output is a row-major num_dps*nn matrix of indices and squared euclidean distances, every row is sorted by increasing distance
+      and starts with the query point itself.
+      Optionally the recall of the graph is estimated against an exact search on a random sample of the data points.
+      If a cache directory is provided, graphs are stored on disk and reused when the same data and search parameters are requested again (see KNNGraphCache).
+    */
+    template <typename scalar = float>
+    class KNNGraphGenerator{
+    public:
+      typedef scalar scalar_type;
+
+    public:
+      //! Parameters used for the computation of the graph
+      class Parameters{
+      public:
+        Parameters();
+      public:
+        KNNBackend _backend;                  //! Engine used for the search
+        int _num_trees;                       //! Number of trees in the kd-forest
+        int _num_checks;                      //! Number of checks in the kd-forest
+        unsigned int _block_size;             //! Number of points in a tile of the exact blocked engine and number of queries in a tile of the GEMM engine
+        unsigned int _graph_degree;           //! Max number of links per node in the proximity graph
+        unsigned int _graph_ef;               //! Size of the candidate list used to build and query the proximity graph
+        int _seed;                            //! Seed used by the randomized engines and by the recall estimation. If a negative value is provided, a time-based seed is used
+        unsigned int _recall_num_samples;     //! Number of points used to estimate the recall. If 0 is provided the recall is not computed
+        unsigned int _memory_budget;          //! Memory (MB) used by the out-of-core engine for the blocks of queries and references. The output graph is not included
+        std::string _cache_directory;         //! Directory of the persistent graph cache. If empty the cache is not used
+      };
+
+      //!
+      //! \brief Collector of Statistics on the computation performed
+      //! \note All time are in seconds with millisecond resolution
+      //!
+      class Statistics{
+      public:
+        Statistics();
+        //! Reset the statistics
+        void reset();
+        //! Log the current statistics to logger
+        void log(utils::AbstractLog* logger)const;
+
+      public:
+        scalar_type _index_construction_time;   //! Time requested for the construction of the search structure
+        scalar_type _search_time;               //! Time requested by the queries
+        scalar_type _recall_time;               //! Time requested by the exact search on the sampled points
+        scalar_type _recall;                    //! Fraction of the exact neighbors that are found by the engine. -1 if not computed
+        scalar_type _cache_time;                //! Time requested to fingerprint the data and to look up the cache
+        bool _cache_hit;                        //! True if the graph was loaded from the cache
+      };
+
+    public:
+      KNNGraphGenerator();
+
+      //! Compute the nn nearest neighbors (the point itself included) of all the data points
+      void computeKNNGraph(const scalar_type* high_dimensional_data, unsigned int num_dim, unsigned int num_dps, unsigned int nn, std::vector<scalar_type>& distances_squared, std::vector<int>& indices, Parameters params = Parameters());
+      //! Compute the nn nearest neighbors (the point itself included) of the data points stored as a raw row-major matrix in a memory-mapped file
+      //! With the out-of-core engine the pages of the file are dropped from memory as soon as a block is processed
+      void computeKNNGraph(const utils::MemoryMappedFile& file, unsigned int num_dim, unsigned int nn, std::vector<scalar_type>& distances_squared, std::vector<int>& indices, Parameters params = Parameters());
+
+      //! Return the current log
+      utils::AbstractLog* logger()const{return _logger;}
+      //! Set a pointer to an existing log
+      void setLogger(utils::AbstractLog* logger){_logger = logger;}
+
+      //! Return statistics on the last computation
+      const Statistics& statistics()const{ return _statistics; }
+
+      //! Name of a backend
+      static const char* backendName(KNNBackend backend);
+      //! Key of the search parameters used by the cache. Parameters that do not change the graph (e.g. block sizes and number of neighbors) are ignored
+      static uint64_t cacheKey(const Parameters& params);
+
+    private:
+      void computeWithFlannKDTree(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, unsigned int nn, std::vector<scalar_type>& distances_squared, std::vector<int>& indices, const Parameters& params);
+      void computeWithExactBlocked(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, unsigned int nn, std::vector<scalar_type>& distances_squared, std::vector<int>& indices, const Parameters& params);
+      void computeWithProximityGraph(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, unsigned int nn, std::vector<scalar_type>& distances_squared, std::vector<int>& indices, const Parameters& params);
+      void computeWithOutOfCoreBlocked(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, unsigned int nn, std::vector<scalar_type>& distances_squared, std::vector<int>& indices, const Parameters& params);
+      void computeWithExactGEMM(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, unsigned int nn, std::vector<scalar_type>& distances_squared, std::vector<int>& indices, const Parameters& params);
+
+      typedef std::pair<scalar_type,int> neighbor_type;
+      //! Distances between a tile of queries and the references in [r_begin,r_end), the heaps of the queries are updated with the nn best candidates
+      static void processTile(const scalar_type* const* queries, int num_queries, const scalar_type* data, unsigned int num_dim, unsigned int r_begin, unsigned int r_end, unsigned int nn, scalar_type* tile, std::vector<neighbor_type>* heaps);
+
+      //! Exact nn nearest neighbors of the points in query_ids. Queries and references are processed in tiles of block_size points
+      static void exactBlockedSearch(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, const std::vector<unsigned int>& query_ids, unsigned int nn, unsigned int block_size, scalar_type* distances_squared, int* indices);
+      //! Make sure that every row starts with the query point
+      void enforceSelfAsFirstNeighbor(unsigned int num_dps, unsigned int nn, std::vector<scalar_type>& distances_squared, std::vector<int>& indices)const;
+      //! Estimate the recall of the graph with an exact search on a random subset of the points
+      void estimateRecall(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, unsigned int nn, const std::vector<int>& indices, const Parameters& params);
+
+    private:
+      utils::AbstractLog* _logger;
+      Statistics _statistics;
+      const utils::MemoryMappedFile* _mapped_file; //! Mapping of the data in use, if any
+    };
+
+  }
+}
+#endif
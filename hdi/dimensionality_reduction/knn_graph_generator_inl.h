@@ -0,0 +1,589 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef KNN_GRAPH_GENERATOR_INL
+#define KNN_GRAPH_GENERATOR_INL
+
+#include "hdi/dimensionality_reduction/knn_graph_generator.h"
+#include "hdi/dimensionality_reduction/knn_graph_cache.h"
+#include "hdi/dimensionality_reduction/proximity_graph_index.h"
+#include "hdi/utils/log_helper_functions.h"
+#include "hdi/utils/scoped_timers.h"
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <chrono>
+#include <unordered_set>
+#include <limits>
+#include "hdi/utils/Eigen/Dense"
+
+#pragma warning( push )
+#pragma warning( disable : 4267)
+#pragma warning( push )
+#pragma warning( disable : 4291)
+#pragma warning( push )
+#pragma warning( disable : 4996)
+#pragma warning( push )
+#pragma warning( disable : 4018)
+#pragma warning( push )
+#pragma warning( disable : 4244)
+#include "flann/flann.h"
+#pragma warning( pop )
+#pragma warning( pop )
+#pragma warning( pop )
+#pragma warning( pop )
+#pragma warning( pop )
+
+namespace hdi{
+  namespace dr{
+  /////////////////////////////////////////////////////////////////////////
+
+    template <typename scalar>
+    KNNGraphGenerator<scalar>::Parameters::Parameters():
+      _backend(KNNBackend::FlannKDTree),
+      _num_trees(4),
+      _num_checks(1024),
+      _block_size(128),
+      _graph_degree(16),
+      _graph_ef(200),
+      _seed(-1),
+      _recall_num_samples(0),
+      _memory_budget(1024),
+      _cache_directory()
+    {}
+
+  /////////////////////////////////////////////////////////////////////////
+
+    template <typename scalar>
+    KNNGraphGenerator<scalar>::Statistics::Statistics():
+      _index_construction_time(0),
+      _search_time(0),
+      _recall_time(0),
+      _recall(-1),
+      _cache_time(0),
+      _cache_hit(false)
+    {}
+
+    template <typename scalar>
+    void KNNGraphGenerator<scalar>::Statistics::reset(){
+      _index_construction_time = 0;
+      _search_time = 0;
+      _recall_time = 0;
+      _recall = -1;
+      _cache_time = 0;
+      _cache_hit = false;
+    }
+
+    template <typename scalar>
+    void KNNGraphGenerator<scalar>::Statistics::log(utils::AbstractLog* logger)const{
+      utils::secureLog(logger,"\n-------------- KNN Graph Generator Statistics ----------------");
+      utils::secureLogValue(logger,"\tIndex construction time",_index_construction_time,true,2);
+      utils::secureLogValue(logger,"\tSearch time",_search_time,true,4);
+      if(_cache_time != 0){
+        utils::secureLogValue(logger,"\tCache hit",_cache_hit?std::string("yes"):std::string("no"));
+        utils::secureLogValue(logger,"\tCache lookup time",_cache_time,true,2);
+      }
+      if(_recall != -1){
+        utils::secureLogValue(logger,"\tRecall (sampled)",_recall,true,3);
+        utils::secureLogValue(logger,"\tRecall estimation time",_recall_time,true,2);
+      }
+      utils::secureLog(logger,"--------------------------------------------------------------\n");
+    }
+
+  /////////////////////////////////////////////////////////////////////////
+
+    template <typename scalar>
+    KNNGraphGenerator<scalar>::KNNGraphGenerator():
+      _logger(nullptr),
+      _mapped_file(nullptr)
+    {}
+
+    template <typename scalar>
+    const char* KNNGraphGenerator<scalar>::backendName(KNNBackend backend){
+      switch(backend){
+        case KNNBackend::FlannKDTree:     return "FLANN kd-forest";
+        case KNNBackend::ExactBlocked:    return "Exact blocked";
+        case KNNBackend::ProximityGraph:  return "Proximity graph";
+        case KNNBackend::OutOfCoreBlocked:return "Out-of-core blocked";
+        case KNNBackend::ExactGEMM:       return "Exact GEMM";
+      }
+      return "Unknown";
+    }
+
+    template <typename scalar>
+    uint64_t KNNGraphGenerator<scalar>::cacheKey(const Parameters& params){
+      typedef KNNGraphCache<scalar_type> cache_type;
+      switch(params._backend){
+        //exact engines produce the same graph
+        case KNNBackend::ExactBlocked:
+        case KNNBackend::OutOfCoreBlocked:
+        case KNNBackend::ExactGEMM:
+          return cache_type::combine(0,static_cast<uint64_t>(KNNBackend::ExactBlocked));
+        case KNNBackend::FlannKDTree:
+          return cache_type::combine(cache_type::combine(cache_type::combine(0,static_cast<uint64_t>(params._backend)),params._num_trees),params._num_checks);
+        case KNNBackend::ProximityGraph:
+          return cache_type::combine(cache_type::combine(cache_type::combine(cache_type::combine(0,static_cast<uint64_t>(params._backend)),params._graph_degree),params._graph_ef),static_cast<int64_t>(params._seed));
+      }
+      return cache_type::combine(0,static_cast<uint64_t>(params._backend));
+    }
+
+    template <typename scalar>
+    void KNNGraphGenerator<scalar>::computeKNNGraph(const scalar_type* high_dimensional_data, unsigned int num_dim, unsigned int num_dps, unsigned int nn, std::vector<scalar_type>& distances_squared, std::vector<int>& indices, Parameters params){
+      checkAndThrowLogic(high_dimensional_data != nullptr, "KNNGraphGenerator: invalid data");
+      checkAndThrowLogic(nn > 0 && nn <= num_dps, "KNNGraphGenerator: the number of neighbors must be in [1,num_dps]");
+      _statistics.reset();
+      utils::secureLogValue(_logger,"\tKNN backend",std::string(backendName(params._backend)));
+
+      const bool use_cache = !params._cache_directory.empty();
+      KNNGraphCache<scalar_type> cache(params._cache_directory);
+      uint64_t data_fingerprint = 0;
+      if(use_cache){
+        utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._cache_time);
+        data_fingerprint = cache.fingerprint(high_dimensional_data,num_dim,num_dps);
+        _statistics._cache_hit = cache.load(data_fingerprint,cacheKey(params),num_dim,num_dps,nn,distances_squared,indices);
+      }
+
+      if(_statistics._cache_hit){
+        utils::secureLog(_logger,"\tKNN graph loaded from the cache");
+      }else{
+        distances_squared.resize(size_t(num_dps)*nn);
+        indices.resize(size_t(num_dps)*nn);
+
+        switch(params._backend){
+          case KNNBackend::FlannKDTree:     computeWithFlannKDTree(high_dimensional_data,num_dim,num_dps,nn,distances_squared,indices,params); break;
+          case KNNBackend::ExactBlocked:    computeWithExactBlocked(high_dimensional_data,num_dim,num_dps,nn,distances_squared,indices,params); break;
+          case KNNBackend::ProximityGraph:  computeWithProximityGraph(high_dimensional_data,num_dim,num_dps,nn,distances_squared,indices,params); break;
+          case KNNBackend::OutOfCoreBlocked:computeWithOutOfCoreBlocked(high_dimensional_data,num_dim,num_dps,nn,distances_squared,indices,params); break;
+          case KNNBackend::ExactGEMM:       computeWithExactGEMM(high_dimensional_data,num_dim,num_dps,nn,distances_squared,indices,params); break;
+          default: throw std::logic_error("KNNGraphGenerator: unknown backend");
+        }
+        enforceSelfAsFirstNeighbor(num_dps,nn,distances_squared,indices);
+
+        if(use_cache && !cache.save(data_fingerprint,cacheKey(params),num_dim,num_dps,nn,distances_squared,indices)){
+          utils::secureLogValue(_logger,"\tWARNING: unable to write the KNN graph cache",cache.fileName(data_fingerprint,cacheKey(params)));
+        }
+      }
+
+      if(params._recall_num_samples > 0){
+        estimateRecall(high_dimensional_data,num_dim,num_dps,nn,indices,params);
+      }
+    }
+
+    template <typename scalar>
+    void KNNGraphGenerator<scalar>::computeKNNGraph(const utils::MemoryMappedFile& file, unsigned int num_dim, unsigned int nn, std::vector<scalar_type>& distances_squared, std::vector<int>& indices, Parameters params){
+      checkAndThrowLogic(file.isOpen(), "KNNGraphGenerator: the file is not mapped");
+      checkAndThrowLogic(num_dim > 0 && file.size()%(sizeof(scalar_type)*num_dim) == 0, "KNNGraphGenerator: the size of the file does not agree with the number of dimensions");
+      const unsigned int num_dps = static_cast<unsigned int>(file.size()/(sizeof(scalar_type)*num_dim));
+      _mapped_file = &file;
+      try{
+        computeKNNGraph(file.dataAs<scalar_type>(),num_dim,num_dps,nn,distances_squared,indices,params);
+      }catch(...){
+        _mapped_file = nullptr;
+        throw;
+      }
+      _mapped_file = nullptr;
+    }
+
+    template <typename scalar>
+    void KNNGraphGenerator<scalar>::computeWithFlannKDTree(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, unsigned int nn, std::vector<scalar_type>& distances_squared, std::vector<int>& indices, const Parameters& params){
+      //FLANN does not modify the data but it does not accept a const pointer
+      scalar_type* data_ptr = const_cast<scalar_type*>(data);
+      flann::Matrix<scalar_type> dataset  (data_ptr,num_dps,num_dim);
+      flann::Matrix<scalar_type> query  (data_ptr,num_dps,num_dim);
+
+      flann::Index<flann::L2<scalar_type> > index(dataset, flann::KDTreeIndexParams(params._num_trees));
+      {
+        utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._index_construction_time);
+        utils::secureLog(_logger,"\tBuilding the trees...");
+        index.buildIndex();
+      }
+      {
+        utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._search_time);
+        utils::secureLog(_logger,"\tAKNN queries...");
+        flann::Matrix<int> indices_mat(indices.data(), query.rows, nn);
+        flann::Matrix<scalar_type> dists_mat(distances_squared.data(), query.rows, nn);
+        flann::SearchParams flann_params(params._num_checks);
+        flann_params.cores = 0; //all cores
+        index.knnSearch(query, indices_mat, dists_mat, nn, flann_params);
+      }
+    }
+
+    template <typename scalar>
+    void KNNGraphGenerator<scalar>::processTile(const scalar_type* const* queries, int num_queries, const scalar_type* data, unsigned int num_dim, unsigned int r_begin, unsigned int r_end, unsigned int nn, scalar_type* tile, std::vector<neighbor_type>* heaps){
+      const unsigned int tile_width = r_end-r_begin;
+      //distances between the query tile and the reference tile
+      for(int q = 0; q < num_queries; ++q){
+        const scalar_type* q_ptr = queries[q];
+        scalar_type* tile_row = tile + size_t(q)*tile_width;
+        for(unsigned int r = r_begin; r < r_end; ++r){
+          const scalar_type* r_ptr = data + size_t(r)*num_dim;
+          scalar_type d(0);
+          for(unsigned int i = 0; i < num_dim; ++i){
+            const scalar_type diff = q_ptr[i]-r_ptr[i];
+            d += diff*diff;
+          }
+          tile_row[r-r_begin] = d;
+        }
+      }
+      //selection of the nn best candidates
+      for(int q = 0; q < num_queries; ++q){
+        auto& heap = heaps[q];
+        const scalar_type* tile_row = tile + size_t(q)*tile_width;
+        for(unsigned int r = r_begin; r < r_end; ++r){
+          const scalar_type d = tile_row[r-r_begin];
+          if(heap.size() < nn){
+            heap.push_back(neighbor_type(d,r));
+            std::push_heap(heap.begin(),heap.end());
+          }else if(d < heap.front().first){
+            std::pop_heap(heap.begin(),heap.end());
+            heap.back() = neighbor_type(d,r);
+            std::push_heap(heap.begin(),heap.end());
+          }
+        }
+      }
+    }
+
+    template <typename scalar>
+    void KNNGraphGenerator<scalar>::exactBlockedSearch(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, const std::vector<unsigned int>& query_ids, unsigned int nn, unsigned int block_size, scalar_type* distances_squared, int* indices){
+      const int num_queries = static_cast<int>(query_ids.size());
+      const int num_query_blocks = (num_queries + block_size - 1) / block_size;
+
+#ifdef __USE_GCD__
+      for(int qb = 0; qb < num_query_blocks; ++qb){
+#else
+      #pragma omp parallel for schedule(dynamic,1)
+      for(int qb = 0; qb < num_query_blocks; ++qb){
+#endif
+        const int q_begin = qb*block_size;
+        const int q_end = std::min<int>(q_begin+block_size,num_queries);
+        std::vector<const scalar_type*> queries(q_end-q_begin);
+        std::vector<std::vector<neighbor_type>> heaps(q_end-q_begin);
+        for(int q = q_begin; q < q_end; ++q){
+          queries[q-q_begin] = data + size_t(query_ids[q])*num_dim;
+          heaps[q-q_begin].reserve(nn+1);
+        }
+        std::vector<scalar_type> tile(size_t(block_size)*block_size);
+
+        for(unsigned int r_begin = 0; r_begin < num_dps; r_begin += block_size){
+          const unsigned int r_end = std::min<unsigned int>(r_begin+block_size,num_dps);
+          processTile(queries.data(),q_end-q_begin,data,num_dim,r_begin,r_end,nn,tile.data(),heaps.data());
+        }
+
+        for(int q = q_begin; q < q_end; ++q){
+          auto& heap = heaps[q-q_begin];
+          std::sort_heap(heap.begin(),heap.end());
+          for(unsigned int n = 0; n < nn; ++n){
+            distances_squared[size_t(q)*nn+n] = heap[n].first;
+            indices[size_t(q)*nn+n] = heap[n].second;
+          }
+        }
+      }
+    }
+
+    template <typename scalar>
+    void KNNGraphGenerator<scalar>::computeWithExactBlocked(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, unsigned int nn, std::vector<scalar_type>& distances_squared, std::vector<int>& indices, const Parameters& params){
+      checkAndThrowLogic(params._block_size > 0, "KNNGraphGenerator: invalid block size");
+      utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._search_time);
+      utils::secureLog(_logger,"\tExact blocked KNN queries...");
+      std::vector<unsigned int> query_ids(num_dps);
+      std::iota(query_ids.begin(),query_ids.end(),0);
+      exactBlockedSearch(data,num_dim,num_dps,query_ids,nn,params._block_size,distances_squared.data(),indices.data());
+    }
+
+    template <typename scalar>
+    void KNNGraphGenerator<scalar>::computeWithExactGEMM(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, unsigned int nn, std::vector<scalar_type>& distances_squared, std::vector<int>& indices, const Parameters& params){
+      typedef Eigen::Matrix<scalar_type,Eigen::Dynamic,Eigen::Dynamic,Eigen::RowMajor> matrix_type;
+      typedef Eigen::Matrix<scalar_type,1,Eigen::Dynamic> row_vector_type;
+      typedef Eigen::Map<const matrix_type> const_map_type;
+      checkAndThrowLogic(params._block_size > 0, "KNNGraphGenerator: invalid block size");
+      utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._search_time);
+      utils::secureLog(_logger,"\tExact GEMM KNN queries...");
+
+      const_map_type points(data,num_dps,num_dim);
+      //The data are centered before the products to limit the cancellation in ||x||^2 + ||y||^2 - 2xy^T
+      Eigen::Matrix<double,1,Eigen::Dynamic> sum = Eigen::Matrix<double,1,Eigen::Dynamic>::Zero(num_dim);
+      for(unsigned int i = 0; i < num_dps; ++i){
+        sum += points.row(i).template cast<double>();
+      }
+      const row_vector_type mean = (sum/num_dps).template cast<scalar_type>();
+      std::vector<scalar_type> norms(num_dps);
+#ifndef __USE_GCD__
+      #pragma omp parallel for
+#endif
+      for(int i = 0; i < int(num_dps); ++i){
+        norms[i] = (points.row(i)-mean).squaredNorm();
+      }
+
+      //the tile of products is kept around 2MB so that it stays in cache during the selection
+      const unsigned int query_block = params._block_size;
+      const unsigned int reference_block = std::max<unsigned int>(query_block,(1<<19)/query_block);
+      const int num_query_blocks = (num_dps + query_block - 1) / query_block;
+
+#ifdef __USE_GCD__
+      for(int qb = 0; qb < num_query_blocks; ++qb){
+#else
+      #pragma omp parallel for schedule(dynamic,1)
+      for(int qb = 0; qb < num_query_blocks; ++qb){
+#endif
+        const unsigned int q_begin = qb*query_block;
+        const unsigned int q_end = std::min<unsigned int>(q_begin+query_block,num_dps);
+        const unsigned int num_queries = q_end-q_begin;
+        const matrix_type queries = points.middleRows(q_begin,num_queries).rowwise() - mean;
+        matrix_type references;
+        matrix_type products;
+        std::vector<std::vector<neighbor_type>> heaps(num_queries);
+        for(auto& heap: heaps){
+          heap.reserve(nn+1);
+        }
+
+        for(unsigned int r_begin = 0; r_begin < num_dps; r_begin += reference_block){
+          const unsigned int num_references = std::min<unsigned int>(reference_block,num_dps-r_begin);
+          references = points.middleRows(r_begin,num_references).rowwise() - mean;
+          products.noalias() = queries * references.transpose();
+
+          //per-row partial selection, the candidates are filtered with the current worst neighbor
+          for(unsigned int q = 0; q < num_queries; ++q){
+            auto& heap = heaps[q];
+            const scalar_type q_norm = norms[q_begin+q];
+            const scalar_type* products_row = products.data() + size_t(q)*num_references;
+            scalar_type threshold = (heap.size() < nn)?std::numeric_limits<scalar_type>::max():heap.front().first;
+            for(unsigned int r = 0; r < num_references; ++r){
+              const scalar_type d = std::max<scalar_type>(0,q_norm + norms[r_begin+r] - 2*products_row[r]);
+              if(d >= threshold){
+                continue;
+              }
+              if(heap.size() < nn){
+                heap.push_back(neighbor_type(d,r_begin+r));
+                std::push_heap(heap.begin(),heap.end());
+              }else{
+                std::pop_heap(heap.begin(),heap.end());
+                heap.back() = neighbor_type(d,r_begin+r);
+                std::push_heap(heap.begin(),heap.end());
+              }
+              if(heap.size() == nn){
+                threshold = heap.front().first;
+              }
+            }
+          }
+        }
+
+        //the distances of the selected neighbors are recomputed exactly
+        for(unsigned int q = 0; q < num_queries; ++q){
+          auto& heap = heaps[q];
+          for(auto& neighbor: heap){
+            neighbor.first = (points.row(q_begin+q)-points.row(neighbor.second)).squaredNorm();
+          }
+          std::sort(heap.begin(),heap.end());
+          for(unsigned int n = 0; n < nn; ++n){
+            distances_squared[size_t(q_begin+q)*nn+n] = heap[n].first;
+            indices[size_t(q_begin+q)*nn+n] = heap[n].second;
+          }
+        }
+      }
+    }
+
+    template <typename scalar>
+    void KNNGraphGenerator<scalar>::computeWithOutOfCoreBlocked(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, unsigned int nn, std::vector<scalar_type>& distances_squared, std::vector<int>& indices, const Parameters& params){
+      checkAndThrowLogic(params._block_size > 0, "KNNGraphGenerator: invalid block size");
+      checkAndThrowLogic(params._memory_budget > 0, "KNNGraphGenerator: invalid memory budget");
+      utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._search_time);
+      utils::secureLog(_logger,"\tOut-of-core blocked KNN queries...");
+
+      //Half of the budget goes to the block of queries (coordinates and heaps), half to the block of references
+      const double budget = double(params._memory_budget)*1024*1024;
+      const double bytes_per_query = double(num_dim)*sizeof(scalar_type) + double(nn+1)*sizeof(neighbor_type);
+      const double bytes_per_reference = double(num_dim)*sizeof(scalar_type);
+      const unsigned int query_block = static_cast<unsigned int>(std::max<double>(params._block_size,std::min<double>(num_dps,budget/2/bytes_per_query)));
+      const unsigned int reference_block = static_cast<unsigned int>(std::max<double>(params._block_size,std::min<double>(num_dps,budget/2/bytes_per_reference)));
+      const unsigned int block_size = params._block_size;
+      const size_t row_bytes = size_t(num_dim)*sizeof(scalar_type);
+      const size_t data_offset = (_mapped_file != nullptr)?size_t(reinterpret_cast<const char*>(data) - _mapped_file->data()):0;
+
+      utils::secureLogValue(_logger,"\tQueries per block",query_block);
+      utils::secureLogValue(_logger,"\tReferences per block",reference_block);
+      utils::secureLogValue(_logger,"\tPasses over the data",(num_dps+query_block-1)/query_block);
+
+      std::vector<scalar_type> query_data;
+      std::vector<std::vector<neighbor_type>> heaps;
+      for(unsigned int qs_begin = 0; qs_begin < num_dps; qs_begin += query_block){
+        const unsigned int qs_end = std::min<unsigned int>(qs_begin+query_block,num_dps);
+        const int num_queries = qs_end-qs_begin;
+
+        //The queries are copied so that the pages of the file can be released
+        query_data.assign(data+size_t(qs_begin)*num_dim, data+size_t(qs_end)*num_dim);
+        if(_mapped_file != nullptr){
+          _mapped_file->release(data_offset+qs_begin*row_bytes, num_queries*row_bytes);
+        }
+        heaps.resize(num_queries);
+        for(auto& h: heaps){
+          h.clear();
+          h.reserve(nn+1);
+        }
+
+        for(unsigned int rs_begin = 0; rs_begin < num_dps; rs_begin += reference_block){
+          const unsigned int rs_end = std::min<unsigned int>(rs_begin+reference_block,num_dps);
+          if(_mapped_file != nullptr){
+            _mapped_file->willNeed(data_offset+rs_begin*row_bytes, (rs_end-rs_begin)*row_bytes);
+          }
+          const int num_query_tiles = (num_queries + block_size - 1) / block_size;
+#ifdef __USE_GCD__
+          for(int qt = 0; qt < num_query_tiles; ++qt){
+#else
+          #pragma omp parallel for schedule(dynamic,1)
+          for(int qt = 0; qt < num_query_tiles; ++qt){
+#endif
+            const int q_begin = qt*block_size;
+            const int q_end = std::min<int>(q_begin+block_size,num_queries);
+            std::vector<const scalar_type*> queries(q_end-q_begin);
+            for(int q = q_begin; q < q_end; ++q){
+              queries[q-q_begin] = query_data.data() + size_t(q)*num_dim;
+            }
+            std::vector<scalar_type> tile(size_t(block_size)*block_size);
+            for(unsigned int r_begin = rs_begin; r_begin < rs_end; r_begin += block_size){
+              const unsigned int r_end = std::min<unsigned int>(r_begin+block_size,rs_end);
+              processTile(queries.data(),q_end-q_begin,data,num_dim,r_begin,r_end,nn,tile.data(),heaps.data()+q_begin);
+            }
+          }
+          if(_mapped_file != nullptr){
+            _mapped_file->release(data_offset+rs_begin*row_bytes, (rs_end-rs_begin)*row_bytes);
+          }
+        }
+
+        for(int q = 0; q < num_queries; ++q){
+          auto& heap = heaps[q];
+          std::sort_heap(heap.begin(),heap.end());
+          const size_t id = qs_begin+q;
+          for(unsigned int n = 0; n < nn; ++n){
+            distances_squared[id*nn+n] = heap[n].first;
+            indices[id*nn+n] = heap[n].second;
+          }
+        }
+      }
+    }
+
+    template <typename scalar>
+    void KNNGraphGenerator<scalar>::computeWithProximityGraph(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, unsigned int nn, std::vector<scalar_type>& distances_squared, std::vector<int>& indices, const Parameters& params){
+      ProximityGraphIndex<scalar_type> index;
+      {
+        utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._index_construction_time);
+        utils::secureLog(_logger,"\tBuilding the proximity graph...");
+        typename ProximityGraphIndex<scalar_type>::Parameters index_params;
+        index_params._max_degree = params._graph_degree;
+        index_params._ef_construction = params._graph_ef;
+        index_params._seed = params._seed;
+        index.build(data,num_dim,num_dps,index_params);
+        utils::secureLogValue(_logger,"\tProximity graph memory (MB)",index.memoryOccupation());
+      }
+      {
+        utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._search_time);
+        utils::secureLog(_logger,"\tAKNN queries...");
+        const int n = num_dps;
+#ifdef __USE_GCD__
+        for(int i = 0; i < n; ++i){
+#else
+        #pragma omp parallel for schedule(dynamic,256)
+        for(int i = 0; i < n; ++i){
+#endif
+          index.search(data+size_t(i)*num_dim,nn,params._graph_ef,indices.data()+size_t(i)*nn,distances_squared.data()+size_t(i)*nn);
+        }
+      }
+    }
+
+    template <typename scalar>
+    void KNNGraphGenerator<scalar>::enforceSelfAsFirstNeighbor(unsigned int num_dps, unsigned int nn, std::vector<scalar_type>& distances_squared, std::vector<int>& indices)const{
+      const int n = num_dps;
+#ifdef __USE_GCD__
+      for(int i = 0; i < n; ++i){
+#else
+      #pragma omp parallel for
+      for(int i = 0; i < n; ++i){
+#endif
+        int* row_idx = indices.data() + size_t(i)*nn;
+        scalar_type* row_dist = distances_squared.data() + size_t(i)*nn;
+        if(row_idx[0] == i){
+          continue;
+        }
+        unsigned int pos = 1;
+        for(; pos < nn; ++pos){
+          if(row_idx[pos] == i){
+            break;
+          }
+        }
+        if(pos == nn){
+          //the point was not found by an approximated engine, the farthest neighbor is dropped
+          pos = nn-1;
+        }
+        //points that have the same position of the query can precede it, the row stays sorted
+        for(unsigned int k = pos; k > 0; --k){
+          row_idx[k] = row_idx[k-1];
+          row_dist[k] = row_dist[k-1];
+        }
+        row_idx[0] = i;
+        row_dist[0] = 0;
+      }
+    }
+
+    template <typename scalar>
+    void KNNGraphGenerator<scalar>::estimateRecall(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, unsigned int nn, const std::vector<int>& indices, const Parameters& params){
+      utils::ScopedTimer<scalar_type, utils::Seconds> timer(_statistics._recall_time);
+      utils::secureLog(_logger,"\tEstimating the recall of the KNN graph...");
+
+      std::vector<unsigned int> query_ids(num_dps);
+      std::iota(query_ids.begin(),query_ids.end(),0);
+      std::default_random_engine generator((params._seed < 0)?static_cast<unsigned int>(std::chrono::system_clock::now().time_since_epoch().count()):params._seed);
+      std::shuffle(query_ids.begin(),query_ids.end(),generator);
+      query_ids.resize(std::min(params._recall_num_samples,num_dps));
+
+      std::vector<scalar_type> exact_distances(query_ids.size()*nn);
+      std::vector<int> exact_indices(query_ids.size()*nn);
+      exactBlockedSearch(data,num_dim,num_dps,query_ids,nn,params._block_size,exact_distances.data(),exact_indices.data());
+
+      //the query point itself is not counted
+      uint64_t found = 0;
+      for(size_t q = 0; q < query_ids.size(); ++q){
+        const unsigned int id = query_ids[q];
+        std::unordered_set<int> exact(exact_indices.begin()+q*nn,exact_indices.begin()+(q+1)*nn);
+        for(unsigned int n = 1; n < nn; ++n){
+          if(exact.find(indices[size_t(id)*nn+n]) != exact.end()){
+            ++found;
+          }
+        }
+      }
+      const uint64_t total = uint64_t(query_ids.size())*(nn-1);
+      _statistics._recall = (total == 0)?1:scalar_type(double(found)/total);
+      utils::secureLogValue(_logger,"\tKNN recall (sampled)",_statistics._recall);
+    }
+
+  }
+}
+#endif
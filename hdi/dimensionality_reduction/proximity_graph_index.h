@@ -0,0 +1,157 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef PROXIMITY_GRAPH_INDEX_H
+#define PROXIMITY_GRAPH_INDEX_H
+
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <random>
+#include <stdint.h>
+#include "hdi/utils/assert_by_exception.h"
+
+namespace hdi{
+  namespace dr{
+    //! Hierarchical proximity graph for approximated nearest neighbor queries
+    /*!
+      Multi-layer navigable small-world graph as presented in the HNSW paper (Malkov and Yashunin).
+      Points are inserted in parallel, every layer keeps a bounded number of links per node selected with the
+      diversity heuristic and queries are answered by a greedy descent followed by a best-first search on the bottom layer.
+      Distances are squared euclidean distances.
+      \note The index does not own the data, the pointer provided in build must stay valid for the lifetime of the index
+    */
+    template <typename scalar = float>
+    class ProximityGraphIndex{
+    public:
+      typedef scalar scalar_type;
+      typedef uint32_t node_id_type;
+
+    public:
+      //! Parameters used for the construction of the graph
+      class Parameters{
+      public:
+        Parameters();
+        unsigned int _max_degree;        //! Max number of links per node in the upper layers. The bottom layer uses twice this value (M in the paper)
+        unsigned int _ef_construction;   //! Size of the candidate list used during the insertion
+        int _seed;                       //! Seed used for the level assignment. If a negative value is provided, a time-based seed is used
+      };
+
+    public:
+      ProximityGraphIndex();
+
+      //! Build the index on num_dps points of dimensionality num_dim
+      void build(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, Parameters params = Parameters());
+      //! Insert the points [first_id, first_id+num_new_dps) in the graph. The pointer must address all the points that are in the index
+      void addPoints(const scalar_type* data, unsigned int first_id, unsigned int num_new_dps);
+      //! Return the nn approximated nearest neighbors of query, sorted by increasing distance. The candidate list has max(ef,nn) elements
+      void search(const scalar_type* query, unsigned int nn, unsigned int ef, int* indices, scalar_type* distances_squared)const;
+
+      //! Number of points in the index
+      unsigned int size()const{return _num_dps;}
+      //! Dimensionality of the indexed points
+      unsigned int dimensionality()const{return _num_dim;}
+      //! Number of layers in the graph
+      unsigned int numLayers()const{return _max_level+1;}
+      //! Memory occupied by the links in MB
+      double memoryOccupation()const;
+
+    private:
+      typedef std::pair<scalar_type,node_id_type> candidate_type;
+
+      //! Marks the nodes visited during a search. Tags avoid clearing the marks at every query
+      class VisitedList{
+      public:
+        VisitedList():_tag(0){}
+        void reset(unsigned int num_nodes);
+        bool visit(node_id_type id){
+          if(_marks[id] == _tag){
+            return false;
+          }
+          _marks[id] = _tag;
+          return true;
+        }
+      private:
+        std::vector<uint16_t> _marks;
+        uint16_t _tag;
+      };
+
+      //! Squared euclidean distance between a query and a point in the index
+      inline scalar_type distance(const scalar_type* query, node_id_type id)const;
+      //! Draw a random level for a new node
+      int randomLevel();
+      //! Allocate the storage for the nodes [first_id, first_id+num_new_dps) and draw their levels
+      void allocateNodes(unsigned int first_id, unsigned int num_new_dps);
+      //! Insert a single node
+      void insert(node_id_type id);
+      //! Best-first search on a layer, the result is returned as a max-heap on the distance
+      void searchLayer(const scalar_type* query, node_id_type entry_point, unsigned int ef, int level, std::vector<candidate_type>& result, bool lock)const;
+      //! Select the neighbors to link using the diversity heuristic of the HNSW paper
+      void selectNeighbors(std::vector<candidate_type>& candidates, unsigned int max_degree)const;
+      //! Copy the links of a node at a given level
+      void getLinks(node_id_type id, int level, std::vector<node_id_type>& links, bool lock)const;
+      //! Add a link and prune the link list if needed
+      void addLink(node_id_type id, node_id_type new_link, int level);
+      //! Replace the links of a node at a given level. The node lock must be held by the caller
+      void setLinks(node_id_type id, int level, const std::vector<candidate_type>& links);
+      //! Max number of links of a node at a given level
+      unsigned int maxDegree(int level)const{return (level == 0)?2*_params._max_degree:_params._max_degree;}
+
+      //! Acquire a visited list from the pool
+      std::unique_ptr<VisitedList> acquireVisitedList()const;
+      //! Return a visited list to the pool
+      void releaseVisitedList(std::unique_ptr<VisitedList> list)const;
+
+    private:
+      const scalar_type* _data;
+      unsigned int _num_dim;
+      unsigned int _num_dps;
+      Parameters _params;
+
+      std::vector<node_id_type> _links_layer_zero; //! Links on the bottom layer. For each node: [num_links, link_0, ... , link_(2M-1)]
+      std::vector<std::vector<std::vector<node_id_type>>> _links_upper_layers; //! Links on the upper layers, _links_upper_layers[id][level-1]
+      std::vector<int> _levels;
+
+      int _max_level;
+      node_id_type _entry_point;
+      double _level_multiplier;
+      std::default_random_engine _generator;
+
+      std::unique_ptr<std::mutex[]> _node_locks;
+      std::mutex _global_lock;
+      mutable std::mutex _visited_pool_lock;
+      mutable std::vector<std::unique_ptr<VisitedList>> _visited_pool;
+    };
+
+  }
+}
+#endif
@@ -0,0 +1,430 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef PROXIMITY_GRAPH_INDEX_INL
+#define PROXIMITY_GRAPH_INDEX_INL
+
+#include "hdi/dimensionality_reduction/proximity_graph_index.h"
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <limits>
+#include <cmath>
+
+namespace hdi{
+  namespace dr{
+  /////////////////////////////////////////////////////////////////////////
+
+    template <typename scalar>
+    ProximityGraphIndex<scalar>::Parameters::Parameters():
+      _max_degree(16),
+      _ef_construction(200),
+      _seed(-1)
+    {}
+
+    template <typename scalar>
+    void ProximityGraphIndex<scalar>::VisitedList::reset(unsigned int num_nodes){
+      if(_marks.size() < num_nodes){
+        _marks.assign(num_nodes,0);
+        _tag = 0;
+      }
+      ++_tag;
+      if(_tag == 0){ //overflow of the tag
+        std::fill(_marks.begin(),_marks.end(),0);
+        _tag = 1;
+      }
+    }
+
+  /////////////////////////////////////////////////////////////////////////
+
+    template <typename scalar>
+    ProximityGraphIndex<scalar>::ProximityGraphIndex():
+      _data(nullptr),
+      _num_dim(0),
+      _num_dps(0),
+      _max_level(-1),
+      _entry_point(0),
+      _level_multiplier(0)
+    {}
+
+    template <typename scalar>
+    void ProximityGraphIndex<scalar>::build(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, Parameters params){
+      checkAndThrowLogic(data != nullptr, "ProximityGraphIndex::build: invalid data");
+      checkAndThrowLogic(num_dim > 0, "ProximityGraphIndex::build: invalid dimensionality");
+      checkAndThrowLogic(params._max_degree > 1, "ProximityGraphIndex::build: the max degree must be greater than one");
+
+      _params = params;
+      _num_dim = num_dim;
+      _num_dps = 0;
+      _max_level = -1;
+      _entry_point = 0;
+      _level_multiplier = 1./std::log(double(_params._max_degree));
+      if(_params._seed < 0){
+        _generator.seed(static_cast<unsigned int>(std::chrono::system_clock::now().time_since_epoch().count()));
+      }else{
+        _generator.seed(_params._seed);
+      }
+
+      _links_layer_zero.clear();
+      _links_upper_layers.clear();
+      _levels.clear();
+
+      addPoints(data,0,num_dps);
+    }
+
+    template <typename scalar>
+    void ProximityGraphIndex<scalar>::addPoints(const scalar_type* data, unsigned int first_id, unsigned int num_new_dps){
+      checkAndThrowLogic(first_id == _num_dps, "ProximityGraphIndex::addPoints: new points must be appended to the index");
+      _data = data;
+      if(num_new_dps == 0){
+        return;
+      }
+
+      allocateNodes(first_id,num_new_dps);
+      int begin = first_id;
+      if(_max_level < 0){
+        //the first point is the entry point of the empty graph
+        _entry_point = first_id;
+        _max_level = _levels[first_id];
+        ++begin;
+      }
+      _num_dps = first_id + num_new_dps;
+
+      const int end = _num_dps;
+#ifdef __USE_GCD__
+      for(int i = begin; i < end; ++i){
+#else
+      #pragma omp parallel for schedule(dynamic,64)
+      for(int i = begin; i < end; ++i){
+#endif
+        insert(i);
+      }
+    }
+
+    template <typename scalar>
+    void ProximityGraphIndex<scalar>::allocateNodes(unsigned int first_id, unsigned int num_new_dps){
+      const unsigned int new_size = first_id + num_new_dps;
+      const size_t stride = maxDegree(0) + 1;
+      _links_layer_zero.resize(new_size*stride,0);
+      _links_upper_layers.resize(new_size);
+      _levels.resize(new_size);
+      for(unsigned int i = first_id; i < new_size; ++i){
+        _levels[i] = randomLevel();
+        _links_upper_layers[i].resize(_levels[i]);
+      }
+      _node_locks.reset(new std::mutex[new_size]);
+    }
+
+    template <typename scalar>
+    int ProximityGraphIndex<scalar>::randomLevel(){
+      std::uniform_real_distribution<double> distribution(std::numeric_limits<double>::min(),1.);
+      return static_cast<int>(-std::log(distribution(_generator))*_level_multiplier);
+    }
+
+    template <typename scalar>
+    typename ProximityGraphIndex<scalar>::scalar_type ProximityGraphIndex<scalar>::distance(const scalar_type* query, node_id_type id)const{
+      const scalar_type* point = _data + size_t(id)*_num_dim;
+      scalar_type res(0);
+      for(unsigned int d = 0; d < _num_dim; ++d){
+        const scalar_type diff = query[d]-point[d];
+        res += diff*diff;
+      }
+      return res;
+    }
+
+  /////////////////////////////////////////////////////////////////////////
+
+    template <typename scalar>
+    void ProximityGraphIndex<scalar>::insert(node_id_type id){
+      const scalar_type* point = _data + size_t(id)*_num_dim;
+      const int level = _levels[id];
+
+      //the global lock is kept only if the new node becomes the entry point
+      std::unique_lock<std::mutex> global_lock(_global_lock);
+      const int max_level = _max_level;
+      node_id_type entry_point = _entry_point;
+      if(level <= max_level){
+        global_lock.unlock();
+      }
+
+      //greedy descent on the layers that are above the level of the new node
+      scalar_type entry_distance = distance(point,entry_point);
+      std::vector<node_id_type> links;
+      for(int l = max_level; l > level; --l){
+        bool changed = true;
+        while(changed){
+          changed = false;
+          getLinks(entry_point,l,links,true);
+          for(auto n: links){
+            const scalar_type d = distance(point,n);
+            if(d < entry_distance){
+              entry_distance = d;
+              entry_point = n;
+              changed = true;
+            }
+          }
+        }
+      }
+
+      std::vector<candidate_type> candidates;
+      std::vector<candidate_type> selected;
+      for(int l = std::min(level,max_level); l >= 0; --l){
+        searchLayer(point,entry_point,_params._ef_construction,l,candidates,true);
+        entry_point = std::min_element(candidates.begin(),candidates.end())->second;
+
+        selected.clear();
+        for(auto& c: candidates){
+          if(c.second != id){
+            selected.push_back(c);
+          }
+        }
+        selectNeighbors(selected,_params._max_degree);
+        {
+          std::lock_guard<std::mutex> guard(_node_locks[id]);
+          setLinks(id,l,selected);
+        }
+        for(auto& s: selected){
+          addLink(s.second,id,l);
+        }
+      }
+
+      if(level > max_level){
+        _entry_point = id;
+        _max_level = level;
+      }
+    }
+
+    template <typename scalar>
+    void ProximityGraphIndex<scalar>::searchLayer(const scalar_type* query, node_id_type entry_point, unsigned int ef, int level, std::vector<candidate_type>& result, bool lock)const{
+      std::unique_ptr<VisitedList> visited(acquireVisitedList());
+      visited->reset(_num_dps);
+
+      std::vector<candidate_type> candidates; //min-heap on the distance
+      std::vector<node_id_type> links;
+      result.clear(); //max-heap on the distance
+
+      const scalar_type entry_distance = distance(query,entry_point);
+      visited->visit(entry_point);
+      candidates.push_back(candidate_type(entry_distance,entry_point));
+      result.push_back(candidate_type(entry_distance,entry_point));
+
+      while(!candidates.empty()){
+        std::pop_heap(candidates.begin(),candidates.end(),std::greater<candidate_type>());
+        const candidate_type current = candidates.back();
+        candidates.pop_back();
+        if(current.first > result.front().first && result.size() >= ef){
+          break;
+        }
+
+        getLinks(current.second,level,links,lock);
+        for(auto n: links){
+          if(!visited->visit(n)){
+            continue;
+          }
+          const scalar_type d = distance(query,n);
+          if(result.size() < ef || d < result.front().first){
+            candidates.push_back(candidate_type(d,n));
+            std::push_heap(candidates.begin(),candidates.end(),std::greater<candidate_type>());
+            result.push_back(candidate_type(d,n));
+            std::push_heap(result.begin(),result.end());
+            if(result.size() > ef){
+              std::pop_heap(result.begin(),result.end());
+              result.pop_back();
+            }
+          }
+        }
+      }
+
+      releaseVisitedList(std::move(visited));
+    }
+
+    template <typename scalar>
+    void ProximityGraphIndex<scalar>::selectNeighbors(std::vector<candidate_type>& candidates, unsigned int max_degree)const{
+      std::sort(candidates.begin(),candidates.end());
+      if(candidates.size() <= max_degree){
+        return;
+      }
+
+      //a candidate is kept only if it is closer to the node than to all the neighbors already selected
+      std::vector<candidate_type> selected;
+      selected.reserve(max_degree);
+      for(auto& c: candidates){
+        if(selected.size() >= max_degree){
+          break;
+        }
+        const scalar_type* point = _data + size_t(c.second)*_num_dim;
+        bool keep = true;
+        for(auto& s: selected){
+          if(distance(point,s.second) < c.first){
+            keep = false;
+            break;
+          }
+        }
+        if(keep){
+          selected.push_back(c);
+        }
+      }
+      candidates.swap(selected);
+    }
+
+    template <typename scalar>
+    void ProximityGraphIndex<scalar>::getLinks(node_id_type id, int level, std::vector<node_id_type>& links, bool lock)const{
+      std::unique_lock<std::mutex> guard(_node_locks[id],std::defer_lock);
+      if(lock){
+        guard.lock();
+      }
+      if(level == 0){
+        const node_id_type* ptr = _links_layer_zero.data() + size_t(id)*(maxDegree(0)+1);
+        links.assign(ptr+1,ptr+1+ptr[0]);
+      }else{
+        links = _links_upper_layers[id][level-1];
+      }
+    }
+
+    template <typename scalar>
+    void ProximityGraphIndex<scalar>::setLinks(node_id_type id, int level, const std::vector<candidate_type>& links){
+      if(level == 0){
+        node_id_type* ptr = _links_layer_zero.data() + size_t(id)*(maxDegree(0)+1);
+        ptr[0] = static_cast<node_id_type>(links.size());
+        for(size_t i = 0; i < links.size(); ++i){
+          ptr[i+1] = links[i].second;
+        }
+      }else{
+        auto& level_links = _links_upper_layers[id][level-1];
+        level_links.resize(links.size());
+        for(size_t i = 0; i < links.size(); ++i){
+          level_links[i] = links[i].second;
+        }
+      }
+    }
+
+    template <typename scalar>
+    void ProximityGraphIndex<scalar>::addLink(node_id_type id, node_id_type new_link, int level){
+      std::lock_guard<std::mutex> guard(_node_locks[id]);
+      std::vector<node_id_type> links;
+      getLinks(id,level,links,false);
+      if(std::find(links.begin(),links.end(),new_link) != links.end()){
+        return;
+      }
+
+      const unsigned int max_degree = maxDegree(level);
+      if(links.size() < max_degree){
+        if(level == 0){
+          node_id_type* ptr = _links_layer_zero.data() + size_t(id)*(max_degree+1);
+          ptr[1+ptr[0]] = new_link;
+          ++ptr[0];
+        }else{
+          _links_upper_layers[id][level-1].push_back(new_link);
+        }
+        return;
+      }
+
+      //the node is full, the links are pruned with the same heuristic used for the insertion
+      const scalar_type* point = _data + size_t(id)*_num_dim;
+      std::vector<candidate_type> candidates;
+      candidates.reserve(links.size()+1);
+      for(auto n: links){
+        candidates.push_back(candidate_type(distance(point,n),n));
+      }
+      candidates.push_back(candidate_type(distance(point,new_link),new_link));
+      selectNeighbors(candidates,max_degree);
+      setLinks(id,level,candidates);
+    }
+
+  /////////////////////////////////////////////////////////////////////////
+
+    template <typename scalar>
+    void ProximityGraphIndex<scalar>::search(const scalar_type* query, unsigned int nn, unsigned int ef, int* indices, scalar_type* distances_squared)const{
+      checkAndThrowLogic(_num_dps > 0, "ProximityGraphIndex::search: the index is empty");
+
+      node_id_type entry_point = _entry_point;
+      scalar_type entry_distance = distance(query,entry_point);
+      std::vector<node_id_type> links;
+      for(int l = _max_level; l > 0; --l){
+        bool changed = true;
+        while(changed){
+          changed = false;
+          getLinks(entry_point,l,links,false);
+          for(auto n: links){
+            const scalar_type d = distance(query,n);
+            if(d < entry_distance){
+              entry_distance = d;
+              entry_point = n;
+              changed = true;
+            }
+          }
+        }
+      }
+
+      std::vector<candidate_type> result;
+      searchLayer(query,entry_point,std::max(ef,nn),0,result,false);
+      std::sort(result.begin(),result.end());
+      for(unsigned int i = 0; i < nn; ++i){
+        //if the graph is not connected less than nn points can be reached, the farthest one is repeated
+        const candidate_type& c = result[std::min<size_t>(i,result.size()-1)];
+        indices[i] = static_cast<int>(c.second);
+        distances_squared[i] = c.first;
+      }
+    }
+
+    template <typename scalar>
+    double ProximityGraphIndex<scalar>::memoryOccupation()const{
+      double mem = _links_layer_zero.capacity()*sizeof(node_id_type);
+      for(auto& node: _links_upper_layers){
+        for(auto& level: node){
+          mem += level.capacity()*sizeof(node_id_type);
+        }
+      }
+      return mem / 1024 / 1024;
+    }
+
+    template <typename scalar>
+    std::unique_ptr<typename ProximityGraphIndex<scalar>::VisitedList> ProximityGraphIndex<scalar>::acquireVisitedList()const{
+      std::lock_guard<std::mutex> guard(_visited_pool_lock);
+      if(_visited_pool.empty()){
+        return std::unique_ptr<VisitedList>(new VisitedList());
+      }
+      std::unique_ptr<VisitedList> list(std::move(_visited_pool.back()));
+      _visited_pool.pop_back();
+      return list;
+    }
+
+    template <typename scalar>
+    void ProximityGraphIndex<scalar>::releaseVisitedList(std::unique_ptr<VisitedList> list)const{
+      std::lock_guard<std::mutex> guard(_visited_pool_lock);
+      _visited_pool.push_back(std::move(list));
+    }
+
+  }
+}
+#endif
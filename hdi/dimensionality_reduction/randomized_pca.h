@@ -0,0 +1,131 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef RANDOMIZED_PCA_H
+#define RANDOMIZED_PCA_H
+
+#include <vector>
+#include "hdi/utils/abstract_log.h"
+#include "hdi/utils/memory_mapped_file.h"
+#include "hdi/data/panel_data.h"
+
+namespace hdi{
+  namespace dr{
+
+    //! Principal Component Analysis computed with a randomized subspace iteration
+    /*!
+      Principal Component Analysis computed with a randomized subspace iteration (Halko, Martinsson and Tropp, 2011).
+      The data are streamed in blocks of rows and never copied as a whole: every pass accumulates in parallel the product of the
+      centered covariance matrix with a small num_dim*(num_components+oversampling) basis, hence the memory footprint is independent
+      from the number of data points and the algorithm can be used on memory-mapped files.
+      The principal components are extracted with a Rayleigh-Ritz projection on the final basis.
+      \note Computations are performed in double precision
+    */
+    template <typename scalar = float>
+    class RandomizedPCA{
+    public:
+      typedef scalar scalar_type;
+
+    public:
+      //! Parameters of the decomposition
+      class Parameters{
+      public:
+        Parameters();
+      public:
+        unsigned int _num_components;       //! Number of principal components
+        unsigned int _oversampling;         //! Additional vectors in the random basis, they improve the accuracy of the last components
+        unsigned int _num_power_iterations; //! Number of passes over the data that refine the basis. Each pass costs a multiplication by the covariance matrix
+        unsigned int _block_size;           //! Number of rows processed at once
+        int _seed;                          //! Seed of the random basis. If a negative value is provided, a time-based seed is used
+      };
+
+    public:
+      RandomizedPCA();
+
+      //! Compute the principal components of a row-major num_dps*num_dim matrix
+      void fit(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, Parameters params = Parameters());
+      //! Compute the principal components of a raw row-major matrix stored in a memory-mapped file. Pages are dropped once a block is processed
+      void fit(const utils::MemoryMappedFile& file, unsigned int num_dim, Parameters params = Parameters());
+      //! Compute the principal components of the data in a panel
+      void fit(const data::PanelData<scalar_type>& panel_data, Parameters params = Parameters());
+
+      //! Project a row-major num_dps*num_dim matrix on the principal components. The output is a row-major num_dps*num_components matrix
+      void transform(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, std::vector<scalar_type>& projected)const;
+      //! Project the data stored in a memory-mapped file on the principal components
+      void transform(const utils::MemoryMappedFile& file, unsigned int num_dim, std::vector<scalar_type>& projected)const;
+      //! Project the data in a panel on the principal components
+      void transform(const data::PanelData<scalar_type>& panel_data, std::vector<scalar_type>& projected)const;
+
+      //! Fit followed by a projection of the same data
+      void fitTransform(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, std::vector<scalar_type>& projected, Parameters params = Parameters());
+      void fitTransform(const utils::MemoryMappedFile& file, unsigned int num_dim, std::vector<scalar_type>& projected, Parameters params = Parameters());
+      void fitTransform(const data::PanelData<scalar_type>& panel_data, std::vector<scalar_type>& projected, Parameters params = Parameters());
+
+      //! Number of principal components computed
+      unsigned int numComponents()const{return _num_components;}
+      //! Number of dimensions of the input data
+      unsigned int numDimensions()const{return _num_dim;}
+      //! Principal components as a row-major num_components*num_dim matrix
+      const std::vector<double>& components()const{return _components;}
+      //! Mean of the input data
+      const std::vector<double>& mean()const{return _mean;}
+      //! Variance of the data along every principal component
+      const std::vector<double>& explainedVariance()const{return _explained_variance;}
+      //! Fraction of the total variance captured by every principal component
+      std::vector<double> explainedVarianceRatio()const;
+
+      //! Return the current log
+      utils::AbstractLog* logger()const{return _logger;}
+      //! Set a pointer to an existing log
+      void setLogger(utils::AbstractLog* logger){_logger = logger;}
+
+    private:
+      void fitImpl(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, const utils::MemoryMappedFile* file, const Parameters& params);
+      void transformImpl(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, const utils::MemoryMappedFile* file, std::vector<scalar_type>& projected)const;
+      //! Accumulate the mean and the total variance of the data
+      void computeMoments(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, const utils::MemoryMappedFile* file, unsigned int block_size);
+      //! Compute product = X_c^T X_c basis, where X_c is the centered data and basis is a column-major num_dim*num_vectors matrix
+      void multiplyByCovariance(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, const utils::MemoryMappedFile* file, unsigned int block_size, const std::vector<double>& basis, unsigned int num_vectors, std::vector<double>& product)const;
+
+    private:
+      unsigned int _num_dim;
+      unsigned int _num_components;
+      std::vector<double> _components;
+      std::vector<double> _mean;
+      std::vector<double> _explained_variance;
+      double _total_variance;
+      utils::AbstractLog* _logger;
+    };
+
+  }
+}
+#endif
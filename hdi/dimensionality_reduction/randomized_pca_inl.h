@@ -0,0 +1,328 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef RANDOMIZED_PCA_INL
+#define RANDOMIZED_PCA_INL
+
+#include "hdi/dimensionality_reduction/randomized_pca.h"
+#include "hdi/utils/assert_by_exception.h"
+#include "hdi/utils/log_helper_functions.h"
+#include "hdi/utils/scoped_timers.h"
+#include "hdi/utils/Eigen/Dense"
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <cmath>
+
+namespace hdi{
+  namespace dr{
+  /////////////////////////////////////////////////////////////////////////
+
+    template <typename scalar>
+    RandomizedPCA<scalar>::Parameters::Parameters():
+      _num_components(50),
+      _oversampling(10),
+      _num_power_iterations(2),
+      _block_size(512),
+      _seed(0)
+    {}
+
+  /////////////////////////////////////////////////////////////////////////
+
+    template <typename scalar>
+    RandomizedPCA<scalar>::RandomizedPCA():
+      _num_dim(0),
+      _num_components(0),
+      _total_variance(0),
+      _logger(nullptr)
+    {}
+
+    template <typename scalar>
+    void RandomizedPCA<scalar>::fit(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, Parameters params){
+      checkAndThrowLogic(data != nullptr, "RandomizedPCA: invalid data");
+      fitImpl(data,num_dim,num_dps,nullptr,params);
+    }
+
+    template <typename scalar>
+    void RandomizedPCA<scalar>::fit(const utils::MemoryMappedFile& file, unsigned int num_dim, Parameters params){
+      checkAndThrowLogic(file.isOpen(), "RandomizedPCA: the file is not mapped");
+      checkAndThrowLogic(num_dim > 0 && file.size()%(sizeof(scalar_type)*num_dim) == 0, "RandomizedPCA: the size of the file does not agree with the number of dimensions");
+      fitImpl(file.dataAs<scalar_type>(),num_dim,static_cast<unsigned int>(file.size()/(sizeof(scalar_type)*num_dim)),&file,params);
+    }
+
+    template <typename scalar>
+    void RandomizedPCA<scalar>::fit(const data::PanelData<scalar_type>& panel_data, Parameters params){
+      fitImpl(panel_data.getData().data(),panel_data.numDimensions(),panel_data.numDataPoints(),nullptr,params);
+    }
+
+    template <typename scalar>
+    void RandomizedPCA<scalar>::transform(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, std::vector<scalar_type>& projected)const{
+      checkAndThrowLogic(data != nullptr, "RandomizedPCA: invalid data");
+      transformImpl(data,num_dim,num_dps,nullptr,projected);
+    }
+
+    template <typename scalar>
+    void RandomizedPCA<scalar>::transform(const utils::MemoryMappedFile& file, unsigned int num_dim, std::vector<scalar_type>& projected)const{
+      checkAndThrowLogic(file.isOpen(), "RandomizedPCA: the file is not mapped");
+      checkAndThrowLogic(num_dim > 0 && file.size()%(sizeof(scalar_type)*num_dim) == 0, "RandomizedPCA: the size of the file does not agree with the number of dimensions");
+      transformImpl(file.dataAs<scalar_type>(),num_dim,static_cast<unsigned int>(file.size()/(sizeof(scalar_type)*num_dim)),&file,projected);
+    }
+
+    template <typename scalar>
+    void RandomizedPCA<scalar>::transform(const data::PanelData<scalar_type>& panel_data, std::vector<scalar_type>& projected)const{
+      transformImpl(panel_data.getData().data(),panel_data.numDimensions(),panel_data.numDataPoints(),nullptr,projected);
+    }
+
+    template <typename scalar>
+    void RandomizedPCA<scalar>::fitTransform(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, std::vector<scalar_type>& projected, Parameters params){
+      fit(data,num_dim,num_dps,params);
+      transform(data,num_dim,num_dps,projected);
+    }
+
+    template <typename scalar>
+    void RandomizedPCA<scalar>::fitTransform(const utils::MemoryMappedFile& file, unsigned int num_dim, std::vector<scalar_type>& projected, Parameters params){
+      fit(file,num_dim,params);
+      transform(file,num_dim,projected);
+    }
+
+    template <typename scalar>
+    void RandomizedPCA<scalar>::fitTransform(const data::PanelData<scalar_type>& panel_data, std::vector<scalar_type>& projected, Parameters params){
+      fit(panel_data,params);
+      transform(panel_data,projected);
+    }
+
+    template <typename scalar>
+    std::vector<double> RandomizedPCA<scalar>::explainedVarianceRatio()const{
+      std::vector<double> ratio(_explained_variance);
+      for(auto& r: ratio){
+        r = (_total_variance > 0)?r/_total_variance:0;
+      }
+      return ratio;
+    }
+
+  /////////////////////////////////////////////////////////////////////////
+
+    template <typename scalar>
+    void RandomizedPCA<scalar>::fitImpl(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, const utils::MemoryMappedFile* file, const Parameters& params){
+      typedef Eigen::MatrixXd matrix_type;
+      checkAndThrowLogic(num_dim > 0 && num_dps > 1, "RandomizedPCA: at least two data points are needed");
+      checkAndThrowLogic(params._num_components > 0 && params._num_components <= num_dim, "RandomizedPCA: the number of components must be in [1,num_dim]");
+      checkAndThrowLogic(params._block_size > 0, "RandomizedPCA: invalid block size");
+
+      utils::secureLog(_logger,"Randomized PCA...");
+      _num_dim = num_dim;
+      _num_components = params._num_components;
+      const unsigned int num_vectors = std::min(num_dim,std::min(num_dps,params._num_components+params._oversampling));
+
+      utils::secureLog(_logger,"\tMean and variance...");
+      computeMoments(data,num_dim,num_dps,file,params._block_size);
+
+      //Random gaussian basis
+      std::default_random_engine generator((params._seed < 0)?static_cast<unsigned int>(std::chrono::system_clock::now().time_since_epoch().count()):params._seed);
+      std::normal_distribution<double> distribution;
+      matrix_type basis(num_dim,num_vectors);
+      for(unsigned int j = 0; j < num_vectors; ++j){
+        for(unsigned int i = 0; i < num_dim; ++i){
+          basis(i,j) = distribution(generator);
+        }
+      }
+      basis = Eigen::HouseholderQR<matrix_type>(basis).householderQ()*matrix_type::Identity(num_dim,num_vectors);
+
+      //Subspace iteration on the covariance matrix. The product of the last pass is used for the Rayleigh-Ritz projection
+      std::vector<double> basis_buffer(basis.data(),basis.data()+basis.size());
+      std::vector<double> product_buffer;
+      for(unsigned int it = 0; it <= params._num_power_iterations; ++it){
+        utils::secureLogValue(_logger,"\tPass over the data",it+1);
+        multiplyByCovariance(data,num_dim,num_dps,file,params._block_size,basis_buffer,num_vectors,product_buffer);
+        if(it == params._num_power_iterations){
+          break;
+        }
+        Eigen::Map<matrix_type> product(product_buffer.data(),num_dim,num_vectors);
+        basis = Eigen::HouseholderQR<matrix_type>(product).householderQ()*matrix_type::Identity(num_dim,num_vectors);
+        std::copy(basis.data(),basis.data()+basis.size(),basis_buffer.begin());
+      }
+
+      //Rayleigh-Ritz: eigendecomposition of basis^T C basis
+      Eigen::Map<matrix_type> product(product_buffer.data(),num_dim,num_vectors);
+      matrix_type projected_covariance = basis.transpose()*product;
+      projected_covariance = (projected_covariance + projected_covariance.transpose())*0.5;
+      Eigen::SelfAdjointEigenSolver<matrix_type> solver(projected_covariance);
+      checkAndThrowRuntime(solver.info() == Eigen::Success, "RandomizedPCA: eigendecomposition failed");
+      //eigenvalues are sorted in increasing order
+      const matrix_type ritz_vectors = basis*solver.eigenvectors();
+
+      _components.resize(size_t(_num_components)*num_dim);
+      _explained_variance.resize(_num_components);
+      for(unsigned int c = 0; c < _num_components; ++c){
+        const unsigned int col = num_vectors-1-c;
+        _explained_variance[c] = std::max(0.,solver.eigenvalues()[col]);
+        //the sign of every component is fixed by its largest loading
+        unsigned int max_id = 0;
+        ritz_vectors.col(col).cwiseAbs().maxCoeff(&max_id);
+        const double sign = (ritz_vectors(max_id,col) < 0)?-1:1;
+        for(unsigned int d = 0; d < num_dim; ++d){
+          _components[size_t(c)*num_dim+d] = sign*ritz_vectors(d,col);
+        }
+      }
+
+      if(_logger != nullptr){
+        double captured = 0;
+        for(auto r: explainedVarianceRatio()){
+          captured += r;
+        }
+        utils::secureLogValue(_logger,"\tExplained variance ratio",captured);
+      }
+    }
+
+    template <typename scalar>
+    void RandomizedPCA<scalar>::computeMoments(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, const utils::MemoryMappedFile* file, unsigned int block_size){
+      const int num_blocks = (num_dps + block_size - 1) / block_size;
+      std::vector<double> sum(num_dim,0);
+      double sum_squared_norms = 0;
+
+#ifndef __USE_GCD__
+      #pragma omp parallel
+#endif
+      {
+        std::vector<double> local_sum(num_dim,0);
+        double local_sum_squared_norms = 0;
+#ifndef __USE_GCD__
+        #pragma omp for schedule(dynamic,1)
+#endif
+        for(int b = 0; b < num_blocks; ++b){
+          const size_t begin = size_t(b)*block_size;
+          const size_t end = std::min<size_t>(begin+block_size,num_dps);
+          for(size_t i = begin; i < end; ++i){
+            const scalar_type* row = data + i*num_dim;
+            for(unsigned int d = 0; d < num_dim; ++d){
+              local_sum[d] += row[d];
+              local_sum_squared_norms += double(row[d])*row[d];
+            }
+          }
+          if(file != nullptr){
+            file->release(begin*num_dim*sizeof(scalar_type),(end-begin)*num_dim*sizeof(scalar_type));
+          }
+        }
+#ifndef __USE_GCD__
+        #pragma omp critical
+#endif
+        {
+          for(unsigned int d = 0; d < num_dim; ++d){
+            sum[d] += local_sum[d];
+          }
+          sum_squared_norms += local_sum_squared_norms;
+        }
+      }
+
+      _mean.resize(num_dim);
+      double mean_squared_norm = 0;
+      for(unsigned int d = 0; d < num_dim; ++d){
+        _mean[d] = sum[d]/num_dps;
+        mean_squared_norm += _mean[d]*_mean[d];
+      }
+      _total_variance = std::max(0.,(sum_squared_norms - num_dps*mean_squared_norm)/(num_dps-1));
+    }
+
+    template <typename scalar>
+    void RandomizedPCA<scalar>::multiplyByCovariance(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, const utils::MemoryMappedFile* file, unsigned int block_size, const std::vector<double>& basis_buffer, unsigned int num_vectors, std::vector<double>& product_buffer)const{
+      typedef Eigen::MatrixXd matrix_type;
+      typedef Eigen::Matrix<double,Eigen::Dynamic,Eigen::Dynamic,Eigen::RowMajor> row_major_matrix_type;
+      typedef Eigen::Map<const Eigen::Matrix<scalar_type,Eigen::Dynamic,Eigen::Dynamic,Eigen::RowMajor>> const_map_type;
+
+      const Eigen::Map<const matrix_type> basis(basis_buffer.data(),num_dim,num_vectors);
+      const Eigen::Map<const Eigen::RowVectorXd> mean(_mean.data(),num_dim);
+      const int num_blocks = (num_dps + block_size - 1) / block_size;
+      product_buffer.assign(size_t(num_dim)*num_vectors,0);
+      Eigen::Map<matrix_type> product(product_buffer.data(),num_dim,num_vectors);
+
+#ifndef __USE_GCD__
+      #pragma omp parallel
+#endif
+      {
+        matrix_type local_product = matrix_type::Zero(num_dim,num_vectors);
+        row_major_matrix_type centered;
+        matrix_type projected;
+#ifndef __USE_GCD__
+        #pragma omp for schedule(dynamic,1)
+#endif
+        for(int b = 0; b < num_blocks; ++b){
+          const size_t begin = size_t(b)*block_size;
+          const size_t end = std::min<size_t>(begin+block_size,num_dps);
+          centered = const_map_type(data+begin*num_dim,end-begin,num_dim).template cast<double>().rowwise() - mean;
+          if(file != nullptr){
+            file->release(begin*num_dim*sizeof(scalar_type),(end-begin)*num_dim*sizeof(scalar_type));
+          }
+          projected.noalias() = centered*basis;
+          local_product.noalias() += centered.transpose()*projected;
+        }
+#ifndef __USE_GCD__
+        #pragma omp critical
+#endif
+        {
+          product += local_product;
+        }
+      }
+      product /= (num_dps-1);
+    }
+
+    template <typename scalar>
+    void RandomizedPCA<scalar>::transformImpl(const scalar_type* data, unsigned int num_dim, unsigned int num_dps, const utils::MemoryMappedFile* file, std::vector<scalar_type>& projected)const{
+      typedef Eigen::Matrix<double,Eigen::Dynamic,Eigen::Dynamic,Eigen::RowMajor> row_major_matrix_type;
+      typedef Eigen::Map<const Eigen::Matrix<scalar_type,Eigen::Dynamic,Eigen::Dynamic,Eigen::RowMajor>> const_map_type;
+      typedef Eigen::Map<Eigen::Matrix<scalar_type,Eigen::Dynamic,Eigen::Dynamic,Eigen::RowMajor>> map_type;
+      checkAndThrowLogic(_num_components > 0, "RandomizedPCA: the decomposition has not been computed");
+      checkAndThrowLogic(num_dim == _num_dim, "RandomizedPCA: the number of dimensions does not agree with the decomposition");
+
+      const Eigen::Map<const row_major_matrix_type> components(_components.data(),_num_components,num_dim);
+      const Eigen::Map<const Eigen::RowVectorXd> mean(_mean.data(),num_dim);
+      const unsigned int block_size = 512;
+      const int num_blocks = (num_dps + block_size - 1) / block_size;
+      projected.resize(size_t(num_dps)*_num_components);
+
+#ifndef __USE_GCD__
+      #pragma omp parallel for schedule(dynamic,1)
+#endif
+      for(int b = 0; b < num_blocks; ++b){
+        const size_t begin = size_t(b)*block_size;
+        const size_t end = std::min<size_t>(begin+block_size,num_dps);
+        const row_major_matrix_type centered = const_map_type(data+begin*num_dim,end-begin,num_dim).template cast<double>().rowwise() - mean;
+        if(file != nullptr){
+          file->release(begin*num_dim*sizeof(scalar_type),(end-begin)*num_dim*sizeof(scalar_type));
+        }
+        map_type(projected.data()+begin*_num_components,end-begin,_num_components) = (centered*components.transpose()).template cast<scalar_type>();
+      }
+    }
+
+  }
+}
+#endif
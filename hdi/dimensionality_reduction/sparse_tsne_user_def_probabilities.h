@@ -42,6 +42,9 @@
 #include "hdi/data/embedding.h"
 #include "hdi/data/map_mem_eff.h"
 #include "tsne_parameters.h"
+#include "sptree.h"
+#include "fft_repulsion.h"
+#include "exact_repulsion.h"
 
 
 namespace hdi{
@@ -65,6 +68,9 @@ namespace hdi{
       void initialize(const sparse_scalar_matrix_type& probabilities, data::Embedding<scalar_type>* embedding, TsneParameters params = TsneParameters());
       //! Initialize the class with a joint-probability distribution. Note that it must be provided non initialized and with the weight of each row equal to 2.
       void initializeWithJointProbabilityDistribution(const sparse_scalar_matrix_type& distribution, data::Embedding<scalar_type>* embedding, TsneParameters params = TsneParameters());
+      //! Insert new data points in an initialized embedding. distribution is the joint-probability distribution extended with the rows of the new points and updated_rows lists the existing rows that changed (see IncrementalJointProbabilityGenerator)
+      //! New points are placed at the weighted average of their embedded neighbors and refined by num_local_iterations of gradient descent in which the existing points are fixed
+      void addDataPoints(const sparse_scalar_matrix_type& distribution, const std::vector<unsigned int>& updated_rows, unsigned int num_local_iterations = 50);
       //! Reset the internal state of the class but it keeps the inserted data-points
       void reset();
       //! Reset the class and remove all the data points
@@ -76,10 +82,20 @@ namespace hdi{
 
       //! Get the number of data points
       unsigned int getNumberOfDataPoints(){  return _P.size();  }
-      //! Get P
+      //! Get P. If TsneParameters::_symmetric_storage is set only the upper triangle is returned. If the points are spatially reordered, P is in the order
+      //! of the curve until restoreOriginalOrder is called
       const sparse_scalar_matrix_type& getDistributionP()const{ return _P; }
-      //! Get Q
+      //! Get Q (not normalized). Q is not used by the gradient descent, it is empty unless computeDistributionQ is called
       const scalar_vector_type& getDistributionQ()const{ return _Q; }
+      //! Materialize Q for the current embedding, it requires n^2 memory
+      void computeDistributionQ();
+      //! Release the memory used by a previous call to computeDistributionQ
+      void releaseDistributionQ(){ scalar_vector_type().swap(_Q); }
+
+      //! Memory occupation of the engine in MB
+      double memoryOccupation()const;
+      //! Log the memory occupation of the engine, split by buffer
+      void logMemoryOccupation()const;
 
       //! Return the current log
       utils::AbstractLog* logger()const{return _logger;}
@@ -100,6 +116,27 @@ namespace hdi{
       void setTheta(double theta){_theta = theta;}
       //! Barnes Hut approximation theta
       double theta(){return _theta;}
+      //! Compute the repulsive forces with a dual-tree traversal, in which well-separated pairs of cells interact, instead of a traversal per point
+      void setDualTree(bool dual_tree){_dual_tree = dual_tree;}
+      //! Dual-tree traversal for the repulsive forces
+      bool dualTree()const{return _dual_tree;}
+      //! Store the nodes of the Barnes-Hut tree in single precision. The traversals are faster and the totals of every point are compensated
+      void setSinglePrecisionTree(bool single_precision_tree){_single_precision_tree = single_precision_tree;}
+      //! Nodes of the Barnes-Hut tree stored in single precision
+      bool singlePrecisionTree()const{return _single_precision_tree;}
+      //! Compute the repulsive forces by interpolation on a grid and FFT convolution instead of the Barnes-Hut approximation. Only 1D and 2D embeddings are supported
+      void setFFTInterpolation(bool fft_interpolation){_fft_interpolation = fft_interpolation;}
+      //! Repulsive forces computed by FFT interpolation
+      bool fftInterpolation()const{return _fft_interpolation;}
+      //! Engine used for the FFT interpolation, e.g., to change the size of the grid
+      FFTRepulsion<scalar_type>& fftRepulsion(){return _fft_repulsion;}
+      //! Every period iterations the points are sorted along a space-filling curve of their embedding position, 0 disables the reordering
+      //! The gradient descent works on the sorted points, the embedding is always returned in the original order
+      void setSpatialReorderingPeriod(unsigned int period){_spatial_reordering_period = period;}
+      //! Iterations between two spatial reorderings of the points, 0 if disabled
+      unsigned int spatialReorderingPeriod()const{return _spatial_reordering_period;}
+      //! Store P and the state of the gradient descent in the original order of the points. The next reordering sorts them again
+      void restoreOriginalOrder();
 
       //! Exageration baseline
       double& exaggeration_baseline(){return _exaggeration_baseline;}
@@ -114,16 +151,35 @@ namespace hdi{
       void doAnIterationExact(double mult = 1);
       //! Do an iteration of the gradient descent
       void doAnIterationBarnesHut(double mult = 1);
-      //! Compute Low-dimensional distribution
-      void computeLowDimensionalDistribution();
-      //! Compute tSNE gradient with the exact algorithm
+      //! Do an iteration of the gradient descent
+      void doAnIterationFFTInterpolation(double mult = 1);
+      //! Compute tSNE gradient with the exact algorithm. Q is recomputed tile by tile, together with its normalization, and it is not stored
       void computeExactGradient(double exaggeration);
+      //! Memory occupation of P in MB
+      double memoryOccupationP()const;
       //! Compute tSNE gradient with the BarnesHut algorithm
       void computeBarnesHutGradient(double exaggeration);
+      //! Barnes-Hut gradient computed with the given tree
+      template <typename tree_type>
+      void computeBarnesHutGradient(tree_type& sptree, double exaggeration);
+      //! Barnes-Hut gradient with the kernels specialized on the embedding dimensionality D, D = 0 is the generic kernel
+      template <unsigned int D, typename tree_type>
+      void computeBarnesHutGradient(tree_type& sptree, double exaggeration);
+      //! Compute tSNE gradient with the repulsive forces computed by FFT interpolation
+      void computeFFTInterpolationGradient(double exaggeration);
+      template <unsigned int D>
+      void computeFFTInterpolationGradient(double exaggeration);
       //! Update the embedding
       void updateTheEmbedding(double mult = 1.);
       //! Compute the exaggeration factor based on the current iteration
       scalar_type exaggerationFactor();
+      //! Sort the points along a space-filling curve of the current embedding
+      void updateSpatialOrder();
+      //! Move P and the state of the gradient descent of every point i to new_index[i]
+      void relabelPoints(const std::vector<unsigned int>& new_index);
+      //! Local gradient descent on the points added after old_num_dps, the existing points are fixed
+      template <typename tree_type>
+      void optimizeNewPoints(tree_type& sptree, const sparse_scalar_matrix_type& distribution, unsigned int old_num_dps, unsigned int num_local_iterations);
 
     
 
@@ -135,7 +191,7 @@ namespace hdi{
       double _exaggeration_baseline;
 
       sparse_scalar_matrix_type _P; //! Conditional probalility distribution in the High-dimensional space
-      scalar_vector_type _Q; //! Conditional probalility distribution in the Low-dimensional space
+      scalar_vector_type _Q; //! Conditional probalility distribution in the Low-dimensional space. Empty unless requested with computeDistributionQ
       scalar_type _normalization_Q; //! Normalization factor of Q - Z in the original paper
 
       // Gradient descent
@@ -143,6 +199,19 @@ namespace hdi{
       scalar_vector_type _previous_gradient; //! Previous gradient
       scalar_vector_type _gain; //! Gain
       scalar_type _theta; //! value of theta used in the Barnes-Hut approximation. If a value of 1 is provided the exact tSNE computation is used.
+      bool _dual_tree; //! repulsive forces computed with a dual-tree traversal
+      bool _single_precision_tree; //! nodes of the Barnes-Hut tree stored in single precision
+      bool _fft_interpolation; //! repulsive forces computed by FFT interpolation
+      ExactRepulsion<scalar_type> _exact_repulsion; //! Exact repulsive forces, its storage is reused across iterations
+      FFTRepulsion<scalar_type> _fft_repulsion; //! FFT interpolation engine, its storage is reused across iterations
+      SPTree<scalar_type> _sptree; //! Barnes-Hut tree, its storage is reused across iterations
+      SPTree<scalar_type,float> _sptree_single; //! Barnes-Hut tree with single-precision nodes
+
+      // Spatial reordering. P and the gradient descent state are stored in the order of the curve, the embedding only during an iteration
+      unsigned int _spatial_reordering_period;
+      std::vector<unsigned int> _order;   //! original index of the k-th point on the curve, empty if the points are in the original order
+      std::vector<unsigned int> _rank;    //! position on the curve of every point
+      scalar_vector_type _permutation_buffer;
 
       TsneParameters _params;
       unsigned int _iteration;
@@ -36,10 +36,14 @@
 
 #include "hdi/dimensionality_reduction/sparse_tsne_user_def_probabilities.h"
 #include "hdi/utils/math_utils.h"
+#include "hdi/dimensionality_reduction/gradient_descent_utils.h"
 #include "hdi/utils/log_helper_functions.h"
 #include "hdi/utils/scoped_timers.h"
+#include "hdi/data/map_helpers.h"
 #include "sptree.h"
 #include <random>
+#include <numeric>
+#include <cmath>
 
 #ifdef __USE_GCD__
 #include <dispatch/dispatch.h>
@@ -69,9 +73,13 @@ namespace hdi{
     template <typename scalar, typename sparse_scalar_matrix>
     SparseTSNEUserDefProbabilities<scalar, sparse_scalar_matrix>::SparseTSNEUserDefProbabilities():
       _initialized(false),
-      _logger(nullptr),
+      _exaggeration_baseline(1),
       _theta(0),
-      _exaggeration_baseline(1)
+      _dual_tree(false),
+      _single_precision_tree(false),
+      _fft_interpolation(false),
+      _spatial_reordering_period(0),
+      _logger(nullptr)
     {
 
     }
@@ -104,17 +112,19 @@ namespace hdi{
 
     template <typename scalar, typename sparse_scalar_matrix>
     void SparseTSNEUserDefProbabilities<scalar, sparse_scalar_matrix>::initialize(const sparse_scalar_matrix& probabilities, data::Embedding<scalar_type>* embedding, TsneParameters params){
+      typedef typename sparse_scalar_matrix::value_type map_type;
+      typedef hdi::data::MapHelpers<typename map_type::key_type,typename map_type::mapped_type,map_type> map_helpers_type;
       utils::secureLog(_logger,"Initializing tSNE...");
       {//Aux data
         _params = params;
         unsigned int size = probabilities.size();
-        unsigned int size_sq = probabilities.size()*probabilities.size();
 
         _embedding = embedding;
         _embedding_container = &(embedding->getContainer());
         _embedding->resize(_params._embedding_dimensionality,size);
         _P.resize(size);
-        _Q.resize(size_sq);
+        _order.clear();
+        _rank.clear();
         _gradient.resize(size*params._embedding_dimensionality,0);
         _previous_gradient.resize(size*params._embedding_dimensionality,0);
         _gain.resize(size*params._embedding_dimensionality,1);
@@ -123,27 +133,33 @@ namespace hdi{
       utils::secureLogValue(_logger,"Number of data points",_P.size());
 
       computeHighDimensionalDistribution(probabilities);
+      if(_params._symmetric_storage){
+        map_helpers_type::keepUpperTriangle(_P);
+      }
       initializeEmbeddingPosition(params._seed, params._rngRange);
 
       _iteration = 0;
 
       _initialized = true;
+      utils::secureLogValue(_logger,"Memory occupation (MB)",memoryOccupation());
       utils::secureLog(_logger,"Initialization complete!");
     }
 
     template <typename scalar, typename sparse_scalar_matrix>
     void SparseTSNEUserDefProbabilities<scalar, sparse_scalar_matrix>::initializeWithJointProbabilityDistribution(const sparse_scalar_matrix& distribution, data::Embedding<scalar_type>* embedding, TsneParameters params){
+      typedef typename sparse_scalar_matrix::value_type map_type;
+      typedef hdi::data::MapHelpers<typename map_type::key_type,typename map_type::mapped_type,map_type> map_helpers_type;
       utils::secureLog(_logger,"Initializing tSNE with a user-defined joint-probability distribution...");
       {//Aux data
         _params = params;
         unsigned int size = distribution.size();
-        unsigned int size_sq = distribution.size()*distribution.size();
 
         _embedding = embedding;
         _embedding_container = &(embedding->getContainer());
         _embedding->resize(_params._embedding_dimensionality,size);
         _P.resize(size);
-        _Q.resize(size_sq);
+        _order.clear();
+        _rank.clear();
         _gradient.resize(size*params._embedding_dimensionality,0);
         _previous_gradient.resize(size*params._embedding_dimensionality,0);
         _gain.resize(size*params._embedding_dimensionality,1);
@@ -152,11 +168,15 @@ namespace hdi{
       utils::secureLogValue(_logger,"Number of data points",_P.size());
 
       _P = distribution;
+      if(_params._symmetric_storage){
+        map_helpers_type::keepUpperTriangle(_P);
+      }
       initializeEmbeddingPosition(params._seed, params._rngRange);
 
       _iteration = 0;
 
       _initialized = true;
+      utils::secureLogValue(_logger,"Memory occupation (MB)",memoryOccupation());
       utils::secureLog(_logger,"Initialization complete!");
     }
 
@@ -164,20 +184,12 @@ namespace hdi{
     void SparseTSNEUserDefProbabilities<scalar, sparse_scalar_matrix>::computeHighDimensionalDistribution(const sparse_scalar_matrix& probabilities){
       utils::secureLog(_logger,"Computing high-dimensional joint probability distribution...");
 
-      const int n = getNumberOfDataPoints();
-      //Can be improved by using the simmetry of the matrix (half the memory) //TODO
-      for(int j = 0; j < n; ++j){
-        for(auto& elem: probabilities[j]){
-          scalar_type v0 = elem.second;
-          auto iter = probabilities[elem.first].find(j);
-          scalar_type v1 = 0.;
-          if(iter != probabilities[elem.first].end())
-            v1 = iter->second;
-
-          _P[j][elem.first] = static_cast<scalar_type>((v0+v1)*0.5);
-          _P[elem.first][j] = static_cast<scalar_type>((v0+v1)*0.5);
-        }
-      }
+      typedef typename sparse_scalar_matrix::value_type map_type;
+      typedef typename map_type::key_type key_type;
+      typedef typename map_type::mapped_type mapped_type;
+      typedef hdi::data::MapHelpers<key_type,mapped_type,map_type> map_helpers_type;
+
+      map_helpers_type::symmetrize(probabilities,_P);
     }
 
 
@@ -205,7 +217,9 @@ namespace hdi{
         x *= radius * multiplier;
         y *= radius * multiplier;
         _embedding->dataAt(i, 0) = x;
-        _embedding->dataAt(i, 1) = y;
+        if(_embedding->numDimensions() > 1){
+          _embedding->dataAt(i, 1) = y;
+        }
       }
     }
 
@@ -222,11 +236,71 @@ namespace hdi{
         utils::secureLog(_logger,"Remove exaggeration...");
       }
 
-      if(_theta == 0){
+      if(_spatial_reordering_period > 0 && (_iteration % _spatial_reordering_period) == 0){
+        updateSpatialOrder();
+      }
+      //The embedding is moved in the order of the curve only for the duration of the iteration
+      const bool reordered = !_order.empty();
+      if(reordered){
+        permutePoints(_embedding_container->data(), getNumberOfDataPoints(), _params._embedding_dimensionality, _rank, _permutation_buffer);
+      }
+
+      if(_fft_interpolation){
+        doAnIterationFFTInterpolation(mult);
+      }else if(_theta == 0){
         doAnIterationExact(mult);
       }else{
         doAnIterationBarnesHut(mult);
       }
+
+      if(reordered){
+        permutePoints(_embedding_container->data(), getNumberOfDataPoints(), _params._embedding_dimensionality, _order, _permutation_buffer);
+      }
+    }
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    void SparseTSNEUserDefProbabilities<scalar, sparse_scalar_matrix>::updateSpatialOrder(){
+      const unsigned int n = getNumberOfDataPoints();
+      std::vector<unsigned int> order;
+      spaceFillingCurveOrder(_embedding_container->data(), n, _params._embedding_dimensionality, order);
+
+      //From the current order of the points to the new one
+      std::vector<unsigned int> rank(n);
+      for(unsigned int k = 0; k < n; ++k){
+        rank[order[k]] = k;
+      }
+      std::vector<unsigned int> new_index(n);
+      for(unsigned int k = 0; k < n; ++k){
+        new_index[k] = _order.empty() ? rank[k] : rank[_order[k]];
+      }
+      relabelPoints(new_index);
+      _order.swap(order);
+      _rank.swap(rank);
+    }
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    void SparseTSNEUserDefProbabilities<scalar, sparse_scalar_matrix>::restoreOriginalOrder(){
+      if(_order.empty()){
+        return;
+      }
+      relabelPoints(_order);
+      _order.clear();
+      _rank.clear();
+    }
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    void SparseTSNEUserDefProbabilities<scalar, sparse_scalar_matrix>::relabelPoints(const std::vector<unsigned int>& new_index){
+      typedef typename sparse_scalar_matrix::value_type map_type;
+      typedef hdi::data::MapHelpers<typename map_type::key_type,typename map_type::mapped_type,map_type> map_helpers_type;
+      const unsigned int n = getNumberOfDataPoints();
+      const unsigned int dim = _params._embedding_dimensionality;
+
+      sparse_scalar_matrix_type permuted;
+      map_helpers_type::permute(_P, new_index, _params._symmetric_storage, permuted);
+      _P.swap(permuted);
+      permutePoints(_gain.data(), n, dim, new_index, _permutation_buffer);
+      permutePoints(_previous_gradient.data(), n, dim, new_index, _permutation_buffer);
+      permutePoints(_gradient.data(), n, dim, new_index, _permutation_buffer);
     }
 
     template <typename scalar, typename sparse_scalar_matrix>
@@ -247,10 +321,7 @@ namespace hdi{
 
     template <typename scalar, typename sparse_scalar_matrix>
     void SparseTSNEUserDefProbabilities<scalar, sparse_scalar_matrix>::doAnIterationExact(double mult){
-      //Compute Low-dimensional distribution
-      computeLowDimensionalDistribution();
-
-      //Compute gradient of the KL function
+      //Compute gradient of the KL function, the normalization of Q is computed together with the repulsive forces
       computeExactGradient(exaggerationFactor());
 
       //Update the embedding based on the gradient
@@ -264,87 +335,160 @@ namespace hdi{
       //Update the embedding based on the gradient
       updateTheEmbedding();
     }
+    template <typename scalar, typename sparse_scalar_matrix>
+    void SparseTSNEUserDefProbabilities<scalar, sparse_scalar_matrix>::doAnIterationFFTInterpolation(double mult){
+      //Compute gradient of the KL function using the FFT interpolation
+      computeFFTInterpolationGradient(exaggerationFactor());
+
+      //Update the embedding based on the gradient
+      updateTheEmbedding();
+    }
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    void SparseTSNEUserDefProbabilities<scalar, sparse_scalar_matrix>::computeExactGradient(double exaggeration){
+      typedef double hp_scalar_type;
+      const int n = getNumberOfDataPoints();
+      const int dim = _params._embedding_dimensionality;
+      const scalar_type* positions = _embedding_container->data();
+
+      //Repulsive forces and normalization in a single pass on the pairs of points
+      std::vector<hp_scalar_type> negative_forces(size_t(n)*dim,0);
+      hp_scalar_type sum_Q = 0;
+      _exact_repulsion.computeNonEdgeForces(dim, positions, n, negative_forces.data(), sum_Q);
+      _normalization_Q = static_cast<scalar_type>(sum_Q);
+
+      //Attractive forces 4*exaggeration*p_ij*q_ij*(y_i-y_j) with the edge-balanced kernels of the tree, which is not built
+      std::vector<hp_scalar_type> positive_forces(size_t(n)*dim,0);
+      _sptree.setData(dim, _embedding_container->data());
+      if(_params._symmetric_storage){
+        _sptree.computeSymmetricEdgeForces(_P, 4*exaggeration, positive_forces.data());
+      }else{
+        _sptree.computeEdgeForces(_P, 4*exaggeration, positive_forces.data());
+      }
+
+      for(size_t c = 0; c < negative_forces.size(); ++c){
+        _gradient[c] = static_cast<scalar_type>(positive_forces[c] - 4*negative_forces[c]/sum_Q);
+      }
+    }
 
     template <typename scalar, typename sparse_scalar_matrix>
-    void SparseTSNEUserDefProbabilities<scalar, sparse_scalar_matrix>::computeLowDimensionalDistribution(){
+    void SparseTSNEUserDefProbabilities<scalar, sparse_scalar_matrix>::computeDistributionQ(){
+      if(!_initialized){
+        throw std::logic_error("Algorithm must be initialized before computing Q");
+      }
       const int n = getNumberOfDataPoints();
+      const int dim = _params._embedding_dimensionality;
+      const scalar_type* positions = _embedding_container->data();
+      _Q.resize(size_t(n)*n);
 #ifdef __USE_GCD__
-      //std::cout << "GCD dispatch, sparse_tsne_user_def_probabilities 285.\n";
       dispatch_apply(n, dispatch_get_global_queue(0, 0), ^(size_t j) {
 #else
       #pragma omp parallel for
       for(int j = 0; j < n; ++j){
 #endif //__USE_GCD__
-        _Q[j*n + j] = 0;
+        _Q[size_t(j)*n + j] = 0;
         for(int i = j+1; i < n; ++i){
           const double euclidean_dist_sq(
               utils::euclideanDistanceSquared<scalar_type>(
-                (*_embedding_container).begin()+j*_params._embedding_dimensionality,
-                (*_embedding_container).begin()+(j+1)*_params._embedding_dimensionality,
-                (*_embedding_container).begin()+i*_params._embedding_dimensionality,
-                (*_embedding_container).begin()+(i+1)*_params._embedding_dimensionality
+                positions+j*dim, positions+(j+1)*dim,
+                positions+i*dim, positions+(i+1)*dim
               )
             );
           const double v = 1./(1.+euclidean_dist_sq);
-          _Q[j*n + i] = static_cast<scalar_type>(v);
-          _Q[i*n + j] = static_cast<scalar_type>(v);
+          _Q[size_t(j)*n + i] = static_cast<scalar_type>(v);
+          _Q[size_t(i)*n + j] = static_cast<scalar_type>(v);
         }
       }
 #ifdef __USE_GCD__
       );
 #endif // __USE_GCD__
-      double sum_Q = 0;
-      for(auto& v : _Q){
-        sum_Q += v;
+    }
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    double SparseTSNEUserDefProbabilities<scalar, sparse_scalar_matrix>::memoryOccupationP()const{
+      typedef typename sparse_scalar_matrix::value_type map_type;
+      double mem = double(_P.size())*sizeof(map_type);
+      for(size_t i = 0; i < _P.size(); ++i){
+        mem += double(_P[i].size())*(sizeof(typename map_type::key_type)+sizeof(typename map_type::mapped_type));
       }
-      _normalization_Q = static_cast<scalar_type>(sum_Q);
+      return mem / 1024 / 1024;
     }
 
     template <typename scalar, typename sparse_scalar_matrix>
-    void SparseTSNEUserDefProbabilities<scalar, sparse_scalar_matrix>::computeExactGradient(double exaggeration){
-      const int n = getNumberOfDataPoints();
-      const int dim = _params._embedding_dimensionality;
+    double SparseTSNEUserDefProbabilities<scalar, sparse_scalar_matrix>::memoryOccupation()const{
+      if(!_initialized){
+        return 0;
+      }
+      double mem = double(_embedding_container->capacity() + _Q.capacity() + _gradient.capacity() + _previous_gradient.capacity() + _gain.capacity() + _permutation_buffer.capacity())*sizeof(scalar_type);
+      mem += double(_order.capacity() + _rank.capacity())*sizeof(unsigned int);
+      return memoryOccupationP() + mem / 1024 / 1024 + _exact_repulsion.memoryOccupation() + _fft_repulsion.memoryOccupation();
+    }
 
-      for(int i = 0; i < n; ++i){
-        for(int d = 0; d < dim; ++d){
-          _gradient[i * dim + d] = 0;
-        }
+    template <typename scalar, typename sparse_scalar_matrix>
+    void SparseTSNEUserDefProbabilities<scalar, sparse_scalar_matrix>::logMemoryOccupation()const{
+      if(!_initialized){
+        return;
       }
+      const double to_mb = double(sizeof(scalar_type))/1024/1024;
+      utils::secureLog(_logger,"\n-------- Sparse tSNE memory occupation (MB) ------------------");
+      utils::secureLogValue(_logger,"Total",memoryOccupation());
+      utils::secureLogValue(_logger,"\tP",memoryOccupationP());
+      utils::secureLogValue(_logger,"\tEmbedding",_embedding_container->capacity()*to_mb);
+      utils::secureLogValue(_logger,"\tGradient descent",(_gradient.capacity() + _previous_gradient.capacity() + _gain.capacity())*to_mb);
+      utils::secureLogValue(_logger,"\tQ",_Q.capacity()*to_mb);
+      utils::secureLogValue(_logger,"\tExact repulsion",_exact_repulsion.memoryOccupation());
+      utils::secureLogValue(_logger,"\tFFT interpolation",_fft_repulsion.memoryOccupation());
+      utils::secureLogValue(_logger,"\tSpatial order",(double(_order.capacity() + _rank.capacity())*sizeof(unsigned int) + _permutation_buffer.capacity()*sizeof(scalar_type))/1024/1024);
+      utils::secureLog(_logger,"--------------------------------------------------------------\n");
+    }
 
-      for(int i = 0; i < n; ++i){
-        for(int j = 0; j < n; ++j){
-          for(int d = 0; d < dim; ++d){
-            const int idx = i*n + j;
-            const double distance((*_embedding_container)[i * dim + d] - (*_embedding_container)[j * dim + d]);
-            const double negative(_Q[idx] * _Q[idx] / _normalization_Q * distance);
-            _gradient[i * dim + d] += static_cast<scalar_type>(-4*negative);
-          }
-        }
-        for(auto& elem: _P[i]){
-          for(int d = 0; d < dim; ++d){
-            const int j = elem.first;
-            const int idx = i*n + j;
-            const double distance((*_embedding_container)[i * dim + d] - (*_embedding_container)[j * dim + d]);
-            double p_ij = elem.second/n;
+    template <typename scalar, typename sparse_scalar_matrix>
+    void SparseTSNEUserDefProbabilities<scalar, sparse_scalar_matrix>::computeBarnesHutGradient(double exaggeration){
+      if(_single_precision_tree){
+        computeBarnesHutGradient(_sptree_single, exaggeration);
+      }else{
+        computeBarnesHutGradient(_sptree, exaggeration);
+      }
+    }
 
-            const double positive(p_ij * _Q[idx] * distance);
-            _gradient[i * dim + d] += static_cast<scalar_type>(4*exaggeration*positive);
-          }
-        }
+    template <typename scalar, typename sparse_scalar_matrix>
+    template <typename tree_type>
+    void SparseTSNEUserDefProbabilities<scalar, sparse_scalar_matrix>::computeBarnesHutGradient(tree_type& sptree, double exaggeration){
+      // The kernels are dispatched once on the dimensionality of the embedding
+      switch(_params._embedding_dimensionality){
+        case 1:  computeBarnesHutGradient<1>(sptree, exaggeration); break;
+        case 2:  computeBarnesHutGradient<2>(sptree, exaggeration); break;
+        case 3:  computeBarnesHutGradient<3>(sptree, exaggeration); break;
+        default: computeBarnesHutGradient<0>(sptree, exaggeration); break;
       }
     }
 
     template <typename scalar, typename sparse_scalar_matrix>
-    void SparseTSNEUserDefProbabilities<scalar, sparse_scalar_matrix>::computeBarnesHutGradient(double exaggeration){
+    template <unsigned int D, typename tree_type>
+    void SparseTSNEUserDefProbabilities<scalar, sparse_scalar_matrix>::computeBarnesHutGradient(tree_type& sptree, double exaggeration){
       typedef double hp_scalar_type;
+      const unsigned int dim = (D == 0) ? _params._embedding_dimensionality : D;
 
-      SPTree<scalar_type> sptree(_params._embedding_dimensionality,_embedding->getContainer().data(),getNumberOfDataPoints());
+      sptree.build(_params._embedding_dimensionality,_embedding->getContainer().data(),getNumberOfDataPoints());
 
-      scalar_type sum_Q = .0;
       std::vector<hp_scalar_type> positive_forces(getNumberOfDataPoints()*_params._embedding_dimensionality);
       /*__block*/ std::vector<hp_scalar_type> negative_forces(getNumberOfDataPoints()*_params._embedding_dimensionality);
 
-      sptree.computeEdgeForces(_P, exaggeration, positive_forces.data());
+      // As in the original implementation, the attractive forces are scaled by the square of the exaggeration
+      if(_params._symmetric_storage){
+        sptree.template computeSymmetricEdgeForces<D>(_P, exaggeration * exaggeration, positive_forces.data());
+      }else{
+        sptree.template computeEdgeForces<D>(_P, exaggeration * exaggeration, positive_forces.data());
+      }
+
+      if(_dual_tree){
+        hp_scalar_type sum_Q_dual_tree = 0;
+        sptree.template computeDualTreeNonEdgeForces<D>(_theta, negative_forces.data(), sum_Q_dual_tree);
+        for(size_t i = 0; i < _gradient.size(); ++i){
+          _gradient[i] = positive_forces[i] - (negative_forces[i] / sum_Q_dual_tree);
+        }
+        return;
+      }
 
       /*__block*/ std::vector<hp_scalar_type> sum_Q_subvalues(getNumberOfDataPoints(),0);
 //#ifdef __USE_GCD__
@@ -354,15 +498,19 @@ namespace hdi{
       #pragma omp parallel for
       for(int n = 0; n < getNumberOfDataPoints(); n++){
 //#endif //__USE_GCD__
-        sptree.computeNonEdgeForcesOMP(n, _theta, negative_forces.data() + n * _params._embedding_dimensionality, sum_Q_subvalues[n]);
+        sptree.template computeNonEdgeForcesOMP<D>(n, _theta, negative_forces.data() + n * dim, sum_Q_subvalues[n]);
       }
 //#ifdef __USE_GCD__
 //      );
 //#endif
 
-      sum_Q = 0;
+      // Z is a sum of n terms, it is accumulated in double precision with Kahan summation
+      hp_scalar_type sum_Q = 0, c_Q = 0;
       for(int n = 0; n < getNumberOfDataPoints(); n++){
-        sum_Q += sum_Q_subvalues[n];
+        const hp_scalar_type y = sum_Q_subvalues[n] - c_Q;
+        const hp_scalar_type t = sum_Q + y;
+        c_Q = (t - sum_Q) - y;
+        sum_Q = t;
       }
 
       for(int i = 0; i < _gradient.size(); i++){
@@ -371,31 +519,201 @@ namespace hdi{
 
     }
 
+    template <typename scalar, typename sparse_scalar_matrix>
+    void SparseTSNEUserDefProbabilities<scalar, sparse_scalar_matrix>::computeFFTInterpolationGradient(double exaggeration){
+      switch(_params._embedding_dimensionality){
+        case 1:  computeFFTInterpolationGradient<1>(exaggeration); break;
+        case 2:  computeFFTInterpolationGradient<2>(exaggeration); break;
+        default: throw std::logic_error("FFT interpolation supports only 1D and 2D embeddings");
+      }
+    }
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    template <unsigned int D>
+    void SparseTSNEUserDefProbabilities<scalar, sparse_scalar_matrix>::computeFFTInterpolationGradient(double exaggeration){
+      typedef double hp_scalar_type;
+      const unsigned int n = getNumberOfDataPoints();
+      scalar_type* positions = _embedding->getContainer().data();
+
+      // The attractive forces use the edge kernels of the tree, which is not built
+      _sptree.setData(D, positions);
+      std::vector<hp_scalar_type> positive_forces(size_t(n) * D);
+      std::vector<hp_scalar_type> negative_forces(size_t(n) * D);
+      // Same scaling of the attractive forces as the Barnes-Hut gradient
+      if(_params._symmetric_storage){
+        _sptree.template computeSymmetricEdgeForces<D>(_P, exaggeration * exaggeration, positive_forces.data());
+      }else{
+        _sptree.template computeEdgeForces<D>(_P, exaggeration * exaggeration, positive_forces.data());
+      }
+
+      hp_scalar_type sum_Q = 0;
+      _fft_repulsion.computeNonEdgeForces(D, positions, n, negative_forces.data(), sum_Q);
+
+      for(size_t i = 0; i < _gradient.size(); ++i){
+        _gradient[i] = positive_forces[i] - (negative_forces[i] / sum_Q);
+      }
+    }
+
     //temp
     template <typename T>
     T sign(T x) { return (x == .0 ? .0 : (x < .0 ? -1.0 : 1.0)); }
 
     template <typename scalar, typename sparse_scalar_matrix>
     void SparseTSNEUserDefProbabilities<scalar, sparse_scalar_matrix>::updateTheEmbedding(double mult){
-      for(int i = 0; i < _gradient.size(); ++i){
-        _gain[i] = static_cast<scalar_type>((sign(_gradient[i]) != sign(_previous_gradient[i])) ? (_gain[i] + .2) : (_gain[i] * .8));
-        if(_gain[i] < _params._minimum_gain){
-          _gain[i] = static_cast<scalar_type>(_params._minimum_gain);
+      const unsigned int dim = _params._embedding_dimensionality;
+      const double momentum = (_iteration<_params._mom_switching_iter)?_params._momentum:_params._final_momentum;
+      //The bounding box of the embedding is computed during the update
+      std::vector<scalar_type> limits(dim*2);
+      gradientDescentStep(_gradient.data(), _previous_gradient.data(), _gain.data(), _embedding_container->data(), static_cast<unsigned int>(_gradient.size()/dim), dim,
+                          _params._eta, _params._minimum_gain, momentum, mult, limits.data());
+
+      //Same as Embedding::scaleIfSmallerThan and Embedding::zeroCentered, without computing the bounding box again
+      //MAGIC NUMBER
+      const scalar_type diameter = static_cast<scalar_type>(0.1);
+      const bool scale = exaggerationFactor() > 1.2;
+      if(!scale || (limits[1]-limits[0]) < diameter){
+        std::vector<scalar_type> shifts(dim);
+        for(unsigned int d = 0; d < dim; ++d){
+          shifts[d] = static_cast<scalar_type>(-0.5*(limits[d*2+1]+limits[d*2]));
+        }
+        const double scale_factor = scale?(diameter/(limits[1]-limits[0])):1.;
+        translateAndScale(_embedding_container->data(), _embedding->numDataPoints(), dim, shifts.data(), scale_factor);
+      }
+
+      ++_iteration;
+    }
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    void SparseTSNEUserDefProbabilities<scalar, sparse_scalar_matrix>::addDataPoints(const sparse_scalar_matrix& distribution, const std::vector<unsigned int>& updated_rows, unsigned int num_local_iterations){
+      typedef typename sparse_scalar_matrix::value_type map_type;
+      typedef typename map_type::key_type key_type;
+      typedef typename map_type::mapped_type mapped_type;
+      typedef hdi::data::MapHelpers<key_type,mapped_type,map_type> map_helpers_type;
+      if(!_initialized){
+        throw std::logic_error("Algorithm must be initialized before adding data points");
+      }
+      //The rows of distribution are in the original order
+      restoreOriginalOrder();
+      const unsigned int old_num_dps = getNumberOfDataPoints();
+      const unsigned int num_dps = distribution.size();
+      checkAndThrowLogic(num_dps >= old_num_dps, "SparseTSNEUserDefProbabilities: the distribution must contain the existing data points");
+      const unsigned int num_new_dps = num_dps - old_num_dps;
+      const int dim = _params._embedding_dimensionality;
+      utils::secureLogValue(_logger,"Adding data points",num_new_dps);
+
+      //Only the rows that changed are copied
+      std::vector<unsigned int> rows(updated_rows);
+      for(auto r: updated_rows){
+        checkAndThrowLogic(r < old_num_dps, "SparseTSNEUserDefProbabilities: invalid updated row");
+      }
+      for(unsigned int i = old_num_dps; i < num_dps; ++i){
+        rows.push_back(i);
+      }
+      _P.resize(num_dps);
+      map_helpers_type::replaceRows(_P,distribution,rows);
+      if(_params._symmetric_storage){
+        map_helpers_type::keepUpperTriangle(_P);
+      }
+      if(num_new_dps == 0){
+        return;
+      }
+
+      //New points are placed at the weighted average of their embedded neighbors.
+      //If all the neighbors are new, the neighbors of the neighbors are used.
+      //The complete rows are read from distribution since _P may only store its upper triangle
+      std::vector<std::unordered_map<unsigned int,scalar_type>> weights(num_new_dps);
+      for(unsigned int i = 0; i < num_new_dps; ++i){
+        for(auto& e: distribution[old_num_dps+i]){
+          if(e.first < old_num_dps){
+            weights[i][e.first] += e.second;
+          }
+        }
+        if(weights[i].size() == 0){
+          for(auto& e: distribution[old_num_dps+i]){
+            for(auto& e2: distribution[e.first]){
+              if(e2.first < old_num_dps){
+                weights[i][e2.first] += e.second*e2.second;
+              }
+            }
+          }
         }
-        _gradient[i] = static_cast<scalar_type>((_gradient[i]>0?1:-1)*std::abs(_gradient[i]*_params._eta* _gain[i])/(_params._eta*_gain[i]));
+      }
+      data::Embedding<scalar_type> interpolated;
+      data::interpolateEmbeddingPositions(*_embedding,interpolated,weights);
 
-        _previous_gradient[i] = static_cast<scalar_type>(((_iteration<_params._mom_switching_iter)?_params._momentum:_params._final_momentum) * _previous_gradient[i] - _params._eta * _gain[i] * _gradient[i]);
-        (*_embedding_container)[i] += static_cast<scalar_type>(_previous_gradient[i] * mult);
+      _embedding->resize(dim,num_dps);
+      for(unsigned int i = 0; i < num_new_dps; ++i){
+        for(int d = 0; d < dim; ++d){
+          _embedding->dataAt(old_num_dps+i,d) = (weights[i].size() == 0)?0:interpolated.dataAt(i,d);
+        }
       }
+      _gradient.resize(num_dps*dim,0);
+      _previous_gradient.resize(num_dps*dim,0);
+      _gain.resize(num_dps*dim,1);
+      releaseDistributionQ();
 
-      //MAGIC NUMBER
-      if(exaggerationFactor() > 1.2){
-        _embedding->scaleIfSmallerThan(0.1);
+      if(num_local_iterations == 0){
+        return;
+      }
+      if(_single_precision_tree){
+        optimizeNewPoints(_sptree_single, distribution, old_num_dps, num_local_iterations);
       }else{
-        _embedding->zeroCentered();
+        optimizeNewPoints(_sptree, distribution, old_num_dps, num_local_iterations);
       }
+    }
 
-      ++_iteration;
+    template <typename scalar, typename sparse_scalar_matrix>
+    template <typename tree_type>
+    void SparseTSNEUserDefProbabilities<scalar, sparse_scalar_matrix>::optimizeNewPoints(tree_type& sptree, const sparse_scalar_matrix& distribution, unsigned int old_num_dps, unsigned int num_local_iterations){
+      typedef double hp_scalar_type;
+      const unsigned int num_dps = distribution.size();
+      const unsigned int num_new_dps = num_dps - old_num_dps;
+      const int dim = _params._embedding_dimensionality;
+
+      //The existing points are fixed, hence the tree is built once and the normalization of Q is estimated
+      //on a sample of the existing points. Repulsion between new points is ignored
+      const hp_scalar_type theta = (_theta > 0)?_theta:0.5;
+      sptree.build(dim,_embedding_container->data(),old_num_dps);
+
+      const int num_samples = std::min<unsigned int>(old_num_dps,256);
+      std::vector<hp_scalar_type> sum_Q_samples(num_samples,0);
+      #pragma omp parallel for
+      for(int s = 0; s < num_samples; ++s){
+        std::vector<hp_scalar_type> negative_force(dim,0);
+        sptree.computeNonEdgeForcesOMP(static_cast<unsigned int>(size_t(s)*old_num_dps/num_samples), theta, negative_force.data(), sum_Q_samples[s]);
+      }
+      const hp_scalar_type sum_Q = std::accumulate(sum_Q_samples.begin(),sum_Q_samples.end(),hp_scalar_type(0))/num_samples*num_dps;
+
+      //Same scaling of the attractive forces as the Barnes-Hut gradient
+      const hp_scalar_type exaggeration = exaggerationFactor();
+      const hp_scalar_type scale = exaggeration * exaggeration;
+      std::vector<hp_scalar_type> gradient(size_t(num_new_dps)*dim,0);
+      std::vector<hp_scalar_type> update(size_t(num_new_dps)*dim,0);
+      std::vector<hp_scalar_type> gain(size_t(num_new_dps)*dim,1);
+      scalar_type* positions = _embedding_container->data();
+      for(unsigned int it = 0; it < num_local_iterations; ++it){
+        #pragma omp parallel for
+        for(int i = 0; i < int(num_new_dps); ++i){
+          std::vector<hp_scalar_type> positive_force(dim,0);
+          std::vector<hp_scalar_type> negative_force(dim,0);
+          hp_scalar_type sum_Q_i = 0;
+          sptree.computeNonEdgeForcesOMP(old_num_dps+i, theta, negative_force.data(), sum_Q_i);
+          //The complete rows are read from distribution since _P may only store its upper triangle
+          sptree.computeEdgeForces(old_num_dps+i, distribution[old_num_dps+i], scale, num_dps, positive_force.data());
+          for(int d = 0; d < dim; ++d){
+            gradient[size_t(i)*dim+d] = positive_force[d] - negative_force[d]/sum_Q;
+          }
+        }
+
+        for(size_t c = 0; c < gradient.size(); ++c){
+          gain[c] = (sign(gradient[c]) != sign(update[c])) ? (gain[c] + .2) : (gain[c] * .8);
+          if(gain[c] < _params._minimum_gain){
+            gain[c] = _params._minimum_gain;
+          }
+          update[c] = _params._final_momentum * update[c] - _params._eta * gain[c] * gradient[c];
+          positions[size_t(old_num_dps)*dim+c] += static_cast<scalar_type>(update[c]);
+        }
+      }
     }
 
     template <typename scalar, typename sparse_scalar_matrix>
@@ -69,5 +69,7 @@ namespace hdi{
   namespace dr{
     template class SPTree<double>;
     template class SPTree<float>;
+    template class SPTree<double,float>;
+    template class SPTree<float,float>;
   }
 }
@@ -69,6 +69,12 @@
 #include <vector>
 #include <unordered_map>
 #include <map>
+#include <thread>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <type_traits>
+#include "hdi/data/sparse_matrix_csr.h"
 
 #ifdef __USE_GCD__
 #include <dispatch/dispatch.h>
@@ -81,132 +87,727 @@ namespace hdi{
     /*!
       Sparse Partitioning Tree used for the Barnes Hut approximation.
       The original version was implemented by Laurens van der Maaten,
+      The tree is linearized: nodes are stored breadth-first in contiguous arrays and the storage is reused when the tree is rebuilt.
+      2D and 3D trees are built in parallel from the Morton codes of the points.
+      If weights are provided, the mass of a node is the sum of the weights of its points (see WeightedSPTree).
+      The nodes read by the traversals (mass, size and center of mass) are stored with node_scalar_type. With single-precision nodes the
+      interactions are computed in single precision and only the totals of a point, forces and normalization, are compensated (Kahan summation).
+      The forces are always returned in hp_scalar_type.
       \author Laurens van der Maaten
       \author Nicola Pezzotti
     */
-    template <typename scalar_type>
+    template <typename scalar_type, typename node_scalar_type = double>
     class SPTree{
     public:
 
       typedef double hp_scalar_type;
 
+    public:
+      //! Empty tree, it must be built before computing the forces
+      SPTree();
+      //! Build the tree on N points with D dimensions
+      SPTree(unsigned int D, scalar_type* inp_data, unsigned int N, const scalar_type* weights = nullptr);
+      //! Build the tree on N points with D dimensions. The storage of a previous build is reused
+      void build(unsigned int D, scalar_type* inp_data, unsigned int N, const scalar_type* weights = nullptr);
+      void setData(scalar_type* inp_data);
+      //! Update the positions and the weights of the points. As for the positions, the nodes are updated only by the next build
+      void setData(scalar_type* inp_data, const scalar_type* weights){_emb_positions = inp_data; _weights = weights;}
+      //! Set the positions used by the edge forces without building the tree. The tree must be built before computing the non-edge forces
+      void setData(unsigned int D, scalar_type* inp_data){_emb_dimension = D; _emb_positions = inp_data;}
+      bool isCorrect()const;
+      void getAllIndices(unsigned int* indices)const;
+      unsigned int getDepth()const{return _depth;}
+      unsigned int getNumberOfNodes()const{return _cum_size.size();}
+      //! Memory occupation of the nodes in MB
+      double memoryOccupation()const;
+      //! The kernels are specialized at compile time on the embedding dimensionality D, D = 0 is the generic kernel
+      template <unsigned int D = 0>
+      void computeNonEdgeForcesOMP(unsigned int point_index, hp_scalar_type theta, hp_scalar_type neg_f[], hp_scalar_type& sum_Q)const;
+      void computeNonEdgeForces(unsigned int point_index, hp_scalar_type theta, hp_scalar_type neg_f[], hp_scalar_type* sum_Q)const;
+      //! Non-edge forces multiplied by the weight of the point
+      template <unsigned int D = 0>
+      void computeWeightedNonEdgeForces(unsigned int point_index, hp_scalar_type theta, hp_scalar_type weight, hp_scalar_type neg_f[], hp_scalar_type& sum_Q)const;
+      //! Non-edge forces of all the points computed with a dual-tree (cell-cell) traversal. neg_f contains D values per point.
+      //! The expansions of the cells are accumulated in a buffer of the tree that is reused across calls
+      template <unsigned int D = 0>
+      void computeDualTreeNonEdgeForces(hp_scalar_type theta, hp_scalar_type* neg_f, hp_scalar_type& sum_Q);
+      void computeEdgeForces(unsigned int* row_P, unsigned int* col_P, hp_scalar_type* val_P, hp_scalar_type sum_P, int N, hp_scalar_type* pos_f)const;
+
+      //! Attractive (edge) forces scale*p_ij*q_ij*(y_i-y_j)/n added to pos_f. Rows are split in blocks with the same number of edges
+      template <unsigned int D = 0, typename sparse_scalar_matrix>
+      void computeEdgeForces(const sparse_scalar_matrix& matrix, hp_scalar_type scale, hp_scalar_type* pos_f)const;
+      //! Edge forces on the contiguous arrays of a CSR matrix. The edges are split in blocks of the same size, also inside a row
+      template <unsigned int D = 0, typename Key, typename T>
+      void computeEdgeForces(const data::SparseMatrixCSR<Key,T>& matrix, hp_scalar_type scale, hp_scalar_type* pos_f)const;
+      //! Edge forces for a symmetric matrix of which only the upper triangle (j > i) is stored. Each edge is visited once and applied to both endpoints.
+      //! Blocks of rows are paired in rounds so that no two threads write the same forces, no private buffer is allocated
+      template <unsigned int D = 0, typename sparse_scalar_matrix>
+      void computeSymmetricEdgeForces(const sparse_scalar_matrix& matrix, hp_scalar_type scale, hp_scalar_type* pos_f)const;
+      //! Edge forces of a single row of a matrix with n rows, added to pos_f (D values). Same kernel as computeEdgeForces
+      template <unsigned int D = 0, typename Row>
+      void computeEdgeForces(unsigned int point_index, const Row& row, hp_scalar_type scale, hp_scalar_type n, hp_scalar_type* pos_f)const{
+        typedef decltype(row.begin()) row_iterator;
+        accumulateEdgeForces<D>(point_index, MapEdgeIterator<row_iterator>(row.begin()), MapEdgeIterator<row_iterator>(row.end()), scale, n, pos_f);
+      }
+
+      void print()const;
+
     private:
-      class Cell {
-        unsigned int _emb_dimension;
-        hp_scalar_type* corner;
-        hp_scalar_type* width;
+      void resizeNodes(unsigned int num_nodes);
+      //! The tree is built by splitting the nodes and not from the Morton codes, the boxes of all the nodes are stored
+      bool isBuiltBySplitting()const{return _emb_dimension != 2 && _emb_dimension != 3;}
+      void initializeChildren(unsigned int node, unsigned int first_child, const unsigned int* child_begin);
+      //! Split the points of a node among its children, which are appended to the node arrays
+      void subdivide(unsigned int node);
+      unsigned int childOf(unsigned int node, unsigned int point_index)const;
+      static uint64_t spreadBits(uint64_t v, unsigned int D);
+      void buildFromMortonCodes(std::vector<unsigned int>& level_begin);
+      void sortByMortonCodes(unsigned int bits);
+      void computeCentersOfMass(const std::vector<unsigned int>& level_begin);
+      void print(unsigned int node)const;
+      template <unsigned int D>
+      void interactCells(unsigned int a, unsigned int b, hp_scalar_type theta_sq, bool update_b, hp_scalar_type* node_f, std::vector<std::pair<unsigned int,unsigned int>>& cell_pairs)const;
+      //! Kahan summation, c keeps the low-order bits lost by sum. The compiler must not reassociate floating-point operations (no fast-math)
+      static void compensatedAdd(node_scalar_type& sum, node_scalar_type& c, node_scalar_type v){
+        const node_scalar_type y = v - c;
+        const node_scalar_type t = sum + y;
+        c = (t - sum) - y;
+        sum = t;
+      }
+      //! Attractive forces of the edges in [begin,end) of a point, added to pos_f (D values)
+      template <unsigned int D, typename Iterator>
+      void accumulateEdgeForces(unsigned int point_index, Iterator begin, Iterator end, hp_scalar_type scale, hp_scalar_type n, hp_scalar_type* pos_f)const;
+
+    private:
+      //! Rows whose keys are iterated in increasing order
+      template <typename Row>
+      struct HasSortedKeys{ static const bool value = true; };
+      template <typename Key, typename T>
+      struct HasSortedKeys<std::unordered_map<Key,T>>{ static const bool value = false; };
 
+      //! Edges of a row of a vector of maps
+      template <typename RowIterator>
+      class MapEdgeIterator{
       public:
-        Cell(unsigned int inp__emb_dimension);
-        Cell(unsigned int inp__emb_dimension, hp_scalar_type* inp_corner, hp_scalar_type* inp_width);
-        ~Cell();
-
-        hp_scalar_type getCorner(unsigned int d);
-        hp_scalar_type getWidth(unsigned int d);
-        void setCorner(unsigned int d, hp_scalar_type val);
-        void setWidth(unsigned int d, hp_scalar_type val);
-        bool containsPoint(scalar_type point[]);
+        explicit MapEdgeIterator(RowIterator it):_it(it){}
+        MapEdgeIterator& operator++(){++_it; return *this;}
+        bool operator!=(const MapEdgeIterator& other)const{return _it != other._it;}
+        unsigned int key()const{return _it->first;}
+        hp_scalar_type value()const{return _it->second;}
+      private:
+        RowIterator _it;
+      };
+      //! Edges stored in the contiguous arrays of a CSR matrix
+      template <typename Key, typename T>
+      class CSREdgeIterator{
+      public:
+        CSREdgeIterator(const Key* key, const T* value):_key(key),_value(value){}
+        CSREdgeIterator& operator++(){++_key; ++_value; return *this;}
+        bool operator!=(const CSREdgeIterator& other)const{return _key != other._key;}
+        unsigned int key()const{return *_key;}
+        hp_scalar_type value()const{return *_value;}
+      private:
+        const Key* _key;
+        const T* _value;
       };
 
-      // Fixed constants
-      static const unsigned int QT_NODE_CAPACITY = 1;
-
-      // A buffer we use when doing force computations
-      //hp_scalar_type* buff;
+    private:
+      // Size of the traversal stack that is allocated on the call stack, deeper trees use a heap allocated stack
+      static const unsigned int STACK_SIZE = 512;
 
-      // Properties of this node in the tree
-      SPTree* parent;
       unsigned int _emb_dimension;
-      bool is_leaf;
-      unsigned int size;
-      unsigned int cum_size;
+      unsigned int _no_children;
+      unsigned int _depth;
+      scalar_type* _emb_positions;
+      const scalar_type* _weights;
 
-      // Axis-aligned bounding box stored as a center with half-_emb_dimensions to represent the boundaries of this quad tree
-      Cell* boundary;
+      // Nodes are stored breadth-first in contiguous arrays. The children of a node are contiguous and _first_child is 0 for leaves
+      std::vector<unsigned int> _first_child;
+      std::vector<unsigned int> _cum_size;
+      std::vector<unsigned int> _points_begin;          //! first point of the node in _points
+      std::vector<node_scalar_type> _mass;              //! number of points, or sum of their weights
+      std::vector<node_scalar_type> _center_of_mass;    //! _emb_dimension values per node
+      // Boxes of the nodes, _emb_dimension values per node. They are needed only to split the nodes, hence 2D and 3D trees,
+      // which are built from the Morton codes, store only the box of the root
+      std::vector<hp_scalar_type> _corner;
+      std::vector<hp_scalar_type> _width;
+      std::vector<node_scalar_type> _max_width;
+      std::vector<unsigned int> _level_begin;           //! first node of every level, followed by the number of nodes
+      std::vector<hp_scalar_type> _node_f;              //! expansions of the dual-tree traversal, (_emb_dimension+1)^2 values per node
 
-      // Indices in this space-partitioning tree node, corresponding center-of-mass, and list of all children
-      scalar_type* _emb_positions;
-      hp_scalar_type* _center_of_mass;
-      unsigned int index[QT_NODE_CAPACITY];
+      // Point indices sorted by node. A leaf holds a point and its duplicates or, in 2D and 3D, distinct points whose Morton codes collide
+      std::vector<unsigned int> _points;
+      std::vector<unsigned int> _points_buffer;
+      std::vector<unsigned int> _child_count;
+      std::vector<uint64_t> _codes;
+      std::vector<uint64_t> _codes_buffer;
+    };
 
-      // Children
-      SPTree** children;
-      unsigned int no_children;
 
-    public:
-      SPTree(unsigned int D, scalar_type* inp_data, unsigned int N);
-    private:
-      SPTree(unsigned int D, scalar_type* inp_data, hp_scalar_type* inp_corner, hp_scalar_type* inp_width);
-      SPTree(unsigned int D, scalar_type* inp_data, unsigned int N, hp_scalar_type* inp_corner, hp_scalar_type* inp_width);
-      SPTree(SPTree* inp_parent, unsigned int D, scalar_type* inp_data, unsigned int N, hp_scalar_type* inp_corner, hp_scalar_type* inp_width);
-      SPTree(SPTree* inp_parent, unsigned int D, scalar_type* inp_data, hp_scalar_type* inp_corner, hp_scalar_type* inp_width);
-    public:
-      ~SPTree();
-      void setData(scalar_type* inp_data);
-      SPTree* getParent();
-      void construct(Cell boundary);
-      bool insert(unsigned int new_index);
-      void subdivide();
-      bool isCorrect();
-      void rebuildTree();
-      void getAllIndices(unsigned int* indices);
-      unsigned int getDepth();
-      void computeNonEdgeForcesOMP(unsigned int point_index, hp_scalar_type theta, hp_scalar_type neg_f[], hp_scalar_type& sum_Q)const;
-      void computeNonEdgeForces(unsigned int point_index, hp_scalar_type theta, hp_scalar_type neg_f[], hp_scalar_type* sum_Q)const;
-      void computeEdgeForces(unsigned int* row_P, unsigned int* col_P, hp_scalar_type* val_P, hp_scalar_type sum_P, int N, hp_scalar_type* pos_f)const;
+/////////////////////////////////////////////////////////////////////////
 
-      template <typename sparse_scalar_matrix>
-      void computeEdgeForces(const sparse_scalar_matrix& matrix, hp_scalar_type multiplier, hp_scalar_type* pos_f)const;
+    // Compute non-edge forces using Barnes-Hut algorithm
+    template <typename scalar_type, typename node_scalar_type>
+    template <unsigned int D>
+    void SPTree<scalar_type, node_scalar_type>::computeNonEdgeForcesOMP(unsigned int point_index, hp_scalar_type theta, hp_scalar_type neg_f[], hp_scalar_type& sum_Q)const
+    {
+      computeWeightedNonEdgeForces<D>(point_index, theta, 1, neg_f, sum_Q);
+    }
 
-      void print();
+    // Compute non-edge forces using Barnes-Hut algorithm. The contributions are multiplied by the weight of the point
+    template <typename scalar_type, typename node_scalar_type>
+    template <unsigned int D>
+    void SPTree<scalar_type, node_scalar_type>::computeWeightedNonEdgeForces(unsigned int point_index, hp_scalar_type theta, hp_scalar_type weight, hp_scalar_type neg_f[], hp_scalar_type& sum_Q)const
+    {
+      assert(D == 0 || D == _emb_dimension);
+      // With D known at compile time the loops over the dimensions are unrolled
+      const unsigned int dim = (D == 0) ? _emb_dimension : D;
+      const unsigned int no_children = (D == 0) ? _no_children : (1u << D);
+      const scalar_type* point = _emb_positions + size_t(point_index) * dim;
+      const node_scalar_type theta_sq = theta * theta;
+      const node_scalar_type w = weight;
 
-    private:
-      void init(SPTree* inp_parent, unsigned int D, scalar_type* inp_data, hp_scalar_type* inp_corner, hp_scalar_type* inp_width);
-      void fill(unsigned int N);
-      unsigned int getAllIndices(unsigned int* indices, unsigned int loc);
-      bool isChild(unsigned int test_index, unsigned int start, unsigned int end);
-    };
+      // Totals of the point. Single-precision totals are compensated, c_* keep the low-order bits lost by the sums.
+      // The generic kernel accumulates the forces directly in neg_f
+      const bool compensated = sizeof(node_scalar_type) < sizeof(hp_scalar_type);
+      node_scalar_type f[(D == 0) ? 1 : D] = {}, c_f[(D == 0) ? 1 : D] = {};
+      node_scalar_type q_sum = 0, c_q = 0;
+
+      // Depth-first traversal with an explicit stack. The children are pushed in reverse order so that they are visited in order
+      unsigned int local_stack[STACK_SIZE];
+      std::vector<unsigned int> heap_stack;
+      unsigned int* stack = local_stack;
+      const size_t stack_size = size_t(_depth) * (no_children - 1) + 1;
+      if(stack_size > STACK_SIZE){
+        heap_stack.resize(stack_size);
+        stack = heap_stack.data();
+      }
+      unsigned int stack_top = 0;
+      stack[stack_top++] = 0;
 
+      const unsigned int* first_children = _first_child.data();
+      const unsigned int* points = _points.data();
+      const unsigned int* points_begin = _points_begin.data();
+      const unsigned int* cum_sizes = _cum_size.data();
+      const node_scalar_type* masses = _mass.data();
+      const node_scalar_type* max_widths = _max_width.data();
+      const node_scalar_type* centers_of_mass = _center_of_mass.data();
 
-/////////////////////////////////////////////////////////////////////////
+      while(stack_top != 0){
+        const unsigned int node = stack[--stack_top];
+        const unsigned int first_child = first_children[node];
+        const bool is_leaf = (first_child == 0);
+
+        // Make sure that we spend no time on empty nodes or self-interactions
+        if(masses[node] == 0 || (is_leaf && cum_sizes[node] == 1 && points[points_begin[node]] == point_index)) continue;
+
+        // A leaf holds duplicates or distinct points whose Morton codes collide. If the point is one of them, the other
+        // points interact one by one and the point does not interact with itself
+        if(is_leaf && cum_sizes[node] > 1){
+          const unsigned int* leaf_begin = points + points_begin[node];
+          const unsigned int* leaf_end = leaf_begin + cum_sizes[node];
+          if(std::find(leaf_begin, leaf_end, point_index) != leaf_end){
+            for(const unsigned int* p = leaf_begin; p != leaf_end; ++p){
+              if(*p == point_index) continue;
+              const scalar_type* other = _emb_positions + size_t(*p) * dim;
+              node_scalar_type dist_sq = .0;
+              for(unsigned int d = 0; d < dim; d++) dist_sq += node_scalar_type(point[d] - other[d]) * node_scalar_type(point[d] - other[d]);
+              const node_scalar_type q = node_scalar_type(1) / (node_scalar_type(1) + dist_sq);
+              node_scalar_type mult = ((_weights == nullptr) ? node_scalar_type(1) : node_scalar_type(_weights[*p])) * q;
+              if(compensated) compensatedAdd(q_sum, c_q, w * mult);
+              else q_sum += w * mult;
 
-    template <typename scalar_type>
-    template <typename sparse_scalar_matrix>
-    void SPTree<scalar_type>::computeEdgeForces(const sparse_scalar_matrix& sparse_matrix, hp_scalar_type multiplier, hp_scalar_type* pos_f)const{
+              mult *= q;
+              for(unsigned int d = 0; d < dim; d++){
+                const node_scalar_type force = w * mult * node_scalar_type(point[d] - other[d]);
+                if(D == 0) neg_f[d] += force;
+                else if(compensated) compensatedAdd(f[d], c_f[d], force);
+                else f[d] += force;
+              }
+            }
+            continue;
+          }
+        }
+
+        // Compute distance between point and center-of-mass
+        const node_scalar_type* com = centers_of_mass + size_t(node) * dim;
+        node_scalar_type dist_sq = .0;
+        for(unsigned int d = 0; d < dim; d++) dist_sq += node_scalar_type(point[d] - com[d]) * node_scalar_type(point[d] - com[d]);
+
+        // Check whether we can use this node as a "summary"
+        if(is_leaf || max_widths[node] * max_widths[node] < theta_sq * dist_sq) {
+
+          // Compute and add t-SNE force between point and current node
+          const node_scalar_type q = node_scalar_type(1) / (node_scalar_type(1) + dist_sq);
+          node_scalar_type mult = masses[node] * q;
+          if(compensated) compensatedAdd(q_sum, c_q, w * mult);
+          else q_sum += w * mult;
+
+          mult *= q;
+          for(unsigned int d = 0; d < dim; d++){
+            const node_scalar_type force = w * mult * node_scalar_type(point[d] - com[d]);
+            if(D == 0) neg_f[d] += force;
+            else if(compensated) compensatedAdd(f[d], c_f[d], force);
+            else f[d] += force;
+          }
+        }
+        else {
+          for(unsigned int c = no_children; c > 0; --c) stack[stack_top++] = first_child + c - 1;
+        }
+      }
+
+      sum_Q += hp_scalar_type(q_sum) - hp_scalar_type(c_q);
+      if(D != 0){
+        for(unsigned int d = 0; d < dim; d++) neg_f[d] += hp_scalar_type(f[d]) - hp_scalar_type(c_f[d]);
+      }
+    }
+
+    // Compute the non-edge forces of all the points with a dual-tree traversal. Pairs of well-separated cells interact
+    // through their centers of mass. Each cell accumulates a first order expansion, i.e., value and gradient, of the forces
+    // and of the normalization around its center of mass. The expansions are translated down to the points at the end
+    template <typename scalar_type, typename node_scalar_type>
+    template <unsigned int D>
+    void SPTree<scalar_type, node_scalar_type>::computeDualTreeNonEdgeForces(hp_scalar_type theta, hp_scalar_type* neg_f, hp_scalar_type& sum_Q)
+    {
+      assert(D == 0 || D == _emb_dimension);
+      typedef std::pair<unsigned int,unsigned int> cell_pair_type;
+      const unsigned int dim = (D == 0) ? _emb_dimension : D;
+      const unsigned int field = dim + 1;         // value followed by the gradient
+      const unsigned int stride = field * field;  // dim forces followed by the normalization
+      const unsigned int num_nodes = getNumberOfNodes();
+      const unsigned int no_children = (D == 0) ? _no_children : (1u << D);
+      const hp_scalar_type theta_sq = theta * theta;
+      const unsigned int min_tasks = 16 * std::max(1u,std::thread::hardware_concurrency());
+
+      // Every task owns the subtree of a cell of the cut, i.e., the cells of the first level with enough cells and the shallower leaves.
+      // The cells of the cut partition the points and a task writes only the expansions of its own subtree
+      unsigned int cut_level = 0;
+      while(cut_level + 2 < _level_begin.size() && _level_begin[cut_level+1] - _level_begin[cut_level] < min_tasks){
+        ++cut_level;
+      }
+      std::vector<unsigned int> tasks;
+      for(unsigned int node = 0; node < _level_begin[cut_level+1]; ++node){
+        if(_mass[node] != 0 && (node >= _level_begin[cut_level] || _first_child[node] == 0)){
+          tasks.push_back(node);
+        }
+      }
+
+      _node_f.assign(size_t(num_nodes) * stride, 0);
+      hp_scalar_type* node_f = _node_f.data();
+      const unsigned int* tasks_ptr = tasks.data();
+      const int num_tasks = tasks.size();
+#ifdef __USE_GCD__
+      dispatch_apply(num_tasks, dispatch_get_global_queue(0, 0), ^(size_t t) {
+#else
+#pragma omp parallel for schedule(dynamic,1)
+      for(int t = 0; t < num_tasks; ++t) {
+#endif //__USE_GCD__
+        const unsigned int owned = tasks_ptr[t];
+        const unsigned int owned_begin = _points_begin[owned];
+        const unsigned int owned_end = owned_begin + _cum_size[owned];
+        std::vector<cell_pair_type> stack;
+
+        // Pairs of cells of the owned subtree update both cells
+        stack.push_back(cell_pair_type(owned,owned));
+        while(!stack.empty()){
+          const cell_pair_type cells = stack.back();
+          stack.pop_back();
+          interactCells<D>(cells.first, cells.second, theta_sq, true, node_f, stack);
+        }
+
+        // The rest of the tree, starting from the root, updates only the owned cells. The other cell of a pair
+        // is updated by the task that owns it. An ancestor of the owned cell is split, the owned cell itself is skipped
+        stack.push_back(cell_pair_type(owned,0));
+        while(!stack.empty()){
+          const cell_pair_type cells = stack.back();
+          stack.pop_back();
+          const unsigned int b = cells.second;
+          const bool is_ancestor = b <= owned && _points_begin[b] <= owned_begin && owned_end <= _points_begin[b] + _cum_size[b];
+          if(b == owned){
+            continue;
+          }
+          if(is_ancestor){
+            for(unsigned int c = _first_child[b]; c < _first_child[b] + no_children; ++c)
+              stack.push_back(cell_pair_type(cells.first,c));
+            continue;
+          }
+          interactCells<D>(cells.first, b, theta_sq, false, node_f, stack);
+        }
+      }
+#ifdef __USE_GCD__
+      );
+#endif
+
+      // Push down, level by level. The cells above the cut have no expansion
+      for(unsigned int level = cut_level; level + 2 < _level_begin.size(); ++level){
+        const unsigned int begin = _level_begin[level];
+        const unsigned int level_size = _level_begin[level+1] - begin;
+#ifdef __USE_GCD__
+        dispatch_apply(level_size, dispatch_get_global_queue(0, 0), ^(size_t i) {
+#else
+#pragma omp parallel for
+        for(int i = 0; i < int(level_size); ++i) {
+#endif //__USE_GCD__
+          const unsigned int node = begin + i;
+          const unsigned int first_child = _first_child[node];
+          if(first_child != 0){
+            const hp_scalar_type* parent_f = node_f + size_t(node) * stride;
+            const node_scalar_type* parent_com = _center_of_mass.data() + size_t(node) * dim;
+            for(unsigned int c = first_child; c < first_child + no_children; ++c){
+              if(_mass[c] == 0) continue;
+              hp_scalar_type* child_f = node_f + size_t(c) * stride;
+              const node_scalar_type* child_com = _center_of_mass.data() + size_t(c) * dim;
+              for(unsigned int k = 0; k < field; k++){
+                hp_scalar_type value = parent_f[k * field];
+                for(unsigned int d = 0; d < dim; d++){
+                  value += parent_f[k * field + 1 + d] * (child_com[d] - parent_com[d]);
+                  child_f[k * field + 1 + d] += parent_f[k * field + 1 + d];
+                }
+                child_f[k * field] += value;
+              }
+            }
+          }
+        }
+#ifdef __USE_GCD__
+        );
+#endif
+      }
+
+      // Every point of a leaf receives the forces of the leaf. The interaction of a point with itself is removed from the normalization
+      hp_scalar_type leaves_sum_Q = 0;
+#ifndef __USE_GCD__
+#pragma omp parallel for reduction(+:leaves_sum_Q)
+#endif
+      for(int node = 0; node < int(num_nodes); ++node){
+        if(_first_child[node] != 0) continue;
+        const hp_scalar_type* f = node_f + size_t(node) * stride;
+        const node_scalar_type* com = _center_of_mass.data() + size_t(node) * dim;
+        for(unsigned int p = _points_begin[node]; p < _points_begin[node] + _cum_size[node]; ++p){
+          const unsigned int point_index = _points[p];
+          const scalar_type* point = _emb_positions + size_t(point_index) * dim;
+          const hp_scalar_type weight = (_weights == nullptr) ? 1 : _weights[point_index];
+          for(unsigned int k = 0; k < field; k++){
+            hp_scalar_type value = f[k * field];
+            for(unsigned int d = 0; d < dim; d++)
+              value += f[k * field + 1 + d] * (point[d] - com[d]);
+            if(k < dim){
+              neg_f[size_t(point_index) * dim + k] += weight * value;
+            }else{
+              leaves_sum_Q += weight * (value - weight);
+            }
+          }
+        }
+      }
+      sum_Q += leaves_sum_Q;
+    }
+
+    // Interaction between two cells. The expansions are accumulated for a point with unit weight in each cell, the expansion
+    // of b only if update_b is set. If the cells are not well-separated the pairs of their children are pushed in cell_pairs
+    template <typename scalar_type, typename node_scalar_type>
+    template <unsigned int D>
+    void SPTree<scalar_type, node_scalar_type>::interactCells(unsigned int a, unsigned int b, hp_scalar_type theta_sq, bool update_b, hp_scalar_type* node_f, std::vector<std::pair<unsigned int,unsigned int>>& cell_pairs)const
+    {
+      const unsigned int dim = (D == 0) ? _emb_dimension : D;
+      const unsigned int field = dim + 1;
+      const unsigned int stride = field * field;
+      const unsigned int no_children = (D == 0) ? _no_children : (1u << D);
+      const hp_scalar_type mass_a = _mass[a];
+      const hp_scalar_type mass_b = _mass[b];
+      if(mass_a == 0 || mass_b == 0) return;
+
+      const unsigned int first_child_a = _first_child[a];
+      const unsigned int first_child_b = _first_child[b];
+      if(a == b){
+        if(first_child_a == 0){
+          // Coincident points, q = 1 and no force
+          node_f[size_t(a) * stride + dim * field] += mass_a;
+        }else{
+          for(unsigned int c1 = first_child_a; c1 < first_child_a + no_children; ++c1)
+            for(unsigned int c2 = c1; c2 < first_child_a + no_children; ++c2)
+              cell_pairs.push_back(std::make_pair(c1,c2));
+        }
+        return;
+      }
+
+      const node_scalar_type* com_a = _center_of_mass.data() + size_t(a) * dim;
+      const node_scalar_type* com_b = _center_of_mass.data() + size_t(b) * dim;
+      hp_scalar_type dist_sq = .0;
+      for(unsigned int d = 0; d < dim; d++) dist_sq += (com_a[d] - com_b[d]) * (com_a[d] - com_b[d]);
+
+      // The cells are well-separated if the sum of their widths is smaller than theta times their distance. A leaf is a single position and has no extent
+      const hp_scalar_type width_a = (first_child_a == 0) ? 0 : _max_width[a];
+      const hp_scalar_type width_b = (first_child_b == 0) ? 0 : _max_width[b];
+      const hp_scalar_type width = width_a + width_b;
+      if((first_child_a == 0 && first_child_b == 0) || width * width < theta_sq * dist_sq){
+        const hp_scalar_type q = 1.0 / (1.0 + dist_sq);
+        const hp_scalar_type q_sq = q * q;
+        hp_scalar_type* f_a = node_f + size_t(a) * stride;
+        hp_scalar_type* f_b = node_f + size_t(b) * stride;
+
+        // Normalization q and its gradient -2q^2(y_a-y_b)
+        f_a[dim * field] += mass_b * q;
+        if(update_b) f_b[dim * field] += mass_a * q;
+        for(unsigned int j = 0; j < dim; j++){
+          const hp_scalar_type grad = -2 * q_sq * (com_a[j] - com_b[j]);
+          f_a[dim * field + 1 + j] += mass_b * grad;
+          if(update_b) f_b[dim * field + 1 + j] -= mass_a * grad;
+        }
+        // Forces q^2(y_a-y_b) and their jacobian q^2 I - 4q^3(y_a-y_b)(y_a-y_b)^T
+        for(unsigned int i = 0; i < dim; i++){
+          const hp_scalar_type diff_i = com_a[i] - com_b[i];
+          f_a[i * field] += mass_b * q_sq * diff_i;
+          if(update_b) f_b[i * field] -= mass_a * q_sq * diff_i;
+          for(unsigned int j = 0; j < dim; j++){
+            const hp_scalar_type jacobian = ((i == j) ? q_sq : 0) - 4 * q_sq * q * diff_i * (com_a[j] - com_b[j]);
+            f_a[i * field + 1 + j] += mass_b * jacobian;
+            if(update_b) f_b[i * field + 1 + j] += mass_a * jacobian;
+          }
+        }
+      }
+      // The larger cell is split
+      else if(first_child_a == 0 || (first_child_b != 0 && width_b > width_a)){
+        for(unsigned int c = first_child_b; c < first_child_b + no_children; ++c)
+          cell_pairs.push_back(std::make_pair(a,c));
+      }else{
+        for(unsigned int c = first_child_a; c < first_child_a + no_children; ++c)
+          cell_pairs.push_back(std::make_pair(c,b));
+      }
+    }
+
+    template <typename scalar_type, typename node_scalar_type>
+    template <unsigned int D, typename Iterator>
+    void SPTree<scalar_type, node_scalar_type>::accumulateEdgeForces(unsigned int point_index, Iterator begin, Iterator end, hp_scalar_type scale, hp_scalar_type n, hp_scalar_type* pos_f)const{
+      const unsigned int dim = (D == 0) ? _emb_dimension : D;
+      const size_t ind1 = size_t(point_index) * dim;
+      // The forces of a specialized kernel are accumulated on the stack, the generic kernel writes in pos_f
+      hp_scalar_type row_f[(D == 0) ? 1 : D] = {};
+      hp_scalar_type* f = (D == 0) ? pos_f : row_f;
+      for(Iterator it = begin; it != end; ++it) {
+        // Compute pairwise distance and Q-value
+        hp_scalar_type q_ij_1 = 1.0;
+        const size_t ind2 = size_t(it.key()) * dim;
+        for(unsigned int d = 0; d < dim; d++){
+          const hp_scalar_type diff = _emb_positions[ind1 + d] - _emb_positions[ind2 + d];
+          q_ij_1 += diff * diff;
+        }
+
+        hp_scalar_type res = hp_scalar_type(it.value()) * scale / q_ij_1 / n;
+
+        // Sum positive force
+        for(unsigned int d = 0; d < dim; d++)
+          f[d] += res * hp_scalar_type(_emb_positions[ind1 + d] - _emb_positions[ind2 + d]); //(p_ij*q_j*scale) * (yi-yj)
+      }
+      if(D != 0){
+        for(unsigned int d = 0; d < dim; d++)
+          pos_f[d] += row_f[d];
+      }
+    }
+
+    template <typename scalar_type, typename node_scalar_type>
+    template <unsigned int D, typename sparse_scalar_matrix>
+    void SPTree<scalar_type, node_scalar_type>::computeEdgeForces(const sparse_scalar_matrix& sparse_matrix, hp_scalar_type scale, hp_scalar_type* pos_f)const{
+      assert(D == 0 || D == _emb_dimension);
+      typedef decltype(sparse_matrix[0].begin()) row_iterator;
       const int n = sparse_matrix.size();
+      const unsigned int dim = (D == 0) ? _emb_dimension : D;
+      // More blocks than threads, hence the rows with many edges are balanced by the dynamic schedule
+      const int num_blocks = std::max<int>(1,std::min<int>(n,4*std::thread::hardware_concurrency()));
+
+      // Rows are split in blocks with the same number of edges
+      std::vector<int> block_begin(num_blocks+1,n);
+      {
+        size_t num_edges = 0;
+        for(int j = 0; j < n; ++j){
+          num_edges += sparse_matrix[j].size();
+        }
+        block_begin[0] = 0;
+        size_t acc = 0;
+        int b = 0;
+        for(int j = 0; j < n && b+1 < num_blocks; ++j){
+          acc += sparse_matrix[j].size();
+          while(b+1 < num_blocks && acc*num_blocks >= num_edges*(b+1)){
+            block_begin[++b] = j+1;
+          }
+        }
+      }
+      const int* block_begin_ptr = block_begin.data();
 
       // Loop over all edges in the graph
 #ifdef __USE_GCD__
-      //std::cout << "GCD dispatch, sptree 180.\n";
-      dispatch_apply(n, dispatch_get_global_queue(0, 0), ^(size_t j) {
+      dispatch_apply(num_blocks, dispatch_get_global_queue(0, 0), ^(size_t b) {
 #else
-#pragma omp parallel for
-      for(int j = 0; j < n; ++j) {
+#pragma omp parallel for schedule(dynamic,1)
+      for(int b = 0; b < num_blocks; ++b) {
+#endif //__USE_GCD__
+        for(int j = block_begin_ptr[b]; j < block_begin_ptr[b+1]; ++j){
+          const auto& row = sparse_matrix[j];
+          accumulateEdgeForces<D>(j, MapEdgeIterator<row_iterator>(row.begin()), MapEdgeIterator<row_iterator>(row.end()), scale, n, pos_f + size_t(j) * dim);
+        }
+      }
+#ifdef __USE_GCD__
+      );
+#endif
+    }
+
+    template <typename scalar_type, typename node_scalar_type>
+    template <unsigned int D, typename Key, typename T>
+    void SPTree<scalar_type, node_scalar_type>::computeEdgeForces(const data::SparseMatrixCSR<Key,T>& sparse_matrix, hp_scalar_type scale, hp_scalar_type* pos_f)const{
+      assert(D == 0 || D == _emb_dimension);
+      typedef typename data::SparseMatrixCSR<Key,T>::offset_type offset_type;
+      const int n = sparse_matrix.size();
+      const unsigned int dim = (D == 0) ? _emb_dimension : D;
+      const Key* keys = sparse_matrix.keys().data();
+      const T* values = sparse_matrix.values().data();
+      const offset_type* offsets = sparse_matrix.offsets().data();
+      const size_t num_edges = sparse_matrix.numElements();
+      const int num_blocks = int(std::max<size_t>(1,std::min<size_t>(num_edges,4*std::thread::hardware_concurrency())));
+
+      // The array of the edges is split in blocks of the same size, hence a row with many edges can be shared by several blocks.
+      // A block owns the rows that it contains entirely, the partial sums of the first and of the last row of a block are
+      // stored in two private slots and reduced at the end
+      std::vector<int> partial_rows(2*num_blocks,-1);
+      std::vector<hp_scalar_type> partial_f(size_t(2)*num_blocks*dim,0);
+      int* partial_rows_ptr = partial_rows.data();
+      hp_scalar_type* partial_f_ptr = partial_f.data();
+
+#ifdef __USE_GCD__
+      dispatch_apply(num_blocks, dispatch_get_global_queue(0, 0), ^(size_t b) {
+#else
+#pragma omp parallel for schedule(dynamic,1)
+      for(int b = 0; b < num_blocks; ++b) {
 #endif //__USE_GCD__
-        std::vector<hp_scalar_type> buff(_emb_dimension,0);
-        unsigned int ind1, ind2;
-        hp_scalar_type q_ij_1;
-        ind1 = j * _emb_dimension;
-        for(auto elem: sparse_matrix[j]) {
-          // Compute pairwise distance and Q-value
-          q_ij_1 = 1.0;
-          ind2 = elem.first * _emb_dimension;
-          for(unsigned int d = 0; d < _emb_dimension; d++)
-            buff[d] = _emb_positions[ind1 + d] - _emb_positions[ind2 + d]; //buff contains (yi-yj) per each _emb_dimension
-          for(unsigned int d = 0; d < _emb_dimension; d++)
-            q_ij_1 += buff[d] * buff[d];
-
-          hp_scalar_type p_ij = elem.second;
-          hp_scalar_type res = hp_scalar_type(p_ij) * multiplier / q_ij_1 / n;
-
-          // Sum positive force
-          for(unsigned int d = 0; d < _emb_dimension; d++)
-            pos_f[ind1 + d] += res * buff[d] * multiplier; //(p_ij*q_j*mult) * (yi-yj)
+        const offset_type e_begin = num_edges * b / num_blocks;
+        const offset_type e_end = num_edges * (b+1) / num_blocks;
+        // Row that contains the first edge of the block
+        int j = int(std::upper_bound(offsets, offsets + n + 1, e_begin) - offsets) - 1;
+        int num_partial = 0;
+        for(; j < n && offsets[j] < e_end; ++j){
+          const offset_type begin = std::max(offsets[j], e_begin);
+          const offset_type end = std::min(offsets[j+1], e_end);
+          if(begin == end){
+            continue;
+          }
+          hp_scalar_type* f = pos_f + size_t(j) * dim;
+          if(offsets[j] < e_begin || offsets[j+1] > e_end){
+            const int slot = 2*b + num_partial++;
+            partial_rows_ptr[slot] = j;
+            f = partial_f_ptr + size_t(slot) * dim;
+          }
+          accumulateEdgeForces<D>(j, CSREdgeIterator<Key,T>(keys + begin, values + begin), CSREdgeIterator<Key,T>(keys + end, values + end), scale, n, f);
         }
       }
 #ifdef __USE_GCD__
       );
 #endif
+
+      // Reduction of the rows shared by several blocks
+      for(int slot = 0; slot < 2*num_blocks; ++slot){
+        if(partial_rows[slot] < 0){
+          continue;
+        }
+        for(unsigned int d = 0; d < dim; d++)
+          pos_f[size_t(partial_rows[slot]) * dim + d] += partial_f[size_t(slot) * dim + d];
+      }
+    }
+
+    template <typename scalar_type, typename node_scalar_type>
+    template <unsigned int D, typename sparse_scalar_matrix>
+    void SPTree<scalar_type, node_scalar_type>::computeSymmetricEdgeForces(const sparse_scalar_matrix& sparse_matrix, hp_scalar_type scale, hp_scalar_type* pos_f)const{
+      assert(D == 0 || D == _emb_dimension);
+      typedef decltype(sparse_matrix[0].begin()) row_iterator;
+      typedef typename std::decay<decltype(sparse_matrix[0])>::type row_type;
+      const bool sorted_rows = HasSortedKeys<row_type>::value;
+      const int n = sparse_matrix.size();
+      const unsigned int dim = (D == 0) ? _emb_dimension : D;
+      // More blocks than threads, hence every round below still has enough tasks when the blocks close to the diagonal are done
+      const int num_blocks = std::max<int>(1,std::min<int>(n,8*std::thread::hardware_concurrency()));
+
+      // Rows are split in blocks with the same number of edges
+      std::vector<int> block_begin(num_blocks+1,n);
+      {
+        size_t num_edges = 0;
+        for(int j = 0; j < n; ++j){
+          num_edges += sparse_matrix[j].size();
+        }
+        block_begin[0] = 0;
+        size_t acc = 0;
+        int b = 0;
+        for(int j = 0; j < n && b+1 < num_blocks; ++j){
+          acc += sparse_matrix[j].size();
+          while(b+1 < num_blocks && acc*num_blocks >= num_edges*(b+1)){
+            block_begin[++b] = j+1;
+          }
+        }
+      }
+
+      // The edges between the rows of block b and the rows of block b+r are visited by one task in round r, which writes
+      // only the forces of the two blocks. In round r the tasks of blocks b and b+r conflict, hence they are run in two
+      // phases: blocks with an even floor(b/r) first and then the odd ones. No buffer is needed and every force is written
+      // by one thread at a time.
+      // Since the targets of a row are visited in increasing order, a cursor per row remembers the first edge of the next
+      // round. Rows with unsorted keys have no cursor and are scanned in every round
+      std::vector<row_iterator> cursors(sorted_rows ? n : 0);
+      for(int j = 0; j < int(cursors.size()); ++j){
+        cursors[j] = sparse_matrix[j].begin();
+      }
+      const int* block_begin_ptr = block_begin.data();
+      row_iterator* cursors_ptr = cursors.data();
+      const scalar_type* positions = _emb_positions;
+      const sparse_scalar_matrix* matrix_ptr = &sparse_matrix;
+
+      for(int r = 0; r < num_blocks; ++r){
+        for(int phase = 0; phase < ((r == 0) ? 1 : 2); ++phase){
+#ifdef __USE_GCD__
+          dispatch_apply(num_blocks-r, dispatch_get_global_queue(0, 0), ^(size_t b) {
+#else
+#pragma omp parallel for schedule(dynamic,1)
+          for(int b = 0; b < num_blocks-r; ++b) {
+#endif //__USE_GCD__
+            if(r == 0 || int(b/r)%2 == phase){
+              const int target_begin = block_begin_ptr[b+r];
+              const int target_end = block_begin_ptr[b+r+1];
+              for(int j = block_begin_ptr[b]; j < block_begin_ptr[b+1]; ++j){
+                const size_t ind1 = size_t(j) * dim;
+                const auto& row = (*matrix_ptr)[j];
+                row_iterator it = sorted_rows ? cursors_ptr[j] : row.begin();
+                for(; it != row.end(); ++it){
+                  const int target = int(it->first);
+                  assert(target > j);
+                  if(target >= target_end){
+                    if(sorted_rows) break;
+                    continue;
+                  }
+                  if(target < target_begin){
+                    continue;
+                  }
+                  // Compute pairwise distance and Q-value
+                  hp_scalar_type q_ij_1 = 1.0;
+                  const size_t ind2 = size_t(target) * dim;
+                  for(unsigned int d = 0; d < dim; d++){
+                    const hp_scalar_type diff = positions[ind1 + d] - positions[ind2 + d];
+                    q_ij_1 += diff * diff;
+                  }
+
+                  const hp_scalar_type res = hp_scalar_type(it->second) * scale / q_ij_1 / n;
+
+                  // Opposite forces on the two endpoints
+                  for(unsigned int d = 0; d < dim; d++){
+                    const hp_scalar_type force = res * hp_scalar_type(positions[ind1 + d] - positions[ind2 + d]);
+                    pos_f[ind1 + d] += force;
+                    pos_f[ind2 + d] -= force;
+                  }
+                }
+                if(sorted_rows){
+                  cursors_ptr[j] = it;
+                }
+              }
+            }
+          }
+#ifdef __USE_GCD__
+          );
+#endif
+        }
+      }
     }
 
   }
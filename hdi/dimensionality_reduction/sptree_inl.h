@@ -76,70 +76,42 @@
 namespace hdi{
   namespace dr{
 
-    //! Constructs cell
-    template <typename scalar_type>
-    SPTree<scalar_type>::Cell::Cell(unsigned int inp__emb_dimension) {
-      _emb_dimension = inp__emb_dimension;
-      corner = (hp_scalar_type*) malloc(_emb_dimension * sizeof(hp_scalar_type));
-      width  = (hp_scalar_type*) malloc(_emb_dimension * sizeof(hp_scalar_type));
-    }
-
-    template <typename scalar_type>
-    SPTree<scalar_type>::Cell::Cell(unsigned int inp__emb_dimension, hp_scalar_type* inp_corner, hp_scalar_type* inp_width) {
-      _emb_dimension = inp__emb_dimension;
-      corner = (hp_scalar_type*) malloc(_emb_dimension * sizeof(hp_scalar_type));
-      width  = (hp_scalar_type*) malloc(_emb_dimension * sizeof(hp_scalar_type));
-      for(int d = 0; d < _emb_dimension; d++) setCorner(d, inp_corner[d]);
-      for(int d = 0; d < _emb_dimension; d++) setWidth( d,  inp_width[d]);
-    }
-
-    //! Destructs cell
-    template <typename scalar_type>
-    SPTree<scalar_type>::Cell::~Cell() {
-      free(corner);
-      free(width);
-    }
-
-    template <typename scalar_type>
-    typename SPTree<scalar_type>::hp_scalar_type SPTree<scalar_type>::Cell::getCorner(unsigned int d) {
-      return corner[d];
-    }
-
-    template <typename scalar_type>
-    typename SPTree<scalar_type>::hp_scalar_type SPTree<scalar_type>::Cell::getWidth(unsigned int d) {
-      return width[d];
-    }
-
-    template <typename scalar_type>
-    void SPTree<scalar_type>::Cell::setCorner(unsigned int d, hp_scalar_type val) {
-      corner[d] = val;
-    }
-
-    template <typename scalar_type>
-    void SPTree<scalar_type>::Cell::setWidth(unsigned int d, hp_scalar_type val) {
-      width[d] = val;
+    template <typename scalar_type, typename node_scalar_type>
+    SPTree<scalar_type, node_scalar_type>::SPTree():
+      _emb_dimension(0),
+      _no_children(0),
+      _depth(0),
+      _emb_positions(nullptr),
+      _weights(nullptr)
+    {
     }
 
-    // Checks whether a point lies in a cell
-    template <typename scalar_type>
-    bool SPTree<scalar_type>::Cell::containsPoint(scalar_type point[])
+    template <typename scalar_type, typename node_scalar_type>
+    SPTree<scalar_type, node_scalar_type>::SPTree(unsigned int D, scalar_type* inp_data, unsigned int N, const scalar_type* weights):
+      _emb_dimension(0),
+      _no_children(0),
+      _depth(0),
+      _emb_positions(nullptr),
+      _weights(nullptr)
     {
-      for(int d = 0; d < _emb_dimension; d++) {
-        if(corner[d] - width[d] > point[d]) return false;
-        if(corner[d] + width[d] < point[d]) return false;
-      }
-      return true;
+      build(D, inp_data, N, weights);
     }
 
-/////////////////////////////////////////////////////////////////////////////////////////////
+    //! Build the tree breadth-first. 2D and 3D trees are built in parallel from the Morton codes of the points, the others by splitting the nodes in order
+    template <typename scalar_type, typename node_scalar_type>
+    void SPTree<scalar_type, node_scalar_type>::build(unsigned int D, scalar_type* inp_data, unsigned int N, const scalar_type* weights){
+      _emb_dimension = D;
+      _no_children = 1u << D;
+      _emb_positions = inp_data;
+      _weights = weights;
+
+      _points.resize(N);
+      _points_buffer.resize(N);
+      _child_count.resize(_no_children+1);
+      for(unsigned int n = 0; n < N; n++) _points[n] = n;
 
-    //! Default constructor for SPTree -- build tree, too!
-    template <typename scalar_type>
-    SPTree<scalar_type>::SPTree(unsigned int D, scalar_type* inp_data, unsigned int N){
       // Compute mean, width, and height of current map (boundaries of SPTree)
-      hp_scalar_type* mean_Y = (hp_scalar_type*) malloc(D * sizeof(hp_scalar_type)); for(unsigned int d = 0; d < D; d++) mean_Y[d] = .0;
-      hp_scalar_type*  min_Y = (hp_scalar_type*) malloc(D * sizeof(hp_scalar_type)); for(unsigned int d = 0; d < D; d++)  min_Y[d] =  DBL_MAX;
-      hp_scalar_type*  max_Y = (hp_scalar_type*) malloc(D * sizeof(hp_scalar_type)); for(unsigned int d = 0; d < D; d++)  max_Y[d] = -DBL_MAX;
+      std::vector<hp_scalar_type> mean_Y(D,.0), min_Y(D,DBL_MAX), max_Y(D,-DBL_MAX);
       for(unsigned int n = 0; n < N; n++) {
         for(unsigned int d = 0; d < D; d++) {
           mean_Y[d] += inp_data[n * D + d];
@@ -147,322 +119,422 @@ namespace hdi{
           if(inp_data[n * D + d] > max_Y[d]) max_Y[d] = inp_data[n * D + d];
         }
       }
-      for(int d = 0; d < D; d++) mean_Y[d] /= (hp_scalar_type) N;
-
-      // Construct SPTree
-      hp_scalar_type* width = (hp_scalar_type*) malloc(D * sizeof(hp_scalar_type));
-      for(int d = 0; d < D; d++)
-        //width[d] = fmax(max_Y[d] - mean_Y[d], mean_Y[d] - min_Y[d]) + 1e-5; //C++11
-          width[d] = std::max(max_Y[d] - mean_Y[d], mean_Y[d] - min_Y[d]) + 1e-5;
-      init(NULL, D, inp_data, mean_Y, width);
-      fill(N);
-
-      // Clean up memory
-      free(mean_Y);
-      free(max_Y);
-      free(min_Y);
-      free(width);
-    }
-
-    //! Constructor for SPTree with particular size and parent -- build the tree, too!
-    template <typename scalar_type>
-    SPTree<scalar_type>::SPTree(unsigned int D, scalar_type* inp_data, unsigned int N, hp_scalar_type* inp_corner, hp_scalar_type* inp_width){
-      init(NULL, D, inp_data, inp_corner, inp_width);
-      fill(N);
+      for(unsigned int d = 0; d < D; d++) mean_Y[d] /= (hp_scalar_type) N;
+
+      // Root node
+      resizeNodes(1);
+      _max_width[0] = 0;
+      for(unsigned int d = 0; d < D; d++) {
+        _corner[d] = mean_Y[d];
+        _width[d] = std::max(max_Y[d] - mean_Y[d], mean_Y[d] - min_Y[d]) + 1e-5;
+        _max_width[0] = std::max(_max_width[0], node_scalar_type(_width[d]));
+      }
+      _first_child[0] = 0;
+      _cum_size[0] = N;
+      _points_begin[0] = 0;
+
+      std::vector<unsigned int>& level_begin = _level_begin;
+      level_begin.assign(1,0);
+      if(D == 2 || D == 3){
+        buildFromMortonCodes(level_begin);
+      }else{
+        unsigned int level_end = 1;
+        for(unsigned int node = 0; node < _cum_size.size(); ++node){
+          if(node == level_end){
+            level_begin.push_back(level_end);
+            level_end = _cum_size.size();
+          }
+          subdivide(node);
+        }
+        level_begin.push_back(level_end);
+      }
+      _depth = level_begin.size() - 1;
+      computeCentersOfMass(level_begin);
     }
 
-    //! Constructor for SPTree with particular size (do not fill the tree)
-    template <typename scalar_type>
-    SPTree<scalar_type>::SPTree(unsigned int D, scalar_type* inp_data, hp_scalar_type* inp_corner, hp_scalar_type* inp_width){
-      init(NULL, D, inp_data, inp_corner, inp_width);
+    template <typename scalar_type, typename node_scalar_type>
+    void SPTree<scalar_type, node_scalar_type>::resizeNodes(unsigned int num_nodes){
+      _first_child.resize(num_nodes);
+      _cum_size.resize(num_nodes);
+      _points_begin.resize(num_nodes);
+      _mass.resize(num_nodes);
+      _max_width.resize(num_nodes);
+      _center_of_mass.resize(size_t(num_nodes) * _emb_dimension);
+      const unsigned int num_boxes = isBuiltBySplitting() ? num_nodes : 1;
+      _corner.resize(size_t(num_boxes) * _emb_dimension);
+      _width.resize(size_t(num_boxes) * _emb_dimension);
     }
 
-    //! Constructor for SPTree with particular size and parent (do not fill tree)
-    template <typename scalar_type>
-    SPTree<scalar_type>::SPTree(SPTree* inp_parent, unsigned int D, scalar_type* inp_data, hp_scalar_type* inp_corner, hp_scalar_type* inp_width){
-      init(inp_parent, D, inp_data, inp_corner, inp_width);
+    //! Initialize the children of a node. The points of the child c are in [child_begin[c], child_begin[c+1])
+    template <typename scalar_type, typename node_scalar_type>
+    void SPTree<scalar_type, node_scalar_type>::initializeChildren(unsigned int node, unsigned int first_child, const unsigned int* child_begin){
+      const unsigned int D = _emb_dimension;
+      _first_child[node] = first_child;
+      for(unsigned int c = 0; c < _no_children; ++c){
+        const unsigned int child = first_child + c;
+        _first_child[child] = 0;
+        _cum_size[child] = child_begin[c+1] - child_begin[c];
+        _points_begin[child] = child_begin[c];
+        _max_width[child] = .5 * _max_width[node];
+        if(!isBuiltBySplitting()) continue;
+        for(unsigned int d = 0; d < D; d++){
+          const hp_scalar_type width = .5 * _width[size_t(node) * D + d];
+          const hp_scalar_type corner = _corner[size_t(node) * D + d];
+          _width[size_t(child) * D + d] = width;
+          _corner[size_t(child) * D + d] = ((c >> d) & 1) ? corner - width : corner + width;
+        }
+      }
     }
 
-    //! Constructor for SPTree with particular size and parent -- build the tree, too!
-    template <typename scalar_type>
-    SPTree<scalar_type>::SPTree(SPTree* inp_parent, unsigned int D, scalar_type* inp_data, unsigned int N, hp_scalar_type* inp_corner, hp_scalar_type* inp_width){
-      init(inp_parent, D, inp_data, inp_corner, inp_width);
-      fill(N);
-    }
+    //! If a node contains more than one distinct point, split it in _no_children children
+    template <typename scalar_type, typename node_scalar_type>
+    void SPTree<scalar_type, node_scalar_type>::subdivide(unsigned int node){
+      const unsigned int D = _emb_dimension;
+      const unsigned int begin = _points_begin[node];
+      const unsigned int end = begin + _cum_size[node];
+      if(end - begin < 2){
+        return;
+      }
 
-    //! Main initialization function
-    template <typename scalar_type>
-    void SPTree<scalar_type>::init(SPTree* inp_parent, unsigned int D, scalar_type* inp_data, hp_scalar_type* inp_corner, hp_scalar_type* inp_width){
-      parent = inp_parent;
-      _emb_dimension = D;
-      no_children = 2;
-      for(unsigned int d = 1; d < D; d++) no_children *= 2;
-      _emb_positions = inp_data;
-      is_leaf = true;
-      size = 0;
-      cum_size = 0;
+      bool any_distinct = false;
+      const scalar_type* first = _emb_positions + size_t(_points[begin]) * D;
+      for(unsigned int i = begin; i < end && !any_distinct; ++i){
+        const scalar_type* point = _emb_positions + size_t(_points[i]) * D;
+        for(unsigned int d = 0; d < D; d++){
+          any_distinct = any_distinct || (point[d] != first[d]);
+        }
+      }
 
-      boundary = new Cell(_emb_dimension);
-      for(unsigned int d = 0; d < D; d++) boundary->setCorner(d, inp_corner[d]);
-      for(unsigned int d = 0; d < D; d++) boundary->setWidth( d, inp_width[d]);
+      // Leaf with a single point, possibly repeated
+      if(!any_distinct){
+        return;
+      }
 
-      children = (SPTree**) malloc(no_children * sizeof(SPTree*));
-      for(unsigned int i = 0; i < no_children; i++) children[i] = NULL;
+      // Stable partition of the points among the children
+      std::fill(_child_count.begin(), _child_count.end(), 0);
+      for(unsigned int i = begin; i < end; ++i){
+        ++_child_count[childOf(node, _points[i]) + 1];
+      }
+      _child_count[0] = begin;
+      for(unsigned int c = 0; c < _no_children; ++c) _child_count[c+1] += _child_count[c];
 
-      _center_of_mass = (hp_scalar_type*) malloc(D * sizeof(hp_scalar_type));
-      for(unsigned int d = 0; d < D; d++) _center_of_mass[d] = .0;
-      //buff = (hp_scalar_type*) malloc(D * sizeof(hp_scalar_type));
-    }
+      const unsigned int first_child = _cum_size.size();
+      resizeNodes(first_child + _no_children);
+      initializeChildren(node, first_child, _child_count.data());
 
-    // Destructor for SPTree
-    template <typename scalar_type>
-    SPTree<scalar_type>::~SPTree()
-    {
-      for(unsigned int i = 0; i < no_children; i++) {
-        if(children[i] != NULL) delete children[i];
+      for(unsigned int i = begin; i < end; ++i){
+        const unsigned int child = childOf(node, _points[i]);
+        _points_buffer[_child_count[child]++] = _points[i];
       }
-      free(children);
-      free(_center_of_mass);
-      //free(buff);
-      delete boundary;
+      std::copy(_points_buffer.begin() + begin, _points_buffer.begin() + end, _points.begin() + begin);
     }
 
-    // Update the _emb_positions underlying this tree
-    template <typename scalar_type>
-    void SPTree<scalar_type>::setData(scalar_type* inp_data)
-    {
-      _emb_positions = inp_data;
+    //! Child of a node containing a point. A point goes on the lower side of dimension d if the bit d of the child is set
+    template <typename scalar_type, typename node_scalar_type>
+    unsigned int SPTree<scalar_type, node_scalar_type>::childOf(unsigned int node, unsigned int point_index)const{
+      const scalar_type* point = _emb_positions + size_t(point_index) * _emb_dimension;
+      const hp_scalar_type* corner = _corner.data() + size_t(node) * _emb_dimension;
+      unsigned int child = 0;
+      for(unsigned int d = 0; d < _emb_dimension; d++){
+        if(point[d] < corner[d]) child |= (1u << d);
+      }
+      return child;
     }
 
-    // Get the parent of the current tree
-    template <typename scalar_type>
-    SPTree<scalar_type>* SPTree<scalar_type>::getParent()
-    {
-      return parent;
+    //! Interleave the bits of a coordinate with D-1 zeros
+    template <typename scalar_type, typename node_scalar_type>
+    uint64_t SPTree<scalar_type, node_scalar_type>::spreadBits(uint64_t v, unsigned int D){
+      if(D == 2){
+        v &= 0x00000000ffffffffull;
+        v = (v | (v << 16)) & 0x0000ffff0000ffffull;
+        v = (v | (v << 8))  & 0x00ff00ff00ff00ffull;
+        v = (v | (v << 4))  & 0x0f0f0f0f0f0f0f0full;
+        v = (v | (v << 2))  & 0x3333333333333333ull;
+        v = (v | (v << 1))  & 0x5555555555555555ull;
+      }else{
+        v &= 0x00000000001fffffull;
+        v = (v | (v << 32)) & 0x001f00000000ffffull;
+        v = (v | (v << 16)) & 0x001f0000ff0000ffull;
+        v = (v | (v << 8))  & 0x100f00f00f00f00full;
+        v = (v | (v << 4))  & 0x10c30c30c30c30c3ull;
+        v = (v | (v << 2))  & 0x1249249249249249ull;
+      }
+      return v;
     }
 
-    // Insert a point into the SPTree
-    template <typename scalar_type>
-    bool SPTree<scalar_type>::insert(unsigned int new_index)
-    {
-    //#pragma critical
-      {
-        // Ignore objects which do not belong in this quad tree
-        scalar_type* point = _emb_positions + new_index * _emb_dimension;
-        if(!boundary->containsPoint(point))
-          return false;
-
-        // Online update of cumulative size and center-of-mass
-        cum_size++;
-        hp_scalar_type mult1 = (hp_scalar_type) (cum_size - 1) / (hp_scalar_type) cum_size;
-        hp_scalar_type mult2 = 1.0 / (hp_scalar_type) cum_size;
-        for(unsigned int d = 0; d < _emb_dimension; d++) _center_of_mass[d] *= mult1;
-        for(unsigned int d = 0; d < _emb_dimension; d++) _center_of_mass[d] += mult2 * point[d];
-
-        // If there is space in this quad tree and it is a leaf, add the object here
-        if(is_leaf && size < QT_NODE_CAPACITY) {
-          index[size] = new_index;
-          size++;
-          return true;
+    //! Build a 2D or 3D tree level by level. The points are sorted by Morton code, hence the points of a node are contiguous and
+    //! the children of a node are found with a binary search on the digit of their level. The nodes of a level are initialized in parallel
+    template <typename scalar_type, typename node_scalar_type>
+    void SPTree<scalar_type, node_scalar_type>::buildFromMortonCodes(std::vector<unsigned int>& level_begin){
+      const unsigned int D = _emb_dimension;
+      const unsigned int N = _points.size();
+      const unsigned int no_children = _no_children;
+      const unsigned int bits = (D == 2) ? 31 : 21;
+      const uint64_t max_coordinate = (uint64_t(1) << bits) - 1;
+      const hp_scalar_type scale = hp_scalar_type(uint64_t(1) << bits);
+
+      // Morton codes. The coordinates are measured from the upper corner, hence the bit d of a digit is set on the lower side as in childOf
+      _codes.resize(N);
+      _codes_buffer.resize(N);
+      uint64_t* codes = _codes.data();
+      const scalar_type* positions = _emb_positions;
+      const hp_scalar_type* root_corner = _corner.data();
+      const hp_scalar_type* root_width = _width.data();
+#ifdef __USE_GCD__
+      dispatch_apply(N, dispatch_get_global_queue(0, 0), ^(size_t i) {
+#else
+#pragma omp parallel for
+      for(int i = 0; i < int(N); ++i) {
+#endif //__USE_GCD__
+        uint64_t code = 0;
+        for(unsigned int d = 0; d < D; d++){
+          const hp_scalar_type x = (root_corner[d] + root_width[d] - positions[size_t(i) * D + d]) / (2 * root_width[d]) * scale;
+          const uint64_t coordinate = (x <= 0) ? 0 : std::min(max_coordinate, uint64_t(x));
+          code |= spreadBits(coordinate, D) << d;
+        }
+        codes[i] = code;
+      }
+#ifdef __USE_GCD__
+      );
+#endif
+      sortByMortonCodes(bits * D);
+      codes = _codes.data();
+
+      std::vector<unsigned int> split_offset;
+      unsigned int level_end = 1;
+      for(unsigned int level = 0; level < bits; ++level){
+        const unsigned int begin = level_begin.back();
+        const unsigned int level_size = level_end - begin;
+
+        // Nodes with more than one distinct code are split, the offsets of their children are a prefix sum
+        split_offset.assign(level_size + 1, 0);
+        for(unsigned int i = 0; i < level_size; ++i){
+          const unsigned int node = begin + i;
+          const unsigned int first = _points_begin[node];
+          const unsigned int last = first + _cum_size[node];
+          split_offset[i+1] = split_offset[i] + ((last - first > 1 && codes[first] != codes[last-1]) ? 1 : 0);
         }
+        if(split_offset[level_size] == 0){
+          break;
+        }
+        resizeNodes(level_end + split_offset[level_size] * no_children);
 
-        // Don't add duplicates for now (this is not very nice)
-        bool any_duplicate = false;
-        for(unsigned int n = 0; n < size; n++) {
-          bool duplicate = true;
-          for(unsigned int d = 0; d < _emb_dimension; d++) {
-            if(point[d] != _emb_positions[index[n] * _emb_dimension + d]) { duplicate = false; break; }
+        const unsigned int shift = (bits - 1 - level) * D;
+        const unsigned int* split_offset_ptr = split_offset.data();
+#ifdef __USE_GCD__
+        dispatch_apply(level_size, dispatch_get_global_queue(0, 0), ^(size_t i) {
+#else
+#pragma omp parallel for
+        for(int i = 0; i < int(level_size); ++i) {
+#endif //__USE_GCD__
+          if(split_offset_ptr[i] != split_offset_ptr[i+1]){
+            const unsigned int node = begin + i;
+            const unsigned int first = _points_begin[node];
+            const unsigned int last = first + _cum_size[node];
+            unsigned int child_begin[9];
+            child_begin[0] = first;
+            for(unsigned int c = 0; c < no_children; ++c){
+              child_begin[c+1] = std::upper_bound(codes + child_begin[c], codes + last, uint64_t(c),
+                                                  [shift,no_children](uint64_t digit, uint64_t code){return digit < ((code >> shift) & (no_children - 1));}) - codes;
+            }
+            initializeChildren(node, level_end + split_offset_ptr[i] * no_children, child_begin);
           }
-          any_duplicate = any_duplicate | duplicate;
         }
-        if(any_duplicate) return true;
+#ifdef __USE_GCD__
+        );
+#endif
+        level_begin.push_back(level_end);
+        level_end = _cum_size.size();
+      }
+      level_begin.push_back(level_end);
+    }
+
+    //! Stable LSD radix sort of the points by Morton code. Every block of points builds its own histogram, hence the digits are scattered in parallel
+    template <typename scalar_type, typename node_scalar_type>
+    void SPTree<scalar_type, node_scalar_type>::sortByMortonCodes(unsigned int bits){
+      const unsigned int N = _points.size();
+      const unsigned int radix_bits = 8;
+      const unsigned int radix = 1u << radix_bits;
+      const unsigned int num_blocks = std::max<unsigned int>(1, std::min<unsigned int>(N / 4096 + 1, std::thread::hardware_concurrency()));
+      const unsigned int block_size = (N + num_blocks - 1) / num_blocks;
+
+      std::vector<unsigned int> histograms(size_t(num_blocks) * radix);
+      unsigned int* histograms_ptr = histograms.data();
+      for(unsigned int shift = 0; shift < bits; shift += radix_bits){
+        const uint64_t* codes = _codes.data();
+        const unsigned int* points = _points.data();
+        uint64_t* sorted_codes = _codes_buffer.data();
+        unsigned int* sorted_points = _points_buffer.data();
 
-        // Otherwise, we need to subdivide the current cell
-        if(is_leaf) subdivide();
+#ifdef __USE_GCD__
+        dispatch_apply(num_blocks, dispatch_get_global_queue(0, 0), ^(size_t b) {
+#else
+#pragma omp parallel for schedule(static,1)
+        for(int b = 0; b < int(num_blocks); ++b) {
+#endif //__USE_GCD__
+          unsigned int* histogram = histograms_ptr + size_t(b) * radix;
+          std::fill(histogram, histogram + radix, 0);
+          const unsigned int end = std::min(N, (b+1) * block_size);
+          for(unsigned int i = b * block_size; i < end; ++i){
+            ++histogram[(codes[i] >> shift) & (radix - 1)];
+          }
+        }
+#ifdef __USE_GCD__
+        );
+#endif
 
-        // Find out where the point can be inserted
-        for(unsigned int i = 0; i < no_children; i++) {
-          if(children[i]->insert(new_index)) return true;
+        // Offsets ordered by digit and then by block
+        unsigned int offset = 0;
+        for(unsigned int digit = 0; digit < radix; ++digit){
+          for(unsigned int b = 0; b < num_blocks; ++b){
+            const unsigned int count = histograms[size_t(b) * radix + digit];
+            histograms[size_t(b) * radix + digit] = offset;
+            offset += count;
+          }
         }
 
-        // Otherwise, the point cannot be inserted (this should never happen)
-        return false;
+#ifdef __USE_GCD__
+        dispatch_apply(num_blocks, dispatch_get_global_queue(0, 0), ^(size_t b) {
+#else
+#pragma omp parallel for schedule(static,1)
+        for(int b = 0; b < int(num_blocks); ++b) {
+#endif //__USE_GCD__
+          unsigned int* histogram = histograms_ptr + size_t(b) * radix;
+          const unsigned int end = std::min(N, (b+1) * block_size);
+          for(unsigned int i = b * block_size; i < end; ++i){
+            const unsigned int pos = histogram[(codes[i] >> shift) & (radix - 1)]++;
+            sorted_codes[pos] = codes[i];
+            sorted_points[pos] = points[i];
+          }
+        }
+#ifdef __USE_GCD__
+        );
+#endif
+        _codes.swap(_codes_buffer);
+        _points.swap(_points_buffer);
       }
     }
 
-    // Create four children which fully divide this cell into four quads of equal area
-    template <typename scalar_type>
-    void SPTree<scalar_type>::subdivide() {
-
-      // Create new children
-      hp_scalar_type* new_corner = (hp_scalar_type*) malloc(_emb_dimension * sizeof(hp_scalar_type));
-      hp_scalar_type* new_width  = (hp_scalar_type*) malloc(_emb_dimension * sizeof(hp_scalar_type));
-      for(unsigned int i = 0; i < no_children; i++) {
-        unsigned int div = 1;
-        for(unsigned int d = 0; d < _emb_dimension; d++) {
-          new_width[d] = .5 * boundary->getWidth(d);
-          if((i / div) % 2 == 1) new_corner[d] = boundary->getCorner(d) - .5 * boundary->getWidth(d);
-          else           new_corner[d] = boundary->getCorner(d) + .5 * boundary->getWidth(d);
-          div *= 2;
-        }
-        children[i] = new SPTree(this, _emb_dimension, _emb_positions, new_corner, new_width);
-      }
-      free(new_corner);
-      free(new_width);
-
-      // Move existing points to correct children
-      for(unsigned int i = 0; i < size; i++) {
-        bool success = false;
-        for(unsigned int j = 0; j < no_children; j++) {
-          if(!success) success = children[j]->insert(index[i]);
+    //! Mass and center of mass of the nodes, from the deepest level to the root. The nodes of a level are reduced in parallel
+    template <typename scalar_type, typename node_scalar_type>
+    void SPTree<scalar_type, node_scalar_type>::computeCentersOfMass(const std::vector<unsigned int>& level_begin){
+      const unsigned int D = _emb_dimension;
+      for(int level = int(level_begin.size()) - 2; level >= 0; --level){
+        const unsigned int begin = level_begin[level];
+        const unsigned int level_size = level_begin[level+1] - begin;
+#ifdef __USE_GCD__
+        dispatch_apply(level_size, dispatch_get_global_queue(0, 0), ^(size_t i) {
+#else
+#pragma omp parallel for
+        for(int i = 0; i < int(level_size); ++i) {
+#endif //__USE_GCD__
+          const unsigned int node = begin + i;
+          node_scalar_type* com = _center_of_mass.data() + size_t(node) * D;
+          hp_scalar_type mass = 0;
+          for(unsigned int d = 0; d < D; d++) com[d] = 0;
+          if(_first_child[node] == 0){
+            for(unsigned int p = _points_begin[node]; p < _points_begin[node] + _cum_size[node]; ++p){
+              const hp_scalar_type weight = (_weights == nullptr) ? 1 : _weights[_points[p]];
+              const scalar_type* point = _emb_positions + size_t(_points[p]) * D;
+              mass += weight;
+              for(unsigned int d = 0; d < D; d++) com[d] += weight * point[d];
+            }
+          }else{
+            for(unsigned int c = _first_child[node]; c < _first_child[node] + _no_children; ++c){
+              const node_scalar_type* child_com = _center_of_mass.data() + size_t(c) * D;
+              mass += _mass[c];
+              for(unsigned int d = 0; d < D; d++) com[d] += _mass[c] * child_com[d];
+            }
+          }
+          if(mass != 0){
+            for(unsigned int d = 0; d < D; d++) com[d] /= mass;
+          }
+          _mass[node] = mass;
         }
-        index[i] = -1;
+#ifdef __USE_GCD__
+        );
+#endif
       }
-
-      // Empty parent node
-      size = 0;
-      is_leaf = false;
     }
 
-    // Build SPTree on dataset
-    template <typename scalar_type>
-    void SPTree<scalar_type>::fill(unsigned int N)
+    // Update the _emb_positions underlying this tree
+    template <typename scalar_type, typename node_scalar_type>
+    void SPTree<scalar_type, node_scalar_type>::setData(scalar_type* inp_data)
     {
-      int i = 0;
-    //#pragma omp parallel for
-      for(i = 0; i < N; i++)
-        insert(i);
+      _emb_positions = inp_data;
     }
 
-    // Checks whether the specified tree is correct
-    template <typename scalar_type>
-    bool SPTree<scalar_type>::isCorrect()
+    // Checks whether the specified tree is correct. Points can be assigned to a neighboring cell by the rounding of their Morton code.
+    // The boxes of the nodes are computed from the box of the root, parents are stored before their children
+    template <typename scalar_type, typename node_scalar_type>
+    bool SPTree<scalar_type, node_scalar_type>::isCorrect()const
     {
-      for(unsigned int n = 0; n < size; n++) {
-        scalar_type* point = _emb_positions + index[n] * _emb_dimension;
-        if(!boundary->containsPoint(point)) return false;
-      }
-      if(!is_leaf) {
-        bool correct = true;
-        for(int i = 0; i < no_children; i++) correct = correct && children[i]->isCorrect();
-        return correct;
+      const unsigned int D = _emb_dimension;
+      std::vector<hp_scalar_type> corners(_cum_size.size() * size_t(D)), widths(_cum_size.size() * size_t(D));
+      std::copy(_corner.begin(), _corner.begin() + D, corners.begin());
+      std::copy(_width.begin(), _width.begin() + D, widths.begin());
+      for(unsigned int node = 0; node < _cum_size.size(); ++node){
+        for(unsigned int c = 0; _first_child[node] != 0 && c < _no_children; ++c){
+          const unsigned int child = _first_child[node] + c;
+          for(unsigned int d = 0; d < D; d++){
+            const hp_scalar_type width = .5 * widths[size_t(node) * D + d];
+            const hp_scalar_type corner = corners[size_t(node) * D + d];
+            widths[size_t(child) * D + d] = width;
+            corners[size_t(child) * D + d] = ((c >> d) & 1) ? corner - width : corner + width;
+          }
+        }
+        for(unsigned int i = _points_begin[node]; i < _points_begin[node] + _cum_size[node]; ++i){
+          const scalar_type* point = _emb_positions + size_t(_points[i]) * D;
+          for(unsigned int d = 0; d < D; d++) {
+            const hp_scalar_type corner = corners[size_t(node) * D + d];
+            const hp_scalar_type width = widths[size_t(node) * D + d];
+            const hp_scalar_type tolerance = 1e-12 * widths[d];
+            if(corner - width - tolerance > point[d]) return false;
+            if(corner + width + tolerance < point[d]) return false;
+          }
+        }
+        if(_first_child[node] != 0){
+          unsigned int cum_size = 0;
+          for(unsigned int c = 0; c < _no_children; ++c) cum_size += _cum_size[_first_child[node] + c];
+          if(cum_size != _cum_size[node]) return false;
+        }
       }
-      else return true;
-    }
-
-    // Build a list of all indices in SPTree
-    template <typename scalar_type>
-    void SPTree<scalar_type>::getAllIndices(unsigned int* indices)
-    {
-      getAllIndices(indices, 0);
+      return true;
     }
 
-    // Build a list of all indices in SPTree
-    template <typename scalar_type>
-    unsigned int SPTree<scalar_type>::getAllIndices(unsigned int* indices, unsigned int loc)
+    template <typename scalar_type, typename node_scalar_type>
+    double SPTree<scalar_type, node_scalar_type>::memoryOccupation()const
     {
-
-      // Gather indices in current quadrant
-      for(unsigned int i = 0; i < size; i++) indices[loc + i] = index[i];
-      loc += size;
-
-      // Gather indices in children
-      if(!is_leaf) {
-        for(int i = 0; i < no_children; i++) loc = children[i]->getAllIndices(indices, loc);
-      }
-      return loc;
-    }
-
-    template <typename scalar_type>
-    unsigned int SPTree<scalar_type>::getDepth() {
-      if(is_leaf) return 1;
-      unsigned int depth = 0;
-      for(unsigned int i = 0; i < no_children; i++)
-        //depth = fmax(depth, children[i]->getDepth()); //C++11
-        depth = std::max(depth, children[i]->getDepth());
-      return 1 + depth;
+      const double node_data = double(_mass.capacity() + _center_of_mass.capacity() + _max_width.capacity()) * sizeof(node_scalar_type);
+      const double construction_data = double(_corner.capacity() + _width.capacity()) * sizeof(hp_scalar_type);
+      const double traversal_data = double(_node_f.capacity()) * sizeof(hp_scalar_type);
+      const double indices = double(_first_child.capacity() + _cum_size.capacity() + _points_begin.capacity() + _level_begin.capacity() + _points.capacity() + _points_buffer.capacity() + _child_count.capacity()) * sizeof(unsigned int)
+                           + double(_codes.capacity() + _codes_buffer.capacity()) * sizeof(uint64_t);
+      return (node_data + construction_data + traversal_data + indices) / 1024 / 1024;
     }
 
-    // Compute non-edge forces using Barnes-Hut algorithm
-    template <typename scalar_type>
-    void SPTree<scalar_type>::computeNonEdgeForcesOMP(unsigned int point_index, hp_scalar_type theta, hp_scalar_type neg_f[], hp_scalar_type& sum_Q)const
+    // Build a list of all indices in SPTree. Duplicated points are listed once
+    template <typename scalar_type, typename node_scalar_type>
+    void SPTree<scalar_type, node_scalar_type>::getAllIndices(unsigned int* indices)const
     {
-      std::vector<hp_scalar_type> buff(_emb_dimension,0);
-      // Make sure that we spend no time on empty nodes or self-interactions
-      if(cum_size == 0 || (is_leaf && size == 1 && index[0] == point_index)) return;
-
-      // Compute distance between point and center-of-mass
-      hp_scalar_type D = .0;
-      unsigned int ind = point_index * _emb_dimension;
-      for(unsigned int d = 0; d < _emb_dimension; d++) buff[d] = _emb_positions[ind + d] - _center_of_mass[d];
-      for(unsigned int d = 0; d < _emb_dimension; d++) D += buff[d] * buff[d];
-
-      // Check whether we can use this node as a "summary"
-      hp_scalar_type max_width = 0.0;
-      hp_scalar_type cur_width;
-      for(unsigned int d = 0; d < _emb_dimension; d++) {
-        cur_width = boundary->getWidth(d);
-        max_width = (max_width > cur_width) ? max_width : cur_width;
-      }
-      if(is_leaf || max_width / sqrt(D) < theta) {
-
-        // Compute and add t-SNE force between point and current node
-        D = 1.0 / (1.0 + D);
-        hp_scalar_type mult = cum_size * D;
-        sum_Q += mult;
-
-        mult *= D;
-        for(unsigned int d = 0; d < _emb_dimension; d++) neg_f[d] += mult * buff[d];
-      }
-      else {
-
-        // Recursively apply Barnes-Hut to children
-        for(unsigned int i = 0; i < no_children; i++) children[i]->computeNonEdgeForcesOMP(point_index, theta, neg_f, sum_Q);
+      unsigned int loc = 0;
+      for(unsigned int node = 0; node < _cum_size.size(); ++node){
+        if(_first_child[node] == 0 && _cum_size[node] != 0){
+          indices[loc++] = _points[_points_begin[node]];
+        }
       }
     }
 
     // Compute non-edge forces using Barnes-Hut algorithm
-    template <typename scalar_type>
-    void SPTree<scalar_type>::computeNonEdgeForces(unsigned int point_index, hp_scalar_type theta, hp_scalar_type neg_f[], hp_scalar_type* sum_Q)const
+    template <typename scalar_type, typename node_scalar_type>
+    void SPTree<scalar_type, node_scalar_type>::computeNonEdgeForces(unsigned int point_index, hp_scalar_type theta, hp_scalar_type neg_f[], hp_scalar_type* sum_Q)const
     {
-
-      std::vector<hp_scalar_type> buff(_emb_dimension,0);
-      // Make sure that we spend no time on empty nodes or self-interactions
-      if(cum_size == 0 || (is_leaf && size == 1 && index[0] == point_index)) return;
-
-      // Compute distance between point and center-of-mass
-      hp_scalar_type D = .0;
-      unsigned int ind = point_index * _emb_dimension;
-      for(unsigned int d = 0; d < _emb_dimension; d++) buff[d] = _emb_positions[ind + d] - _center_of_mass[d];
-      for(unsigned int d = 0; d < _emb_dimension; d++) D += buff[d] * buff[d];
-
-      // Check whether we can use this node as a "summary"
-      hp_scalar_type max_width = 0.0;
-      hp_scalar_type cur_width;
-      for(unsigned int d = 0; d < _emb_dimension; d++) {
-        cur_width = boundary->getWidth(d);
-        max_width = (max_width > cur_width) ? max_width : cur_width;
-      }
-      if(is_leaf || max_width / sqrt(D) < theta) {
-
-        // Compute and add t-SNE force between point and current node
-        D = 1.0 / (1.0 + D);
-        hp_scalar_type mult = cum_size * D;
-        *sum_Q += mult;
-
-        mult *= D;
-        for(unsigned int d = 0; d < _emb_dimension; d++) neg_f[d] += mult * buff[d];
-      }
-      else {
-
-        // Recursively apply Barnes-Hut to children
-        for(unsigned int i = 0; i < no_children; i++) children[i]->computeNonEdgeForces(point_index, theta, neg_f, sum_Q);
-      }
+      computeNonEdgeForcesOMP(point_index, theta, neg_f, *sum_Q);
     }
 
     // Computes edge forces
-    template <typename scalar_type>
-    void SPTree<scalar_type>::computeEdgeForces(unsigned int* row_P, unsigned int* col_P, hp_scalar_type* val_P, hp_scalar_type multiplier, int N, hp_scalar_type* pos_f)const
+    template <typename scalar_type, typename node_scalar_type>
+    void SPTree<scalar_type, node_scalar_type>::computeEdgeForces(unsigned int* row_P, unsigned int* col_P, hp_scalar_type* val_P, hp_scalar_type multiplier, int N, hp_scalar_type* pos_f)const
     {
 #ifdef __USE_GCD__
       std::cout << "GCD dispatch, sptree_inl 468.\n";
@@ -564,29 +636,32 @@ namespace hdi{
     */
 
     //! Print out tree
-    template <typename scalar_type>
-    void SPTree<scalar_type>::print()
+    template <typename scalar_type, typename node_scalar_type>
+    void SPTree<scalar_type, node_scalar_type>::print()const
     {
-      if(cum_size == 0) {
+      print(0);
+    }
+
+    template <typename scalar_type, typename node_scalar_type>
+    void SPTree<scalar_type, node_scalar_type>::print(unsigned int node)const
+    {
+      if(_cum_size[node] == 0) {
         printf("Empty node\n");
         return;
       }
 
-      if(is_leaf) {
+      if(_first_child[node] == 0) {
+        const unsigned int index = _points[_points_begin[node]];
+        const scalar_type* point = _emb_positions + size_t(index) * _emb_dimension;
         printf("Leaf node; _emb_positions = [");
-        for(int i = 0; i < size; i++) {
-          scalar_type* point = _emb_positions + index[i] * _emb_dimension;
-          for(int d = 0; d < _emb_dimension; d++) printf("%f, ", point[d]);
-          printf(" (index = %d)", index[i]);
-          if(i < size - 1) printf("\n");
-          else printf("]\n");
-        }
+        for(unsigned int d = 0; d < _emb_dimension; d++) printf("%f, ", point[d]);
+        printf(" (index = %d)]\n", index);
       }
       else {
         printf("Intersection node with center-of-mass = [");
-        for(int d = 0; d < _emb_dimension; d++) printf("%f, ", _center_of_mass[d]);
+        for(unsigned int d = 0; d < _emb_dimension; d++) printf("%f, ", _center_of_mass[size_t(node) * _emb_dimension + d]);
         printf("]; children are:\n");
-        for(int i = 0; i < no_children; i++) children[i]->print();
+        for(unsigned int c = 0; c < _no_children; c++) print(_first_child[node] + c);
       }
     }
   }
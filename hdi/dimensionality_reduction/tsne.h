@@ -38,6 +38,7 @@
 #include "hdi/utils/assert_by_exception.h"
 #include "hdi/utils/abstract_log.h"
 #include "hdi/data/embedding.h"
+#include "exact_repulsion.h"
 
 namespace hdi{
   namespace dr{
@@ -114,8 +115,12 @@ namespace hdi{
       const scalar_vector_type& getDistancesSquared()const{ return _distances_squared; }
       //! Get P
       const scalar_vector_type& getDistributionP()const{ return _P; }
-      //! Get Q
+      //! Get Q (not normalized). Q is not used by the gradient descent, it is empty unless computeDistributionQ is called
       const scalar_vector_type& getDistributionQ()const{ return _Q; }
+      //! Materialize Q for the current embedding, it requires n^2 memory
+      void computeDistributionQ(){ computeLowDimensionalDistribution(); }
+      //! Release the memory used by a previous call to computeDistributionQ
+      void releaseDistributionQ(){ scalar_vector_type().swap(_Q); }
       //! Get Sigmas
       const scalar_vector_type& getSigmas()const{ return _sigmas; }
 
@@ -126,7 +131,7 @@ namespace hdi{
 
       //! Do an iteration of the gradient descent
       void doAnIteration(double mult = 1);
-      //! Compute the Kullback Leibler divergence
+      //! Compute the Kullback Leibler divergence. Q is recomputed on the fly and it is not stored
       double computeKullbackLeiblerDivergence();
     
 
@@ -141,7 +146,7 @@ namespace hdi{
       void initializeEmbeddingPosition(int seed, double multipleir = .0001);
       //! Compute Low-dimensional distribution
       void computeLowDimensionalDistribution();
-      //! Compute tSNE gradient
+      //! Compute tSNE gradient. Q is recomputed on the fly and it is not stored
       void computeGradient(double exaggeration);
       //! Update the embedding
       void updateTheEmbedding(double mult = 1.);
@@ -157,7 +162,7 @@ namespace hdi{
       bool _initialized; //! Initialization flag
 
       scalar_vector_type _P; //! Conditional probalility distribution in the High-dimensional space
-      scalar_vector_type _Q; //! Conditional probalility distribution in the Low-dimensional space
+      scalar_vector_type _Q; //! Conditional probalility distribution in the Low-dimensional space. Empty unless requested with computeDistributionQ
       scalar_type _normalization_Q; //! Normalization factor of Q - Z in the original paper
 
       scalar_vector_type _distances_squared; //! High-dimensional distances
@@ -167,6 +172,7 @@ namespace hdi{
       scalar_vector_type _gradient; //! Current gradient
       scalar_vector_type _previous_gradient; //! Previous gradient
       scalar_vector_type _gain; //! Gain
+      ExactRepulsion<scalar_type> _exact_repulsion; //! Exact repulsive forces, its storage is reused across iterations
 
 
       InitParams _init_params;
@@ -36,6 +36,7 @@
 
 #include "hdi/dimensionality_reduction/tsne.h"
 #include "hdi/utils/math_utils.h"
+#include "hdi/dimensionality_reduction/gradient_descent_utils.h"
 #include "hdi/utils/log_helper_functions.h"
 
 #include <time.h>
@@ -129,7 +130,6 @@ namespace hdi{
         int size_sq = size();
         size_sq *= size_sq;
         _P.resize(size_sq);
-        _Q.resize(size_sq);
         _distances_squared.resize(size_sq);
         _embedding->resize(params._embedding_dimensionality,size(),0);
         _embedding_container = &_embedding->getContainer();
@@ -185,29 +185,8 @@ namespace hdi{
     void TSNE<scalar_type>::computeGaussianDistributions(double perplexity){
       utils::secureLog(_logger,"Computing gaussian distributions...");
       const int n = size();
-#ifdef __USE_GCD__
-      std::cout << "GCD dispatch, tsne_inl 189.\n";
-      dispatch_apply(n, dispatch_get_global_queue(0, 0), ^(size_t j) {
-#else
-      #pragma omp parallel for
-      for(int j = 0; j < n; ++j){
-#endif //__USE_GCD__
-        const auto sigma =  utils::computeGaussianDistributionWithFixedPerplexity<scalar_vector_type>(
-                  _distances_squared.begin() + j*n,
-                  _distances_squared.begin() + (j + 1)*n,
-                  _P.begin() + j*n,
-                  _P.begin() + (j + 1)*n,
-                  perplexity,
-                  200,
-                  1e-5,
-                  j
-                );
-        _P[j*n + j] = 0.;
-        _sigmas[j] = static_cast<scalar_type>(sigma);
-      }
-#ifdef __USE_GCD__
-      );
-#endif
+      //Row j ignores the distance of the point to itself
+      utils::computeGaussianDistributionsWithFixedPerplexity<scalar_type>(_distances_squared.data(), _P.data(), n, n, perplexity, 200, 1e-5, 0, 1, _sigmas.data());
     }
 
     template <typename scalar_type>
@@ -266,9 +245,6 @@ namespace hdi{
         utils::secureLog(_logger,"Remove exaggeration...");
       }
 
-      //Compute Low-dimensional distribution
-      computeLowDimensionalDistribution();
-
       //Compute gradient of the KL function
       computeGradient((_iteration<_init_params._remove_exaggeration_iter)?_init_params._exaggeration_factor:1.);
 
@@ -279,6 +255,7 @@ namespace hdi{
     template <typename scalar_type>
     void TSNE<scalar_type>::computeLowDimensionalDistribution(){
       const int n = size();
+      _Q.resize(size_t(n)*n);
 #ifdef __USE_GCD__
       std::cout << "GCD dispatch, tsne_inl 283.\n";
       dispatch_apply(n, dispatch_get_global_queue(0, 0), ^(size_t j) {
@@ -315,24 +292,45 @@ namespace hdi{
     void TSNE<scalar_type>::computeGradient(double exaggeration){
       const int n = size();
       const int dim = _init_params._embedding_dimensionality;
+      const scalar_type* positions = _embedding_container->data();
 
-  //#pragma omp parallel for
+      //Repulsive forces and normalization in a single pass on the pairs of points
+      std::vector<double> negative_forces(size_t(n)*dim,0);
+      double sum_Q = 0;
+      _exact_repulsion.computeNonEdgeForces(dim, positions, n, negative_forces.data(), sum_Q);
+      _normalization_Q = static_cast<scalar_type>(sum_Q);
+
+      //Attractive forces, every row owns its part of the gradient
+#ifdef __USE_GCD__
+      dispatch_apply(n, dispatch_get_global_queue(0, 0), ^(size_t i) {
+#else
+      #pragma omp parallel for
       for(int i = 0; i < n; ++i){
-        for(int d = 0; d < dim; ++d){
-          _gradient[i * dim + d] = 0;
-          double sum_positive(0.);
-          double sum_negative(0.);
-          for(int j = 0; j < n; ++j){
-            const int idx = i*n + j;
-            const double distance((*_embedding_container)[i * dim + d] - (*_embedding_container)[j * dim + d]);
-            const double positive(_P[idx] * _Q[idx] * distance);
-            const double negative(_Q[idx] * _Q[idx] / _normalization_Q * distance);
-            sum_positive += positive;
-            sum_negative += negative;
+#endif //__USE_GCD__
+        std::vector<double> sum_positive(dim,0);
+        for(int j = 0; j < n; ++j){
+          const double p_ij = _P[size_t(i)*n + j];
+          if(i == j || p_ij == 0){
+            continue;
+          }
+          const double euclidean_dist_sq(
+              utils::euclideanDistanceSquared<scalar_type>(
+                positions+i*dim, positions+(i+1)*dim,
+                positions+j*dim, positions+(j+1)*dim
+              )
+            );
+          const double q_ij = 1./(1.+euclidean_dist_sq);
+          for(int d = 0; d < dim; ++d){
+            sum_positive[d] += p_ij * q_ij * (positions[i * dim + d] - positions[j * dim + d]);
           }
-          _gradient[i * dim + d] = static_cast<scalar_type>(4 * (exaggeration*sum_positive - sum_negative));
+        }
+        for(int d = 0; d < dim; ++d){
+          _gradient[i * dim + d] = static_cast<scalar_type>(4 * (exaggeration*sum_positive[d] - negative_forces[i * dim + d] / sum_Q));
         }
       }
+#ifdef __USE_GCD__
+      );
+#endif
 
     }
   
@@ -342,28 +340,38 @@ namespace hdi{
 
     template <typename scalar_type>
     void TSNE<scalar_type>::updateTheEmbedding(double mult){
-      for(int i = 0; i < _gradient.size(); ++i){
-        _gain[i] = static_cast<scalar_type>((sign(_gradient[i]) != sign(_previous_gradient[i])) ? (_gain[i] + .2) : (_gain[i] * .8));
-        if(_gain[i] < _init_params._minimum_gain){
-          _gain[i] = static_cast<scalar_type>(_init_params._minimum_gain);
-        }
-        _gradient[i] = static_cast<scalar_type>((_gradient[i]>0?1:-1)*std::abs(_gradient[i]*_init_params._eta* _gain[i])/(_init_params._eta*_gain[i]));
-
-        _previous_gradient[i] = static_cast<scalar_type>(((_iteration<_init_params._mom_switching_iter)?_init_params._momentum:_init_params._final_momentum) * _previous_gradient[i] - _init_params._eta * _gain[i] * _gradient[i]);
-        (*_embedding_container)[i] += _previous_gradient[i] * mult;
-      }
+      const unsigned int dim = _init_params._embedding_dimensionality;
+      const double momentum = (_iteration<_init_params._mom_switching_iter)?_init_params._momentum:_init_params._final_momentum;
+      gradientDescentStep(_gradient.data(), _previous_gradient.data(), _gain.data(), _embedding_container->data(), static_cast<unsigned int>(_gradient.size()/dim), dim,
+                          _init_params._eta, _init_params._minimum_gain, momentum, mult);
       ++_iteration;
     }
 
     template <typename scalar_type>
     double TSNE<scalar_type>::computeKullbackLeiblerDivergence(){
-      double kl = 0;
       const int n = size();
+      const int dim = _init_params._embedding_dimensionality;
+      const scalar_type* positions = _embedding_container->data();
+
+      //Normalization computed by the same pass used by the gradient, Q is not materialized
+      std::vector<double> negative_forces(size_t(n)*dim,0);
+      double sum_Q = 0;
+      _exact_repulsion.computeNonEdgeForces(dim, positions, n, negative_forces.data(), sum_Q);
+
+      double kl = 0;
+      #pragma omp parallel for reduction(+:kl)
       for(int j = 0; j < n; ++j){
         for(int i = 0; i < n; ++i){
           if(i == j)
             continue;
-          kl += _P[j*n + i] * std::log(_P[j*n + i] / (_Q[j*n + i]/_normalization_Q));
+          const double euclidean_dist_sq(
+              utils::euclideanDistanceSquared<scalar_type>(
+                positions+j*dim, positions+(j+1)*dim,
+                positions+i*dim, positions+(i+1)*dim
+              )
+            );
+          const double q = 1./(1.+euclidean_dist_sq);
+          kl += _P[j*n + i] * std::log(_P[j*n + i] / (q/sum_Q));
         }
       }
       return kl;
@@ -49,7 +49,8 @@ namespace hdi {
         _mom_switching_iter(250),
         _exaggeration_factor(4),
         _remove_exaggeration_iter(250),
-        _exponential_decay_iter(150)
+        _exponential_decay_iter(150),
+        _symmetric_storage(false)
       { }
 
       int _seed;
@@ -64,6 +65,7 @@ namespace hdi {
       double _exaggeration_factor;                //! exaggeration factor for the attractive forces. Note: it shouldn't be too high when few points are used
       unsigned int _remove_exaggeration_iter;     //! iterations with complete exaggeration of the attractive forces
       unsigned int _exponential_decay_iter;       //! iterations required to remove the exaggeration using an exponential decay
+      bool _symmetric_storage;                    //! only the upper triangle of the joint-probability distribution is stored, halving its memory (SparseTSNEUserDefProbabilities)
     };
   }
 }
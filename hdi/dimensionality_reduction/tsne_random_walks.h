@@ -37,6 +37,7 @@
 #include <stdint.h>
 #include "hdi/utils/assert_by_exception.h"
 #include "hdi/utils/abstract_log.h"
+#include "hdi/dimensionality_reduction/knn_graph_generator.h"
 
 namespace hdi{
   namespace dr{
@@ -72,6 +73,7 @@ namespace hdi{
         unsigned int _number_of_landmarks;
         unsigned int _num_walks_per_landmark;
         bool _distance_weighted_random_walk;
+        KNNBackend _knn_backend; //! Engine used for the computation of the neighborhood graph
       };
 
       //! Collection of statistics on the algorithm
@@ -36,32 +36,16 @@
 
 #include "hdi/dimensionality_reduction/tsne_random_walks.h"
 #include "hdi/utils/math_utils.h"
+#include "hdi/dimensionality_reduction/gradient_descent_utils.h"
 #include "hdi/utils/log_helper_functions.h"
 #include "hdi/utils/scoped_timers.h"
 #include <random>
+#include "hdi/dimensionality_reduction/knn_graph_generator.h"
 
 #ifdef __USE_GCD__
 #include <dispatch/dispatch.h>
 #endif
 
-#pragma warning( push )
-#pragma warning( disable : 4267)
-#pragma warning( push )
-#pragma warning( disable : 4291)
-#pragma warning( push )
-#pragma warning( disable : 4996)
-#pragma warning( push )
-#pragma warning( disable : 4018)
-#pragma warning( push )
-#pragma warning( disable : 4244)
-//#define FLANN_USE_CUDA
-#include "flann/flann.h"
-#pragma warning( pop )
-#pragma warning( pop )
-#pragma warning( pop )
-#pragma warning( pop )
-#pragma warning( pop )
-
 namespace hdi{
   namespace dr{
   /////////////////////////////////////////////////////////////////////////
@@ -80,7 +64,8 @@ namespace hdi{
       _remove_exaggeration_iter(250),
       _number_of_landmarks(100),
       _num_walks_per_landmark(2000),
-      _distance_weighted_random_walk(true)
+      _distance_weighted_random_walk(true),
+      _knn_backend(KNNBackend::FlannKDTree)
     {}
 
   /////////////////////////////////////////////////////////////////////////
@@ -197,24 +182,14 @@ namespace hdi{
     void TSNERandomWalks<scalar_type>::computeNeighborhoodGraph(){
       utils::ScopedTimer<scalar_type, utils::Milliseconds> timer(_statistics._neighborhood_graph_time);
       utils::secureLog(_logger,"Computing the neighborhood graph...");
-      flann::Matrix<scalar_type> dataset  (_high_dimensional_data,_num_dps,_dimensionality);
-      flann::Matrix<scalar_type> query  (_high_dimensional_data,_num_dps,_dimensionality);
-      
-      flann::Index<flann::L2<scalar_type> > index(dataset, flann::KDTreeIndexParams(4)); //TEMP
-      //flann::Index<flann::L2<scalar_type> > index(dataset, flann::KDTreeCuda3dIndexParams()); //TEMP
-      index.buildIndex();
-
       unsigned int nn = _params._num_neighbors + 1;
 
-      _knns.resize(_num_dps*nn);
-      _rw_probabilities.resize(_num_dps*nn);
-
-      flann::Matrix<int> indices_mat(_knns.data(), query.rows, nn);
-      flann::Matrix<scalar_type> dists_mat(_rw_probabilities.data(), query.rows, nn);
-
-      flann::SearchParams params(1024); //TEMP
-      params.cores = 8;
-      index.knnSearch(query, indices_mat, dists_mat, nn, params);
+      KNNGraphGenerator<scalar_type> knn_generator;
+      typename KNNGraphGenerator<scalar_type>::Parameters knn_params;
+      knn_params._backend = _params._knn_backend;
+      knn_params._seed = _params._seed;
+      knn_generator.setLogger(_logger);
+      knn_generator.computeKNNGraph(_high_dimensional_data, _dimensionality, _num_dps, nn, _rw_probabilities, _knns, knn_params);
 
       for(int d = 0; d < _num_dps; ++d){
         {
@@ -514,16 +489,10 @@ namespace hdi{
 
     template <typename scalar_type>
     void TSNERandomWalks<scalar_type>::updateTheEmbedding(double mult){
-      for(int i = 0; i < _gradient.size(); ++i){
-        _gain[i] = static_cast<scalar_type>((sign(_gradient[i]) != sign(_previous_gradient[i])) ? (_gain[i] + .2) : (_gain[i] * .8));
-        if(_gain[i] < _params._minimum_gain){
-          _gain[i] = static_cast<scalar_type>(_params._minimum_gain);
-        }
-        _gradient[i] = static_cast<scalar_type>((_gradient[i]>0?1:-1)*std::abs(_gradient[i]*_params._eta* _gain[i])/(_params._eta*_gain[i]));
-
-        _previous_gradient[i] = static_cast<scalar_type>(((_iteration<_params._mom_switching_iter)?_params._momentum:_params._final_momentum) * _previous_gradient[i] - _params._eta * _gain[i] * _gradient[i]);
-        _embedding[i] += static_cast<scalar_type>(_previous_gradient[i] * mult);
-      }
+      const unsigned int dim = _params._embedding_dimensionality;
+      const double momentum = (_iteration<_params._mom_switching_iter)?_params._momentum:_params._final_momentum;
+      gradientDescentStep(_gradient.data(), _previous_gradient.data(), _gain.data(), _embedding.data(), static_cast<unsigned int>(_gradient.size()/dim), dim,
+                          _params._eta, _params._minimum_gain, momentum, mult);
       ++_iteration;
     }
 
@@ -68,6 +68,7 @@
 #include <iostream>
 #include <vector>
 #include <unordered_map>
+#include "sptree.h"
 
 #ifdef __USE_GCD__
 #include <dispatch/dispatch.h>
@@ -80,6 +81,7 @@ namespace hdi{
     /*!
       Sparse Partitioning Tree used for the Barnes Hut approximation.
       The original version was implemented by Laurens van der Maaten,
+      The nodes are stored in a linearized SPTree in which the mass of a node is the sum of the weights of its points.
       \author Laurens van der Maaten
       \author Nicola Pezzotti
     */
@@ -88,121 +90,46 @@ namespace hdi{
     public:
       typedef double hp_scalar_type;
 
-    private:
-      class Cell {
-        unsigned int _emb_dimension;
-        hp_scalar_type* corner;
-        hp_scalar_type* width;
-
-      public:
-        Cell(unsigned int emb_dimension);
-        Cell(unsigned int emb_dimension, hp_scalar_type* inp_corner, hp_scalar_type* inp_width);
-        ~Cell();
-
-        hp_scalar_type getCorner(unsigned int d);
-        hp_scalar_type getWidth(unsigned int d);
-        void setCorner(unsigned int d, hp_scalar_type val);
-        void setWidth(unsigned int d, hp_scalar_type val);
-        bool containsPoint(scalar_type point[]);
-      };
-
-      // Fixed constants
-      static const unsigned int QT_NODE_CAPACITY = 1;
-
-      // A buffer we use when doing force computations
-      //hp_scalar_type* buff;
-
-      // Properties of this node in the tree
-      WeightedSPTree* parent;
-      unsigned int _emb_dimension;
-      bool is_leaf;
-      unsigned int size;
-      hp_scalar_type cum_size;
-
-      // Axis-aligned bounding box stored as a center with half-_emb_dimensions to represent the boundaries of this quad tree
-      Cell* boundary;
-
-      // Indices in this space-partitioning tree node, corresponding center-of-mass, and list of all children
-      scalar_type* _emb_positions;
-      const scalar_type* _weights;
-      hp_scalar_type* _center_of_mass;
-      unsigned int index[QT_NODE_CAPACITY];
-
-      // Children
-      WeightedSPTree** children;
-      unsigned int no_children;
-
     public:
+      //! Empty tree, it must be built before computing the forces
+      WeightedSPTree();
       WeightedSPTree(unsigned int D, scalar_type* inp_data, const scalar_type* weights, unsigned int N);
-
-    private:
-      WeightedSPTree(unsigned int D, scalar_type* inp_data, const scalar_type* weights, hp_scalar_type* inp_corner, hp_scalar_type* inp_width);
-      WeightedSPTree(unsigned int D, scalar_type* inp_data, const scalar_type* weights, unsigned int N, hp_scalar_type* inp_corner, hp_scalar_type* inp_width);
-      WeightedSPTree(WeightedSPTree* inp_parent, unsigned int D, scalar_type* inp_data, const scalar_type* weights, unsigned int N, hp_scalar_type* inp_corner, hp_scalar_type* inp_width);
-      WeightedSPTree(WeightedSPTree* inp_parent, unsigned int D, scalar_type* inp_data, const scalar_type* weights, hp_scalar_type* inp_corner, hp_scalar_type* inp_width);
+      //! Build the tree on N points with D dimensions. The storage of a previous build is reused
+      void build(unsigned int D, scalar_type* inp_data, const scalar_type* weights, unsigned int N);
 
     public:
-      ~WeightedSPTree();
       void setData(scalar_type* inp_data, const scalar_type* weights);
-      WeightedSPTree* getParent();
-      void construct(Cell boundary);
-      bool insert(unsigned int new_index);
-      void subdivide();
-      bool isCorrect();
-      void rebuildTree();
-      void getAllIndices(unsigned int* indices);
-      unsigned int getDepth();
+      bool isCorrect()const{return _tree.isCorrect();}
+      void getAllIndices(unsigned int* indices)const{_tree.getAllIndices(indices);}
+      unsigned int getDepth()const{return _tree.getDepth();}
+      //! The kernels are specialized at compile time on the embedding dimensionality D, D = 0 is the generic kernel
+      template <unsigned int D = 0>
       void computeNonEdgeForces(unsigned int point_index, hp_scalar_type theta, hp_scalar_type neg_f[], hp_scalar_type& sum_Q)const;
-      template <class sparse_scalar_matrix_type>
-      void computeEdgeForces(const sparse_scalar_matrix_type& matrix, hp_scalar_type multiplier, hp_scalar_type* pos_f)const;
-      void print();
+      //! Attractive forces, the edge-balanced kernels of SPTree are used for vectors of maps and for CSR matrices
+      template <unsigned int D = 0, class sparse_scalar_matrix_type>
+      void computeEdgeForces(const sparse_scalar_matrix_type& matrix, hp_scalar_type scale, hp_scalar_type* pos_f)const;
+      void print()const{_tree.print();}
 
     private:
-      void init(WeightedSPTree* inp_parent, unsigned int D, scalar_type* inp_data, const scalar_type* weights, hp_scalar_type* inp_corner, hp_scalar_type* inp_width);
-      void fill(unsigned int N);
-      unsigned int getAllIndices(unsigned int* indices, unsigned int loc);
-      bool isChild(unsigned int test_index, unsigned int start, unsigned int end);
+      unsigned int _emb_dimension;
+      scalar_type* _emb_positions;
+      const scalar_type* _weights;
+      SPTree<scalar_type> _tree;
     };
 
 /////////////////////////////////////////////////////////////////
 
     template <typename scalar_type>
-    template <class sparse_scalar_matrix_type>
-    void WeightedSPTree<scalar_type>::computeEdgeForces(const sparse_scalar_matrix_type& sparse_matrix, hp_scalar_type multiplier, hp_scalar_type* pos_f)const{
-      const int n = sparse_matrix.size();
-
-      // Loop over all edges in the graph
-#ifdef __USE_GCD__
-      std::cout << "GCD dispatch, weighted_sptree 176.\n";
-      dispatch_apply(n, dispatch_get_global_queue(0, 0), ^(size_t j) {
-#else
-      #pragma omp parallel for
-      for(int j = 0; j < n; ++j){
-#endif //__USE_GCD__
-        std::vector<hp_scalar_type> buff(_emb_dimension,0);
-        unsigned int ind1, ind2;
-        hp_scalar_type q_ij_1;
-        ind1 = j * _emb_dimension;
-        for(auto elem: sparse_matrix[j]) {
-          // Compute pairwise distance and Q-value
-          q_ij_1 = 1.0;
-          ind2 = elem.first * _emb_dimension;
-          for(unsigned int d = 0; d < _emb_dimension; d++)
-            buff[d] = _emb_positions[ind1 + d] - _emb_positions[ind2 + d]; //buff contains (yi-yj) per each _emb_dimension
-          for(unsigned int d = 0; d < _emb_dimension; d++)
-            q_ij_1 += buff[d] * buff[d];
-
-          hp_scalar_type p_ij = elem.second;
-          hp_scalar_type res = hp_scalar_type(p_ij) * multiplier / q_ij_1 / n;
+    template <unsigned int D>
+    void WeightedSPTree<scalar_type>::computeNonEdgeForces(unsigned int point_index, hp_scalar_type theta, hp_scalar_type neg_f[], hp_scalar_type& sum_Q)const
+    {
+      _tree.template computeWeightedNonEdgeForces<D>(point_index, theta, _weights[point_index], neg_f, sum_Q);
+    }
 
-          // Sum positive force
-          for(unsigned int d = 0; d < _emb_dimension; d++)
-            pos_f[ind1 + d] += res * buff[d] * multiplier; //(p_ij*q_j*mult) * (yi-yj)
-        }
-      }
-#ifdef __USE_GCD__
-      );
-#endif
+    template <typename scalar_type>
+    template <unsigned int D, class sparse_scalar_matrix_type>
+    void WeightedSPTree<scalar_type>::computeEdgeForces(const sparse_scalar_matrix_type& sparse_matrix, hp_scalar_type scale, hp_scalar_type* pos_f)const{
+      _tree.template computeEdgeForces<D>(sparse_matrix, scale, pos_f);
     }
   }
 }
@@ -41,6 +41,7 @@
 #include <unordered_map>
 #include "hdi/data/embedding.h"
 #include "hdi/data/map_mem_eff.h"
+#include "weighted_sptree.h"
 
 namespace hdi{
   namespace dr{
@@ -95,8 +96,17 @@ namespace hdi{
       unsigned int getNumberOfDataPoints(){  return _P.size();  }
       //! Get P
       const sparse_scalar_matrix& getDistributionP()const{ return _P; }
-      //! Get Q
+      //! Get Q (not normalized). Q is not used by the gradient descent, it is empty unless computeDistributionQ is called
       const scalar_vector_type& getDistributionQ()const{ return _Q; }
+      //! Materialize Q for the current embedding, it requires n^2 memory
+      void computeDistributionQ();
+      //! Release the memory used by a previous call to computeDistributionQ
+      void releaseDistributionQ(){ scalar_vector_type().swap(_Q); }
+
+      //! Memory occupation of the engine in MB
+      double memoryOccupation()const;
+      //! Log the memory occupation of the engine, split by buffer
+      void logMemoryOccupation()const;
 
       //! Return the current log
       utils::AbstractLog* logger()const{return _logger;}
@@ -130,12 +140,17 @@ namespace hdi{
       void doAnIterationExact(double mult = 1);
       //! Do an iteration of the gradient descent
       void doAnIterationBarnesHut(double mult = 1);
-      //! Compute Low-dimensional distribution
+      //! Compute the normalization factor of the Low-dimensional distribution. Q is computed tile by tile and it is not stored
       void computeLowDimensionalDistribution();
-      //! Compute tSNE gradient with the exact algorithm
+      //! Compute tSNE gradient with the exact algorithm. Q is recomputed tile by tile and it is not stored
       void computeExactGradient(double exaggeration);
+      //! Memory occupation of P in MB
+      double memoryOccupationP()const;
       //! Compute tSNE gradient with the BarnesHut algorithm
       void computeBarnesHutGradient(double exaggeration);
+      //! Barnes-Hut gradient with the kernels specialized on the embedding dimensionality D, D = 0 is the generic kernel
+      template <unsigned int D>
+      void computeBarnesHutGradient(double exaggeration);
       //! Update the embedding
       void updateTheEmbedding(double mult = 1.);
       //! Compute the exaggeration factor based on the current iteration
@@ -150,7 +165,7 @@ namespace hdi{
 
       scalar_vector_type _weights;
       sparse_scalar_matrix _P; //! Conditional probalility distribution in the High-dimensional space
-      scalar_vector_type _Q; //! Conditional probalility distribution in the Low-dimensional space
+      scalar_vector_type _Q; //! Conditional probalility distribution in the Low-dimensional space. Empty unless requested with computeDistributionQ
       scalar_type _normalization_Q; //! Normalization factor of Q - Z in the original paper
 
       // Gradient descent
@@ -158,6 +173,7 @@ namespace hdi{
       scalar_vector_type _previous_gradient; //! Previous gradient
       scalar_vector_type _gain; //! Gain
       scalar_type _theta; //! value of theta used in the Barnes-Hut approximation. If a value of 1 is provided the exact tSNE computation is used.
+      WeightedSPTree<scalar_type> _sptree; //! Barnes-Hut tree, its storage is reused across iterations
 
       Parameters _params;
       unsigned int _iteration;
@@ -36,8 +36,10 @@
 
 #include "hdi/dimensionality_reduction/wtsne.h"
 #include "hdi/utils/math_utils.h"
+#include "hdi/dimensionality_reduction/gradient_descent_utils.h"
 #include "hdi/utils/log_helper_functions.h"
 #include "hdi/utils/scoped_timers.h"
+#include "hdi/data/map_helpers.h"
 #include "weighted_sptree.h"
 #include <random>
 
@@ -124,13 +126,11 @@ namespace hdi{
       {//Aux data
         _params = params;
         unsigned int size = probabilities.size();
-        unsigned int size_sq = probabilities.size()*probabilities.size();
         
         _embedding = embedding;
         _embedding_container = &(embedding->getContainer());
         _embedding->resize(_params._embedding_dimensionality,size);
         _P.resize(size);
-        _Q.resize(size_sq);
         _gradient.resize(size*params._embedding_dimensionality,0);
         _previous_gradient.resize(size*params._embedding_dimensionality,0);
         _gain.resize(size*params._embedding_dimensionality,1);
@@ -145,6 +145,7 @@ namespace hdi{
       _iteration = 0;
 
       _initialized = true;
+      utils::secureLogValue(_logger,"Memory occupation (MB)",memoryOccupation());
       utils::secureLog(_logger,"Initialization complete!");
     }
 
@@ -154,13 +155,11 @@ namespace hdi{
       {//Aux data
         _params = params;
         unsigned int size = distribution.size();
-        unsigned int size_sq = distribution.size()*distribution.size();
 
         _embedding = embedding;
         _embedding_container = &(embedding->getContainer());
         _embedding->resize(_params._embedding_dimensionality,size);
         _P.resize(size);
-        _Q.resize(size_sq);
         _gradient.resize(size*params._embedding_dimensionality,0);
         _previous_gradient.resize(size*params._embedding_dimensionality,0);
         _gain.resize(size*params._embedding_dimensionality,1);
@@ -176,6 +175,7 @@ namespace hdi{
       _iteration = 0;
 
       _initialized = true;
+      utils::secureLogValue(_logger,"Memory occupation (MB)",memoryOccupation());
       utils::secureLog(_logger,"Initialization complete!");
     }
 
@@ -183,20 +183,12 @@ namespace hdi{
     void WeightedTSNE<scalar, sparse_scalar_matrix>::computeHighDimensionalDistribution(const sparse_scalar_matrix& probabilities){
       utils::secureLog(_logger,"Computing high-dimensional joint probability distribution...");
 
-      const int n = getNumberOfDataPoints();
-      //Can be improved by using the simmetry of the matrix (half the memory) //TODO
-      for(int j = 0; j < n; ++j){
-        for(auto& elem: probabilities[j]){
-          scalar_type v0 = elem.second;
-          auto iter = probabilities[elem.first].find(j);
-          scalar_type v1 = 0.;
-          if(iter != probabilities[elem.first].end())
-            v1 = iter->second;
-
-          _P[j][elem.first] = static_cast<scalar_type>((v0+v1)*0.5);
-          _P[elem.first][j] = static_cast<scalar_type>((v0+v1)*0.5);
-        }
-      }
+      typedef typename sparse_scalar_matrix::value_type map_type;
+      typedef typename map_type::key_type key_type;
+      typedef typename map_type::mapped_type mapped_type;
+      typedef hdi::data::MapHelpers<key_type,mapped_type,map_type> map_helpers_type;
+
+      map_helpers_type::symmetrize(probabilities,_P);
     }
 
     template <typename scalar, typename sparse_scalar_matrix>
@@ -302,82 +294,205 @@ namespace hdi{
     template <typename scalar, typename sparse_scalar_matrix>
     void WeightedTSNE<scalar, sparse_scalar_matrix>::computeLowDimensionalDistribution(){
       const int n = getNumberOfDataPoints();
+      const int dim = _params._embedding_dimensionality;
+      const int tile_size = 256;
+      const int num_tiles = (n+tile_size-1)/tile_size;
+      const scalar_type* positions = _embedding_container->data();
 
+      //Only the tiles in the upper triangle are visited, Q is symmetric and its diagonal is zero
+#ifdef __USE_GCD__
+      __block std::vector<double> sum_Q_tiles(num_tiles,0);
+#else
+      std::vector<double> sum_Q_tiles(num_tiles,0);
+#endif //__USE_GCD__
+#ifdef __USE_GCD__
+      dispatch_apply(num_tiles, dispatch_get_global_queue(0, 0), ^(size_t ti) {
+#else
+      #pragma omp parallel for schedule(dynamic)
+      for(int ti = 0; ti < num_tiles; ++ti){
+#endif //__USE_GCD__
+        const int i_begin = ti*tile_size;
+        const int i_end = std::min(n,i_begin+tile_size);
+        double sum_Q = 0;
+        for(int j_begin = i_begin; j_begin < n; j_begin += tile_size){
+          const int j_end = std::min(n,j_begin+tile_size);
+          for(int i = i_begin; i < i_end; ++i){
+            for(int j = std::max(i+1,j_begin); j < j_end; ++j){
+              const double euclidean_dist_sq(
+                  utils::euclideanDistanceSquared<scalar_type>(
+                    positions+i*dim, positions+(i+1)*dim,
+                    positions+j*dim, positions+(j+1)*dim
+                  )
+                );
+              sum_Q += _weights[i]*_weights[j]/(1.+euclidean_dist_sq);
+            }
+          }
+        }
+        sum_Q_tiles[ti] = 2*sum_Q;
+      }
+#ifdef __USE_GCD__
+      );
+#endif
       double sum_Q = 0;
-      
-      
-      // Loop over all edges in the graph
+      for(auto v : sum_Q_tiles){
+        sum_Q += v;
+      }
+      _normalization_Q = static_cast<scalar_type>(sum_Q);
+    }
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    void WeightedTSNE<scalar, sparse_scalar_matrix>::computeExactGradient(double exaggeration){
+      const int n = getNumberOfDataPoints();
+      const int dim = _params._embedding_dimensionality;
+      const int tile_size = 256;
+      const int num_tiles = (n+tile_size-1)/tile_size;
+      const scalar_type* positions = _embedding_container->data();
+
+      //Every tile of rows owns its part of the gradient
+#ifdef __USE_GCD__
+      dispatch_apply(num_tiles, dispatch_get_global_queue(0, 0), ^(size_t ti) {
+#else
+      #pragma omp parallel for
+      for(int ti = 0; ti < num_tiles; ++ti){
+#endif //__USE_GCD__
+        const int i_begin = ti*tile_size;
+        const int i_end = std::min(n,i_begin+tile_size);
+        std::vector<double> forces((i_end-i_begin)*dim,0);
+        for(int j_begin = 0; j_begin < n; j_begin += tile_size){
+          const int j_end = std::min(n,j_begin+tile_size);
+          for(int i = i_begin; i < i_end; ++i){
+            double* force = forces.data()+(i-i_begin)*dim;
+            for(int j = j_begin; j < j_end; ++j){
+              if(i == j){
+                continue;
+              }
+              const double euclidean_dist_sq(
+                  utils::euclideanDistanceSquared<scalar_type>(
+                    positions+i*dim, positions+(i+1)*dim,
+                    positions+j*dim, positions+(j+1)*dim
+                  )
+                );
+              const double q_ij = 1./(1.+euclidean_dist_sq);
+              const double mult = _weights[i] * _weights[j] * q_ij * q_ij / _normalization_Q;
+              for(int d = 0; d < dim; ++d){
+                force[d] -= 4 * mult * (positions[i * dim + d] - positions[j * dim + d]);
+              }
+            }
+          }
+        }
+        for(int i = i_begin; i < i_end; ++i){
+          double* force = forces.data()+(i-i_begin)*dim;
+          for(auto& elem: _P[i]){
+            const int j = elem.first;
+            const double euclidean_dist_sq(
+                utils::euclideanDistanceSquared<scalar_type>(
+                  positions+i*dim, positions+(i+1)*dim,
+                  positions+j*dim, positions+(j+1)*dim
+                )
+              );
+            const double q_ij = 1./(1.+euclidean_dist_sq);
+            const double p_ij = elem.second/n;
+            for(int d = 0; d < dim; ++d){
+              force[d] += 4 * exaggeration * p_ij * q_ij * (positions[i * dim + d] - positions[j * dim + d]);
+            }
+          }
+        }
+        for(int c = 0; c < (i_end-i_begin)*dim; ++c){
+          _gradient[i_begin * dim + c] = static_cast<scalar_type>(forces[c]);
+        }
+      }
+#ifdef __USE_GCD__
+      );
+#endif
+    }
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    void WeightedTSNE<scalar, sparse_scalar_matrix>::computeDistributionQ(){
+      if(!_initialized){
+        throw std::logic_error("Algorithm must be initialized before computing Q");
+      }
+      const int n = getNumberOfDataPoints();
+      const int dim = _params._embedding_dimensionality;
+      const scalar_type* positions = _embedding_container->data();
+      _Q.resize(size_t(n)*n);
 #ifdef __USE_GCD__
-      std::cout << "GCD dispatch, wtsne_inl 303.\n";
       dispatch_apply(n, dispatch_get_global_queue(0, 0), ^(size_t j) {
 #else
       #pragma omp parallel for
       for(int j = 0; j < n; ++j){
 #endif //__USE_GCD__
-        //_Q[j*n + j] = 0;
+        _Q[size_t(j)*n + j] = 0;
         for(int i = j+1; i < n; ++i){
           const double euclidean_dist_sq(
               utils::euclideanDistanceSquared<scalar_type>(
-                (*_embedding_container).begin()+j*_params._embedding_dimensionality,
-                (*_embedding_container).begin()+(j+1)*_params._embedding_dimensionality,
-                (*_embedding_container).begin()+i*_params._embedding_dimensionality,
-                (*_embedding_container).begin()+(i+1)*_params._embedding_dimensionality
+                positions+j*dim, positions+(j+1)*dim,
+                positions+i*dim, positions+(i+1)*dim
               )
             );
           const double v = 1./(1.+euclidean_dist_sq);
-          _Q[j*n + i] = static_cast<scalar_type>(v);
-          _Q[i*n + j] = static_cast<scalar_type>(v);
+          _Q[size_t(j)*n + i] = static_cast<scalar_type>(v);
+          _Q[size_t(i)*n + j] = static_cast<scalar_type>(v);
         }
       }
 #ifdef __USE_GCD__
       );
 #endif
-      for(int j = 0; j < n; ++j){
-        for(int i = 0; i < n; ++i){
-          sum_Q += _Q[j*n + i]*_weights[j]*_weights[i];
-        }
+    }
+
+    template <typename scalar, typename sparse_scalar_matrix>
+    double WeightedTSNE<scalar, sparse_scalar_matrix>::memoryOccupationP()const{
+      typedef typename sparse_scalar_matrix::value_type map_type;
+      double mem = double(_P.size())*sizeof(map_type);
+      for(size_t i = 0; i < _P.size(); ++i){
+        mem += double(_P[i].size())*(sizeof(typename map_type::key_type)+sizeof(typename map_type::mapped_type));
       }
-      _normalization_Q = static_cast<scalar_type>(sum_Q);
+      return mem / 1024 / 1024;
     }
 
     template <typename scalar, typename sparse_scalar_matrix>
-    void WeightedTSNE<scalar, sparse_scalar_matrix>::computeExactGradient(double exaggeration){
-      const int n = getNumberOfDataPoints();
-      const int dim = _params._embedding_dimensionality;
+    double WeightedTSNE<scalar, sparse_scalar_matrix>::memoryOccupation()const{
+      if(!_initialized){
+        return 0;
+      }
+      double mem = double(_embedding_container->capacity() + _weights.capacity() + _Q.capacity() + _gradient.capacity() + _previous_gradient.capacity() + _gain.capacity())*sizeof(scalar_type);
+      return memoryOccupationP() + mem / 1024 / 1024;
+    }
 
-      for(int i = 0; i < n; ++i){
-        for(int d = 0; d < dim; ++d){
-          _gradient[i * dim + d] = 0;
-        }
+    template <typename scalar, typename sparse_scalar_matrix>
+    void WeightedTSNE<scalar, sparse_scalar_matrix>::logMemoryOccupation()const{
+      if(!_initialized){
+        return;
       }
+      const double to_mb = double(sizeof(scalar_type))/1024/1024;
+      utils::secureLog(_logger,"\n-------- W-tSNE memory occupation (MB) -----------------------");
+      utils::secureLogValue(_logger,"Total",memoryOccupation());
+      utils::secureLogValue(_logger,"\tP",memoryOccupationP());
+      utils::secureLogValue(_logger,"\tEmbedding",_embedding_container->capacity()*to_mb);
+      utils::secureLogValue(_logger,"\tWeights",_weights.capacity()*to_mb);
+      utils::secureLogValue(_logger,"\tGradient descent",(_gradient.capacity() + _previous_gradient.capacity() + _gain.capacity())*to_mb);
+      utils::secureLogValue(_logger,"\tQ",_Q.capacity()*to_mb);
+      utils::secureLog(_logger,"--------------------------------------------------------------\n");
+    }
 
-      for(int i = 0; i < n; ++i){
-        for(int j = 0; j < n; ++j){
-          for(int d = 0; d < dim; ++d){
-            const int idx = i*n + j;
-            const double distance((*_embedding_container)[i * dim + d] - (*_embedding_container)[j * dim + d]);
-            const double negative(_weights[i] * _weights[j] * _Q[idx] * _Q[idx] * distance / _normalization_Q);
-            _gradient[i * dim + d] += static_cast<scalar_type>(-4*negative);
-          }
-        }
-        for(auto& elem: _P[i]){
-          for(int d = 0; d < dim; ++d){
-            const int j = elem.first;
-            const int idx = i*n + j;
-            const double distance((*_embedding_container)[i * dim + d] - (*_embedding_container)[j * dim + d]);
-            double p_ij = elem.second/n;
-            const double positive(p_ij * _Q[idx] * distance);
-            _gradient[i * dim + d] += static_cast<scalar_type>(4*exaggeration*positive);
-          }
-        }
+    template <typename scalar, typename sparse_scalar_matrix>
+    void WeightedTSNE<scalar, sparse_scalar_matrix>::computeBarnesHutGradient(double exaggeration){
+      // The kernels are dispatched once on the dimensionality of the embedding
+      switch(_params._embedding_dimensionality){
+        case 1:  computeBarnesHutGradient<1>(exaggeration); break;
+        case 2:  computeBarnesHutGradient<2>(exaggeration); break;
+        case 3:  computeBarnesHutGradient<3>(exaggeration); break;
+        default: computeBarnesHutGradient<0>(exaggeration); break;
       }
     }
 
     template <typename scalar, typename sparse_scalar_matrix>
+    template <unsigned int D>
     void WeightedTSNE<scalar, sparse_scalar_matrix>::computeBarnesHutGradient(double exaggeration){
       typedef double hp_scalar_type;
+      const unsigned int dim = (D == 0) ? _params._embedding_dimensionality : D;
 
-      WeightedSPTree<scalar_type> sptree(_params._embedding_dimensionality,_embedding->getContainer().data(),_weights.data(),getNumberOfDataPoints());
+      WeightedSPTree<scalar_type>& sptree = _sptree;
+      sptree.build(_params._embedding_dimensionality,_embedding->getContainer().data(),_weights.data(),getNumberOfDataPoints());
 
       scalar_type sum_Q = .0;
       std::vector<hp_scalar_type> positive_forces(getNumberOfDataPoints()*_params._embedding_dimensionality);
@@ -387,7 +502,8 @@ namespace hdi{
         std::vector<hp_scalar_type> negative_forces(getNumberOfDataPoints()*_params._embedding_dimensionality);
 #endif //__USE_GCD__
 
-      sptree.computeEdgeForces(_P, exaggeration, positive_forces.data());
+      // As in the original implementation, the attractive forces are scaled by the square of the exaggeration
+      sptree.template computeEdgeForces<D>(_P, exaggeration * exaggeration, positive_forces.data());
 
 #ifdef __USE_GCD__
         __block std::vector<hp_scalar_type> sum_Q_subvalues(getNumberOfDataPoints(),0);
@@ -401,7 +517,7 @@ namespace hdi{
       #pragma omp parallel for
       for(int n = 0; n < getNumberOfDataPoints(); n++){
 #endif //__USE_GCD__
-        sptree.computeNonEdgeForces(n, _theta, negative_forces.data() + n * _params._embedding_dimensionality, sum_Q_subvalues[n]);
+        sptree.template computeNonEdgeForces<D>(n, _theta, negative_forces.data() + n * dim, sum_Q_subvalues[n]);
       }
 #ifdef __USE_GCD__
       );
@@ -424,16 +540,10 @@ namespace hdi{
 
     template <typename scalar, typename sparse_scalar_matrix>
     void WeightedTSNE<scalar, sparse_scalar_matrix>::updateTheEmbedding(double mult){
-      for(int i = 0; i < _gradient.size(); ++i){
-        _gain[i] = static_cast<scalar_type>((sign(_gradient[i]) != sign(_previous_gradient[i])) ? (_gain[i] + .2) : (_gain[i] * .8));
-        if(_gain[i] < _params._minimum_gain){
-          _gain[i] = static_cast<scalar_type>(_params._minimum_gain);
-        }
-        _gradient[i] = static_cast<scalar_type>((_gradient[i]>0?1:-1)*std::abs(_gradient[i]*_params._eta* _gain[i])/(_params._eta*_gain[i]));
-
-        _previous_gradient[i] = static_cast<scalar_type>(((_iteration<_params._mom_switching_iter)?_params._momentum:_params._final_momentum) * _previous_gradient[i] - _params._eta * _gain[i] * _gradient[i]);
-        (*_embedding_container)[i] += static_cast<scalar_type>(_previous_gradient[i] * mult);
-      }
+      const unsigned int dim = _params._embedding_dimensionality;
+      const double momentum = (_iteration<_params._mom_switching_iter)?_params._momentum:_params._final_momentum;
+      gradientDescentStep(_gradient.data(), _previous_gradient.data(), _gain.data(), _embedding_container->data(), static_cast<unsigned int>(_gradient.size()/dim), dim,
+                          _params._eta, _params._minimum_gain, momentum, mult);
       ++_iteration;
     }
 
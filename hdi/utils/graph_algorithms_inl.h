@@ -40,6 +40,7 @@
 #include <unordered_map>
 #include <cmath>
 #include "hdi/utils/math_utils.h"
+#include "hdi/data/map_helpers.h"
 
 namespace hdi{
   namespace utils{
@@ -85,6 +86,10 @@ namespace hdi{
 
     template <class map_type>
     void extractSubGraph(const std::vector<map_type>& orig_transition_matrix, const std::vector<unsigned int>& selected_idxes, std::vector<map_type>& new_transition_matrix, std::vector<unsigned int>& new_idxes, typename map_type::mapped_type thresh){
+      typedef typename map_type::key_type key_type;
+      typedef typename map_type::mapped_type mapped_type;
+      typedef hdi::data::MapHelpers<key_type,mapped_type,map_type> map_helpers_type;
+
       new_transition_matrix.clear();
       new_idxes.clear();
       std::map<unsigned int,unsigned int> map_selected_idxes;
@@ -109,23 +114,24 @@ namespace hdi{
       }
 
       //Now that I have the maps, I generate the new transition matrix
+      //Each row is collected unordered and built in bulk (new indices do not follow the order of the original ones)
       new_transition_matrix.resize(map_non_selected_idxes.size() + map_selected_idxes.size());
-      for(auto e: map_selected_idxes){
-        for(auto row_elem: orig_transition_matrix[e.first]){
-          if(map_selected_idxes.find(row_elem.first) != map_selected_idxes.end()){
-            new_transition_matrix[e.second][map_selected_idxes[row_elem.first]] = row_elem.second;
-          }else if(map_non_selected_idxes.find(row_elem.first) != map_non_selected_idxes.end()){
-            new_transition_matrix[e.second][map_non_selected_idxes[row_elem.first]] = row_elem.second;
-          }
-        }
-      }
-      for(auto e: map_non_selected_idxes){
-        for(auto row_elem: orig_transition_matrix[e.first]){
-          if(map_selected_idxes.find(row_elem.first) != map_selected_idxes.end()){
-            new_transition_matrix[e.second][map_selected_idxes[row_elem.first]] = row_elem.second;
-          }else if(map_non_selected_idxes.find(row_elem.first) != map_non_selected_idxes.end()){
-            new_transition_matrix[e.second][map_non_selected_idxes[row_elem.first]] = row_elem.second;
+      std::vector<std::pair<key_type,mapped_type>> row;
+      for(auto idxes: {&map_selected_idxes,&map_non_selected_idxes}){
+        for(auto e: *idxes){
+          row.clear();
+          for(auto row_elem: orig_transition_matrix[e.first]){
+            auto selected = map_selected_idxes.find(row_elem.first);
+            if(selected != map_selected_idxes.end()){
+              row.push_back(std::make_pair(selected->second,row_elem.second));
+              continue;
+            }
+            auto non_selected = map_non_selected_idxes.find(row_elem.first);
+            if(non_selected != map_non_selected_idxes.end()){
+              row.push_back(std::make_pair(non_selected->second,row_elem.second));
+            }
           }
+          map_helpers_type::initializeUnsorted(new_transition_matrix[e.second],row.begin(),row.end(),data::DuplicatePolicy::Overwrite);
         }
       }
 
@@ -145,6 +151,10 @@ namespace hdi{
 
     template <class sparse_scalar_matrix_type>
     void removeEdgesToUnselectedVertices(sparse_scalar_matrix_type& adjacency_matrix, const std::vector<unsigned int>& valid_vertices){
+      typedef typename sparse_scalar_matrix_type::value_type map_type;
+      typedef typename map_type::key_type key_type;
+      typedef typename map_type::mapped_type mapped_type;
+      typedef hdi::data::MapHelpers<key_type,mapped_type,map_type> map_helpers_type;
 
       std::unordered_map<unsigned int,unsigned int> valid_set;
       for(int i = 0; i < valid_vertices.size(); ++i){
@@ -152,15 +162,18 @@ namespace hdi{
       }
 
       sparse_scalar_matrix_type new_map(adjacency_matrix.size());
+      std::vector<std::pair<key_type,mapped_type>> row;
       for(int i = 0; i < adjacency_matrix.size(); ++i){
+        row.clear();
         for (auto& elem: adjacency_matrix[i]){
           auto search_iter = valid_set.find(elem.first);
           if(search_iter != valid_set.end()){
-            new_map[i][search_iter->second] = elem.second;
+            row.push_back(std::make_pair(search_iter->second,elem.second));
           }
         }
+        map_helpers_type::initializeUnsorted(new_map[i],row.begin(),row.end(),data::DuplicatePolicy::Overwrite);
       }
-      adjacency_matrix = new_map;
+      adjacency_matrix.swap(new_map);
 
     }
 
@@ -62,6 +62,9 @@ namespace hdi{
     template double computeGaussianDistributionWithFixedPerplexity<std::vector<float>>(std::vector<float>::const_iterator distances_begin, std::vector<float>::const_iterator distances_end, std::vector<float>::iterator P_begin, std::vector<float>::iterator P_end, double perplexity, int max_iterations, double tol, int ignore);
     template double computeGaussianDistributionWithFixedPerplexity<std::vector<double>>(std::vector<double>::const_iterator distances_begin, std::vector<double>::const_iterator distances_end, std::vector<double>::iterator P_begin, std::vector<double>::iterator P_end, double perplexity, int max_iterations, double tol, int ignore);
 
+    template void computeGaussianDistributionsWithFixedPerplexity<float>(const float* distances, float* distributions, unsigned int num_rows, unsigned int row_size, double perplexity, int max_iterations, double tol, int ignore, int ignore_increment, float* sigmas);
+    template void computeGaussianDistributionsWithFixedPerplexity<double>(const double* distances, double* distributions, unsigned int num_rows, unsigned int row_size, double perplexity, int max_iterations, double tol, int ignore, int ignore_increment, double* sigmas);
+
     template double computeGaussianDistributionWithFixedWeight<std::vector<float>>(std::vector<float>::const_iterator distances_begin, std::vector<float>::const_iterator distances_end, std::vector<float>::iterator P_begin, std::vector<float>::iterator P_end, double perplexity, int max_iterations, double tol, int ignore);
     template double computeGaussianDistributionWithFixedWeight<std::vector<double>>(std::vector<double>::const_iterator distances_begin, std::vector<double>::const_iterator distances_end, std::vector<double>::iterator P_begin, std::vector<double>::iterator P_end, double perplexity, int max_iterations, double tol, int ignore);
 
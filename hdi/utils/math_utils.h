@@ -68,6 +68,17 @@ namespace hdi{
     template <typename Vector>
     double computeGaussianDistributionWithFixedPerplexity(typename Vector::const_iterator distances_begin, typename Vector::const_iterator distances_end, typename Vector::iterator distr_begin, typename Vector::iterator distr_end, double perplexity, int max_iterations = 500, double tol = 1e-5, int ignore = -1);
 
+    //! Compute the gaussian distributions with fixed perplexity of a batch of num_rows rows of row_size distances stored contiguously.
+    /*!
+      Rows are calibrated together in small blocks using a Newton/bisection hybrid on the precision of the kernel.
+      The block is stored as a structure of arrays so that the exponentials of all the rows in the block are computed by the same vector instructions.
+      Column ignore+r*ignore_increment is excluded from row r (ignore < 0 disables it).
+      If sigmas is not null it receives the sigma of every row, 0 for rows that did not converge and are set to a uniform distribution.
+      distances and distributions can point to the same memory.
+    */
+    template <typename scalar_type>
+    void computeGaussianDistributionsWithFixedPerplexity(const scalar_type* distances, scalar_type* distributions, unsigned int num_rows, unsigned int row_size, double perplexity, int max_iterations = 200, double tol = 1e-5, int ignore = -1, int ignore_increment = 0, scalar_type* sigmas = nullptr);
+
     template <typename Vector>
     double computeGaussianDistributionWithFixedWeight(typename Vector::const_iterator distances_begin, typename Vector::const_iterator distances_end, typename Vector::iterator distr_begin, typename Vector::iterator distr_end, double weight, int max_iterations = 500, double tol = 1e-5, int ignore = -1);
 
@@ -38,6 +38,9 @@
 #include <cmath>
 #include <stdexcept>
 #include <limits>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
 
 #ifdef __USE_GCD__
 #include <dispatch/dispatch.h>
@@ -256,6 +259,177 @@ namespace hdi{
       return sigma;
     }
 
+    //! exp(x) for x <= 0 with a branch-free implementation that can be vectorized by the compiler. The relative error is below 1e-14 and results below exp(-708) are flushed to 0
+    inline double expNonPositive(double x){
+      const double log2e = 1.4426950408889634;
+      const double ln2_hi = 6.93145751953125e-1;
+      const double ln2_lo = 1.42860682030941723212e-6;
+      const double round_magic = 6755399441055744.; //1.5*2^52, the integer part of n ends up in the low bits of the mantissa
+
+      const double is_normal = x >= -708.;
+      x = x < -708. ? -708. : x;
+      const double t = x * log2e + round_magic;
+      const double n = t - round_magic;
+      const double r = (x - n * ln2_hi) - n * ln2_lo;
+
+      double p = 1./39916800.;
+      p = p * r + 1./3628800.;
+      p = p * r + 1./362880.;
+      p = p * r + 1./40320.;
+      p = p * r + 1./5040.;
+      p = p * r + 1./720.;
+      p = p * r + 1./120.;
+      p = p * r + 1./24.;
+      p = p * r + 1./6.;
+      p = p * r + 0.5;
+      p = p * r + 1.;
+      p = p * r + 1.;
+
+      //The shift is done on the unsigned representation, n is in [-1022,0] and the biased exponent is never negative
+      uint64_t bits;
+      std::memcpy(&bits, &t, sizeof(double));
+      bits = (bits + 1023) << 52;
+      double scale;
+      std::memcpy(&scale, &bits, sizeof(double));
+      return p * scale * is_normal;
+    }
+
+    template <typename scalar_type>
+    void computeGaussianDistributionsWithFixedPerplexity(const scalar_type* distances, scalar_type* distributions, unsigned int num_rows, unsigned int row_size, double perplexity, int max_iterations, double tol, int ignore, int ignore_increment, scalar_type* sigmas){
+      if(row_size == 0){
+        throw std::logic_error("Invalid containers");
+      }
+      //Number of rows calibrated together. 8 doubles fill one AVX-512 register or two AVX2 registers
+      const int block_size = 8;
+      const int num_blocks = (num_rows + block_size - 1) / block_size;
+      const double log_perplexity = std::log(perplexity);
+
+#ifdef __USE_GCD__
+      dispatch_apply(num_blocks, dispatch_get_global_queue(0, 0), ^(size_t b) {
+#else
+      #pragma omp parallel for schedule(dynamic,16)
+      for(int b = 0; b < num_blocks; ++b){
+#endif //__USE_GCD__
+        //Structure of arrays: element j of the row in lane l is stored in position j*block_size+l
+        std::vector<double> block_distances(row_size*block_size,0);
+        std::vector<double> block_weights(row_size*block_size,0);
+        std::vector<double> block_distribution(row_size*block_size,0);
+
+        double beta[block_size], min_beta[block_size], max_beta[block_size];
+        double sum_p[block_size], sum_pd[block_size], sum_pdd[block_size];
+        bool active[block_size], found[block_size];
+
+        const int first_row = b*block_size;
+        const int rows_in_block = std::min<int>(block_size, num_rows-first_row);
+        for(int l = 0; l < block_size; ++l){
+          beta[l] = 1;
+          min_beta[l] = 0;
+          max_beta[l] = std::numeric_limits<double>::max();
+          active[l] = l < rows_in_block;
+          found[l] = false;
+          if(!active[l]){
+            continue;
+          }
+          const int row = first_row + l;
+          const int ignore_idx = (ignore < 0)? -1 : ignore + row*ignore_increment;
+          const scalar_type* row_distances = distances + std::size_t(row)*row_size;
+
+          //Distances are shifted by their minimum: the entropy does not change and the exponentials do not underflow
+          double min_distance = std::numeric_limits<double>::max();
+          for(int j = 0; j < int(row_size); ++j){
+            if(j != ignore_idx && row_distances[j] < min_distance){
+              min_distance = row_distances[j];
+            }
+          }
+          for(int j = 0; j < int(row_size); ++j){
+            if(j != ignore_idx){
+              block_distances[j*block_size+l] = row_distances[j] - min_distance;
+              block_weights[j*block_size+l] = 1;
+            }
+          }
+        }
+
+        int iter = 0;
+        bool any_active = rows_in_block > 0;
+        while(any_active && iter < max_iterations){
+          for(int l = 0; l < block_size; ++l){
+            sum_p[l] = 0;
+            sum_pd[l] = 0;
+            sum_pdd[l] = 0;
+          }
+          for(int j = 0; j < int(row_size); ++j){
+            const double* d = block_distances.data() + j*block_size;
+            const double* w = block_weights.data() + j*block_size;
+            double* p = block_distribution.data() + j*block_size;
+            for(int l = 0; l < block_size; ++l){
+              const double v = w[l] * expNonPositive(-beta[l] * d[l]);
+              p[l] = v;
+              sum_p[l] += v;
+              sum_pd[l] += v * d[l];
+              sum_pdd[l] += v * d[l] * d[l];
+            }
+          }
+
+          any_active = false;
+          for(int l = 0; l < block_size; ++l){
+            if(!active[l]){
+              continue;
+            }
+            const double mean = sum_pd[l] / sum_p[l];
+            const double H = beta[l] * mean + std::log(sum_p[l]);
+            const double Hdiff = H - log_perplexity;
+            if(Hdiff < tol && -Hdiff < tol){
+              active[l] = false;
+              found[l] = true;
+              continue;
+            }
+            //The entropy decreases monotonically with beta
+            if(Hdiff > 0){
+              min_beta[l] = beta[l];
+            }else{
+              max_beta[l] = beta[l];
+            }
+            //Newton step, dH/dbeta = -beta * var(d). Bisection is used when the step leaves the bracket
+            const double variance = sum_pdd[l] / sum_p[l] - mean * mean;
+            const double newton_beta = beta[l] + Hdiff / (beta[l] * variance);
+            if(variance > 0 && newton_beta > min_beta[l] && newton_beta < max_beta[l]){
+              beta[l] = newton_beta;
+            }else if(max_beta[l] == std::numeric_limits<double>::max()){
+              beta[l] *= 2;
+            }else if(min_beta[l] == 0){
+              beta[l] /= 2;
+            }else{
+              beta[l] = (min_beta[l] + max_beta[l]) / 2.;
+            }
+            any_active = true;
+          }
+          ++iter;
+        }
+
+        for(int l = 0; l < rows_in_block; ++l){
+          const int row = first_row + l;
+          const int ignore_idx = (ignore < 0)? -1 : ignore + row*ignore_increment;
+          scalar_type* row_distribution = distributions + std::size_t(row)*row_size;
+          if(found[l]){
+            for(int j = 0; j < int(row_size); ++j){
+              row_distribution[j] = static_cast<scalar_type>(block_distribution[j*block_size+l] / sum_p[l]);
+            }
+          }else{
+            const double v = 1./(row_size+((ignore_idx<0||ignore_idx>=int(row_size))?0:-1));
+            for(int j = 0; j < int(row_size); ++j){
+              row_distribution[j] = static_cast<scalar_type>((j == ignore_idx)?0:v);
+            }
+          }
+          if(sigmas != nullptr){
+            sigmas[row] = static_cast<scalar_type>(found[l]?std::sqrt(1/(2*beta[l])):0);
+          }
+        }
+      }
+#ifdef __USE_GCD__
+      );
+#endif
+    }
+
     template <typename Vector>
     double computeGaussianDistributionWithFixedWeight(typename Vector::const_iterator distances_begin, typename Vector::const_iterator distances_end, typename Vector::iterator distribution_begin, typename Vector::iterator distribution_end, double weight, int max_iterations, double tol, int ignore){
       const int size(static_cast<int>(std::distance(distances_begin, distances_end)));
@@ -0,0 +1,177 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+#include "hdi/utils/memory_mapped_file.h"
+#include "hdi/utils/assert_by_exception.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace hdi{
+  namespace utils{
+
+    MemoryMappedFile::MemoryMappedFile():
+      _data(nullptr),
+      _size(0),
+#ifdef _WIN32
+      _file_handle(nullptr),
+      _mapping_handle(nullptr)
+#else
+      _file_descriptor(-1)
+#endif
+    {}
+
+    MemoryMappedFile::MemoryMappedFile(const std::string& filename):
+      MemoryMappedFile()
+    {
+      open(filename);
+    }
+
+    MemoryMappedFile::~MemoryMappedFile(){
+      close();
+    }
+
+    void MemoryMappedFile::open(const std::string& filename){
+      checkAndThrowLogic(!isOpen(),"MemoryMappedFile: a file is already mapped");
+#ifdef _WIN32
+      HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL|FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+      checkAndThrowRuntime(file != INVALID_HANDLE_VALUE,"MemoryMappedFile: unable to open " + filename);
+      LARGE_INTEGER file_size;
+      if(!GetFileSizeEx(file,&file_size) || file_size.QuadPart == 0){
+        CloseHandle(file);
+        throw std::runtime_error("MemoryMappedFile: invalid size of " + filename);
+      }
+      HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+      if(mapping == NULL){
+        CloseHandle(file);
+        throw std::runtime_error("MemoryMappedFile: unable to map " + filename);
+      }
+      void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      if(data == NULL){
+        CloseHandle(mapping);
+        CloseHandle(file);
+        throw std::runtime_error("MemoryMappedFile: unable to map " + filename);
+      }
+      _file_handle = file;
+      _mapping_handle = mapping;
+      _size = static_cast<size_t>(file_size.QuadPart);
+#else
+      int fd = ::open(filename.c_str(), O_RDONLY);
+      checkAndThrowRuntime(fd != -1,"MemoryMappedFile: unable to open " + filename);
+      struct stat file_stat;
+      if(fstat(fd,&file_stat) != 0 || file_stat.st_size == 0){
+        ::close(fd);
+        throw std::runtime_error("MemoryMappedFile: invalid size of " + filename);
+      }
+      void* data = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if(data == MAP_FAILED){
+        ::close(fd);
+        throw std::runtime_error("MemoryMappedFile: unable to map " + filename);
+      }
+      madvise(data, file_stat.st_size, MADV_SEQUENTIAL);
+      _file_descriptor = fd;
+      _size = static_cast<size_t>(file_stat.st_size);
+#endif
+      _data = static_cast<char*>(data);
+    }
+
+    void MemoryMappedFile::close(){
+      if(!isOpen()){
+        return;
+      }
+#ifdef _WIN32
+      UnmapViewOfFile(_data);
+      CloseHandle(_mapping_handle);
+      CloseHandle(_file_handle);
+      _file_handle = nullptr;
+      _mapping_handle = nullptr;
+#else
+      munmap(_data,_size);
+      ::close(_file_descriptor);
+      _file_descriptor = -1;
+#endif
+      _data = nullptr;
+      _size = 0;
+    }
+
+    bool MemoryMappedFile::pageRange(size_t offset, size_t length, char*& begin, size_t& aligned_length)const{
+      if(!isOpen() || offset >= _size || length == 0){
+        return false;
+      }
+#ifdef _WIN32
+      SYSTEM_INFO system_info;
+      GetSystemInfo(&system_info);
+      const size_t page_size = system_info.dwPageSize;
+#else
+      const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+      const size_t end = (offset+length > _size)?_size:offset+length;
+      const size_t aligned_begin = (offset/page_size)*page_size;
+      begin = _data + aligned_begin;
+      aligned_length = end - aligned_begin;
+      return true;
+    }
+
+    void MemoryMappedFile::willNeed(size_t offset, size_t length)const{
+      char* begin = nullptr;
+      size_t aligned_length = 0;
+      if(!pageRange(offset,length,begin,aligned_length)){
+        return;
+      }
+#ifndef _WIN32
+      madvise(begin, aligned_length, MADV_WILLNEED);
+#endif
+    }
+
+    void MemoryMappedFile::release(size_t offset, size_t length)const{
+      char* begin = nullptr;
+      size_t aligned_length = 0;
+      if(!pageRange(offset,length,begin,aligned_length)){
+        return;
+      }
+#ifdef _WIN32
+      //Unlocking pages that are not locked removes them from the working set
+      VirtualUnlock(begin, aligned_length);
+#else
+      //The mapping is read-only and backed by the file, dropped pages are read again on access
+      madvise(begin, aligned_length, MADV_DONTNEED);
+#endif
+    }
+
+  }
+}
@@ -0,0 +1,95 @@
+/*
+ *
+ * Copyright (c) 2014, Nicola Pezzotti (Delft University of Technology)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *  must display the following acknowledgement:
+ *  This product includes software developed by the Delft University of Technology.
+ * 4. Neither the name of the Delft University of Technology nor the names of
+ *  its contributors may be used to endorse or promote products derived from
+ *  this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NICOLA PEZZOTTI ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL NICOLA PEZZOTTI BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+ * OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef MEMORY_MAPPED_FILE_H
+#define MEMORY_MAPPED_FILE_H
+
+#include <string>
+#include <cstddef>
+
+namespace hdi{
+  namespace utils{
+
+    //! Read-only memory mapping of a file
+    /*!
+      Read-only memory mapping of a file.
+      It allows the algorithms to access datasets that do not fit in memory: pages are loaded on demand by the operating system
+      and can be explicitly dropped from the resident memory once a block of data has been processed.
+    */
+    class MemoryMappedFile{
+    public:
+      MemoryMappedFile();
+      explicit MemoryMappedFile(const std::string& filename);
+      ~MemoryMappedFile();
+
+      //! Map the file in memory
+      void open(const std::string& filename);
+      //! Unmap the file
+      void close();
+      //! Return true if a file is mapped
+      bool isOpen()const{return _data != nullptr;}
+
+      //! Pointer to the beginning of the mapping
+      const char* data()const{return _data;}
+      //! Pointer to the beginning of the mapping reinterpreted as an array of T
+      template <typename T>
+      const T* dataAs()const{return reinterpret_cast<const T*>(_data);}
+      //! Size of the file in bytes
+      size_t size()const{return _size;}
+
+      //! Hint that the range [offset,offset+length) will be accessed soon
+      void willNeed(size_t offset, size_t length)const;
+      //! Drop the pages in the range [offset,offset+length) from the resident memory. They are read again from the file if accessed
+      void release(size_t offset, size_t length)const;
+      //! Return true if ptr points inside the mapping
+      bool contains(const void* ptr)const{return _data != nullptr && static_cast<const char*>(ptr) >= _data && static_cast<const char*>(ptr) < _data+_size;}
+
+    private:
+      MemoryMappedFile(const MemoryMappedFile&);
+      MemoryMappedFile& operator=(const MemoryMappedFile&);
+      //! Align a range to the page boundaries that are fully contained in the mapping
+      bool pageRange(size_t offset, size_t length, char*& begin, size_t& aligned_length)const;
+
+    private:
+      char* _data;
+      size_t _size;
+#ifdef _WIN32
+      void* _file_handle;
+      void* _mapping_handle;
+#else
+      int _file_descriptor;
+#endif
+    };
+
+  }
+}
+#endif